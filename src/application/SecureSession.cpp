@@ -13,6 +13,9 @@ using namespace TUI::Network;
 using namespace TUI::Application;
 using namespace TUI::Application::SecureSession;
 
+static_assert(Cipher::ChaCha20Poly1305::NONCE_SIZE <= OutboundBuffer::SESSION_HEADROOM, "Not enough headroom for the nonce");
+static_assert(Cipher::ChaCha20Poly1305::TAG_SIZE <= OutboundBuffer::TAILROOM, "Not enough tailroom for the tag");
+
 /** Session */
 
 Connection::Connection(
@@ -56,7 +59,7 @@ bool Connection::IsClosed() const noexcept
     return _closed;
 }
 
-void Connection::Send(std::vector<std::uint8_t> message)
+void Connection::Send(OutboundBuffer message)
 {
     if (IsClosed())
     {
@@ -64,7 +67,11 @@ void Connection::Send(std::vector<std::uint8_t> message)
     }
     if (!_turnOffEncryption)
     {
-        message = _encryptor.Encrypt(message);
+        /** Nonce | CipherText | Tag, in the room around the payload */
+        auto plainTextSize = message.Size();
+        message.Prepend(Cipher::ChaCha20Poly1305::NONCE_SIZE);
+        message.UseTailroom(Cipher::ChaCha20Poly1305::TAG_SIZE);
+        _encryptor.EncryptInPlace(message.Data(), plainTextSize);
     }
     _connection->Send(std::move(message));
 }
@@ -234,8 +241,8 @@ JS::Promise<void> Server::HandleHandshakeAsync(std::shared_ptr<IConnection<void>
                     case ProtocolType::Password:
                         auth = std::make_shared<Cipher::Spake2p::Server>([this, &callerId, &usernameOpt](const std::string& username) -> Cipher::Spake2p::RegistrationResult {
                             Cipher::Spake2p::RegistrationResult result;
-                            auto pairOpt = _getUserCredential(username);
-                            if (!pairOpt.has_value())
+                            auto userCredentialOpt = _getUserCredential(username);
+                            if (!userCredentialOpt.has_value())
                             {
                                 /** invalid username. However, we need to trick the attacker to do the computational heavy handshake. */
                                 result = _fakeCredentialGenerator.GetFakeCredential(username);
@@ -251,18 +258,12 @@ JS::Promise<void> Server::HandleHandshakeAsync(std::shared_ptr<IConnection<void>
                                      * But the other credentials should be fake.
                                      */
                                     result = _fakeCredentialGenerator.GetFakeCredential(username);
-                                    auto pair = std::move(pairOpt.value());
-                                    auto userCredential = nlohmann::json::parse(pair.first).get<Schema::IServer::UserCredential>();
-                                    result.salt = Common::Base64::Decode<sizeof(result.salt)>(userCredential.get_salt());
+                                    result.salt = userCredentialOpt.value().registration.salt;
                                 }
                                 else
                                 {
-                                    auto pair = std::move(pairOpt.value());
-                                    auto userCredential = nlohmann::json::parse(pair.first).get<Schema::IServer::UserCredential>();
-                                    result.w0 = Common::Base64::Decode<sizeof(result.w0)>(userCredential.get_w0());
-                                    result.L = Common::Base64::Decode<sizeof(result.L)>(userCredential.get_l());
-                                    result.salt = Common::Base64::Decode<sizeof(result.salt)>(userCredential.get_salt());
-                                    callerId.userId = pair.second;
+                                    result = userCredentialOpt.value().registration;
+                                    callerId.userId = userCredentialOpt.value().userId;
                                 }
                                 usernameOpt = username;
                             }
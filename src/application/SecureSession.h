@@ -14,6 +14,7 @@
 #include "cipher/ChaCha20Poly1305.h"
 #include "cipher/EcdhePsk.h"
 #include "cipher/FakeCredentialGenerator.h"
+#include "cipher/Spake2p.h"
 #include "cipher/BruteForceLimiter.h"
 #include "common/Cache.h"
 
@@ -38,7 +39,7 @@ namespace TUI::Application::SecureSession
 
         void Close() override;
         bool IsClosed() const noexcept override;
-        void Send(std::vector<std::uint8_t> message) override;
+        void Send(Network::OutboundBuffer message) override;
         JS::Promise<std::optional<std::vector<std::uint8_t>>> ReceiveAsync() override;
         CallerId GetId() const override;
 
@@ -60,7 +61,14 @@ namespace TUI::Application::SecureSession
         /** 5 minutes */
         static constexpr uint64_t RESUMPTION_KEY_TIMEOUT_MS = 5 * 60 * 1000;
 
-        using GetUserCredentialFunc = std::function<std::optional<std::pair<std::string, Common::Uuid>>(const std::string&)>;
+        /** The registration of a user, decoded */
+        struct UserCredential
+        {
+            Common::Uuid userId;
+            Cipher::Spake2p::RegistrationResult registration;
+        };
+        /** Called on the main loop for every password handshake, it should be cheap */
+        using GetUserCredentialFunc = std::function<std::optional<UserCredential>(const std::string&)>;
 
         enum class ProtocolType : uint8_t
         {
@@ -85,7 +93,7 @@ namespace TUI::Application::SecureSession
     private:
         Tev& _tev;
         std::shared_ptr<Network::IServer<void>> _server;
-        std::function<std::optional<std::pair<std::string, Common::Uuid>>(const std::string&)> _getUserCredential;
+        GetUserCredentialFunc _getUserCredential;
         JS::AsyncGenerator<std::shared_ptr<Network::IConnection<CallerId>>> _connectionGenerator{};
         std::map<std::string, std::pair<Cipher::EcdhePsk::Psk, CallerId>> _sessionResumptionKeys{};
         std::map<std::string, Tev::Timeout> _resumptionKeyTimeouts{};
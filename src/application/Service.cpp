@@ -24,6 +24,7 @@ Service::Service(
             {"getMetadata", std::bind(&Service::OnGetMetadataAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"deleteMetadata", std::bind(&Service::OnDeleteMetadataAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"getChatList", std::bind(&Service::OnGetChatListAsync, this, std::placeholders::_1, std::placeholders::_2)},
+            {"searchChats", std::bind(&Service::OnSearchChatsAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"newChat", std::bind(&Service::OnNewChatAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"getChat", std::bind(&Service::OnGetChatAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"deleteChat", std::bind(&Service::DeleteChatAsync, this, std::placeholders::_1, std::placeholders::_2)},
@@ -38,7 +39,9 @@ Service::Service(
             {"deleteUser", std::bind(&Service::OnDeleteUserAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"getUserAdminSettings", std::bind(&Service::OnGetUserAdminSettingsAsync, this, std::placeholders::_1, std::placeholders::_2)},
             {"setUserAdminSettings", std::bind(&Service::OnSetUserAdminSettingsAsync, this, std::placeholders::_1, std::placeholders::_2)},
-            {"setUserCredential", std::bind(&Service::OnSetUserCredentialAsync, this, std::placeholders::_1, std::placeholders::_2)}
+            {"setUserCredential", std::bind(&Service::OnSetUserCredentialAsync, this, std::placeholders::_1, std::placeholders::_2)},
+            {"backupDatabase", std::bind(&Service::OnBackupDatabaseAsync, this, std::placeholders::_1, std::placeholders::_2)},
+            {"getBackupProgress", std::bind(&Service::OnGetBackupProgressAsync, this, std::placeholders::_1, std::placeholders::_2)}
         },
         std::unordered_map<std::string, Rpc::RpcServer<CallerId>::StreamRequestHandler>{
             {"chatCompletion", std::bind(&Service::OnChatCompletionAsync, this, std::placeholders::_1, std::placeholders::_2)},
@@ -61,6 +64,18 @@ void Service::Close()
     /** @todo more */
 }
 
+JS::Promise<std::filesystem::path> Service::BackupDatabaseAsync(
+    std::function<void(Database::Sqlite::BackupProgress)> onProgress)
+{
+    if (!_database)
+    {
+        throw std::runtime_error("Service closed");
+    }
+    /** Keep the database alive for the whole backup */
+    auto database = _database;
+    co_return co_await database->BackupAsync({}, std::move(onProgress));
+}
+
 /**
  * @brief 
  * 
@@ -86,13 +101,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid global path");
         }
-        auto metadataStringOptional = _database->GetGlobalValue("metadata");
-        auto metadataString = metadataStringOptional.has_value() ?
-            metadataStringOptional.value() : "{}";
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetGlobalValueAsync(
-            "metadata",
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::GLOBAL},
+            std::move(params.get_mutable_entries()));
     }
     else if (path[0] == "model")
     {
@@ -103,11 +114,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid model path");
         }
         Common::Uuid modelId{path[1]};
-        auto metadataString = _database->GetModelMetadata(modelId);
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetModelMetadataAsync(
-            modelId,
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::MODEL, modelId},
+            std::move(params.get_mutable_entries()));
     }
     else if (path[0] == "user")
     {
@@ -116,11 +125,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user path");
         }
-        auto metadataString = _database->GetUserMetadata(callerId.userId);
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetUserMetadataAsync(
-            callerId.userId,
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER, callerId.userId},
+            std::move(params.get_mutable_entries()));
     }
     else if (path[0] == "userPublic")
     {
@@ -129,11 +136,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user public path");
         }
-        auto metadataString = _database->GetUserPublicMetadata(callerId.userId);
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetUserPublicMetadataAsync(
-            callerId.userId,
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER_PUBLIC, callerId.userId},
+            std::move(params.get_mutable_entries()));
     }
     else if (path[0] == "userAdmin")
     {
@@ -144,11 +149,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user admin path");
         }
         Common::Uuid targetUserId{path[1]};
-        auto metadataString = _database->GetUserAdminMetadata(targetUserId);
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetUserAdminMetadataAsync(
-            targetUserId,
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER_ADMIN, targetUserId},
+            std::move(params.get_mutable_entries()));
     }
     else if (path[0] == "chat")
     {
@@ -158,11 +161,9 @@ JS::Promise<nlohmann::json> Service::OnSetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid chat path");
         }
         Common::Uuid chatId{path[1]};
-        auto metadataString = _database->GetChatMetadata(callerId.userId, chatId);
-        auto newMetadataString = TryMergeMetadata(metadataString, params.get_mutable_entries());
-        co_await _database->SetChatMetadataAsync(
-            callerId.userId, chatId,
-            std::move(newMetadataString));
+        co_await _database->SetMetadataKeysAsync(
+            {Database::Database::MetadataTarget::CHAT, chatId, callerId.userId},
+            std::move(params.get_mutable_entries()));
     }
     else
     {
@@ -176,7 +177,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
 {
     auto params = ParseParams<Schema::IServer::GetMetadataParams>(paramsJson);
     auto& path = params.get_path();
-    std::string metadataString{};
+    Database::Database::MetadataPath metadataPath{};
     if (path.empty())
     {
         throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid path");
@@ -188,9 +189,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid global path");
         }
-        auto metadataStringOptional = _database->GetGlobalValue("metadata");
-        metadataString = metadataStringOptional.has_value() ?
-            metadataStringOptional.value() : "{}";
+        metadataPath = {Database::Database::MetadataTarget::GLOBAL};
     }
     else if (path[0] == "model")
     {
@@ -200,7 +199,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid model path");
         }
         Common::Uuid modelId{path[1]};
-        metadataString = _database->GetModelMetadata(modelId);
+        metadataPath = {Database::Database::MetadataTarget::MODEL, modelId};
     }
     else if (path[0] == "user")
     {
@@ -209,7 +208,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user path");
         }
-        metadataString = _database->GetUserMetadata(callerId.userId);
+        metadataPath = {Database::Database::MetadataTarget::USER, callerId.userId};
     }
     else if (path[0] == "userPublic")
     {
@@ -225,7 +224,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user public path");
         }
-        metadataString = _database->GetUserPublicMetadata(targetUserId);
+        metadataPath = {Database::Database::MetadataTarget::USER_PUBLIC, targetUserId};
     }
     else if (path[0] == "userAdmin")
     {
@@ -236,7 +235,7 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user admin path");
         }
         Common::Uuid targetUserId{path[1]};
-        metadataString = _database->GetUserAdminMetadata(targetUserId);
+        metadataPath = {Database::Database::MetadataTarget::USER_ADMIN, targetUserId};
     }
     else if (path[0] == "chat")
     {
@@ -246,12 +245,14 @@ JS::Promise<nlohmann::json> Service::OnGetMetadataAsync(CallerId callerId, nlohm
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid chat path");
         }
         Common::Uuid chatId{path[1]};
-        metadataString = _database->GetChatMetadata(callerId.userId, chatId);
+        metadataPath = {Database::Database::MetadataTarget::CHAT, chatId, callerId.userId};
     }
     else
     {
         throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid path");
     }
+    /** Only the requested keys are read */
+    auto metadataString = co_await _database->GetMetadataKeysAsync(std::move(metadataPath), params.get_keys());
     auto metadata = TryGetMetadata(params.get_keys(), metadataString);
     co_return nlohmann::json(metadata);
 }
@@ -272,13 +273,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid global path");
         }
-        auto metadataStringOptional = _database->GetGlobalValue("metadata");
-        auto metadataString = metadataStringOptional.has_value() ?
-            metadataStringOptional.value() : "{}";
-        auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetGlobalValueAsync(
-            "metadata",
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::GLOBAL},
+            params.get_keys());
     }
     else if (path[0] == "model")
     {
@@ -289,11 +286,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid model path");
         }
         Common::Uuid modelId{path[1]};
-        auto metadataString = _database->GetModelMetadata(modelId);
-        auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetModelMetadataAsync(
-            modelId,
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::MODEL, modelId},
+            params.get_keys());
     }
     else if (path[0] == "user")
     {
@@ -302,11 +297,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user path");
         }
-        auto metadataString = _database->GetUserMetadata(callerId.userId);
-       auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetUserMetadataAsync(
-            callerId.userId,
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER, callerId.userId},
+            params.get_keys());
     }
     else if (path[0] == "userPublic")
     {
@@ -315,11 +308,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
         {
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user public path");
         }
-        auto metadataString = _database->GetUserPublicMetadata(callerId.userId);
-        auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetUserPublicMetadataAsync(
-            callerId.userId,
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER_PUBLIC, callerId.userId},
+            params.get_keys());
     }
     else if (path[0] == "userAdmin")
     {
@@ -330,11 +321,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid user admin path");
         }
         Common::Uuid targetUserId{path[1]};
-        auto metadataString = _database->GetUserAdminMetadata(targetUserId);
-        auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetUserAdminMetadataAsync(
-            targetUserId,
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::USER_ADMIN, targetUserId},
+            params.get_keys());
     }
     else if (path[0] == "chat")
     {
@@ -344,11 +333,9 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
             throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid chat path");
         }
         Common::Uuid chatId{path[1]};
-        auto metadataString = _database->GetChatMetadata(callerId.userId, chatId);
-        auto newMetadataString = TryDeleteMetadata(metadataString, params.get_keys());
-        co_await _database->SetChatMetadataAsync(
-            callerId.userId, chatId,
-            std::move(newMetadataString));
+        co_await _database->DeleteMetadataKeysAsync(
+            {Database::Database::MetadataTarget::CHAT, chatId, callerId.userId},
+            params.get_keys());
     }
     else
     {
@@ -370,12 +357,14 @@ JS::Promise<nlohmann::json> Service::OnDeleteMetadataAsync(CallerId callerId, nl
 JS::Promise<nlohmann::json> Service::OnGetChatListAsync(CallerId callerId, nlohmann::json paramsJson)
 {
     auto params = ParseParams<Schema::IServer::GetChatListParams>(paramsJson);
+    auto after = params.get_after();
     /** 
      * The lock should not prevent the reader from continue reading.
-     * Only checking the version when start is 0 (the first page).
+     * Only checking the version for the first page.
      */
     auto lock = _resourceVersionManager->GetReadLock(
-        {"chatList", static_cast<std::string>(callerId.userId)}, callerId, params.get_start() != 0);
+        {"chatList", static_cast<std::string>(callerId.userId)}, callerId,
+        params.get_start() != 0 || after.has_value());
     auto start = params.get_start();
     auto quantity = params.get_quantity();
     if (start < 0 || quantity < 0)
@@ -383,15 +372,31 @@ JS::Promise<nlohmann::json> Service::OnGetChatListAsync(CallerId callerId, nlohm
         throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Start and quantity must be non-negative");
     }
 
-    auto list = _database->ListChat(callerId.userId, static_cast<size_t>(start), static_cast<size_t>(quantity));
+    /** The metadata is projected to these keys by the database */
+    auto metadataKeys = params.get_meta_data_keys();
+    std::list<Database::Database::ChatListItem> list{};
+    if (after.has_value())
+    {
+        list = co_await _database->ListChatAfterAsync(
+            callerId.userId,
+            static_cast<int64_t>(after->get_timestamp()),
+            Common::Uuid{after->get_id()},
+            static_cast<size_t>(quantity),
+            metadataKeys);
+    }
+    else
+    {
+        list = co_await _database->ListChatAsync(
+            callerId.userId, static_cast<size_t>(start), static_cast<size_t>(quantity), metadataKeys);
+    }
     Schema::IServer::GetChatListResult result{};
     result.reserve(list.size());
-    auto metadataKeys = params.get_meta_data_keys();
     for (const auto& item : list)
     {
         using EntryType = std::remove_reference<decltype(result)>::type::value_type;
         EntryType entry;
         entry.set_id(static_cast<std::string>(item.id));
+        entry.set_timestamp(static_cast<double>(item.timestamp));
         if (metadataKeys.has_value())
         {
             using MetadataType = std::invoke_result_t<decltype(&EntryType::get_metadata), EntryType&>;
@@ -404,6 +409,53 @@ JS::Promise<nlohmann::json> Service::OnGetChatListAsync(CallerId callerId, nlohm
     co_return static_cast<nlohmann::json>(result);
 }
 
+/**
+ * @brief Full-text search of the chats, best match first.
+ * 
+ * @attention Access: current user
+ * 
+ * @param callerId 
+ * @param paramsJson SearchChatsParams 
+ * @return JS::Promise<nlohmann::json> SearchChatsResult
+ */
+JS::Promise<nlohmann::json> Service::OnSearchChatsAsync(CallerId callerId, nlohmann::json paramsJson)
+{
+    auto params = ParseParams<Schema::IServer::SearchChatsParams>(paramsJson);
+    auto start = params.get_start();
+    auto quantity = params.get_quantity();
+    if (start < 0 || quantity < 0)
+    {
+        throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Start and quantity must be non-negative");
+    }
+
+    /** Runs on the read connections */
+    auto metadataKeys = params.get_meta_data_keys();
+    auto list = co_await _database->SearchChatAsync(
+        callerId.userId,
+        params.get_query(),
+        static_cast<size_t>(start),
+        static_cast<size_t>(quantity),
+        metadataKeys);
+    Schema::IServer::SearchChatsResult result{};
+    result.reserve(list.size());
+    for (auto& item : list)
+    {
+        using EntryType = std::remove_reference<decltype(result)>::type::value_type;
+        EntryType entry;
+        entry.set_id(static_cast<std::string>(item.id));
+        entry.set_timestamp(static_cast<double>(item.timestamp));
+        entry.set_snippet(std::move(item.snippet));
+        if (metadataKeys.has_value())
+        {
+            using MetadataType = std::invoke_result_t<decltype(&EntryType::get_metadata), EntryType&>;
+            MetadataType metadata{TryGetMetadata(metadataKeys.value(), item.metadata)};
+            entry.set_metadata(std::move(metadata));
+        }
+        result.push_back(std::move(entry));
+    }
+    co_return static_cast<nlohmann::json>(result);
+}
+
 /**
  * @brief 
  * 
@@ -436,12 +488,27 @@ JS::Promise<nlohmann::json> Service::OnNewChatAsync(CallerId callerId, nlohmann:
  */
 JS::Promise<nlohmann::json> Service::OnGetChatAsync(CallerId callerId, nlohmann::json paramsJson)
 {
-    auto params = ParseParams<std::string>(paramsJson);
-    Common::Uuid chatId{params};
+    /** A plain chat id gets the whole TreeHistory. GetChatParams gets a ChatHistoryDelta. */
+    if (paramsJson.is_string())
+    {
+        auto params = ParseParams<std::string>(paramsJson);
+        Common::Uuid chatId{params};
+        auto lock = _resourceVersionManager->GetReadLock(
+            {"chat", static_cast<std::string>(callerId.userId), static_cast<std::string>(chatId)}, callerId);
+        auto history = co_await _database->GetChatHistoryAsync(callerId.userId, chatId);
+        co_return static_cast<nlohmann::json>(history);
+    }
+    auto params = ParseParams<Schema::IServer::GetChatParams>(paramsJson);
+    Common::Uuid chatId{params.get_id()};
+    auto since = static_cast<int64_t>(params.get_since().value_or(0));
+    if (since < 0)
+    {
+        throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::BAD_REQUEST, "Invalid since");
+    }
     auto lock = _resourceVersionManager->GetReadLock(
         {"chat", static_cast<std::string>(callerId.userId), static_cast<std::string>(chatId)}, callerId);
-    auto history = _database->GetChatHistory(callerId.userId, chatId);
-    co_return static_cast<nlohmann::json>(history);
+    auto delta = co_await _database->GetChatHistorySinceAsync(callerId.userId, chatId, since);
+    co_return static_cast<nlohmann::json>(delta);
 }
 
 /**
@@ -493,35 +560,23 @@ JS::AsyncGenerator<nlohmann::json, nlohmann::json> Service::OnChatCompletionAsyn
 
     int64_t userMessageTimestamp = Common::Timestamp::GetWallClock();
 
-    /** Construct the linear history from the tree history and the new user message */
+    /** Construct the linear history from the branch of the parent and the new user message */
     Common::Uuid parentId{nullptr};
     Schema::IServer::LinearHistory history{};
     {
-        auto treeHistory = _database->GetChatHistory(callerId.userId, chatId);
-        auto& nodes = treeHistory.get_nodes();
-        std::list<Schema::IServer::Message> historyList{};
         auto parentIdStr = params.get_parent();
         if (parentIdStr.has_value())
         {
             parentId = Common::Uuid{parentIdStr.value()};
-        }
-        while (parentIdStr.has_value())
-        {
-            auto item = nodes.find(parentIdStr.value());
-            if (item == nodes.end())
+            auto branch = co_await _database->GetChatBranchAsync(callerId.userId, chatId, parentIdStr.value());
+            if (!branch.has_value())
             {
                 throw Schema::Rpc::Exception(Schema::Rpc::ErrorCode::NOT_FOUND, "Parent message not found");
             }
-            auto& node = item->second;
-            /** 
-             * We are searching in reverse. So push to the front
-             * We need to save the tree history back. So don't move the message.
-             */
-            historyList.push_front(node.get_message());
-            parentIdStr = node.get_parent();
+            history = std::move(branch.value());
         }
         /** The previous message should be a assistant message if it exists */
-        if (!historyList.empty() && historyList.back().get_role() != MessageRoleType::ASSISTANT)
+        if (!history.empty() && history.back().get_role() != MessageRoleType::ASSISTANT)
         {
             throw Schema::Rpc::Exception(
                 Schema::Rpc::ErrorCode::BAD_REQUEST,
@@ -529,12 +584,7 @@ JS::AsyncGenerator<nlohmann::json, nlohmann::json> Service::OnChatCompletionAsyn
         }
 
         /** We need to use the user message later. So don't move it. */
-        historyList.push_back(params.get_user_message());
-        history.reserve(historyList.size());
-        for (auto&& item : historyList)
-        {
-            history.push_back(std::move(item));
-        }
+        history.push_back(params.get_user_message());
     }
     
     /** Send the request */
@@ -592,7 +642,6 @@ JS::AsyncGenerator<nlohmann::json, nlohmann::json> Service::OnChatCompletionAsyn
         {
             userNode.set_parent(static_cast<std::string>(parentId));
         }
-        userNode.set_children({static_cast<std::string>(responseMessageId)});
         userNode.set_timestamp(static_cast<double>(userMessageTimestamp));
         co_await _database->AppendChatHistoryAsync(
             callerId.userId, chatId,
@@ -616,9 +665,7 @@ JS::AsyncGenerator<nlohmann::json, nlohmann::json> Service::OnChatCompletionAsyn
         responseNode.set_timestamp(static_cast<double>(Common::Timestamp::GetWallClock()));
         co_await _database->AppendChatHistoryAsync(
             callerId.userId, chatId,
-            std::move(responseNode),
-            /** Skip parent update. As the user node is already written */
-            false);
+            std::move(responseNode));
     }
 
     /** Return completion info */
@@ -675,7 +722,7 @@ JS::Promise<nlohmann::json> Service::OnGetModelListAsync(CallerId callerId, nloh
     auto params = ParseParams<Schema::IServer::GetModelListParams>(paramsJson);
     auto lock = _resourceVersionManager->GetReadLock({"modelList"}, callerId);
 
-    auto list = _database->ListModel();
+    auto list = co_await _database->ListModelAsync();
     auto metadataKeys = params.get_metadata_keys();
     Schema::IServer::GetModelListResult result{};
     result.reserve(list.size());
@@ -741,7 +788,7 @@ JS::Promise<nlohmann::json> Service::OnGetModelAsync(CallerId callerId, nlohmann
     auto lock = _resourceVersionManager->GetReadLock(
         {"model", static_cast<std::string>(modelId)}, callerId);
 
-    auto settingsString = _database->GetModelSettings(modelId);
+    auto settingsString = co_await _database->GetModelSettingsAsync(modelId);
     auto settings = nlohmann::json::parse(settingsString).get<Schema::IServer::ModelSettings>();
 
     co_return static_cast<nlohmann::json>(settings);
@@ -812,35 +859,38 @@ JS::Promise<nlohmann::json> Service::OnGetUserListAsync(CallerId callerId, nlohm
     CheckAdmin(callerId.userId);
     auto params = ParseParams<Schema::IServer::GetUserListParams>(paramsJson);
     auto lock = _resourceVersionManager->GetReadLock({"userList"}, callerId);
-    auto list = _database->ListUser();
+    /** Streamed, only one batch of rows is held besides the result */
+    auto stream = _database->ListUserStream();
     Schema::IServer::GetUserListResult result{};
-    result.reserve(list.size());
-    for (const auto& item: list)
+    while (auto list = co_await stream.NextAsync())
     {
-        using EntryType = decltype(result)::value_type;
-        EntryType entry{};
-        entry.set_id(static_cast<std::string>(item.id));
-        entry.set_user_name(item.userName);
-        auto userAdminSettings = nlohmann::json::parse(item.adminSettings).get<Schema::IServer::UserAdminSettings>();
-        /** @todo force up to date the user admin settings */
-        entry.set_admin_settings(std::move(userAdminSettings));
-        if (params.get_public_metadata_keys().has_value())
-        {
-            using MetadataType = std::remove_reference<decltype(entry.get_public_metadata())>::type;
-            MetadataType metadata{TryGetMetadata(params.get_public_metadata_keys().value(), item.publicMetadata)};
-            entry.set_public_metadata(std::move(metadata));
-        }
-        if (params.get_admin_metadata_keys().has_value())
+        for (const auto& item: list.value())
         {
-            using MetadataType = std::remove_reference<decltype(entry.get_admin_metadata())>::type;
-            MetadataType metadata{TryGetMetadata(params.get_admin_metadata_keys().value(), item.adminMetadata)};
-            entry.set_admin_metadata(std::move(metadata));
-        }
-        if (callerId.userId == item.id)
-        {
-            entry.set_is_self(true);
+            using EntryType = decltype(result)::value_type;
+            EntryType entry{};
+            entry.set_id(static_cast<std::string>(item.id));
+            entry.set_user_name(item.userName);
+            auto userAdminSettings = nlohmann::json::parse(item.adminSettings).get<Schema::IServer::UserAdminSettings>();
+            /** @todo force up to date the user admin settings */
+            entry.set_admin_settings(std::move(userAdminSettings));
+            if (params.get_public_metadata_keys().has_value())
+            {
+                using MetadataType = std::remove_reference<decltype(entry.get_public_metadata())>::type;
+                MetadataType metadata{TryGetMetadata(params.get_public_metadata_keys().value(), item.publicMetadata)};
+                entry.set_public_metadata(std::move(metadata));
+            }
+            if (params.get_admin_metadata_keys().has_value())
+            {
+                using MetadataType = std::remove_reference<decltype(entry.get_admin_metadata())>::type;
+                MetadataType metadata{TryGetMetadata(params.get_admin_metadata_keys().value(), item.adminMetadata)};
+                entry.set_admin_metadata(std::move(metadata));
+            }
+            if (callerId.userId == item.id)
+            {
+                entry.set_is_self(true);
+            }
+            result.push_back(std::move(entry));
         }
-        result.push_back(std::move(entry));
     }
     result.shrink_to_fit();
     co_return static_cast<nlohmann::json>(result);
@@ -918,7 +968,7 @@ JS::Promise<nlohmann::json> Service::OnGetUserAdminSettingsAsync(CallerId caller
     auto lock = _resourceVersionManager->GetReadLock(
         {"user", static_cast<std::string>(userId), "adminSettings"}, callerId);
 
-    auto settingsString = _database->GetUserAdminSettings(userId);
+    auto settingsString = co_await _database->GetUserAdminSettingsAsync(userId);
     auto settings = nlohmann::json::parse(settingsString).get<Schema::IServer::UserAdminSettings>();
 
     co_return static_cast<nlohmann::json>(settings);
@@ -970,6 +1020,48 @@ JS::Promise<nlohmann::json> Service::OnSetUserCredentialAsync(CallerId callerId,
     co_return nlohmann::json{};
 }
 
+/**
+ * @brief Write a snapshot of the database next to it. Resolves when the backup is complete.
+ * With chat shards, every shard is written next to its file, all from the same instant.
+ * 
+ * @attention Access: admin
+ * 
+ * @param callerId 
+ * @param paramsJson 
+ * @return JS::Promise<nlohmann::json> The path of the backup file of the database
+ */
+JS::Promise<nlohmann::json> Service::OnBackupDatabaseAsync(CallerId callerId, nlohmann::json paramsJson)
+{
+    (void)paramsJson;
+    CheckAdmin(callerId.userId);
+    auto path = co_await BackupDatabaseAsync();
+    co_return static_cast<nlohmann::json>(path.string());
+}
+
+/**
+ * @brief Get the progress of the running backup.
+ * 
+ * @attention Access: admin
+ * 
+ * @param callerId 
+ * @param paramsJson 
+ * @return JS::Promise<nlohmann::json> BackupProgress, or null if no backup is running
+ */
+JS::Promise<nlohmann::json> Service::OnGetBackupProgressAsync(CallerId callerId, nlohmann::json paramsJson)
+{
+    (void)paramsJson;
+    CheckAdmin(callerId.userId);
+    auto progress = _database->GetBackupProgress();
+    if (!progress.has_value())
+    {
+        co_return nlohmann::json{};
+    }
+    Schema::IServer::BackupProgress result{};
+    result.set_page_count(static_cast<double>(progress->pageCount));
+    result.set_remaining_pages(static_cast<double>(progress->remainingPages));
+    co_return static_cast<nlohmann::json>(result);
+}
+
 void Service::OnNewConnection(CallerId callerId)
 {
     /** 
@@ -1041,45 +1133,6 @@ std::map<std::string, nlohmann::json> Service::TryGetMetadata(const std::vector<
     return metadata;
 }
 
-std::string Service::TryMergeMetadata(const std::string& base, std::map<std::string, nlohmann::json>& changes)
-{
-    try
-    {
-        auto metadata = nlohmann::json::parse(base);
-        for (auto& [key, value] : changes)
-        {
-            metadata[key] = std::move(value);
-        }
-        return metadata.dump();
-    }
-    catch(...)
-    {
-        /** @todo logging */
-        /** If anything happens, use the new value as the metadata */
-        return nlohmann::json(changes).dump();
-    }
-}
-
-std::string Service::TryDeleteMetadata(const std::string& base, const std::vector<std::string>& keys)
-{
-    try
-    {
-        auto metadata = nlohmann::json::parse(base);
-        for (const auto& key : keys)
-        {
-            metadata.erase(key);
-        }
-        return metadata.dump();
-    }
-    catch(...)
-    {
-        /** @todo logging */
-        /** If anything happens, just delete the whole thing */
-        return "{}";
-    }
-}
-
-
 void Service::CheckAdmin(const Common::Uuid& userId)
 {
     Schema::IServer::UserAdminSettingsRole role = Schema::IServer::UserAdminSettingsRole::USER;
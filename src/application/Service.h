@@ -31,6 +31,13 @@ namespace TUI::Application
         ~Service() = default;
 
         void Close();
+
+        /**
+         * @brief Back up the database next to it. See Database::BackupAsync.
+         * @return The path of the backup file.
+         */
+        JS::Promise<std::filesystem::path> BackupDatabaseAsync(
+            std::function<void(Database::Sqlite::BackupProgress)> onProgress = nullptr);
     private:
         static constexpr uint64_t STREAM_BATCHING_INTERVAL_MS = 300;
 
@@ -48,6 +55,7 @@ namespace TUI::Application
         JS::Promise<nlohmann::json> OnGetMetadataAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnDeleteMetadataAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnGetChatListAsync(CallerId callerId, nlohmann::json params);
+        JS::Promise<nlohmann::json> OnSearchChatsAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnNewChatAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnGetChatAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> DeleteChatAsync(CallerId callerId, nlohmann::json params);
@@ -64,6 +72,8 @@ namespace TUI::Application
         JS::Promise<nlohmann::json> OnGetUserAdminSettingsAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnSetUserAdminSettingsAsync(CallerId callerId, nlohmann::json params);
         JS::Promise<nlohmann::json> OnSetUserCredentialAsync(CallerId callerId, nlohmann::json params);
+        JS::Promise<nlohmann::json> OnBackupDatabaseAsync(CallerId callerId, nlohmann::json params);
+        JS::Promise<nlohmann::json> OnGetBackupProgressAsync(CallerId callerId, nlohmann::json params);
 
         /** Connection handlers */
         void OnNewConnection(CallerId callerId);
@@ -88,8 +98,6 @@ namespace TUI::Application
 
         std::shared_ptr<ApiProvider::IProvider> GetProvider(const Common::Uuid& providerId);
         std::map<std::string, nlohmann::json> TryGetMetadata(const std::vector<std::string>& keys, const std::string& metadataString);
-        std::string TryMergeMetadata(const std::string& base, std::map<std::string, nlohmann::json>& changes);
-        std::string TryDeleteMetadata(const std::string& base, const std::vector<std::string>& keys);
         void CheckAdmin(const Common::Uuid& userId);
     };
 }
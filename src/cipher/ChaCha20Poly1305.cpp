@@ -52,6 +52,28 @@ std::vector<uint8_t> Encryptor::Encrypt(const std::vector<uint8_t>& plainText)
     return Encrypt(plainText.data(), plainText.size());
 }
 
+void Encryptor::EncryptInPlace(uint8_t* message, size_t plainTextSize)
+{
+    const auto& nonce = _counter.GetBytes();
+    /** Increment the counter first to start with 1 */
+    _counter++;
+    std::copy(nonce.begin(), nonce.end(), message);
+    unsigned long long tagLen = 0;
+    int rc = crypto_aead_chacha20poly1305_ietf_encrypt_detached(
+        message + NONCE_SIZE,
+        message + NONCE_SIZE + plainTextSize, &tagLen,
+        message + NONCE_SIZE, plainTextSize,
+        nullptr, 0,
+        nullptr,
+        message,
+        _key.data());
+    if (rc != 0)
+    {
+        /** This should always return 0 */
+        throw std::runtime_error("Encryption failed");
+    }
+}
+
 Decryptor::Decryptor(const Key& key)
     : _key(key)
 {
@@ -33,6 +33,15 @@ namespace TUI::Cipher::ChaCha20Poly1305
         {
             return Encrypt(plainText.data(), plainText.size());
         }
+        /**
+         * @brief Same output as Encrypt, without a copy of the plain text
+         * 
+         * @param message
+         *  Nonce  | PlainText -> CipherText | Tag
+         *   12B   |   plainTextSize         | 16B
+         * @param plainTextSize 
+         */
+        void EncryptInPlace(uint8_t* message, size_t plainTextSize);
     private:
         Key _key{};
         Counter<NONCE_SIZE> _counter{};
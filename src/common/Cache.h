@@ -45,6 +45,23 @@ namespace TUI::Common
             _cache[key] = {value, _order.begin()};
         }
 
+        void Erase(const K& key)
+        {
+            auto item = _cache.find(key);
+            if (item == _cache.end())
+            {
+                return;
+            }
+            _order.erase(item->second.second);
+            _cache.erase(item);
+        }
+
+        void Clear()
+        {
+            _cache.clear();
+            _order.clear();
+        }
+
     private:
         size_t _maxSize;
         std::map<K, std::pair<V, typename std::list<K>::iterator>> _cache{};
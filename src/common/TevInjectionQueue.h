@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <queue>
 #include <mutex>
@@ -14,18 +16,28 @@ namespace TUI::Common
 {
     /**
      * @brief Injects data into the event loop in a thread-safe manner.
-     * 
-     * @tparam T 
+     * Producers push into a lock-free bounded ring, and only write the eventfd when no wake up is pending.
+     * The loop drains up to capacity items per wake up.
+     * When the ring is full, items go to a list under a mutex until the loop catches up,
+     * so Inject never blocks on the loop.
+     *
+     * @tparam T
      */
     template<typename T>
     class TevInjectionQueue : public std::enable_shared_from_this<TevInjectionQueue<T>>
     {
     public:
+        static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+        /**
+         * @param capacity Of the ring, rounded up to a power of 2.
+         */
         static std::shared_ptr<TevInjectionQueue<T>> Create(
-            Tev& tev, std::function<void(T&&)> onData, std::function<void()> onError = nullptr)
+            Tev& tev, std::function<void(T&&)> onData, std::function<void()> onError = nullptr,
+            size_t capacity = DEFAULT_CAPACITY)
         {
             return std::shared_ptr<TevInjectionQueue<T>>(
-                new TevInjectionQueue<T>(tev, std::move(onData), std::move(onError)));
+                new TevInjectionQueue<T>(tev, std::move(onData), std::move(onError), capacity));
         }
 
         TevInjectionQueue(const TevInjectionQueue&) = delete;
@@ -36,18 +48,28 @@ namespace TUI::Common
 
         /**
          * @brief Called in any thread to enqueue data into the event loop.
-         * 
-         * @param data 
+         * Items from one thread are delivered in order.
+         *
+         * @param data
          */
         void Inject(T&& data)
         {
-            if (_eventFd < 0)
+            if (_closed.load(std::memory_order_acquire))
             {
                 throw std::runtime_error("TevInjectionQueue is closed");
             }
+            /** Once something overflowed, the ring waits for it, to keep the order */
+            bool queued = _overflowSize.load(std::memory_order_acquire) == 0 && TryPush(data);
+            if (!queued)
             {
-                std::lock_guard<std::mutex> lock(_mutex);
-                _queue.push(std::move(data));
+                std::lock_guard<std::mutex> lock(_overflowMutex);
+                _overflow.push(std::move(data));
+                _overflowSize.store(_overflow.size(), std::memory_order_release);
+            }
+            /** The pending wake up drains this item too */
+            if (_wakeUpPending.exchange(true, std::memory_order_acq_rel))
+            {
+                return;
             }
             if (eventfd_write(_eventFd, 1) != 0)
             {
@@ -68,9 +90,26 @@ namespace TUI::Common
             CloseInternal();
         }
     private:
-        TevInjectionQueue(Tev& tev, std::function<void(T&&)> onData, std::function<void()> onError)
+        struct Slot
+        {
+            /** Equals the position when free, position + 1 when filled */
+            std::atomic<size_t> sequence{0};
+            std::optional<T> data{};
+        };
+
+        TevInjectionQueue(Tev& tev, std::function<void(T&&)> onData, std::function<void()> onError, size_t capacity)
             : _tev(tev), _onData(std::move(onData)), _onError(std::move(onError))
         {
+            _capacity = 1;
+            while (_capacity < capacity)
+            {
+                _capacity <<= 1;
+            }
+            _slots = std::make_unique<Slot[]>(_capacity);
+            for (size_t i = 0; i < _capacity; i++)
+            {
+                _slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
             _eventFd = Unique::Fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
             if (_eventFd < 0)
             {
@@ -79,6 +118,91 @@ namespace TUI::Common
             _readHandler = _tev.SetReadHandler(_eventFd, std::bind(&TevInjectionQueue<T>::ReadHandler, this));
         }
 
+        /**
+         * Called in any thread
+         *
+         * @param data Only moved from on success
+         * @return false if the ring is full
+         */
+        bool TryPush(T& data)
+        {
+            auto position = _tail.load(std::memory_order_relaxed);
+            Slot* slot = nullptr;
+            while (true)
+            {
+                slot = &_slots[position & (_capacity - 1)];
+                auto sequence = slot->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (diff == 0)
+                {
+                    if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    /** Not consumed for a whole round */
+                    return false;
+                }
+                else
+                {
+                    /** Taken by another producer */
+                    position = _tail.load(std::memory_order_relaxed);
+                }
+            }
+            slot->data.emplace(std::move(data));
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Called in the event loop
+         */
+        std::optional<T> TryPop()
+        {
+            auto& slot = _slots[_head & (_capacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != _head + 1)
+            {
+                /** Empty, or the producer has not finished writing */
+                return std::nullopt;
+            }
+            std::optional<T> data = std::move(slot.data);
+            slot.data.reset();
+            slot.sequence.store(_head + _capacity, std::memory_order_release);
+            _head++;
+            return data;
+        }
+
+        /**
+         * Called in the event loop
+         * The ring first, the overflow only holds newer items.
+         * A reserved but unpublished slot may hold an item older than the overflow,
+         * so the overflow is only read when the ring is really empty.
+         * The producer of that slot wakes the loop up once it is published.
+         */
+        std::optional<T> Pop()
+        {
+            auto data = TryPop();
+            if (data.has_value() || _overflowSize.load(std::memory_order_acquire) == 0)
+            {
+                return data;
+            }
+            if (_tail.load(std::memory_order_acquire) != _head)
+            {
+                return std::nullopt;
+            }
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            if (_overflow.empty())
+            {
+                return std::nullopt;
+            }
+            data = std::move(_overflow.front());
+            _overflow.pop();
+            _overflowSize.store(_overflow.size(), std::memory_order_release);
+            return data;
+        }
+
         void ReadHandler()
         {
             /** Avoid this going out of scope in one of the user's callbacks */
@@ -93,29 +217,22 @@ namespace TUI::Common
                 CloseInternal(true);
                 return;
             }
-            while(true)
+            /** Cleared before draining, so items injected from now on get a new wake up */
+            _wakeUpPending.exchange(false, std::memory_order_acq_rel);
+            for (size_t i = 0; i < _capacity; i++)
             {
-                if (_eventFd < 0)
+                if (_closed.load(std::memory_order_relaxed))
                 {
-                    /** 
+                    /**
                      * The queue is closed, should not process more data
                      * This can happen in the previous callback.
                      */
-                    break;
-                }
-                std::optional<T> data;
-                {
-                    std::lock_guard<std::mutex> lock(_mutex);
-                    if (_queue.empty())
-                    {
-                        break;
-                    }
-                    data = std::move(_queue.front());
-                    _queue.pop();
+                    return;
                 }
+                auto data = Pop();
                 if (!data.has_value())
                 {
-                    break;
+                    return;
                 }
                 try
                 {
@@ -126,24 +243,31 @@ namespace TUI::Common
                     /** Ignored */
                 }
             }
+            /** Let the loop run other handlers before the rest */
+            if (!_wakeUpPending.exchange(true, std::memory_order_acq_rel) && eventfd_write(_eventFd, 1) != 0)
+            {
+                CloseInternal(true);
+            }
         }
 
         void CloseInternal(bool isError = false)
         {
+            _closed.store(true, std::memory_order_release);
             if (_readHandler != nullptr)
             {
                 _readHandler.Clear();
             }
-            if (_eventFd >= 0)
+            /** The eventfd is kept until destruction, producers may still be writing to it */
+            while (TryPop().has_value())
             {
-                _eventFd = Unique::Fd(-1);
             }
             {
-                std::lock_guard<std::mutex> lock(_mutex);
-                while (!_queue.empty())
+                std::lock_guard<std::mutex> lock(_overflowMutex);
+                while (!_overflow.empty())
                 {
-                    _queue.pop();
+                    _overflow.pop();
                 }
+                _overflowSize.store(0, std::memory_order_release);
             }
             if (isError && _onError)
             {
@@ -154,8 +278,17 @@ namespace TUI::Common
         Tev& _tev;
         std::function<void(T&&)> _onData;
         std::function<void()> _onError;
-        std::queue<T> _queue{};
-        std::mutex _mutex{};
+        size_t _capacity{0};
+        std::unique_ptr<Slot[]> _slots{nullptr};
+        /** Producers */
+        alignas(64) std::atomic<size_t> _tail{0};
+        /** Only touched in the event loop */
+        alignas(64) size_t _head{0};
+        alignas(64) std::atomic<bool> _wakeUpPending{false};
+        std::atomic<bool> _closed{false};
+        std::atomic<size_t> _overflowSize{0};
+        std::queue<T> _overflow{};
+        std::mutex _overflowMutex{};
         Unique::Fd _eventFd{-1};
         Tev::FdHandler _readHandler{};
     };
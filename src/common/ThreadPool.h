@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <js-style-co-routine/Promise.h>
+#include <tev-cpp/Tev.h>
+#include "TevInjectionQueue.h"
+#include "WorkerTask.h"
+
+namespace TUI::Common
+{
+    /**
+     * @brief Threads with a deque each, for CPU-heavy tasks that do not need an order.
+     * A thread runs its own tasks oldest first, and steals the newest task of another thread when it runs out.
+     * Tasks are submitted from the main loop, and settled on the main loop, see WorkerTask.
+     */
+    class ThreadPool
+    {
+    public:
+        struct Stats
+        {
+            size_t threadCount{0};
+            /** Submitted and not started */
+            size_t queuedTasks{0};
+            size_t maxQueuedTasks{0};
+            /** Queued or running */
+            size_t pendingTasks{0};
+            uint64_t completedTasks{0};
+            uint64_t stolenTasks{0};
+            /** From submission to start */
+            uint64_t totalQueueTimeUs{0};
+            uint64_t maxQueueTimeUs{0};
+            uint64_t totalRunTimeUs{0};
+            uint64_t maxRunTimeUs{0};
+        };
+
+        /** @param threadCount 0 uses the number of cores */
+        explicit ThreadPool(Tev& tev, size_t threadCount = 0)
+            : _mainLoop(tev)
+        {
+            if (threadCount == 0)
+            {
+                threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+            }
+            _resultQueue = TevInjectionQueue<Result>::Create(
+                _mainLoop, std::bind(&ThreadPool::ResultQueueOnData, this, std::placeholders::_1));
+            _workers.reserve(threadCount);
+            for (size_t i = 0; i < threadCount; i++)
+            {
+                _workers.push_back(std::make_unique<Worker>());
+            }
+            for (size_t i = 0; i < threadCount; i++)
+            {
+                _workers[i]->thread = std::thread(std::bind(&ThreadPool::WorkerThreadFunc, this, i));
+            }
+        }
+
+        ~ThreadPool()
+        {
+            Close();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ThreadPool(ThreadPool&&) noexcept = delete;
+        ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+        /**
+         * @brief Execute a task on any thread of the pool.
+         * Make sure everything you do in the task is thread-safe.
+         * Should ONLY be called from the main loop.
+         *
+         * @tparam Func
+         * @param task
+         * @return JS::Promise<decltype(task())>
+         */
+        template<typename Func>
+        auto ExecTaskAsync(Func&& task) -> JS::Promise<decltype(task())>
+        {
+            if (_closed)
+            {
+                throw std::runtime_error("ThreadPool closed");
+            }
+
+            using ReturnType = decltype(task());
+            auto* typedTask = new WorkerTask<std::decay_t<Func>, ReturnType>(std::forward<Func>(task));
+            auto promise = typedTask->promise;
+            _pendingTasks.Link(typedTask);
+            /** Counted first, so the count never goes below the jobs in the deques */
+            auto queuedTasks = _queuedTasks.fetch_add(1, std::memory_order_acq_rel) + 1;
+            _stats.maxQueuedTasks = std::max(_stats.maxQueuedTasks, queuedTasks);
+            /** Spread over the threads, the idle ones steal the rest */
+            auto& worker = *_workers[_nextWorker];
+            _nextWorker = (_nextWorker + 1) % _workers.size();
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.jobs.push_back(Job{typedTask, std::chrono::steady_clock::now()});
+            }
+            {
+                /** Pairs with the wait, so the wake up cannot be missed */
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+            }
+            _wakeUp.notify_one();
+            return promise;
+        }
+
+        /**
+         * @brief Should ONLY be called from the main loop.
+         */
+        Stats GetStats() const
+        {
+            auto stats = _stats;
+            stats.threadCount = _workers.size();
+            stats.queuedTasks = _queuedTasks.load(std::memory_order_acquire);
+            stats.pendingTasks = _pendingTasks.Size();
+            return stats;
+        }
+
+        /**
+         * @brief Wait for the running tasks to finish and close the threads.
+         * All tasks that are not settled will fail with exception "ThreadPool closed".
+         */
+        void Close()
+        {
+            if (_closed)
+            {
+                return;
+            }
+            _closed = true;
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                _stopping.store(true, std::memory_order_release);
+            }
+            _wakeUp.notify_all();
+            for (auto& worker : _workers)
+            {
+                if (worker->thread.joinable())
+                {
+                    worker->thread.join();
+                }
+            }
+            /** After the join, so no thread injects into a closed queue */
+            _resultQueue->Close();
+            /** The deques and the queue only hold pointers, the tasks are owned by the pending list */
+            _pendingTasks.FailAll("ThreadPool closed");
+        }
+
+    private:
+        struct Job
+        {
+            WorkerTaskBase* task;
+            std::chrono::steady_clock::time_point submittedAt;
+        };
+
+        struct Result
+        {
+            WorkerTaskBase* task;
+            uint64_t queueTimeUs;
+            uint64_t runTimeUs;
+            bool stolen;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex{};
+            std::deque<Job> jobs{};
+            std::thread thread{};
+        };
+
+        /**
+         * Called in the pool threads
+         */
+        void WorkerThreadFunc(size_t index)
+        {
+            /** Queued jobs are not run after close */
+            while (!_stopping.load(std::memory_order_acquire))
+            {
+                bool stolen = false;
+                auto job = PopJob(index, stolen);
+                if (!job.has_value())
+                {
+                    std::unique_lock<std::mutex> lock(_sleepMutex);
+                    _wakeUp.wait(lock, [this]() {
+                        return _stopping.load(std::memory_order_acquire) ||
+                            _queuedTasks.load(std::memory_order_acquire) > 0;
+                    });
+                    continue;
+                }
+                auto startedAt = std::chrono::steady_clock::now();
+                job->task->Run();
+                auto finishedAt = std::chrono::steady_clock::now();
+                try
+                {
+                    _resultQueue->Inject(Result{
+                        job->task,
+                        static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::microseconds>(startedAt - job->submittedAt).count()),
+                        static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::microseconds>(finishedAt - startedAt).count()),
+                        stolen});
+                }
+                catch(...)
+                {
+                    /** Should not happen, the queue is closed after the join. The task is failed by Close. */
+                }
+            }
+        }
+
+        /**
+         * Called in the pool threads
+         * The own deque first, oldest first. Then the newest job of the others.
+         */
+        std::optional<Job> PopJob(size_t index, bool& stolen)
+        {
+            for (size_t i = 0; i < _workers.size(); i++)
+            {
+                auto& worker = *_workers[(index + i) % _workers.size()];
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (worker.jobs.empty())
+                {
+                    continue;
+                }
+                Job job{};
+                if (i == 0)
+                {
+                    job = worker.jobs.front();
+                    worker.jobs.pop_front();
+                }
+                else
+                {
+                    job = worker.jobs.back();
+                    worker.jobs.pop_back();
+                    stolen = true;
+                }
+                _queuedTasks.fetch_sub(1, std::memory_order_acq_rel);
+                return job;
+            }
+            return std::nullopt;
+        }
+
+        /**
+         * Called in _mainLoop
+         *
+         * @param result
+         */
+        void ResultQueueOnData(Result&& result)
+        {
+            std::unique_ptr<WorkerTaskBase> ownedTask{result.task};
+            _pendingTasks.Unlink(result.task);
+            _stats.completedTasks++;
+            if (result.stolen)
+            {
+                _stats.stolenTasks++;
+            }
+            _stats.totalQueueTimeUs += result.queueTimeUs;
+            _stats.maxQueueTimeUs = std::max(_stats.maxQueueTimeUs, result.queueTimeUs);
+            _stats.totalRunTimeUs += result.runTimeUs;
+            _stats.maxRunTimeUs = std::max(_stats.maxRunTimeUs, result.runTimeUs);
+            ownedTask->Settle();
+        }
+
+        Tev& _mainLoop;
+        bool _closed{false};
+        std::vector<std::unique_ptr<Worker>> _workers{};
+        /** Round robin */
+        size_t _nextWorker{0};
+        std::atomic<size_t> _queuedTasks{0};
+        std::mutex _sleepMutex{};
+        std::condition_variable _wakeUp{};
+        /** Set with _sleepMutex held, so the wake up cannot be missed */
+        std::atomic<bool> _stopping{false};
+        std::shared_ptr<TevInjectionQueue<Result>> _resultQueue{nullptr};
+        /** Queued or running */
+        WorkerTaskList _pendingTasks{};
+        /** Only touched on the main loop */
+        Stats _stats{};
+    };
+}
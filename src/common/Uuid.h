@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <span>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <uuid/uuid.h>
 
@@ -24,6 +27,15 @@ namespace TUI::Common
         {
             uuid_clear(_uuid);
         }
+        /** From the 16-byte binary form, as given by Bytes() */
+        explicit Uuid(const std::vector<uint8_t>& bytes)
+        {
+            if (bytes.size() != sizeof(uuid_t))
+            {
+                throw std::runtime_error("Invalid UUID bytes");
+            }
+            uuid_copy(_uuid, bytes.data());
+        }
 
         Uuid(const Uuid& other)
         {
@@ -92,6 +104,12 @@ namespace TUI::Common
             return str;
         }
 
+        /** The 16-byte binary form */
+        std::span<const uint8_t, sizeof(uuid_t)> Bytes() const noexcept
+        {
+            return std::span<const uint8_t, sizeof(uuid_t)>(_uuid);
+        }
+
         size_t Hash() const noexcept
         {
             return std::hash<std::string_view>()(
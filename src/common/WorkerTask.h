@@ -0,0 +1,200 @@
+#pragma once
+
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <js-style-co-routine/Promise.h>
+
+namespace TUI::Common
+{
+    /**
+     * @brief A task run off the main loop, with its own result slot and promise.
+     * Results are moved from the worker to the promise, so they can be move-only.
+     * Only the pointer crosses threads. Run is called on the worker, the rest on the main loop.
+     */
+    class WorkerTaskBase
+    {
+    public:
+        virtual ~WorkerTaskBase() = default;
+        virtual void Run() noexcept = 0;
+        /** After Run */
+        virtual void Settle() = 0;
+        virtual void Fail(std::exception_ptr exception) = 0;
+
+        /** The pending list. Only touched on the main loop. */
+        WorkerTaskBase* prev{nullptr};
+        WorkerTaskBase* next{nullptr};
+    };
+
+    template<typename Func, typename ReturnType>
+    class WorkerTask : public WorkerTaskBase
+    {
+    public:
+        template<typename F>
+        explicit WorkerTask(F&& func)
+            : _func(std::forward<F>(func))
+        {
+        }
+
+        void Run() noexcept override
+        {
+            try
+            {
+                if constexpr (std::is_void_v<ReturnType>)
+                {
+                    (*_func)();
+                    _result.emplace();
+                }
+                else
+                {
+                    _result.emplace((*_func)());
+                }
+            }
+            catch(std::exception&)
+            {
+                _exception = std::current_exception();
+            }
+            catch(...)
+            {
+                _exception = std::make_exception_ptr(std::runtime_error("Unknown exception"));
+            }
+            /** The captures are released on the worker */
+            _func.reset();
+        }
+
+        void Settle() override
+        {
+            if (_exception)
+            {
+                Fail(_exception);
+                return;
+            }
+            if (!_result.has_value())
+            {
+                promise.Reject("Task returned no result");
+                return;
+            }
+            if constexpr (std::is_void_v<ReturnType>)
+            {
+                promise.Resolve();
+            }
+            else
+            {
+                promise.Resolve(std::move(_result.value()));
+            }
+        }
+
+        void Fail(std::exception_ptr exception) override
+        {
+            try
+            {
+                std::rethrow_exception(exception);
+            }
+            catch (const std::exception& e)
+            {
+                promise.Reject(e.what());
+            }
+        }
+
+        JS::Promise<ReturnType> promise{};
+
+    private:
+        std::optional<Func> _func;
+        std::optional<std::conditional_t<std::is_void_v<ReturnType>, std::monostate, ReturnType>> _result{};
+        std::exception_ptr _exception{nullptr};
+    };
+
+    /**
+     * @brief The tasks that are queued or running, owned by the list.
+     * Intrusive, so linking and unlinking are O(1). Only touched on the main loop.
+     */
+    class WorkerTaskList
+    {
+    public:
+        WorkerTaskList() = default;
+        ~WorkerTaskList()
+        {
+            auto* task = TakeAll();
+            while (task != nullptr)
+            {
+                auto* next = task->next;
+                delete task;
+                task = next;
+            }
+        }
+
+        WorkerTaskList(const WorkerTaskList&) = delete;
+        WorkerTaskList& operator=(const WorkerTaskList&) = delete;
+        WorkerTaskList(WorkerTaskList&&) noexcept = delete;
+        WorkerTaskList& operator=(WorkerTaskList&&) noexcept = delete;
+
+        void Link(WorkerTaskBase* task)
+        {
+            task->next = _head;
+            if (_head != nullptr)
+            {
+                _head->prev = task;
+            }
+            _head = task;
+            _size++;
+        }
+
+        /** The caller owns the task after this */
+        void Unlink(WorkerTaskBase* task)
+        {
+            if (task->prev != nullptr)
+            {
+                task->prev->next = task->next;
+            }
+            else
+            {
+                _head = task->next;
+            }
+            if (task->next != nullptr)
+            {
+                task->next->prev = task->prev;
+            }
+            task->prev = nullptr;
+            task->next = nullptr;
+            _size--;
+        }
+
+        /** @return The first task, chained by next. The caller owns them. */
+        WorkerTaskBase* TakeAll()
+        {
+            auto* head = _head;
+            _head = nullptr;
+            _size = 0;
+            return head;
+        }
+
+        /**
+         * @brief Fail and delete every task.
+         * The list is emptied first, so the callbacks may touch the owner.
+         */
+        void FailAll(const std::string& message)
+        {
+            auto* task = TakeAll();
+            while (task != nullptr)
+            {
+                auto* next = task->next;
+                task->Fail(std::make_exception_ptr(std::runtime_error(message)));
+                delete task;
+                task = next;
+            }
+        }
+
+        size_t Size() const
+        {
+            return _size;
+        }
+
+    private:
+        WorkerTaskBase* _head{nullptr};
+        size_t _size{0};
+    };
+}
@@ -0,0 +1,188 @@
+#include <iterator>
+#include "ChatHistoryCache.h"
+
+using namespace TUI::Common;
+using namespace TUI::Database;
+using namespace TUI::Schema;
+
+ChatHistoryCache::ChatHistoryCache(size_t maxSize)
+    : _maxSize(maxSize)
+{
+}
+
+const IServer::TreeHistory* ChatHistoryCache::Find(const Uuid& userId, const Uuid& chatId)
+{
+    auto it = _entries.find({userId, chatId});
+    if (it == _entries.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    _order.splice(_order.begin(), _order, it->second.order);
+    return &it->second.history;
+}
+
+void ChatHistoryCache::BeginLoad(const Uuid& userId, const Uuid& chatId)
+{
+    auto [it, inserted] = _pendingLoads.try_emplace({userId, chatId}, PendingLoad{0, false});
+    it->second.count++;
+}
+
+void ChatHistoryCache::EndLoad(const Uuid& userId, const Uuid& chatId, const IServer::TreeHistory* history)
+{
+    Key key{userId, chatId};
+    auto pending = _pendingLoads.find(key);
+    if (pending == _pendingLoads.end())
+    {
+        return;
+    }
+    bool written = pending->second.written;
+    if (--pending->second.count == 0)
+    {
+        _pendingLoads.erase(pending);
+    }
+    /** The loaded tree may miss the write */
+    if (written || history == nullptr)
+    {
+        return;
+    }
+    auto size = EstimateSize(*history);
+    if (size > _maxSize)
+    {
+        return;
+    }
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        /** Loaded by a concurrent load */
+        EraseEntry(it);
+    }
+    _order.push_front(key);
+    _entries.emplace(key, Entry{*history, size, _order.begin()});
+    _size += size;
+    Evict();
+}
+
+void ChatHistoryCache::Append(const Uuid& userId, const Uuid& chatId, IServer::MessageNode node)
+{
+    Key key{userId, chatId};
+    MarkWritten(key);
+    auto it = _entries.find(key);
+    if (it == _entries.end())
+    {
+        return;
+    }
+    auto& entry = it->second;
+    auto& nodes = entry.history.get_mutable_nodes();
+    if (nodes.contains(node.get_id()))
+    {
+        /** Committed before a load that started after it, the loaded tree already has it */
+        return;
+    }
+    if (node.get_parent().has_value())
+    {
+        auto parent = nodes.find(node.get_parent().value());
+        if (parent != nodes.end())
+        {
+            parent->second.get_mutable_children().push_back(node.get_id());
+            auto childSize = sizeof(std::string) + node.get_id().size();
+            entry.size += childSize;
+            _size += childSize;
+        }
+    }
+    auto size = EstimateSize(node);
+    auto id = node.get_id();
+    nodes.emplace(std::move(id), std::move(node));
+    entry.size += size;
+    _size += size;
+    _order.splice(_order.begin(), _order, entry.order);
+    Evict();
+}
+
+void ChatHistoryCache::Erase(const Uuid& userId, const Uuid& chatId)
+{
+    Key key{userId, chatId};
+    MarkWritten(key);
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        EraseEntry(it);
+    }
+}
+
+void ChatHistoryCache::EraseUser(const Uuid& userId)
+{
+    /** The null uuid is the smallest one */
+    Key first{userId, Uuid{nullptr}};
+    for (auto it = _pendingLoads.lower_bound(first); it != _pendingLoads.end() && it->first.first == userId; it++)
+    {
+        it->second.written = true;
+    }
+    auto it = _entries.lower_bound(first);
+    while (it != _entries.end() && it->first.first == userId)
+    {
+        auto next = std::next(it);
+        EraseEntry(it);
+        it = next;
+    }
+}
+
+ChatHistoryCache::Stats ChatHistoryCache::GetStats() const
+{
+    return Stats{_hits, _misses, _evictions, _entries.size(), _size, _maxSize};
+}
+
+size_t ChatHistoryCache::EstimateSize(const IServer::MessageNode& node)
+{
+    /** The node, its map entry and the id used as the key */
+    size_t size = sizeof(IServer::MessageNode) + sizeof(std::string) + 4 * sizeof(void*) + 2 * node.get_id().size();
+    if (node.get_parent().has_value())
+    {
+        size += node.get_parent().value().size();
+    }
+    for (const auto& child : node.get_children())
+    {
+        size += sizeof(std::string) + child.size();
+    }
+    for (const auto& content : node.get_message().get_content())
+    {
+        size += sizeof(content) + content.get_data().size();
+    }
+    return size;
+}
+
+size_t ChatHistoryCache::EstimateSize(const IServer::TreeHistory& history)
+{
+    size_t size = sizeof(history);
+    for (const auto& [id, node] : history.get_nodes())
+    {
+        size += EstimateSize(node);
+    }
+    return size;
+}
+
+void ChatHistoryCache::MarkWritten(const Key& key)
+{
+    auto pending = _pendingLoads.find(key);
+    if (pending != _pendingLoads.end())
+    {
+        pending->second.written = true;
+    }
+}
+
+void ChatHistoryCache::EraseEntry(std::map<Key, Entry>::iterator it)
+{
+    _size -= it->second.size;
+    _order.erase(it->second.order);
+    _entries.erase(it);
+}
+
+void ChatHistoryCache::Evict()
+{
+    while (_size > _maxSize && !_order.empty())
+    {
+        EraseEntry(_entries.find(_order.back()));
+        _evictions++;
+    }
+}
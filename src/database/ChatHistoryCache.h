@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <utility>
+#include "common/Uuid.h"
+#include "schema/IServer.h"
+
+namespace TUI::Database
+{
+    /**
+     * @brief LRU cache of parsed chat trees, bounded by an estimate of their memory usage.
+     *
+     * The cache is only touched on the main loop. The owner MUST report every write to a chat
+     * after it is committed, with Append, Erase or EraseUser.
+     *
+     * A load from the database may race with a write to the same chat. Wrap each load with
+     * BeginLoad and EndLoad, the loaded tree is dropped if the chat is written in between.
+     */
+    class ChatHistoryCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits{0};
+            uint64_t misses{0};
+            uint64_t evictions{0};
+            size_t entries{0};
+            /** Estimated bytes of the cached trees */
+            size_t size{0};
+            size_t maxSize{0};
+        };
+
+        /** @param maxSize Max estimated bytes. 0 disables the cache. */
+        explicit ChatHistoryCache(size_t maxSize);
+        ~ChatHistoryCache() = default;
+
+        ChatHistoryCache(const ChatHistoryCache&) = delete;
+        ChatHistoryCache& operator=(const ChatHistoryCache&) = delete;
+        ChatHistoryCache(ChatHistoryCache&&) noexcept = delete;
+        ChatHistoryCache& operator=(ChatHistoryCache&&) noexcept = delete;
+
+        /**
+         * @brief Find a cached tree and mark it as recently used.
+         * The pointer is invalidated by any other call.
+         */
+        const Schema::IServer::TreeHistory* Find(const Common::Uuid& userId, const Common::Uuid& chatId);
+
+        void BeginLoad(const Common::Uuid& userId, const Common::Uuid& chatId);
+        /** @param history The loaded tree. nullptr if the load failed. */
+        void EndLoad(
+            const Common::Uuid& userId, const Common::Uuid& chatId, const Schema::IServer::TreeHistory* history);
+
+        /** @brief Add a committed node to the cached tree, if any. */
+        void Append(const Common::Uuid& userId, const Common::Uuid& chatId, Schema::IServer::MessageNode node);
+        void Erase(const Common::Uuid& userId, const Common::Uuid& chatId);
+        void EraseUser(const Common::Uuid& userId);
+
+        Stats GetStats() const;
+    private:
+        using Key = std::pair<Common::Uuid, Common::Uuid>;
+        struct Entry
+        {
+            Schema::IServer::TreeHistory history;
+            size_t size;
+            std::list<Key>::iterator order;
+        };
+        struct PendingLoad
+        {
+            size_t count;
+            bool written;
+        };
+
+        static size_t EstimateSize(const Schema::IServer::MessageNode& node);
+        static size_t EstimateSize(const Schema::IServer::TreeHistory& history);
+
+        void MarkWritten(const Key& key);
+        void EraseEntry(std::map<Key, Entry>::iterator it);
+        void Evict();
+
+        size_t _maxSize;
+        size_t _size{0};
+        std::map<Key, Entry> _entries{};
+        /** Most recently used first */
+        std::list<Key> _order{};
+        std::map<Key, PendingLoad> _pendingLoads{};
+        uint64_t _hits{0};
+        uint64_t _misses{0};
+        uint64_t _evictions{0};
+    };
+}
@@ -1,55 +1,142 @@
+#include <algorithm>
+#include <cctype>
 #include <format>
+#include <limits>
+#include <set>
 #include <nlohmann/json.hpp>
 #include "Database.h"
+#include "common/Base64.h"
 #include "common/Timestamp.h"
 
 using namespace TUI::Common;
 using namespace TUI::Database;
 using namespace TUI::Schema;
 
-JS::Promise<std::shared_ptr<Database>> Database::CreateAsync(Tev& tev, const std::filesystem::path& dbPath)
-{
-    auto db = std::shared_ptr<Database>(new Database());
-    db->_db = co_await Sqlite::CreateAsync(tev, dbPath);
-    /** Create tables */
-    co_await db->_db->ExecAsync(
-        "CREATE TABLE IF NOT EXISTS global ("
-        "key TEXT PRIMARY KEY, "
-        "value TEXT);");
-    co_await db->_db->ExecAsync(
-        "CREATE TABLE IF NOT EXISTS model ("
-        "id TEXT PRIMARY KEY, "
-        "metadata TEXT, "
-        "settings TEXT);");
-    co_await db->_db->ExecAsync(
-        "CREATE TABLE IF NOT EXISTS user ("
-        "id TEXT PRIMARY KEY, "
-        "username TEXT UNIQUE, "
-        "metadata TEXT, "
-        "public_metadata TEXT, "
-        "admin_metadata TEXT, "
-        "admin_settings TEXT, "
-        "credential TEXT);");
-    co_await db->_db->ExecAsync(
-        "CREATE TABLE IF NOT EXISTS chat ("
-        "timestamp INTEGER, "
-        "user_id TEXT, "
-        "id TEXT, "
-        "metadata TEXT, "
-        "PRIMARY KEY (user_id, id));");
-    co_await db->_db->ExecAsync(
-        "CREATE TABLE IF NOT EXISTS chat_content ("
-        "user_id TEXT, "
-        "chat_id TEXT, "
-        "id TEXT, "
-        "parent TEXT, "
-        "children TEXT, "
-        "message TEXT, "
-        "timestamp INTEGER, "
-        "PRIMARY KEY (user_id, chat_id, id));");
+/** Walk up from the leaf by the primary key. The root has an empty parent. */
+const std::string Database::CHAT_BRANCH_QUERY =
+    "WITH RECURSIVE branch(id, parent, message, depth) AS ("
+    "SELECT id, parent, message, 0 FROM chat_content "
+    "WHERE user_id = ?1 AND chat_id = ?2 AND id = ?3 "
+    "UNION ALL "
+    "SELECT chat_content.id, chat_content.parent, chat_content.message, branch.depth + 1 "
+    "FROM chat_content JOIN branch "
+    "ON chat_content.user_id = ?1 AND chat_content.chat_id = ?2 AND chat_content.id = branch.parent "
+    "WHERE branch.depth < ?4) "
+    "SELECT parent, message FROM branch ORDER BY depth DESC;";
+
+/** Rows not backfilled yet have no sequence, it will be their rowid */
+const std::string Database::CHAT_HISTORY_SINCE_QUERY =
+    "SELECT id, parent, message, timestamp, COALESCE(seq, rowid) AS seq FROM chat_content "
+    "WHERE user_id = ? AND chat_id = ? AND COALESCE(seq, rowid) > ? ORDER BY COALESCE(seq, rowid);";
+
+/** Bounded by the version, so it matches the nodes even outside of a snapshot */
+const std::string Database::CHAT_CHILDREN_QUERY =
+    "SELECT parent, id FROM chat_content "
+    "WHERE user_id = ? AND chat_id = ? AND parent IN (SELECT value FROM json_each(?)) "
+    "AND COALESCE(seq, rowid) <= ? ORDER BY COALESCE(seq, rowid);";
+
+/** json_type fails on invalid JSON, CASE keeps it from being evaluated */
+const std::string Database::CHAT_TITLE_CONDITION =
+    "CASE WHEN json_valid(metadata) THEN json_type(metadata, '$.title') = 'text' END";
+
+/** The rows of a chat are found by the index, see GetChatSearchScope */
+const std::string Database::CHAT_SEARCH_TITLE_DELETE =
+    "DELETE FROM chat_search WHERE chat_search MATCH ? AND title IS NOT NULL;";
+
+const std::string Database::CHAT_SEARCH_TITLE_INSERT =
+    "INSERT INTO chat_search (user_id, chat_id, title, chat) "
+    "SELECT hex(user_id), hex(id), json_extract(metadata, '$.title'), id FROM chat "
+    "WHERE user_id = ? AND id = ? AND " + CHAT_TITLE_CONDITION + ";";
+
+const std::string Database::CHAT_SHARD_COUNT_KEY = "chatShardCount";
+
+Database::Database(size_t chatHistoryCacheSize)
+    : _chatHistoryCache(chatHistoryCacheSize)
+{
+}
+
+JS::Promise<std::shared_ptr<Database>> Database::CreateAsync(
+    Tev& tev, const std::filesystem::path& dbPath, SqliteOptions options, size_t chatHistoryCacheSize,
+    std::optional<size_t> chatShardCount)
+{
+    auto db = std::shared_ptr<Database>(new Database(chatHistoryCacheSize));
+    db->_db = co_await Sqlite::CreateAsync(tev, dbPath, options);
+    co_await Migration::RunAsync(*db->_db, GetMigrationSteps());
+    co_await db->LoadUserCredentialsAsync();
+    auto shardCount = co_await db->CheckChatShardCountAsync(chatShardCount);
+    /** The shards have the same schema, only the chat tables are used */
+    for (size_t i = 0; i < shardCount; i++)
+    {
+        auto shard = co_await Sqlite::CreateAsync(tev, GetChatShardPath(dbPath, i), options);
+        co_await Migration::RunAsync(*shard, GetMigrationSteps());
+        db->_chatShards.push_back(std::move(shard));
+    }
+    /**
+     * Not awaited. Old rows are readable while being converted, so a large database does not delay startup.
+     * The rows not backfilled yet read their rowid as the sequence, and are missing from search until indexed.
+     */
+    for (const auto& sqlite : db->GetAllDbs())
+    {
+        Migration::RunBackgroundAsync(sqlite, GetMigrationSteps());
+        ReencodeMessagesAsync(sqlite);
+    }
     co_return db;
 }
 
+std::filesystem::path Database::GetChatShardPath(const std::filesystem::path& dbPath, size_t index)
+{
+    auto path = dbPath;
+    path += ".shard" + std::to_string(index);
+    return path;
+}
+
+JS::Promise<size_t> Database::CheckChatShardCountAsync(std::optional<size_t> chatShardCount)
+{
+    auto stored = GetGlobalValue(CHAT_SHARD_COUNT_KEY);
+    size_t storedCount = stored.has_value() ? static_cast<size_t>(std::stoull(stored.value())) : 0;
+    if (!chatShardCount.has_value() || chatShardCount.value() == storedCount)
+    {
+        co_return storedCount;
+    }
+    /** Moving the chats between files is not supported */
+    if (stored.has_value())
+    {
+        throw std::runtime_error(std::format(
+            "The database has {} chat shards, it cannot be changed to {}", storedCount, chatShardCount.value()));
+    }
+    if (!_db->Exec("SELECT 1 FROM chat LIMIT 1;").empty())
+    {
+        throw std::runtime_error("The database already has chats, it cannot be sharded");
+    }
+    co_await _db->ExecAsync(
+        "INSERT INTO global (key, value) VALUES (?, ?);",
+        CHAT_SHARD_COUNT_KEY, std::to_string(chatShardCount.value()));
+    co_return chatShardCount.value();
+}
+
+Sqlite& Database::GetChatDb(const Uuid& userId) const
+{
+    if (_chatShards.empty())
+    {
+        return *_db;
+    }
+    /** FNV-1a, std::hash is not stable */
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto byte : userId.Bytes())
+    {
+        hash ^= byte;
+        hash *= 1099511628211ULL;
+    }
+    return *_chatShards[hash % _chatShards.size()];
+}
+
+std::vector<std::shared_ptr<Sqlite>> Database::GetAllDbs() const
+{
+    std::vector<std::shared_ptr<Sqlite>> dbs{_db};
+    dbs.insert(dbs.end(), _chatShards.begin(), _chatShards.end());
+    return dbs;
+}
+
 JS::Promise<void> Database::SetGlobalValueAsync(const std::string& key, std::string value)
 {
     co_await _db->ExecAsync(
@@ -62,17 +149,15 @@ std::optional<std::string> Database::GetGlobalValue(const std::string& key)
     auto result = _db->Exec(
         "SELECT value FROM global WHERE key = ?;",
         key);
-    if (result.empty())
-    {
-        return std::nullopt;
-    }
-    auto& row = result.front();
-    auto it = row.find("value");
-    if (it == row.end() || !std::holds_alternative<std::string>(it->second))
-    {
-        return std::nullopt;
-    }
-    return std::get<std::string>(it->second);
+    return ParseGlobalValueResult(result);
+}
+
+JS::Promise<std::optional<std::string>> Database::GetGlobalValueAsync(const std::string& key)
+{
+    auto result = co_await _db->ExecReadAsync(
+        "SELECT value FROM global WHERE key = ?;",
+        key);
+    co_return ParseGlobalValueResult(result);
 }
 
 JS::Promise<void> Database::DeleteGlobalValueAsync(const std::string& key)
@@ -87,7 +172,7 @@ JS::Promise<Uuid> Database::CreateModelAsync(const std::string& settings)
     Uuid id{};
     co_await _db->ExecAsync(
         "INSERT INTO model (id, settings) VALUES (?, ?);",
-        static_cast<std::string>(id), settings);
+        id, settings);
     co_return id;
 }
 
@@ -95,7 +180,7 @@ JS::Promise<void> Database::DeleteModelAsync(const Common::Uuid& id)
 {
     co_await _db->ExecAsync(
         "DELETE FROM model WHERE id = ?;",
-        static_cast<std::string>(id));
+        id);
 }
 
 std::list<Database::IdMetadataPair> Database::ListModel()
@@ -104,6 +189,12 @@ std::list<Database::IdMetadataPair> Database::ListModel()
     return ParseListTableIdWithMetadataResult(result);
 }
 
+JS::Promise<std::list<Database::IdMetadataPair>> Database::ListModelAsync()
+{
+    auto result = co_await _db->ExecReadAsync("SELECT id, metadata FROM model;");
+    co_return ParseListTableIdWithMetadataResult(result);
+}
+
 JS::Promise<void> Database::SetModelMetadataAsync(const Uuid& id, std::string metadata)
 {
     return SetStringToTableById("model", id, "metadata", std::move(metadata));
@@ -114,6 +205,11 @@ std::string Database::GetModelMetadata(const Uuid& id)
     return GetStringFromTableById("model", id, "metadata");
 }
 
+JS::Promise<std::string> Database::GetModelMetadataAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("model", id, "metadata");
+}
+
 JS::Promise<void> Database::SetModelSettingsAsync(const Uuid& id, std::string settings)
 {
     return SetStringToTableById("model", id, "settings", std::move(settings));
@@ -124,107 +220,76 @@ std::string Database::GetModelSettings(const Uuid& id)
     return GetStringFromTableById("model", id, "settings");
 }
 
+JS::Promise<std::string> Database::GetModelSettingsAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("model", id, "settings");
+}
+
 JS::Promise<Uuid> Database::CreateUserAsync(
     std::string username, std::string adminSettings, std::string credential)
 {
     Uuid id{};
     co_await _db->ExecAsync(
         "INSERT INTO user (id, username, admin_settings, credential) VALUES (?, ?, ?, ?);",
-        static_cast<std::string>(id),
+        id,
         std::move(username),
         std::move(adminSettings),
         std::move(credential));
+    EraseUserCredential(id);
     co_return id;
 }
 
 JS::Promise<void> Database::DeleteUserAsync(const Uuid& id)
 {
-    co_await _db->ExecAsync(
-        "DELETE FROM user WHERE id = ?;",
-        static_cast<std::string>(id));
-    co_await _db->ExecAsync(
-        "DELETE FROM chat WHERE user_id = ?;",
-        static_cast<std::string>(id));
-    co_await _db->ExecAsync(
-        "DELETE FROM chat_content WHERE user_id = ?;",
-        static_cast<std::string>(id));
+    /** The arguments are references, do not use them after suspension */
+    Uuid userId{id};
+    auto& chatDb = GetChatDb(userId);
+    if (&chatDb == _db.get())
+    {
+        co_await _db->TransactionAsync([userId](Sqlite::Transaction& transaction) {
+            transaction.Exec("DELETE FROM user WHERE id = ?;", userId);
+            transaction.Exec("DELETE FROM chat WHERE user_id = ?;", userId);
+            transaction.Exec("DELETE FROM chat_content WHERE user_id = ?;", userId);
+            transaction.Exec("DELETE FROM chat_search WHERE chat_search MATCH ?;", GetChatSearchScope(userId));
+        });
+        _chatHistoryCache.EraseUser(userId);
+        EraseUserCredential(userId);
+        co_return;
+    }
+    /**
+     * Two files cannot be written atomically. The chats go first,
+     * so a failure in between leaves a user without chats, not chats without a user.
+     */
+    co_await chatDb.TransactionAsync([userId](Sqlite::Transaction& transaction) {
+        transaction.Exec("DELETE FROM chat WHERE user_id = ?;", userId);
+        transaction.Exec("DELETE FROM chat_content WHERE user_id = ?;", userId);
+        transaction.Exec("DELETE FROM chat_search WHERE chat_search MATCH ?;", GetChatSearchScope(userId));
+    });
+    _chatHistoryCache.EraseUser(userId);
+    co_await _db->ExecAsync("DELETE FROM user WHERE id = ?;", userId);
+    EraseUserCredential(userId);
 }
 
 std::list<Database::UserListItem> Database::ListUser()
 {
     auto result = _db->Exec("SELECT id, username, admin_settings, public_metadata, admin_metadata FROM user;");
-    std::list<UserListItem> list{};
-    for (auto& row : result)
-    {
-        try
-        {
-            auto idItem = row.find("id");
-            if (idItem == row.end())
-            {
-                continue;
-            }
-            Uuid id{std::get<std::string>(idItem->second)};
-
-            auto usernameItem = row.find("username");
-            if (usernameItem == row.end())
-            {
-                continue;
-            }
-            std::string username = std::move(std::get<std::string>(usernameItem->second));
-
-            auto adminSettingsItem = row.find("admin_settings");
-            if (adminSettingsItem == row.end())
-            {
-                continue;
-            }
-            std::string adminSettings = std::move(std::get<std::string>(adminSettingsItem->second));
-
-            auto publicMetadataItem = row.find("public_metadata");
-            std::string publicMetadata{};
-            if (publicMetadataItem == row.end())
-            {
-                continue;
-            }
-            if (std::holds_alternative<std::string>(publicMetadataItem->second))
-            {
-                publicMetadata = std::move(std::get<std::string>(publicMetadataItem->second));
-            }
-            else if (!std::holds_alternative<std::nullptr_t>(publicMetadataItem->second))
-            {
-                /** Invalid metadata */
-                continue;
-            }
+    return ParseUserListResult(result);
+}
 
-            auto adminMetadataItem = row.find("admin_metadata");
-            std::string adminMetadata{};
-            if (adminMetadataItem == row.end())
-            {
-                continue;
-            }
-            if (std::holds_alternative<std::string>(adminMetadataItem->second))
-            {
-                adminMetadata = std::move(std::get<std::string>(adminMetadataItem->second));
-            }
-            else if (!std::holds_alternative<std::nullptr_t>(adminMetadataItem->second))
-            {
-                /** Invalid metadata */
-                continue;
-            }
+JS::Promise<std::list<Database::UserListItem>> Database::ListUserAsync()
+{
+    auto result = co_await _db->ExecReadAsync("SELECT id, username, admin_settings, public_metadata, admin_metadata FROM user;");
+    co_return ParseUserListResult(result);
+}
 
-            list.emplace_back(
-                id,
-                std::move(username),
-                std::move(adminSettings),
-                std::move(publicMetadata),
-                std::move(adminMetadata));
-        }
-        catch(...)
-        {
-            /** @todo log */
-            /** Ignored, avoid corrupted data from corrupting the whole application */
-        }
+JS::AsyncGenerator<std::list<Database::UserListItem>> Database::ListUserStream(size_t batchSize)
+{
+    auto stream = _db->QueryStream(
+        batchSize, "SELECT id, username, admin_settings, public_metadata, admin_metadata FROM user;");
+    while (auto batch = co_await stream.NextAsync())
+    {
+        co_yield ParseUserListResult(batch.value());
     }
-    return list;
 }
 
 JS::Promise<void> Database::SetUserPublicMetadataAsync(const Uuid& id, std::string metadata)
@@ -237,6 +302,11 @@ std::string Database::GetUserPublicMetadata(const Uuid& id)
     return GetStringFromTableById("user", id, "public_metadata");
 }
 
+JS::Promise<std::string> Database::GetUserPublicMetadataAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("user", id, "public_metadata");
+}
+
 JS::Promise<void> Database::SetUserAdminMetadataAsync(const Uuid& id, std::string metadata)
 {
     return SetStringToTableById("user", id, "admin_metadata", std::move(metadata));
@@ -247,6 +317,11 @@ std::string Database::GetUserAdminMetadata(const Uuid& id)
     return GetStringFromTableById("user", id, "admin_metadata");
 }
 
+JS::Promise<std::string> Database::GetUserAdminMetadataAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("user", id, "admin_metadata");
+}
+
 JS::Promise<void> Database::SetUserMetadataAsync(const Uuid& id, std::string metadata)
 {
     return SetStringToTableById("user", id, "metadata", std::move(metadata));
@@ -257,6 +332,11 @@ std::string Database::GetUserMetadata(const Uuid& id)
     return GetStringFromTableById("user", id, "metadata");
 }
 
+JS::Promise<std::string> Database::GetUserMetadataAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("user", id, "metadata");
+}
+
 JS::Promise<void> Database::SetUserAdminSettingsAsync(const Uuid& id, std::string settings)
 {
     return SetStringToTableById("user", id, "admin_settings", std::move(settings));
@@ -267,9 +347,17 @@ std::string Database::GetUserAdminSettings(const Uuid& id)
     return GetStringFromTableById("user", id, "admin_settings");
 }
 
+JS::Promise<std::string> Database::GetUserAdminSettingsAsync(const Uuid& id)
+{
+    return GetStringFromTableByIdAsync("user", id, "admin_settings");
+}
+
 JS::Promise<void> Database::SetUserCredentialAsync(const Uuid& id, std::string credential)
 {
-    return SetStringToTableById("user", id, "credential", std::move(credential));
+    /** The arguments are references, do not use them after suspension */
+    Uuid userId{id};
+    co_await SetStringToTableById("user", userId, "credential", std::move(credential));
+    EraseUserCredential(userId);
 }
 
 std::string Database::GetUserCredential(const Uuid& id)
@@ -286,67 +374,181 @@ Uuid Database::GetUserId(const std::string& username)
     {
         throw std::runtime_error("User not found");
     }
-    auto row = result.front();
-    auto item = row.find("id");
-    if (item == row.end())
+    return result.front().Get<Uuid>(0);
+}
+
+std::optional<Database::UserCredentialItem> Database::FindUserCredential(const std::string& username)
+{
+    auto now = Timestamp::GetMonotonic();
+    auto it = _userCredentials.find(username);
+    if (it != _userCredentials.end())
+    {
+        if (now - it->second.loadedAt < USER_CREDENTIAL_CACHE_TTL_MS)
+        {
+            return it->second.item;
+        }
+        _userCredentials.erase(it);
+    }
+    auto missedAt = _userCredentialMisses.TryGet(username);
+    if (missedAt.has_value())
+    {
+        if (now - missedAt.value() < USER_CREDENTIAL_CACHE_TTL_MS)
+        {
+            return std::nullopt;
+        }
+        _userCredentialMisses.Erase(username);
+    }
+    auto result = _db->Exec(
+        "SELECT id, credential FROM user WHERE username = ?;",
+        username);
+    if (result.empty())
+    {
+        _userCredentialMisses.Update(username, now);
+        return std::nullopt;
+    }
+    std::optional<UserCredentialItem> item{};
+    try
+    {
+        auto row = result.front();
+        item = DecodeUserCredential(row.Get<Uuid>(0), row.Get<std::string>(1));
+    }
+    catch(...)
+    {
+        /** @todo log */
+    }
+    if (!item.has_value())
     {
-        throw std::runtime_error("User ID not found");
+        _userCredentialMisses.Update(username, now);
+        return std::nullopt;
     }
-    return Uuid{std::get<std::string>(item->second)};
+    _userCredentials.emplace(username, CachedUserCredential{item.value(), now});
+    return item;
 }
 
 JS::Promise<Uuid> Database::CreateChatAsync(const Uuid& userId)
 {
     Uuid id{};
-    co_await _db->ExecAsync(
+    co_await GetChatDb(userId).ExecAsync(
         "INSERT INTO chat (timestamp, user_id, id) VALUES(?, ?, ?);",
         Timestamp::GetWallClock(), 
-        static_cast<std::string>(userId),
-        static_cast<std::string>(id));
+        userId,
+        id);
     co_return id;
 }
 
 JS::Promise<void> Database::DeleteChatAsync(const Uuid& userId, const Uuid& id)
 {
-    co_await _db->ExecAsync(
-        "DELETE FROM chat WHERE user_id = ? AND id = ?;",
-        static_cast<std::string>(userId), static_cast<std::string>(id));
-    co_await _db->ExecAsync(
-        "DELETE FROM chat_content WHERE user_id = ? AND chat_id = ?;",
-        static_cast<std::string>(userId), static_cast<std::string>(id));
+    /** The arguments are references, do not use them after suspension */
+    Uuid userIdCopy{userId};
+    Uuid chatId{id};
+    auto& chatDb = GetChatDb(userIdCopy);
+    co_await chatDb.TransactionAsync([userIdCopy, chatId](Sqlite::Transaction& transaction) {
+        transaction.Exec("DELETE FROM chat WHERE user_id = ? AND id = ?;", userIdCopy, chatId);
+        transaction.Exec("DELETE FROM chat_content WHERE user_id = ? AND chat_id = ?;", userIdCopy, chatId);
+        transaction.Exec(
+            "DELETE FROM chat_search WHERE chat_search MATCH ?;", GetChatSearchScope(userIdCopy, chatId));
+    });
+    _chatHistoryCache.Erase(userIdCopy, chatId);
 }
 
 size_t Database::GetChatCount(const Uuid& userId)
 {
-    auto result = _db->Exec(
+    auto result = GetChatDb(userId).Exec(
         "SELECT COUNT(*) AS count FROM chat WHERE user_id = ?;",
-        static_cast<std::string>(userId));
+        userId);
     if (result.empty())
     {
         throw std::runtime_error("Empty result");
     }
-    auto row = result.front();
-    auto item = row.find("count");
-    if (item == row.end())
-    {
-        throw std::runtime_error("Count not found");
-    }
-    return static_cast<size_t>(std::get<int64_t>(item->second));
+    return static_cast<size_t>(result.front().Get<int64_t>(0));
 }
 
-std::list<Database::IdMetadataPair> Database::ListChat(
-    const Uuid& userId, size_t from , size_t limit)
+template<typename ExecFunc>
+auto Database::ExecChatListQuery(
+    ExecFunc&& exec, const Uuid& userId, const std::optional<ChatListPosition>& after,
+    size_t from, size_t limit, const std::optional<std::vector<std::string>>& metadataKeys)
 {
-    auto sql = std::format(
-        "SELECT id, metadata FROM chat WHERE user_id = ? ORDER BY timestamp DESC LIMIT {} OFFSET {}",
-        limit, from);
-    auto result = _db->Exec(sql, static_cast<std::string>(userId));
-    return ParseListTableIdWithMetadataResult(result);
+    /**
+     * All variants bind the same parameters, the unused ones are ignored.
+     * The paging values are bound so all pages share one cached statement.
+     */
+    auto query = std::format(
+        "SELECT id, {}, timestamp FROM chat WHERE user_id = ?2{} "
+        "ORDER BY timestamp DESC, id DESC LIMIT ?5 OFFSET ?6;",
+        metadataKeys.has_value() ? GetMetadataProjectionSql("chat.metadata", "?1") : "metadata",
+        after.has_value() ? " AND (timestamp, id) < (?3, ?4)" : "");
+    return exec(
+        query,
+        metadataKeys.has_value() ? nlohmann::json(metadataKeys.value()).dump() : std::string{},
+        userId,
+        after.has_value() ? after->timestamp : int64_t{0},
+        after.has_value() ? after->id : Uuid{},
+        static_cast<int64_t>(limit),
+        static_cast<int64_t>(after.has_value() ? 0 : from));
+}
+
+std::list<Database::ChatListItem> Database::ListChat(
+    const Uuid& userId, size_t from , size_t limit,
+    const std::optional<std::vector<std::string>>& metadataKeys)
+{
+    auto& chatDb = GetChatDb(userId);
+    auto result = ExecChatListQuery([&](auto&&... args) {
+        return chatDb.Exec(std::forward<decltype(args)>(args)...);
+    }, userId, std::nullopt, from, limit, metadataKeys);
+    return ParseChatListResult(result);
+}
+
+JS::Promise<std::list<Database::ChatListItem>> Database::ListChatAsync(
+    const Uuid& userId, size_t from , size_t limit,
+    const std::optional<std::vector<std::string>>& metadataKeys)
+{
+    auto& chatDb = GetChatDb(userId);
+    /** The arguments are copied by ExecReadAsync before suspension */
+    auto result = co_await ExecChatListQuery([&](auto&&... args) {
+        return chatDb.ExecReadAsync(std::forward<decltype(args)>(args)...);
+    }, userId, std::nullopt, from, limit, metadataKeys);
+    co_return ParseChatListResult(result);
+}
+
+std::list<Database::ChatListItem> Database::ListChatAfter(
+    const Uuid& userId, int64_t afterTimestamp, const Uuid& afterId, size_t limit,
+    const std::optional<std::vector<std::string>>& metadataKeys)
+{
+    auto& chatDb = GetChatDb(userId);
+    auto result = ExecChatListQuery([&](auto&&... args) {
+        return chatDb.Exec(std::forward<decltype(args)>(args)...);
+    }, userId, ChatListPosition{afterTimestamp, afterId}, 0, limit, metadataKeys);
+    return ParseChatListResult(result);
+}
+
+JS::Promise<std::list<Database::ChatListItem>> Database::ListChatAfterAsync(
+    const Uuid& userId, int64_t afterTimestamp, const Uuid& afterId, size_t limit,
+    const std::optional<std::vector<std::string>>& metadataKeys)
+{
+    auto& chatDb = GetChatDb(userId);
+    /** The arguments are copied by ExecReadAsync before suspension */
+    auto result = co_await ExecChatListQuery([&](auto&&... args) {
+        return chatDb.ExecReadAsync(std::forward<decltype(args)>(args)...);
+    }, userId, ChatListPosition{afterTimestamp, afterId}, 0, limit, metadataKeys);
+    co_return ParseChatListResult(result);
 }
 
 JS::Promise<void> Database::SetChatMetadataAsync(const Uuid& userId, const Uuid& id, std::string metadata)
 {
-    return SetStringToChatAsync(userId, id, "metadata", metadata);
+    /** The arguments are references, do not use them after suspension */
+    Uuid userIdCopy{userId};
+    Uuid chatId{id};
+    auto timestamp = Timestamp::GetWallClock();
+    auto& chatDb = GetChatDb(userIdCopy);
+    co_await chatDb.TransactionAsync([userIdCopy, chatId, metadata, timestamp](Sqlite::Transaction& transaction) {
+        transaction.Exec(
+            "UPDATE chat SET metadata = ?, timestamp = ? WHERE user_id = ? AND id = ?;",
+            metadata,
+            timestamp,
+            userIdCopy,
+            chatId);
+        UpdateChatSearchTitle(transaction, userIdCopy, chatId);
+    });
 }
 
 std::string Database::GetChatMetadata(const Uuid& userId, const Uuid& id)
@@ -354,261 +556,1227 @@ std::string Database::GetChatMetadata(const Uuid& userId, const Uuid& id)
     return GetStringFromChat(userId, id, "metadata");
 }
 
+JS::Promise<std::string> Database::GetChatMetadataAsync(const Uuid& userId, const Uuid& id)
+{
+    return GetStringFromChatAsync(userId, id, "metadata");
+}
+
 JS::Promise<void> Database::AppendChatHistoryAsync(
     const Uuid& userId,
     const Uuid& chatId,
-    IServer::MessageNode node,
-    bool updateParent)
+    IServer::MessageNode node)
 {
-    if (node.get_parent().has_value() && updateParent)
+    /** The arguments are references, do not use them after suspension */
+    Uuid userIdCopy{userId};
+    Uuid chatIdCopy{chatId};
+    /** Store the node as it would be read back */
+    if (node.get_parent().has_value() && node.get_parent().value().empty())
     {
-        auto result = _db->Exec(
-            "SELECT children FROM chat_content WHERE user_id = ? AND chat_id = ? AND id = ?;",
-            static_cast<std::string>(userId),
-            static_cast<std::string>(chatId),
-            node.get_parent().value());
-        if (result.empty())
-        {
-            throw std::runtime_error("Parent message not found");
-        }
-        auto& row = result.front();
-        auto it = row.find("children");
-        if (it == row.end())
-        {
-            throw std::runtime_error("Children field not found");
-        }
-        std::string childrenStr;
-        if (std::holds_alternative<std::string>(it->second))
-        {
-            childrenStr = std::get<std::string>(it->second);
-        }
-        else if (std::holds_alternative<std::nullptr_t>(it->second))
+        node.set_parent(std::nullopt);
+    }
+    node.set_children({});
+    node.set_timestamp(static_cast<double>(static_cast<int64_t>(node.get_timestamp())));
+    /**
+     * The children are derived from the parent column. So the parent is not touched.
+     * The chat or the parent may be deleted while the node is generated, so both are checked in the insert.
+     * The writes are serialized, so the sequence is increasing within a chat.
+     * It is also past every rowid, which rows not backfilled yet will get as their sequence.
+     * The message is indexed for search in the same transaction.
+     */
+    auto id = node.get_id();
+    auto parent = node.get_parent().value_or("");
+    auto message = EncodeMessage(static_cast<nlohmann::json>(node.get_message()));
+    auto timestamp = static_cast<int64_t>(node.get_timestamp());
+    auto text = GetMessageSearchText(node.get_message());
+    auto& chatDb = GetChatDb(userIdCopy);
+    co_await chatDb.TransactionAsync([userIdCopy, chatIdCopy, id, parent, message, timestamp, text](
+        Sqlite::Transaction& transaction) {
+        transaction.Exec(
+            "INSERT INTO chat_content (user_id, chat_id, id, parent, message, timestamp, seq) "
+            "SELECT ?1, ?2, ?3, ?4, ?5, ?6, "
+            "MAX((SELECT COALESCE(MAX(seq), 0) FROM chat_content WHERE user_id = ?1 AND chat_id = ?2), "
+            "(SELECT COALESCE(MAX(rowid), 0) FROM chat_content)) + 1 "
+            "WHERE EXISTS (SELECT 1 FROM chat WHERE user_id = ?1 AND id = ?2) "
+            "AND (?4 = '' OR EXISTS (SELECT 1 FROM chat_content WHERE user_id = ?1 AND chat_id = ?2 AND id = ?4));",
+            userIdCopy,
+            chatIdCopy,
+            id,
+            parent,
+            message,
+            timestamp);
+        if (transaction.Changes() == 0)
         {
-            childrenStr = "[]";
+            throw std::runtime_error(parent.empty() ? "Chat not found" : "Parent message not found");
         }
-        else
+        if (!text.empty())
         {
-            throw std::runtime_error("Invalid children field type");
+            transaction.Exec(
+                "INSERT INTO chat_search (user_id, chat_id, content, chat) VALUES (hex(?1), hex(?2), ?3, ?2);",
+                userIdCopy,
+                chatIdCopy,
+                text);
         }
-        nlohmann::json children = nlohmann::json::parse(childrenStr);
-        children.push_back(node.get_id());
-        co_await _db->ExecAsync(
-            "UPDATE chat_content SET children = ? WHERE user_id = ? AND chat_id = ? AND id = ?;",
-            children.dump(),
-            static_cast<std::string>(userId),
-            static_cast<std::string>(chatId),
-            node.get_parent().value());
-    }
-
-    co_await _db->ExecAsync(
-        "INSERT INTO chat_content (user_id, chat_id, id, parent, children, message, timestamp) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?);",
-        static_cast<std::string>(userId),
-        static_cast<std::string>(chatId),
-        node.get_id(),
-        node.get_parent().value_or(""),
-        (static_cast<nlohmann::json>(node.get_children())).dump(),
-        (static_cast<nlohmann::json>(node.get_message())).dump(),
-        static_cast<int64_t>(node.get_timestamp()));
+    });
+    _chatHistoryCache.Append(userIdCopy, chatIdCopy, std::move(node));
 }
 
 IServer::TreeHistory Database::GetChatHistory(const Uuid& userId, const Uuid& id)
 {
-    auto result = _db->Exec(
-        "SELECT id, parent, children, message, timestamp FROM chat_content "
-        "WHERE user_id = ? AND chat_id = ?;",
-        static_cast<std::string>(userId),
-        static_cast<std::string>(id));
+    const auto* cached = _chatHistoryCache.Find(userId, id);
+    if (cached != nullptr)
+    {
+        return *cached;
+    }
+    /** Async loads of the same chat may be running */
+    _chatHistoryCache.BeginLoad(userId, id);
     IServer::TreeHistory history{};
-    auto& nodes = history.get_mutable_nodes();
-    for (auto& row : result)
+    try
     {
-        try
-        {
-            IServer::MessageNode node{};
-
-            auto messageIdItem = row.find("id");
-            if (messageIdItem == row.end())
-            {
-                continue;
-            }
-            node.set_id(std::get<std::string>(messageIdItem->second));
-
-            auto parentItem = row.find("parent");
-            if (parentItem != row.end() && !std::holds_alternative<std::nullptr_t>(parentItem->second))
-            {
-                auto parentStr = std::get<std::string>(parentItem->second);
-                if (!parentStr.empty())
-                {
-                    node.set_parent(parentStr);
-                }
-            }
-
-            auto childrenItem = row.find("children");
-            if (childrenItem != row.end() && std::holds_alternative<std::string>(childrenItem->second))
-            {
-                auto childrenStr = std::get<std::string>(childrenItem->second);
-                nlohmann::json childrenJson = nlohmann::json::parse(childrenStr);
-                std::vector<std::string> children{};
-                for (const auto& child : childrenJson)
-                {
-                    children.emplace_back(child.get<std::string>());
-                }
-                node.set_children(children);
-            }
-
-            auto messageItem = row.find("message");
-            if (messageItem == row.end())
-            {
-                continue;
-            }
-            std::string messageStr = std::get<std::string>(messageItem->second);
-            auto message = nlohmann::json::parse(messageStr).get<IServer::Message>();
-            node.set_message(std::move(message));
-
-            auto timestampItem = row.find("timestamp");
-            if (timestampItem == row.end())
-            {
-                continue;
-            }
-            int64_t timestamp = std::get<int64_t>(timestampItem->second);
-            node.set_timestamp(static_cast<double>(timestamp));
-
-            nodes.emplace(node.get_id(), std::move(node));
-        }
-        catch(...)
-        {
-            /** @todo log */
-            /** Ignored */
-        }
+        auto result = GetChatDb(userId).Exec(
+            "SELECT id, parent, message, timestamp FROM chat_content "
+            "WHERE user_id = ? AND chat_id = ? ORDER BY COALESCE(seq, rowid);",
+            userId,
+            id);
+        history = ParseChatHistoryResult(result);
+    }
+    catch(...)
+    {
+        _chatHistoryCache.EndLoad(userId, id, nullptr);
+        throw;
     }
+    _chatHistoryCache.EndLoad(userId, id, &history);
     return history;
 }
 
-std::list<Database::IdMetadataPair> Database::ParseListTableIdWithMetadataResult(
-    Sqlite::ExecResult& result)
+JS::Promise<IServer::TreeHistory> Database::GetChatHistoryAsync(const Uuid& userId, const Uuid& id)
 {
-    std::list<IdMetadataPair> list{};
-    for (auto& row : result)
+    const auto* cached = _chatHistoryCache.Find(userId, id);
+    if (cached != nullptr)
     {
-        try
-        {
-            auto idItem = row.find("id");
-            if (idItem == row.end())
-            {
-                continue;
-            }
-            Uuid id{std::get<std::string>(idItem->second)};
-            auto metadataItem = row.find("metadata");
-            if (metadataItem == row.end())
-            {
-                continue;
-            }
-            if (std::holds_alternative<std::string>(metadataItem->second))
-            {
-                list.emplace_back(id, std::move(std::get<std::string>(metadataItem->second)));
-            }
-            else if (std::holds_alternative<std::nullptr_t>(metadataItem->second))
-            {
-                /** If metadata is not set, treat it as an empty string */
-                list.emplace_back(id, std::string{});
-            }
-            else
-            {
-                continue;
-            }
-        }
-        catch(...)
-        {
-            /** @todo log */
-            /** Ignored, avoid corrupted data from corrupting the whole application */
-        }
+        co_return *cached;
     }
-    return list;
+    /** The arguments are references, do not use them after suspension */
+    Uuid userIdCopy{userId};
+    Uuid chatId{id};
+    _chatHistoryCache.BeginLoad(userIdCopy, chatId);
+    IServer::TreeHistory history{};
+    try
+    {
+        auto result = co_await GetChatDb(userIdCopy).ExecReadAsync(
+            "SELECT id, parent, message, timestamp FROM chat_content "
+            "WHERE user_id = ? AND chat_id = ? ORDER BY COALESCE(seq, rowid);",
+            userIdCopy,
+            chatId);
+        history = ParseChatHistoryResult(result);
+    }
+    catch(...)
+    {
+        _chatHistoryCache.EndLoad(userIdCopy, chatId, nullptr);
+        throw;
+    }
+    _chatHistoryCache.EndLoad(userIdCopy, chatId, &history);
+    co_return history;
 }
 
-JS::Promise<void> Database::SetStringToTableById(
-    const std::string& table, const Uuid& id, const std::string& name, std::string value)
+IServer::ChatHistoryDelta Database::GetChatHistorySince(const Uuid& userId, const Uuid& chatId, int64_t since)
 {
-    auto sql = std::format("UPDATE {} SET {} = ? WHERE id = ?;", table, name);
-    co_await _db->ExecAsync(sql, std::move(value), static_cast<std::string>(id));
+    auto [result, children] = GetChatDb(userId).ReadTransaction([&](Sqlite::Transaction& transaction) {
+        return QueryChatHistorySince(transaction, userId, chatId, since);
+    });
+    auto delta = ParseChatHistoryDeltaResult(result, since);
+    if (children.has_value())
+    {
+        ParseChatChildrenResult(children.value(), delta);
+    }
+    return delta;
 }
 
-std::string Database::GetStringFromTableById(
-    const std::string& table, const Uuid& id, const std::string& name)
+JS::Promise<IServer::ChatHistoryDelta> Database::GetChatHistorySinceAsync(
+    const Uuid& userId, const Uuid& chatId, int64_t since)
 {
-    auto sql = std::format("SELECT {} FROM {} WHERE id = ?;", name, table);
-    auto result = _db->Exec(sql, static_cast<std::string>(id));
-    if (result.empty())
+    /** The arguments are references, do not use them after suspension */
+    Uuid userIdCopy{userId};
+    Uuid chatIdCopy{chatId};
+    auto& chatDb = GetChatDb(userIdCopy);
+    auto [result, children] = co_await chatDb.ReadTransactionAsync([userIdCopy, chatIdCopy, since](Sqlite::Transaction& transaction) {
+        return QueryChatHistorySince(transaction, userIdCopy, chatIdCopy, since);
+    });
+    auto delta = ParseChatHistoryDeltaResult(result, since);
+    if (children.has_value())
     {
-        throw std::runtime_error(std::format("Item not found in {}", table));
+        ParseChatChildrenResult(children.value(), delta);
     }
-    auto row = result.front();
-    auto item = row.find(name);
-    if (item == row.end())
+    co_return delta;
+}
+
+std::optional<IServer::LinearHistory> Database::GetChatBranch(
+    const Uuid& userId, const Uuid& chatId, const std::string& leafId)
+{
+    const auto* cached = _chatHistoryCache.Find(userId, chatId);
+    if (cached != nullptr)
     {
-        throw std::runtime_error(std::format("{} not found in row", name));
+        return GetChatBranchFromHistory(*cached, leafId);
     }
-    if (std::holds_alternative<std::string>(item->second))
+    auto result = GetChatDb(userId).Exec(
+        CHAT_BRANCH_QUERY,
+        userId,
+        chatId,
+        leafId,
+        MAX_CHAT_BRANCH_DEPTH);
+    return ParseChatBranchResult(result);
+}
+
+JS::Promise<std::optional<IServer::LinearHistory>> Database::GetChatBranchAsync(
+    const Uuid& userId, const Uuid& chatId, const std::string& leafId)
+{
+    const auto* cached = _chatHistoryCache.Find(userId, chatId);
+    if (cached != nullptr)
     {
-        return std::move(std::get<std::string>(item->second));
+        co_return GetChatBranchFromHistory(*cached, leafId);
     }
-    else if (std::holds_alternative<std::nullptr_t>(item->second))
+    auto result = co_await GetChatDb(userId).ExecReadAsync(
+        CHAT_BRANCH_QUERY,
+        userId,
+        chatId,
+        leafId,
+        MAX_CHAT_BRANCH_DEPTH);
+    co_return ParseChatBranchResult(result);
+}
+
+JS::Promise<std::filesystem::path> Database::BackupAsync(
+    SqliteBackupOptions options, std::function<void(Sqlite::BackupProgress)> onProgress)
+{
+    auto suffix = "." + std::to_string(Common::Timestamp::GetWallClock()) + ".backup";
+    /** Keep the files alive for the whole backup */
+    auto dbs = GetAllDbs();
+    std::vector<Sqlite::BackupTarget> targets{};
+    for (const auto& sqlite : dbs)
     {
-        /** If the string is not set, return an empty string. */
-        return std::string{};
+        auto destPath = sqlite->GetPath();
+        destPath += suffix;
+        targets.push_back({sqlite.get(), std::move(destPath)});
     }
-    else
+    auto mainDestPath = targets.front().destPath;
+    co_await Sqlite::BackupAllAsync(std::move(targets), options, std::move(onProgress));
+    co_return mainDestPath;
+}
+
+std::optional<Sqlite::BackupProgress> Database::GetBackupProgress() const
+{
+    /** The files are copied one at a time, the copied ones are done */
+    for (const auto& sqlite : GetAllDbs())
     {
-        throw std::runtime_error("Invalid type");
+        auto progress = sqlite->GetBackupProgress();
+        if (progress.has_value())
+        {
+            return progress;
+        }
     }
+    return std::nullopt;
 }
 
-JS::Promise<void> Database::SetStringToChatAsync(
-    const Uuid& userId, const Uuid& id, const std::string& name, std::string value)
+ChatHistoryCache::Stats Database::GetChatHistoryCacheStats() const
 {
-    auto sql = std::format(
-        "UPDATE chat SET {} = ?, timestamp = ? WHERE user_id = ? AND id = ?;",
-        name);
-    co_await _db->ExecAsync(
-        sql,
-        std::move(value),
-        Timestamp::GetWallClock(),
-        static_cast<std::string>(userId),
-        static_cast<std::string>(id));
+    return _chatHistoryCache.GetStats();
 }
 
-std::string Database::GetStringFromChat(
-    const Uuid& userId, const Uuid& id, const std::string& name)
+JS::Promise<std::list<Database::ChatSearchItem>> Database::SearchChatAsync(
+    const Uuid& userId, const std::string& query, size_t from, size_t limit,
+    const std::optional<std::vector<std::string>>& metadataKeys)
 {
+    auto expression = GetChatSearchExpression(userId, query);
+    if (!expression.has_value())
+    {
+        co_return std::list<ChatSearchItem>{};
+    }
+    /**
+     * The best match of each chat. The user is matched by the index, and checked again by the join.
+     * Titles weigh twice as much as messages.
+     * Materialized, auxiliary functions like bm25 cannot run in a flattened subquery.
+     */
     auto sql = std::format(
-        "SELECT {} FROM chat WHERE user_id = ? AND id = ?;",
-        name);
-    auto result = _db->Exec(
-        sql,
-        static_cast<std::string>(userId), static_cast<std::string>(id));
+        "WITH matches AS MATERIALIZED ("
+        "SELECT chat, bm25(chat_search, 0.0, 0.0, 2.0, 1.0) AS rank, "
+        "CASE WHEN title IS NOT NULL THEN title ELSE snippet(chat_search, 3, '', '', '...', 16) END AS snippet "
+        "FROM chat_search WHERE chat_search MATCH ?1), "
+        "ranked AS (SELECT chat AS chat_id, MIN(rank) AS rank, snippet FROM matches GROUP BY chat) "
+        "SELECT chat.id, {}, chat.timestamp, ranked.snippet FROM ranked "
+        "JOIN chat ON chat.user_id = ?2 AND chat.id = ranked.chat_id "
+        "ORDER BY ranked.rank, chat.id LIMIT ?3 OFFSET ?4;",
+        metadataKeys.has_value() ? GetMetadataProjectionSql("chat.metadata", "?5") : "chat.metadata");
+    Sqlite::ExecResult result{};
+    if (metadataKeys.has_value())
+    {
+        result = co_await GetChatDb(userId).ExecReadAsync(
+            sql,
+            std::move(expression.value()),
+            userId,
+            static_cast<int64_t>(limit),
+            static_cast<int64_t>(from),
+            nlohmann::json(metadataKeys.value()).dump());
+    }
+    else
+    {
+        result = co_await GetChatDb(userId).ExecReadAsync(
+            sql,
+            std::move(expression.value()),
+            userId,
+            static_cast<int64_t>(limit),
+            static_cast<int64_t>(from));
+    }
+    co_return ParseChatSearchResult(result);
+}
+
+JS::Promise<std::string> Database::GetMetadataKeysAsync(MetadataPath path, std::vector<std::string> keys)
+{
+    auto [table, column] = GetMetadataColumn(path.target);
+    /** Qualified, global.value would be shadowed by json_each */
+    auto projection = GetMetadataProjectionSql(std::format("{}.{}", table, column), "?1");
+    auto keysString = nlohmann::json(keys).dump();
+    Sqlite::ExecResult result{};
+    switch (path.target)
+    {
+    case MetadataTarget::GLOBAL:
+        result = co_await _db->ExecReadAsync(
+            std::format("SELECT {} FROM global WHERE key = 'metadata';", projection),
+            std::move(keysString));
+        if (result.empty())
+        {
+            co_return "{}";
+        }
+        break;
+    case MetadataTarget::CHAT:
+        result = co_await GetChatDb(path.userId).ExecReadAsync(
+            std::format("SELECT {} FROM chat WHERE user_id = ?2 AND id = ?3;", projection),
+            std::move(keysString),
+            path.userId,
+            path.id);
+        break;
+    default:
+        result = co_await _db->ExecReadAsync(
+            std::format("SELECT {} FROM {} WHERE id = ?2;", projection, table),
+            std::move(keysString),
+            path.id);
+        break;
+    }
+    co_return ParseStringResult(
+        result, path.target == MetadataTarget::CHAT ? "Chat not found" : std::format("Item not found in {}", table));
+}
+
+JS::Promise<void> Database::SetMetadataKeysAsync(MetadataPath path, std::map<std::string, nlohmann::json> entries)
+{
+    /** {key: value, ...}, the entries replace the old values, null is stored as a value */
+    auto parameter = nlohmann::json::object();
+    for (auto& [key, value] : entries)
+    {
+        parameter[key] = std::move(value);
+    }
+    return PatchMetadataAsync(std::move(path), [](const std::string& objectSql) {
+        return GetMetadataObjectFromEachSql(std::format(
+            "SELECT key, value, type FROM json_each({}) WHERE key NOT IN (SELECT key FROM json_each(?1)) "
+            "UNION ALL SELECT key, value, type FROM json_each(?1)",
+            objectSql));
+    }, parameter.dump());
+}
+
+JS::Promise<void> Database::DeleteMetadataKeysAsync(MetadataPath path, std::vector<std::string> keys)
+{
+    /** [key, ...] */
+    return PatchMetadataAsync(std::move(path), [](const std::string& objectSql) {
+        return GetMetadataObjectFromEachSql(std::format(
+            "SELECT key, value, type FROM json_each({}) WHERE key NOT IN (SELECT value FROM json_each(?1))",
+            objectSql));
+    }, nlohmann::json(keys).dump());
+}
+
+std::list<Database::IdMetadataPair> Database::ParseListTableIdWithMetadataResult(
+    Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT id, metadata ..." */
+    std::list<IdMetadataPair> list{};
+    for (auto row : result)
+    {
+        try
+        {
+            auto id = row.Get<Uuid>(0);
+            /** If metadata is not set, treat it as an empty string */
+            list.emplace_back(id, row.Get<std::optional<std::string>>(1).value_or(""));
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored, avoid corrupted data from corrupting the whole application */
+        }
+    }
+    return list;
+}
+
+std::list<Database::ChatListItem> Database::ParseChatListResult(Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT id, metadata, timestamp ..." */
+    std::list<ChatListItem> list{};
+    for (auto row : result)
+    {
+        try
+        {
+            auto id = row.Get<Uuid>(0);
+            /** If metadata is not set, treat it as an empty string */
+            auto metadata = row.Get<std::optional<std::string>>(1).value_or("");
+            list.emplace_back(id, std::move(metadata), row.Get<int64_t>(2));
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored, avoid corrupted data from corrupting the whole application */
+        }
+    }
+    return list;
+}
+
+std::list<Database::ChatSearchItem> Database::ParseChatSearchResult(Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT id, metadata, timestamp, snippet ..." */
+    std::list<ChatSearchItem> list{};
+    for (auto row : result)
+    {
+        try
+        {
+            auto id = row.Get<Uuid>(0);
+            auto metadata = row.Get<std::optional<std::string>>(1).value_or("");
+            auto timestamp = row.Get<int64_t>(2);
+            auto snippet = row.Get<std::optional<std::string>>(3).value_or("");
+            list.emplace_back(id, std::move(metadata), timestamp, std::move(snippet));
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored, avoid corrupted data from corrupting the whole application */
+        }
+    }
+    return list;
+}
+
+std::optional<std::string> Database::ParseGlobalValueResult(Sqlite::ExecResult& result)
+{
     if (result.empty())
     {
-        throw std::runtime_error("Chat not found");
+        return std::nullopt;
     }
     auto row = result.front();
-    auto item = row.find(name);
-    if (item == row.end())
+    if (!std::holds_alternative<std::string>(row[0]))
     {
-        throw std::runtime_error(std::format("{} not found in row", name));
+        return std::nullopt;
     }
-    if (std::holds_alternative<std::string>(item->second))
+    return row.Get<std::string>(0);
+}
+
+std::list<Database::UserListItem> Database::ParseUserListResult(Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT id, username, admin_settings, public_metadata, admin_metadata ..." */
+    std::list<UserListItem> list{};
+    for (auto row : result)
     {
-        return std::move(std::get<std::string>(item->second));
+        try
+        {
+            auto id = row.Get<Uuid>(0);
+            std::string username = row.Get<std::string>(1);
+            std::string adminSettings = row.Get<std::string>(2);
+            /** Unset metadata is treated as an empty string. Other types are invalid and will throw. */
+            std::string publicMetadata = row.Get<std::optional<std::string>>(3).value_or("");
+            std::string adminMetadata = row.Get<std::optional<std::string>>(4).value_or("");
+            list.emplace_back(
+                id,
+                std::move(username),
+                std::move(adminSettings),
+                std::move(publicMetadata),
+                std::move(adminMetadata));
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored, avoid corrupted data from corrupting the whole application */
+        }
+    }
+    return list;
+}
+
+IServer::TreeHistory Database::ParseChatHistoryResult(Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT id, parent, message, timestamp ... ORDER BY seq" */
+    IServer::TreeHistory history{};
+    auto& nodes = history.get_mutable_nodes();
+    /** In insertion order */
+    std::vector<const IServer::MessageNode*> insertedNodes{};
+    insertedNodes.reserve(result.size());
+    for (auto row : result)
+    {
+        try
+        {
+            IServer::MessageNode node{};
+            node.get_mutable_id() = row.Get<std::string>(0);
+
+            auto parent = row.Get<std::optional<std::string>>(1);
+            if (parent.has_value() && !parent.value().empty())
+            {
+                node.set_parent(std::move(parent));
+            }
+
+            node.get_mutable_message() = DecodeMessage(row, 2);
+
+            node.set_timestamp(static_cast<double>(row.Get<int64_t>(3)));
+
+            auto id = node.get_id();
+            auto [it, inserted] = nodes.emplace(std::move(id), std::move(node));
+            if (inserted)
+            {
+                insertedNodes.push_back(&it->second);
+            }
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored */
+        }
     }
-    else if (std::holds_alternative<std::nullptr_t>(item->second))
+    /** 
+     * Derive the children from the parents.
+     * The rows are in sequence order, so the children are in the order they were added.
+     */
+    for (const auto* node : insertedNodes)
     {
-        /** If the string is not set, return an empty string. */
-        return std::string{};
+        const auto& parent = node->get_parent();
+        if (!parent.has_value())
+        {
+            continue;
+        }
+        auto parentIt = nodes.find(parent.value());
+        if (parentIt == nodes.end())
+        {
+            continue;
+        }
+        parentIt->second.get_mutable_children().push_back(node->get_id());
     }
-    else
+    return history;
+}
+
+IServer::ChatHistoryDelta Database::ParseChatHistoryDeltaResult(Sqlite::ExecResult& result, int64_t since)
+{
+    /** The result should be of "SELECT id, parent, message, timestamp, seq ... ORDER BY seq" */
+    int64_t version = since;
+    for (auto row : result)
+    {
+        version = std::max(version, row.Get<int64_t>(4));
+    }
+    IServer::ChatHistoryDelta delta{};
+    delta.get_mutable_nodes() = std::move(ParseChatHistoryResult(result).get_mutable_nodes());
+    delta.set_version(static_cast<double>(version));
+    return delta;
+}
+
+std::pair<Sqlite::ExecResult, std::optional<Sqlite::ExecResult>> Database::QueryChatHistorySince(
+    Sqlite::Transaction& transaction, const Uuid& userId, const Uuid& chatId, int64_t since)
+{
+    /** One snapshot, so the children match the nodes. The messages are decoded by the caller. */
+    auto result = transaction.Exec(CHAT_HISTORY_SINCE_QUERY, userId, chatId, since);
+    /** The parents from before since, as a JSON array. Get would move the strings out, they are parsed later. */
+    std::set<std::string> ids{};
+    for (auto row : result)
+    {
+        if (const auto* id = std::get_if<std::string>(&row[0]))
+        {
+            ids.insert(*id);
+        }
+    }
+    std::set<std::string> parents{};
+    int64_t version = since;
+    for (auto row : result)
+    {
+        const auto* parent = std::get_if<std::string>(&row[1]);
+        if (parent != nullptr && !parent->empty() && !ids.contains(*parent))
+        {
+            parents.insert(*parent);
+        }
+        version = std::max(version, row.Get<int64_t>(4));
+    }
+    if (parents.empty())
+    {
+        return {std::move(result), std::nullopt};
+    }
+    auto children = transaction.Exec(CHAT_CHILDREN_QUERY, userId, chatId, nlohmann::json(parents).dump(), version);
+    return {std::move(result), std::move(children)};
+}
+
+void Database::ParseChatChildrenResult(Sqlite::ExecResult& result, IServer::ChatHistoryDelta& delta)
+{
+    /** The result should be of "SELECT parent, id ... ORDER BY seq" */
+    auto& children = delta.get_mutable_children();
+    for (auto row : result)
+    {
+        auto parent = row.Get<std::string>(0);
+        children[std::move(parent)].push_back(row.Get<std::string>(1));
+    }
+}
+
+std::optional<IServer::LinearHistory> Database::ParseChatBranchResult(Sqlite::ExecResult& result)
+{
+    /** The result should be of "SELECT parent, message ..." root first */
+    if (result.empty())
+    {
+        return std::nullopt;
+    }
+    /** The path is broken if it does not end at a root */
+    if (!result.front().Get<std::optional<std::string>>(0).value_or("").empty())
+    {
+        return std::nullopt;
+    }
+    IServer::LinearHistory history{};
+    history.reserve(result.size());
+    for (auto row : result)
+    {
+        history.push_back(DecodeMessage(row, 1));
+    }
+    return history;
+}
+
+std::optional<IServer::LinearHistory> Database::GetChatBranchFromHistory(
+    const IServer::TreeHistory& history, const std::string& leafId)
+{
+    const auto& nodes = history.get_nodes();
+    IServer::LinearHistory branch{};
+    auto it = nodes.find(leafId);
+    while (true)
+    {
+        /** Also guards against cycles */
+        if (it == nodes.end() || branch.size() >= nodes.size())
+        {
+            return std::nullopt;
+        }
+        branch.push_back(it->second.get_message());
+        const auto& parent = it->second.get_parent();
+        if (!parent.has_value())
+        {
+            break;
+        }
+        it = nodes.find(parent.value());
+    }
+    std::reverse(branch.begin(), branch.end());
+    return branch;
+}
+
+std::string Database::ParseStringResult(Sqlite::ExecResult& result, const std::string& notFoundMessage)
+{
+    if (result.empty())
+    {
+        throw std::runtime_error(notFoundMessage);
+    }
+    /** If the string is not set, return an empty string. */
+    return result.front().Get<std::optional<std::string>>(0).value_or("");
+}
+
+std::string Database::GetMessageSearchText(const IServer::Message& message)
+{
+    std::string text{};
+    for (const auto& content : message.get_content())
     {
-        throw std::runtime_error("Invalid type");
+        if (content.get_type() != IServer::Type::TEXT)
+        {
+            continue;
+        }
+        if (!text.empty())
+        {
+            text += '\n';
+        }
+        text += content.get_data();
+    }
+    return text;
+}
+
+std::optional<std::string> Database::GetChatSearchExpression(const Uuid& userId, const std::string& query)
+{
+    /** Each word is quoted, so the query cannot use the FTS5 syntax */
+    std::string terms{};
+    size_t termCount = 0;
+    size_t i = 0;
+    while (i < query.size() && termCount < MAX_CHAT_SEARCH_TERMS)
+    {
+        if (std::isspace(static_cast<unsigned char>(query[i])))
+        {
+            i++;
+            continue;
+        }
+        if (termCount > 0)
+        {
+            terms += ' ';
+        }
+        terms += '"';
+        for (; i < query.size() && !std::isspace(static_cast<unsigned char>(query[i])); i++)
+        {
+            if (query[i] == '"')
+            {
+                terms += '"';
+            }
+            terms += query[i];
+        }
+        terms += '"';
+        termCount++;
+    }
+    if (termCount == 0)
+    {
+        return std::nullopt;
+    }
+    return std::format("{} AND {{title content}} : ({})", GetChatSearchScope(userId), terms);
+}
+
+std::string Database::GetChatSearchScope(const Uuid& userId, const std::optional<Uuid>& chatId)
+{
+    /** Same as hex() in SQL */
+    auto toHex = [](const Uuid& uuid) {
+        std::string hex{};
+        for (auto byte : uuid.Bytes())
+        {
+            hex += std::format("{:02X}", byte);
+        }
+        return hex;
+    };
+    auto scope = std::format("user_id : \"{}\"", toHex(userId));
+    if (chatId.has_value())
+    {
+        scope += std::format(" AND chat_id : \"{}\"", toHex(chatId.value()));
+    }
+    return scope;
+}
+
+void Database::UpdateChatSearchTitle(Sqlite::Transaction& transaction, const Uuid& userId, const Uuid& chatId)
+{
+    transaction.Exec(CHAT_SEARCH_TITLE_DELETE, GetChatSearchScope(userId, chatId));
+    transaction.Exec(CHAT_SEARCH_TITLE_INSERT, userId, chatId);
+}
+
+std::vector<uint8_t> Database::EncodeMessage(const nlohmann::json& message)
+{
+    return nlohmann::json::to_msgpack(message);
+}
+
+IServer::Message Database::DecodeMessage(Sqlite::ExecResult::Row& row, size_t column)
+{
+    if (std::holds_alternative<std::string>(row[column]))
+    {
+        /** Not converted yet */
+        return nlohmann::json::parse(row.Get<std::string>(column)).get<IServer::Message>();
+    }
+    return nlohmann::json::from_msgpack(row.Get<std::vector<uint8_t>>(column)).get<IServer::Message>();
+}
+
+JS::Promise<void> Database::ReencodeMessagesAsync(std::weak_ptr<Sqlite> weakDb)
+{
+    /** Skips the rows that cannot be converted. So they are not selected again. */
+    int64_t lastRowid = 0;
+    while (true)
+    {
+        auto sharedDb = weakDb.lock();
+        if (!sharedDb)
+        {
+            co_return;
+        }
+        auto promise = sharedDb->TransactionAsync([lastRowid](Sqlite::Transaction& transaction) {
+            auto rows = transaction.Exec(
+                "SELECT rowid, message FROM chat_content WHERE rowid > ? AND typeof(message) = 'text' "
+                "ORDER BY rowid LIMIT ?;",
+                lastRowid, MESSAGE_REENCODE_CHUNK_SIZE);
+            std::optional<int64_t> chunkLastRowid{};
+            for (auto row : rows)
+            {
+                auto rowid = row.Get<int64_t>(0);
+                chunkLastRowid = rowid;
+                std::vector<uint8_t> message{};
+                try
+                {
+                    message = EncodeMessage(nlohmann::json::parse(row.Get<std::string>(1)));
+                }
+                catch(...)
+                {
+                    /** @todo log */
+                    /** Corrupted, left as is */
+                    continue;
+                }
+                transaction.Exec("UPDATE chat_content SET message = ? WHERE rowid = ?;", std::move(message), rowid);
+            }
+            return chunkLastRowid;
+        });
+        /** Do not keep the database alive while waiting */
+        sharedDb.reset();
+        std::optional<int64_t> chunkLastRowid{};
+        try
+        {
+            chunkLastRowid = co_await promise;
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** The database is closed, or failed. Retried on the next start. */
+            co_return;
+        }
+        if (!chunkLastRowid.has_value())
+        {
+            co_return;
+        }
+        lastRowid = chunkLastRowid.value();
+    }
+}
+
+std::optional<Database::UserCredentialItem> Database::DecodeUserCredential(
+    const Uuid& userId, const std::string& credential)
+{
+    try
+    {
+        auto userCredential = nlohmann::json::parse(credential).get<IServer::UserCredential>();
+        return UserCredentialItem{
+            userId,
+            Base64::Decode<std::tuple_size_v<decltype(UserCredentialItem::w0)>>(userCredential.get_w0()),
+            Base64::Decode<std::tuple_size_v<decltype(UserCredentialItem::L)>>(userCredential.get_l()),
+            Base64::Decode<std::tuple_size_v<decltype(UserCredentialItem::salt)>>(userCredential.get_salt())};
+    }
+    catch(...)
+    {
+        /** @todo log */
+        return std::nullopt;
+    }
+}
+
+JS::Promise<void> Database::LoadUserCredentialsAsync()
+{
+    auto result = co_await _db->ExecReadAsync("SELECT username, id, credential FROM user;");
+    auto now = Timestamp::GetMonotonic();
+    for (auto row : result)
+    {
+        try
+        {
+            auto item = DecodeUserCredential(row.Get<Uuid>(1), row.Get<std::string>(2));
+            if (item.has_value())
+            {
+                _userCredentials.insert_or_assign(row.Get<std::string>(0), CachedUserCredential{std::move(item.value()), now});
+            }
+        }
+        catch(...)
+        {
+            /** @todo log */
+            /** Ignored, loaded again on use */
+        }
+    }
+}
+
+void Database::EraseUserCredential(const Uuid& userId)
+{
+    /** Keyed by name. Credential writes are rare, so a scan is fine. */
+    std::erase_if(_userCredentials, [&userId](const auto& item) {
+        return item.second.item.userId == userId;
+    });
+    /** The misses are not keyed by id. A user with an invalid credential may have been fixed. */
+    _userCredentialMisses.Clear();
+}
+
+std::vector<Migration::Step> Database::GetMigrationSteps()
+{
+    /** Append only. NEVER modify or remove a released step. */
+    return {
+        {1, "Create tables", [](Sqlite::Transaction& transaction) {
+            /** Databases from before versioning already have the tables */
+            transaction.Exec(
+                "CREATE TABLE IF NOT EXISTS global ("
+                "key TEXT PRIMARY KEY, "
+                "value TEXT);");
+            transaction.Exec(
+                "CREATE TABLE IF NOT EXISTS model ("
+                "id TEXT PRIMARY KEY, "
+                "metadata TEXT, "
+                "settings TEXT);");
+            transaction.Exec(
+                "CREATE TABLE IF NOT EXISTS user ("
+                "id TEXT PRIMARY KEY, "
+                "username TEXT UNIQUE, "
+                "metadata TEXT, "
+                "public_metadata TEXT, "
+                "admin_metadata TEXT, "
+                "admin_settings TEXT, "
+                "credential TEXT);");
+            transaction.Exec(
+                "CREATE TABLE IF NOT EXISTS chat ("
+                "timestamp INTEGER, "
+                "user_id TEXT, "
+                "id TEXT, "
+                "metadata TEXT, "
+                "PRIMARY KEY (user_id, id));");
+            transaction.Exec(
+                "CREATE TABLE IF NOT EXISTS chat_content ("
+                "user_id TEXT, "
+                "chat_id TEXT, "
+                "id TEXT, "
+                "parent TEXT, "
+                "message TEXT, "
+                "timestamp INTEGER, "
+                "PRIMARY KEY (user_id, chat_id, id));");
+        }},
+        {2, "Derive chat tree children from the parent column", [](Sqlite::Transaction& transaction) {
+            /** Older databases store the children as a JSON array in chat_content.children */
+            auto columns = transaction.Exec("SELECT name FROM pragma_table_info('chat_content');");
+            for (auto row : columns)
+            {
+                if (row.Get<std::string>(0) == "children")
+                {
+                    /**
+                     * The parent column already has the same information.
+                     * DROP COLUMN rewrites the table in one statement, it cannot be split into chunks.
+                     * Only databases from before versioning have this column.
+                     */
+                    transaction.Exec("ALTER TABLE chat_content DROP COLUMN children;");
+                    return;
+                }
+            }
+        }},
+        {3, "Add chat tree and chat list indexes", [](Sqlite::Transaction& transaction) {
+            /** For deriving the children of a message */
+            transaction.Exec(
+                "CREATE INDEX IF NOT EXISTS chat_content_parent ON chat_content (user_id, chat_id, parent);");
+            /** For listing and counting the chats of a user, newest first */
+            transaction.Exec(
+                "CREATE INDEX IF NOT EXISTS chat_user_timestamp ON chat (user_id, timestamp DESC, id DESC);");
+        }},
+        {4, "Store UUIDs as 16-byte blobs", nullptr, [](Sqlite::Transaction& transaction) {
+            /**
+             * Older databases store the UUIDs as 36-char text. Convert a chunk of the rows of one table at a time.
+             * Converted rows are no longer text, so the progress is kept in the data.
+             * The message ids are opaque strings to the database, so they are kept as text.
+             */
+            static const std::vector<std::pair<std::string, std::vector<std::string>>> tables{
+                {"model", {"id"}},
+                {"user", {"id"}},
+                {"chat", {"user_id", "id"}},
+                {"chat_content", {"user_id", "chat_id"}},
+            };
+            for (const auto& [table, columns] : tables)
+            {
+                auto pending = transaction.Exec(
+                    std::format("SELECT 1 FROM {} WHERE typeof({}) = 'text' LIMIT 1;", table, columns.front()));
+                if (pending.empty())
+                {
+                    continue;
+                }
+                std::string assignments{};
+                for (const auto& column : columns)
+                {
+                    if (!assignments.empty())
+                    {
+                        assignments += ", ";
+                    }
+                    /**
+                     * The same format as uuid_parse: hyphens at 9, 14, 19 and 24, 32 hex digits in either case.
+                     * unhex returns NULL on any other character, and a shorter blob on misplaced hyphens.
+                     * Invalid UUIDs become NULL. Such rows were ignored when read anyway.
+                     */
+                    assignments += std::format(
+                        "{0} = CASE WHEN typeof({0}) != 'text' THEN {0} "
+                        "WHEN length({0}) = 36 AND substr({0}, 9, 1) = '-' AND substr({0}, 14, 1) = '-' "
+                        "AND substr({0}, 19, 1) = '-' AND substr({0}, 24, 1) = '-' "
+                        "AND length(unhex(replace({0}, '-', ''))) = 16 "
+                        "THEN unhex(replace({0}, '-', '')) END",
+                        column);
+                }
+                transaction.Exec(
+                    std::format("UPDATE {0} SET {1} WHERE rowid IN "
+                        "(SELECT rowid FROM {0} WHERE typeof({2}) = 'text' LIMIT ?);",
+                        table, assignments, columns.front()),
+                    UUID_MIGRATION_CHUNK_SIZE);
+                return false;
+            }
+            return true;
+        }},
+        {5, "Add a per-chat sequence to chat_content", [](Sqlite::Transaction& transaction) {
+            /**
+             * For fetching the nodes added after a version. The rowid order is the insertion order.
+             * Adding the column does not rewrite the table. Old rows read their rowid as the sequence
+             * until the backfill fills it in, new rows are numbered after every rowid, see AppendChatHistoryAsync.
+             */
+            auto columns = transaction.Exec("SELECT 1 FROM pragma_table_info('chat_content') WHERE name = 'seq';");
+            if (columns.empty())
+            {
+                transaction.Exec("ALTER TABLE chat_content ADD COLUMN seq INTEGER;");
+            }
+            /** An index is built in one pass, it cannot be split */
+            transaction.Exec(
+                "CREATE INDEX IF NOT EXISTS chat_content_seq ON chat_content (user_id, chat_id, seq);");
+        }, [](Sqlite::Transaction& transaction) -> bool {
+            /** Filled by rowid ranges, the progress is kept between the chunks */
+            auto lastRowid = GetBackfillRowid(transaction, "chatSeqBackfillRowid").value_or(0);
+            auto endRowid = GetBackfillChunkEnd(transaction, "chat_content", lastRowid, SEQ_BACKFILL_CHUNK_SIZE);
+            transaction.Exec(
+                "UPDATE chat_content SET seq = rowid WHERE rowid > ? AND rowid <= ? AND seq IS NULL;",
+                lastRowid, endRowid.value_or(std::numeric_limits<int64_t>::max()));
+            SetBackfillRowid(transaction, "chatSeqBackfillRowid", endRowid);
+            return !endRowid.has_value();
+        }, true},
+        {6, "Create the chat search index", [](Sqlite::Transaction& transaction) {
+            /**
+             * One row per chat title and per message. The ids are indexed as hex tokens,
+             * so a search is scoped to a user, and a chat is deleted, by the full-text index itself.
+             * chat is the id blob, to join back to the chat table.
+             */
+            transaction.Exec(
+                "CREATE VIRTUAL TABLE IF NOT EXISTS chat_search USING fts5("
+                "user_id, chat_id, title, content, chat UNINDEXED);");
+        }, [](Sqlite::Transaction& transaction) -> bool {
+            /**
+             * The titles are indexed by rowid ranges, the progress is kept between the chunks.
+             * A title may be set meanwhile, so each is replaced instead of inserted.
+             */
+            auto lastRowid = GetBackfillRowid(transaction, "chatSearchTitleBackfillRowid").value_or(0);
+            auto endRowid = GetBackfillChunkEnd(transaction, "chat", lastRowid, SEARCH_INDEX_CHUNK_SIZE);
+            auto chats = transaction.Exec(
+                "SELECT user_id, id FROM chat WHERE rowid > ? AND rowid <= ? "
+                "AND user_id IS NOT NULL AND id IS NOT NULL;",
+                lastRowid, endRowid.value_or(std::numeric_limits<int64_t>::max()));
+            for (auto row : chats)
+            {
+                std::optional<std::pair<Uuid, Uuid>> ids{};
+                try
+                {
+                    ids.emplace(row.Get<Uuid>(0), row.Get<Uuid>(1));
+                }
+                catch(...)
+                {
+                    /** Not a valid id, never read */
+                    continue;
+                }
+                UpdateChatSearchTitle(transaction, ids->first, ids->second);
+            }
+            SetBackfillRowid(transaction, "chatSearchTitleBackfillRowid", endRowid);
+            return !endRowid.has_value();
+        }, true},
+        {7, "Index the chat messages for search", [](Sqlite::Transaction& transaction) {
+            /** Messages appended from now on are indexed by AppendChatHistoryAsync */
+            transaction.Exec(
+                "INSERT OR IGNORE INTO global (key, value) "
+                "SELECT 'chatSearchBackfillEndRowid', COALESCE(MAX(rowid), 0) FROM chat_content;");
+        }, [](Sqlite::Transaction& transaction) -> bool {
+            /** The messages are decoded here, the progress is kept between the chunks */
+            int64_t lastRowid = GetBackfillRowid(transaction, "chatSearchBackfillRowid").value_or(0);
+            int64_t endRowid = GetBackfillRowid(transaction, "chatSearchBackfillEndRowid").value_or(0);
+            auto rows = transaction.Exec(
+                "SELECT rowid, message FROM chat_content WHERE rowid > ? AND rowid <= ? ORDER BY rowid LIMIT ?;",
+                lastRowid, endRowid, SEARCH_INDEX_CHUNK_SIZE);
+            for (auto row : rows)
+            {
+                lastRowid = row.Get<int64_t>(0);
+                std::string text{};
+                try
+                {
+                    text = GetMessageSearchText(DecodeMessage(row, 1));
+                }
+                catch(...)
+                {
+                    /** Corrupted, not searchable */
+                    continue;
+                }
+                if (text.empty())
+                {
+                    continue;
+                }
+                transaction.Exec(
+                    "INSERT INTO chat_search (user_id, chat_id, content, chat) "
+                    "SELECT hex(user_id), hex(chat_id), ?, chat_id FROM chat_content "
+                    "WHERE rowid = ? AND user_id IS NOT NULL AND chat_id IS NOT NULL;",
+                    std::move(text), lastRowid);
+            }
+            if (rows.size() < static_cast<size_t>(SEARCH_INDEX_CHUNK_SIZE))
+            {
+                SetBackfillRowid(transaction, "chatSearchBackfillRowid", std::nullopt);
+                SetBackfillRowid(transaction, "chatSearchBackfillEndRowid", std::nullopt);
+                return true;
+            }
+            SetBackfillRowid(transaction, "chatSearchBackfillRowid", lastRowid);
+            return false;
+        }, true},
+    };
+}
+
+std::optional<int64_t> Database::GetBackfillRowid(Sqlite::Transaction& transaction, const std::string& key)
+{
+    auto progress = transaction.Exec("SELECT value FROM global WHERE key = ?;", key);
+    if (progress.empty())
+    {
+        return std::nullopt;
+    }
+    return std::stoll(progress.front().Get<std::string>(0));
+}
+
+void Database::SetBackfillRowid(
+    Sqlite::Transaction& transaction, const std::string& key, std::optional<int64_t> rowid)
+{
+    if (!rowid.has_value())
+    {
+        transaction.Exec("DELETE FROM global WHERE key = ?;", key);
+        return;
+    }
+    transaction.Exec(
+        "INSERT INTO global (key, value) VALUES (?, ?) "
+        "ON CONFLICT (key) DO UPDATE SET value = excluded.value;",
+        key, std::to_string(rowid.value()));
+}
+
+std::optional<int64_t> Database::GetBackfillChunkEnd(
+    Sqlite::Transaction& transaction, const std::string& table, int64_t lastRowid, int64_t chunkSize)
+{
+    /** The rowid of the last row of the chunk, so gaps in the rowids do not make empty chunks */
+    auto next = transaction.Exec(
+        std::format("SELECT rowid FROM {} WHERE rowid > ? ORDER BY rowid LIMIT 1 OFFSET ?;", table),
+        lastRowid, chunkSize - 1);
+    if (next.empty())
+    {
+        return std::nullopt;
+    }
+    return next.front().Get<int64_t>(0);
+}
+
+JS::Promise<void> Database::SetStringToTableById(
+    const std::string& table, const Uuid& id, const std::string& name, std::string value)
+{
+    auto sql = std::format("UPDATE {} SET {} = ? WHERE id = ?;", table, name);
+    co_await _db->ExecAsync(sql, std::move(value), id);
+}
+
+std::string Database::GetStringFromTableById(
+    const std::string& table, const Uuid& id, const std::string& name)
+{
+    auto sql = std::format("SELECT {} FROM {} WHERE id = ?;", name, table);
+    auto result = _db->Exec(sql, id);
+    return ParseStringResult(result, std::format("Item not found in {}", table));
+}
+
+JS::Promise<std::string> Database::GetStringFromTableByIdAsync(
+    const std::string& table, const Uuid& id, const std::string& name)
+{
+    auto sql = std::format("SELECT {} FROM {} WHERE id = ?;", name, table);
+    /** The arguments are references, do not use them after suspension */
+    auto notFoundMessage = std::format("Item not found in {}", table);
+    auto result = co_await _db->ExecReadAsync(sql, id);
+    co_return ParseStringResult(result, notFoundMessage);
+}
+
+std::string Database::GetStringFromChat(
+    const Uuid& userId, const Uuid& id, const std::string& name)
+{
+    auto sql = std::format(
+        "SELECT {} FROM chat WHERE user_id = ? AND id = ?;",
+        name);
+    auto result = GetChatDb(userId).Exec(
+        sql, userId, id);
+    return ParseStringResult(result, "Chat not found");
+}
+
+JS::Promise<std::string> Database::GetStringFromChatAsync(
+    const Uuid& userId, const Uuid& id, const std::string& name)
+{
+    auto sql = std::format(
+        "SELECT {} FROM chat WHERE user_id = ? AND id = ?;",
+        name);
+    auto result = co_await GetChatDb(userId).ExecReadAsync(
+        sql, userId, id);
+    co_return ParseStringResult(result, "Chat not found");
+}
+
+std::pair<std::string, std::string> Database::GetMetadataColumn(MetadataTarget target)
+{
+    switch (target)
+    {
+    case MetadataTarget::GLOBAL:
+        return {"global", "value"};
+    case MetadataTarget::MODEL:
+        return {"model", "metadata"};
+    case MetadataTarget::USER:
+        return {"user", "metadata"};
+    case MetadataTarget::USER_PUBLIC:
+        return {"user", "public_metadata"};
+    case MetadataTarget::USER_ADMIN:
+        return {"user", "admin_metadata"};
+    case MetadataTarget::CHAT:
+        return {"chat", "metadata"};
+    }
+    throw std::runtime_error("Invalid metadata target");
+}
+
+std::string Database::GetMetadataObjectSql(const std::string& column)
+{
+    /** CASE is evaluated in order, json_type fails on invalid JSON */
+    return std::format(
+        "CASE WHEN NOT json_valid({0}) THEN '{{}}' WHEN json_type({0}) = 'object' THEN {0} ELSE '{{}}' END",
+        column);
+}
+
+std::string Database::GetMetadataProjectionSql(const std::string& column, const std::string& keysParam)
+{
+    return GetMetadataObjectFromEachSql(std::format(
+        "SELECT key, value, type FROM json_each({}) WHERE key IN (SELECT value FROM json_each({}))",
+        GetMetadataObjectSql(column), keysParam));
+}
+
+std::string Database::GetMetadataObjectFromEachSql(const std::string& entries)
+{
+    /**
+     * The keys are never put in a JSON path, so any key works.
+     * The values are typed here, JSON subtypes do not survive a subquery.
+     */
+    return std::format(
+        "(SELECT json_group_object(entries.key, CASE entries.type "
+        "WHEN 'true' THEN json('true') WHEN 'false' THEN json('false') WHEN 'null' THEN json('null') "
+        "WHEN 'object' THEN json(entries.value) WHEN 'array' THEN json(entries.value) "
+        "ELSE entries.value END) FROM ({}) AS entries)",
+        entries);
+}
+
+JS::Promise<void> Database::PatchMetadataAsync(
+    MetadataPath path, std::function<std::string(const std::string&)> getPatchSql, std::string parameter)
+{
+    auto [table, column] = GetMetadataColumn(path.target);
+    /** Qualified, an unqualified value would be shadowed by json_each */
+    auto patch = getPatchSql(GetMetadataObjectSql(std::format("{}.{}", table, column)));
+    Sqlite::ExecResult result{};
+    switch (path.target)
+    {
+    case MetadataTarget::GLOBAL:
+        co_await _db->ExecAsync(
+            std::format(
+                "INSERT INTO global (key, value) VALUES ('metadata', {}) "
+                "ON CONFLICT (key) DO UPDATE SET value = {};",
+                getPatchSql("'{}'"), patch),
+            std::move(parameter));
+        co_return;
+    case MetadataTarget::CHAT:
+    {
+        auto sql = std::format(
+            "UPDATE chat SET metadata = {}, timestamp = ?2 WHERE user_id = ?3 AND id = ?4 RETURNING 1;",
+            patch);
+        auto timestamp = Timestamp::GetWallClock();
+        auto& chatDb = GetChatDb(path.userId);
+        co_await chatDb.TransactionAsync([sql, parameter, timestamp, path](
+            Sqlite::Transaction& transaction) {
+            auto result = transaction.Exec(sql, parameter, timestamp, path.userId, path.id);
+            if (result.empty())
+            {
+                throw std::runtime_error("Chat not found");
+            }
+            UpdateChatSearchTitle(transaction, path.userId, path.id);
+        });
+        co_return;
+    }
+    default:
+        result = co_await _db->ExecAsync(
+            std::format("UPDATE {} SET {} = {} WHERE id = ?2 RETURNING 1;", table, column, patch),
+            std::move(parameter),
+            path.id);
+        if (result.empty())
+        {
+            throw std::runtime_error(std::format("Item not found in {}", table));
+        }
+        co_return;
     }
 }
 
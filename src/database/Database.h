@@ -1,14 +1,21 @@
 #pragma once
 
+#include <array>
+#include <functional>
 #include <memory>
 #include <string>
 #include <list>
 #include <format>
+#include <unordered_map>
 #include <tev-cpp/Tev.h>
 #include <js-style-co-routine/Promise.h>
+#include <js-style-co-routine/AsyncGenerator.h>
+#include "common/Cache.h"
 #include "common/Uuid.h"
 #include "schema/IServer.h"
 #include "Sqlite.h"
+#include "Migration.h"
+#include "ChatHistoryCache.h"
 
 namespace TUI::Database
 {
@@ -19,7 +26,24 @@ namespace TUI::Database
     class Database
     {
     public:
-        static JS::Promise<std::shared_ptr<Database>> CreateAsync(Tev& tev, const std::filesystem::path& dbPath);
+        static constexpr size_t DEFAULT_CHAT_HISTORY_CACHE_SIZE = 64 * 1024 * 1024;
+        static constexpr size_t USER_LIST_BATCH_SIZE = 256;
+
+        /**
+         * @param chatHistoryCacheSize Max estimated bytes of the cached chat trees. 0 disables the cache.
+         * @param chatShardCount The chats are split by user into this many files next to the database,
+         * see GetChatShardPath. Each shard has its own writer and read connections.
+         * 0 keeps the chats in the database file. std::nullopt uses the count the database was created with.
+         * The count is fixed once set, and a database that already has chats cannot be sharded.
+         */
+        static JS::Promise<std::shared_ptr<Database>> CreateAsync(
+            Tev& tev,
+            const std::filesystem::path& dbPath,
+            SqliteOptions options = {},
+            size_t chatHistoryCacheSize = DEFAULT_CHAT_HISTORY_CACHE_SIZE,
+            std::optional<size_t> chatShardCount = std::nullopt);
+        /** <database file>.shard<index> */
+        static std::filesystem::path GetChatShardPath(const std::filesystem::path& dbPath, size_t index);
         
         Database(const Database&) = delete;
         Database& operator=(const Database&) = delete;
@@ -28,9 +52,15 @@ namespace TUI::Database
 
         ~Database() = default;
 
+        /**
+         * The sync getters run on the main loop. The async getters run on the read connection pool,
+         * and should be preferred for anything that may be large or slow.
+         */
+
         /** Global KV */
         JS::Promise<void> SetGlobalValueAsync(const std::string& key, std::string value);
         std::optional<std::string> GetGlobalValue(const std::string& key);
+        JS::Promise<std::optional<std::string>> GetGlobalValueAsync(const std::string& key);
         JS::Promise<void> DeleteGlobalValueAsync(const std::string& key);
 
         /** Model */
@@ -42,10 +72,13 @@ namespace TUI::Database
             std::string metadata;
         };
         std::list<IdMetadataPair> ListModel();
+        JS::Promise<std::list<IdMetadataPair>> ListModelAsync();
         JS::Promise<void> SetModelMetadataAsync(const Common::Uuid& id, std::string metadata);
         std::string GetModelMetadata(const Common::Uuid& id);
+        JS::Promise<std::string> GetModelMetadataAsync(const Common::Uuid& id);
         JS::Promise<void> SetModelSettingsAsync(const Common::Uuid& id, std::string settings);
         std::string GetModelSettings(const Common::Uuid& id);
+        JS::Promise<std::string> GetModelSettingsAsync(const Common::Uuid& id);
 
         /** User */
         JS::Promise<Common::Uuid> CreateUserAsync(
@@ -60,48 +93,331 @@ namespace TUI::Database
             std::string adminMetadata;
         };
         std::list<UserListItem> ListUser();
+        JS::Promise<std::list<UserListItem>> ListUserAsync();
+        /**
+         * @brief The users in batches of at most batchSize, read from one snapshot.
+         * Only one batch of rows is held at a time. This object MUST outlive the generator.
+         */
+        JS::AsyncGenerator<std::list<UserListItem>> ListUserStream(size_t batchSize = USER_LIST_BATCH_SIZE);
         JS::Promise<void> SetUserPublicMetadataAsync(const Common::Uuid& id, std::string metadata);
         std::string GetUserPublicMetadata(const Common::Uuid& id);
+        JS::Promise<std::string> GetUserPublicMetadataAsync(const Common::Uuid& id);
         JS::Promise<void> SetUserAdminMetadataAsync(const Common::Uuid& id, std::string metadata);
         std::string GetUserAdminMetadata(const Common::Uuid& id);
+        JS::Promise<std::string> GetUserAdminMetadataAsync(const Common::Uuid& id);
         JS::Promise<void> SetUserMetadataAsync(const Common::Uuid& id, std::string metadata);
         std::string GetUserMetadata(const Common::Uuid& id);
+        JS::Promise<std::string> GetUserMetadataAsync(const Common::Uuid& id);
         JS::Promise<void> SetUserAdminSettingsAsync(const Common::Uuid& id, std::string settings);
         std::string GetUserAdminSettings(const Common::Uuid& id);
+        JS::Promise<std::string> GetUserAdminSettingsAsync(const Common::Uuid& id);
         JS::Promise<void> SetUserCredentialAsync(const Common::Uuid& id, std::string credential);
         std::string GetUserCredential(const Common::Uuid& id);
         Common::Uuid GetUserId(const std::string& username);
+        struct UserCredentialItem
+        {
+            Common::Uuid userId;
+            /** Decoded from the stored Schema::IServer::UserCredential */
+            std::array<uint8_t, 32> w0;
+            std::array<uint8_t, 32> L;
+            std::array<uint8_t, 16> salt;
+        };
+        /**
+         * @brief Find the decoded credential of a user by name, for the handshake.
+         * Served from a cache that is loaded on creation, and kept up to date by the writes of this class.
+         * Entries expire, so the writes of other processes, like tui-register, are picked up.
+         * Unknown names, and names with an invalid credential, are cached as misses with the same expiry.
+         * So a miss costs the same as a hit, and probing for names does not run a query each time.
+         * A user created by another process may not be found until the miss expires.
+         *
+         * @return std::nullopt if the user is not found, or the credential is invalid.
+         */
+        std::optional<UserCredentialItem> FindUserCredential(const std::string& username);
 
         /** Chat */
         JS::Promise<Common::Uuid> CreateChatAsync(const Common::Uuid& userId);
         JS::Promise<void> DeleteChatAsync(const Common::Uuid& userId, const Common::Uuid& chatId);
         size_t GetChatCount(const Common::Uuid& userId);
-        std::list<IdMetadataPair> ListChat(
-            const Common::Uuid& userId, size_t from = 0, size_t limit = 50);
+        struct ChatListItem
+        {
+            Common::Uuid id;
+            std::string metadata;
+            int64_t timestamp;
+        };
+        /**
+         * Newest first. Prefer ListChatAfter for anything but the first page.
+         * @param metadataKeys If set, the metadata only has these keys, see GetMetadataKeysAsync.
+         */
+        std::list<ChatListItem> ListChat(
+            const Common::Uuid& userId, size_t from = 0, size_t limit = 50,
+            const std::optional<std::vector<std::string>>& metadataKeys = std::nullopt);
+        JS::Promise<std::list<ChatListItem>> ListChatAsync(
+            const Common::Uuid& userId, size_t from = 0, size_t limit = 50,
+            const std::optional<std::vector<std::string>>& metadataKeys = std::nullopt);
+        /**
+         * @brief List the chats after the last item of the previous page, newest first.
+         * Served by an index seek, so any page costs the same as the first one.
+         */
+        std::list<ChatListItem> ListChatAfter(
+            const Common::Uuid& userId, int64_t afterTimestamp, const Common::Uuid& afterId, size_t limit = 50,
+            const std::optional<std::vector<std::string>>& metadataKeys = std::nullopt);
+        JS::Promise<std::list<ChatListItem>> ListChatAfterAsync(
+            const Common::Uuid& userId, int64_t afterTimestamp, const Common::Uuid& afterId, size_t limit = 50,
+            const std::optional<std::vector<std::string>>& metadataKeys = std::nullopt);
         JS::Promise<void> SetChatMetadataAsync(
             const Common::Uuid& userId, const Common::Uuid& chatId, std::string metadata);
         std::string GetChatMetadata(const Common::Uuid& userId, const Common::Uuid& chatId);
+        JS::Promise<std::string> GetChatMetadataAsync(const Common::Uuid& userId, const Common::Uuid& chatId);
         JS::Promise<void> AppendChatHistoryAsync(
             const Common::Uuid& userId,
             const Common::Uuid& chatId,
-            Schema::IServer::MessageNode node,
-            bool updateParent = true);
+            Schema::IServer::MessageNode node);
+        /**
+         * Chat trees are cached. The cache is kept up to date by the writes of this class,
+         * so the database MUST NOT be written to by others.
+         */
         Schema::IServer::TreeHistory GetChatHistory(const Common::Uuid& userId, const Common::Uuid& chatId);
+        JS::Promise<Schema::IServer::TreeHistory> GetChatHistoryAsync(
+            const Common::Uuid& userId, const Common::Uuid& chatId);
+        /**
+         * @brief Get the nodes added after the version since, and the new children lists of older nodes.
+         * Each node has a sequence number that increases within the chat. The version is the largest one.
+         * Use 0 to get the whole chat.
+         */
+        Schema::IServer::ChatHistoryDelta GetChatHistorySince(
+            const Common::Uuid& userId, const Common::Uuid& chatId, int64_t since);
+        JS::Promise<Schema::IServer::ChatHistoryDelta> GetChatHistorySinceAsync(
+            const Common::Uuid& userId, const Common::Uuid& chatId, int64_t since);
+        /**
+         * @brief Get the messages on the path from the root to the leaf, root first.
+         * Only the path is read, the sibling branches are not.
+         * 
+         * @return std::nullopt if the leaf is not found or the path is broken.
+         */
+        std::optional<Schema::IServer::LinearHistory> GetChatBranch(
+            const Common::Uuid& userId, const Common::Uuid& chatId, const std::string& leafId);
+        JS::Promise<std::optional<Schema::IServer::LinearHistory>> GetChatBranchAsync(
+            const Common::Uuid& userId, const Common::Uuid& chatId, const std::string& leafId);
+        ChatHistoryCache::Stats GetChatHistoryCacheStats() const;
+        struct ChatSearchItem
+        {
+            Common::Uuid id;
+            std::string metadata;
+            int64_t timestamp;
+            /** Text around the best match, from a message or the title */
+            std::string snippet;
+        };
+        /**
+         * @brief Full-text search of the messages and titles of the chats of a user, best match first.
+         * The title is the "title" key of the chat metadata.
+         * Each whitespace separated word of the query must match a whole token, in the same message or the title.
+         * @param metadataKeys If set, the metadata only has these keys, see GetMetadataKeysAsync.
+         */
+        JS::Promise<std::list<ChatSearchItem>> SearchChatAsync(
+            const Common::Uuid& userId, const std::string& query, size_t from = 0, size_t limit = 50,
+            const std::optional<std::vector<std::string>>& metadataKeys = std::nullopt);
+
+        /**
+         * Metadata
+         * Metadata is a JSON object. Only the requested top level keys are read or written,
+         * by the SQLite JSON functions, and each write is a single statement.
+         * Metadata that is not a JSON object is treated as empty.
+         */
+        enum class MetadataTarget
+        {
+            GLOBAL,
+            MODEL,
+            USER,
+            USER_PUBLIC,
+            USER_ADMIN,
+            CHAT
+        };
+        struct MetadataPath
+        {
+            MetadataTarget target;
+            /** The model, user or chat. Unused for GLOBAL. */
+            Common::Uuid id{nullptr};
+            /** The owner of the chat. Only used for CHAT. */
+            Common::Uuid userId{nullptr};
+        };
+        /** @return A JSON object of the keys that exist */
+        JS::Promise<std::string> GetMetadataKeysAsync(MetadataPath path, std::vector<std::string> keys);
+        /**
+         * @brief Replace the values of the keys.
+         * The values are stored as they are, including nulls.
+         *
+         * @throws std::runtime_error if a key has a double quote, it cannot be a JSON path label.
+         */
+        JS::Promise<void> SetMetadataKeysAsync(MetadataPath path, std::map<std::string, nlohmann::json> entries);
+        JS::Promise<void> DeleteMetadataKeysAsync(MetadataPath path, std::vector<std::string> keys);
+
+        /**
+         * Backup
+         * @brief Write a snapshot of the database next to it, as <database file>.<unix ms>.backup.
+         * Reads and writes go on during the backup. Only one backup can run at a time.
+         * The chat shards are copied after the database, one by one, as <shard file>.<unix ms>.backup
+         * with the same time. The snapshots of all files are taken at the same instant before any is copied,
+         * so the set restores without orphan or missing chats.
+         * 
+         * @return The path of the backup file of the database.
+         */
+        JS::Promise<std::filesystem::path> BackupAsync(
+            SqliteBackupOptions options = {},
+            std::function<void(Sqlite::BackupProgress)> onProgress = nullptr);
+        std::optional<Sqlite::BackupProgress> GetBackupProgress() const;
 
     private:
-        Database() = default;
+        /** Guards against cycles in corrupted chat trees */
+        static constexpr int64_t MAX_CHAT_BRANCH_DEPTH = 100000;
+        static const std::string CHAT_BRANCH_QUERY;
+        static const std::string CHAT_HISTORY_SINCE_QUERY;
+        static const std::string CHAT_CHILDREN_QUERY;
+        /** Whether the metadata column has a string title */
+        static const std::string CHAT_TITLE_CONDITION;
+        static const std::string CHAT_SEARCH_TITLE_DELETE;
+        static const std::string CHAT_SEARCH_TITLE_INSERT;
+        /** Bounds the cost of a search */
+        static constexpr size_t MAX_CHAT_SEARCH_TERMS = 16;
+
+        explicit Database(size_t chatHistoryCacheSize);
+
+        /** The global key of the shard count. Not set for databases created before sharding. */
+        static const std::string CHAT_SHARD_COUNT_KEY;
+        /** @return The shard count to use */
+        JS::Promise<size_t> CheckChatShardCountAsync(std::optional<size_t> chatShardCount);
+        /**
+         * @brief The database of the chats of a user.
+         * The hash MUST be stable across builds and platforms, it decides where the chats are stored.
+         */
+        Sqlite& GetChatDb(const Common::Uuid& userId) const;
+        /** The main database first */
+        std::vector<std::shared_ptr<Sqlite>> GetAllDbs() const;
+
+        static constexpr int64_t USER_CREDENTIAL_CACHE_TTL_MS = 60 * 1000;
+        /** Bounded, the names come from unauthenticated clients */
+        static constexpr size_t USER_CREDENTIAL_MISS_CACHE_SIZE = 4096;
+        struct CachedUserCredential
+        {
+            UserCredentialItem item;
+            /** Monotonic */
+            int64_t loadedAt;
+        };
+        /** @return std::nullopt if the credential is invalid */
+        static std::optional<UserCredentialItem> DecodeUserCredential(
+            const Common::Uuid& userId, const std::string& credential);
+        JS::Promise<void> LoadUserCredentialsAsync();
+        /** Call after the write is committed. Also drops the cached misses. */
+        void EraseUserCredential(const Common::Uuid& userId);
+
+        /** Rows converted per transaction when migrating the UUID columns */
+        static constexpr int64_t UUID_MIGRATION_CHUNK_SIZE = 1000;
+
+        static std::vector<Migration::Step> GetMigrationSteps();
+        /** The last rowid done by a chunked backfill, kept in the global table */
+        static std::optional<int64_t> GetBackfillRowid(Sqlite::Transaction& transaction, const std::string& key);
+        /** @param rowid nullopt when the backfill is done */
+        static void SetBackfillRowid(
+            Sqlite::Transaction& transaction, const std::string& key, std::optional<int64_t> rowid);
+        /** @return The last rowid of the next chunk, nullopt if the rest fits in one chunk */
+        static std::optional<int64_t> GetBackfillChunkEnd(
+            Sqlite::Transaction& transaction, const std::string& table, int64_t lastRowid, int64_t chunkSize);
+
+        /** Rows filled per transaction when adding the chat_content sequence */
+        static constexpr int64_t SEQ_BACKFILL_CHUNK_SIZE = 1000;
+
+        /** Messages indexed per transaction when building the search index */
+        static constexpr int64_t SEARCH_INDEX_CHUNK_SIZE = 500;
+
+        /** Rows re-encoded per transaction by the background re-encoder. Messages can be large. */
+        static constexpr int64_t MESSAGE_REENCODE_CHUNK_SIZE = 100;
+
+        /**
+         * Messages are stored as MessagePack blobs.
+         * Rows written by older versions are JSON text, they are still readable,
+         * and are converted in the background by ReencodeMessagesAsync.
+         */
+        static std::vector<uint8_t> EncodeMessage(const nlohmann::json& message);
+        static Schema::IServer::Message DecodeMessage(Sqlite::ExecResult::Row& row, size_t column);
+        /** Runs until all text rows of the database are converted, or the database is gone */
+        static JS::Promise<void> ReencodeMessagesAsync(std::weak_ptr<Sqlite> weakDb);
 
         std::list<IdMetadataPair> ParseListTableIdWithMetadataResult(
             Sqlite::ExecResult& result);
+        std::list<ChatListItem> ParseChatListResult(Sqlite::ExecResult& result);
+        std::optional<std::string> ParseGlobalValueResult(Sqlite::ExecResult& result);
+        std::list<UserListItem> ParseUserListResult(Sqlite::ExecResult& result);
+        Schema::IServer::TreeHistory ParseChatHistoryResult(Sqlite::ExecResult& result);
+        std::optional<Schema::IServer::LinearHistory> ParseChatBranchResult(Sqlite::ExecResult& result);
+        Schema::IServer::ChatHistoryDelta ParseChatHistoryDeltaResult(Sqlite::ExecResult& result, int64_t since);
+        /** @return The nodes since the version, and the children of their parents from before it, if any */
+        static std::pair<Sqlite::ExecResult, std::optional<Sqlite::ExecResult>> QueryChatHistorySince(
+            Sqlite::Transaction& transaction, const Common::Uuid& userId, const Common::Uuid& chatId, int64_t since);
+        struct ChatListPosition
+        {
+            int64_t timestamp;
+            Common::Uuid id;
+        };
+        /**
+         * @brief The one chat list query behind ListChat and ListChatAfter, sync and async.
+         * @param exec Called as exec(query, args...), with Sqlite::Exec or Sqlite::ExecReadAsync.
+         * @param after If set, list the chats after it and ignore from.
+         * @return What exec returns
+         */
+        template<typename ExecFunc>
+        static auto ExecChatListQuery(
+            ExecFunc&& exec, const Common::Uuid& userId, const std::optional<ChatListPosition>& after,
+            size_t from, size_t limit, const std::optional<std::vector<std::string>>& metadataKeys);
+        static void ParseChatChildrenResult(Sqlite::ExecResult& result, Schema::IServer::ChatHistoryDelta& delta);
+        static std::optional<Schema::IServer::LinearHistory> GetChatBranchFromHistory(
+            const Schema::IServer::TreeHistory& history, const std::string& leafId);
+        /** The text content, indexed for search */
+        static std::string GetMessageSearchText(const Schema::IServer::Message& message);
+        /** @return std::nullopt if the query has no word */
+        static std::optional<std::string> GetChatSearchExpression(
+            const Common::Uuid& userId, const std::string& query);
+        /** FTS5 expression of the rows of a user, or of a chat */
+        static std::string GetChatSearchScope(
+            const Common::Uuid& userId, const std::optional<Common::Uuid>& chatId = std::nullopt);
+        /** Index the title of the chat again, after the metadata is written */
+        static void UpdateChatSearchTitle(
+            Sqlite::Transaction& transaction, const Common::Uuid& userId, const Common::Uuid& chatId);
+        std::list<ChatSearchItem> ParseChatSearchResult(Sqlite::ExecResult& result);
+        std::string ParseStringResult(Sqlite::ExecResult& result, const std::string& notFoundMessage);
         JS::Promise<void> SetStringToTableById(
             const std::string& table, const Common::Uuid& id, const std::string& name, std::string value);
         std::string GetStringFromTableById(
             const std::string& table, const Common::Uuid& id, const std::string& name);
-        JS::Promise<void> SetStringToChatAsync(
-            const Common::Uuid& userId, const Common::Uuid& id, const std::string& name, std::string value);
+        JS::Promise<std::string> GetStringFromTableByIdAsync(
+            const std::string& table, const Common::Uuid& id, const std::string& name);
         std::string GetStringFromChat(
             const Common::Uuid& userId, const Common::Uuid& id, const std::string& name);
+        JS::Promise<std::string> GetStringFromChatAsync(
+            const Common::Uuid& userId, const Common::Uuid& id, const std::string& name);
+        /** @return The table and the column */
+        static std::pair<std::string, std::string> GetMetadataColumn(MetadataTarget target);
+        /** The column if it is a JSON object, or an empty object */
+        static std::string GetMetadataObjectSql(const std::string& column);
+        /**
+         * A JSON object of the column, with only the keys in the JSON array parameter.
+         * The column must be qualified with its table.
+         */
+        static std::string GetMetadataProjectionSql(const std::string& column, const std::string& keysParam);
+        /** A JSON object of the rows of entries, a SELECT of key, value and type like json_each */
+        static std::string GetMetadataObjectFromEachSql(const std::string& entries);
+        /**
+         * Set the column to getPatchSql(object). The object is the column if it is a JSON object.
+         * The parameter is bound as ?1.
+         */
+        JS::Promise<void> PatchMetadataAsync(
+            MetadataPath path, std::function<std::string(const std::string&)> getPatchSql, std::string parameter);
 
         std::shared_ptr<Sqlite> _db;
+        /** Empty if the chats are in _db */
+        std::vector<std::shared_ptr<Sqlite>> _chatShards{};
+        ChatHistoryCache _chatHistoryCache;
+        /** By username */
+        std::unordered_map<std::string, CachedUserCredential> _userCredentials{};
+        /** Username -> monotonic time of the miss */
+        Common::Cache<std::string, int64_t> _userCredentialMisses{USER_CREDENTIAL_MISS_CACHE_SIZE};
     };
 }
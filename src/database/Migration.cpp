@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include "Migration.h"
+
+using namespace TUI::Database;
+
+JS::Promise<void> Migration::RunAsync(Sqlite& db, std::vector<Step> steps)
+{
+    auto version = co_await GetVersionAsync(db);
+    int64_t lastVersion = 0;
+    for (const auto& step : steps)
+    {
+        if (step.version <= lastVersion)
+        {
+            throw std::runtime_error(std::format("Migration step {} is out of order", step.version));
+        }
+        lastVersion = step.version;
+    }
+    if (version > lastVersion)
+    {
+        throw std::runtime_error(std::format(
+            "Database version {} is newer than the supported version {}", version, lastVersion));
+    }
+
+    for (const auto& step : steps)
+    {
+        if (step.version <= version)
+        {
+            continue;
+        }
+        if (step.backfillChunk && !step.background)
+        {
+            bool done = false;
+            while (!done)
+            {
+                done = co_await db.TransactionAsync([backfillChunk = step.backfillChunk, stepVersion = step.version](Sqlite::Transaction& transaction) {
+                    bool finished = backfillChunk(transaction);
+                    if (finished)
+                    {
+                        SetVersion(transaction, stepVersion);
+                    }
+                    return finished;
+                });
+            }
+        }
+        else
+        {
+            co_await db.TransactionAsync([apply = step.apply, background = step.background, stepVersion = step.version](
+                Sqlite::Transaction& transaction) {
+                if (apply)
+                {
+                    apply(transaction);
+                }
+                if (background)
+                {
+                    transaction.Exec("CREATE TABLE IF NOT EXISTS migration_backfill (version INTEGER PRIMARY KEY);");
+                    transaction.Exec("INSERT OR IGNORE INTO migration_backfill (version) VALUES (?);", stepVersion);
+                }
+                SetVersion(transaction, stepVersion);
+            });
+        }
+        version = step.version;
+    }
+}
+
+JS::Promise<void> Migration::RunBackgroundAsync(std::weak_ptr<Sqlite> weakDb, std::vector<Step> steps)
+{
+    std::vector<int64_t> pending{};
+    try
+    {
+        auto sharedDb = weakDb.lock();
+        if (!sharedDb)
+        {
+            co_return;
+        }
+        auto promise = sharedDb->TransactionAsync([](Sqlite::Transaction& transaction) {
+            std::vector<int64_t> versions{};
+            auto table = transaction.Exec(
+                "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'migration_backfill';");
+            if (table.empty())
+            {
+                return versions;
+            }
+            auto rows = transaction.Exec("SELECT version FROM migration_backfill ORDER BY version;");
+            for (auto row : rows)
+            {
+                versions.push_back(row.Get<int64_t>(0));
+            }
+            return versions;
+        });
+        /** Do not keep the database alive while waiting */
+        sharedDb.reset();
+        pending = co_await promise;
+    }
+    catch(...)
+    {
+        /** @todo log */
+        co_return;
+    }
+
+    for (const auto& step : steps)
+    {
+        if (!step.backfillChunk || std::find(pending.begin(), pending.end(), step.version) == pending.end())
+        {
+            continue;
+        }
+        bool done = false;
+        while (!done)
+        {
+            auto sharedDb = weakDb.lock();
+            if (!sharedDb)
+            {
+                co_return;
+            }
+            auto promise = sharedDb->TransactionAsync([backfillChunk = step.backfillChunk, stepVersion = step.version](
+                Sqlite::Transaction& transaction) {
+                bool finished = backfillChunk(transaction);
+                if (finished)
+                {
+                    transaction.Exec("DELETE FROM migration_backfill WHERE version = ?;", stepVersion);
+                }
+                return finished;
+            });
+            sharedDb.reset();
+            try
+            {
+                done = co_await promise;
+            }
+            catch(...)
+            {
+                /** @todo log */
+                /** The database is closed, or failed. Retried on the next start. */
+                co_return;
+            }
+        }
+    }
+}
+
+JS::Promise<int64_t> Migration::GetVersionAsync(Sqlite& db)
+{
+    auto result = co_await db.ExecAsync("PRAGMA user_version;");
+    co_return result.front().Get<int64_t>(0);
+}
+
+void Migration::SetVersion(Sqlite::Transaction& transaction, int64_t version)
+{
+    /** PRAGMA does not take bound parameters */
+    transaction.Exec(std::format("PRAGMA user_version = {};", version));
+}
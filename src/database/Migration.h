@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <js-style-co-routine/Promise.h>
+#include "Sqlite.h"
+
+namespace TUI::Database
+{
+    /**
+     * @brief Schema migrations driven by PRAGMA user_version.
+     *
+     * The steps are run in order of their versions, skipping the ones at or below the current
+     * user_version. Each step bumps user_version in the same transaction as its last change,
+     * so an interrupted migration resumes from the first unfinished step.
+     *
+     * Long backfills should be split into chunks. Each chunk runs in its own transaction on the
+     * writer thread, so other writes can interleave and a crash only loses the current chunk.
+     *
+     * Backfills that readers can do without run in the background, after RunAsync resolves.
+     * Their steps bump user_version once the apply part is done, and are tracked as pending in the
+     * migration_backfill table until the last chunk, so they resume after restart.
+     */
+    class Migration
+    {
+    public:
+        struct Step
+        {
+            /** The user_version after this step. MUST be increasing. */
+            int64_t version;
+            std::string description;
+            /** Runs in one transaction. Only with backfillChunk if background is set. */
+            std::function<void(Sqlite::Transaction&)> apply{nullptr};
+            /**
+             * Runs repeatedly, each time in its own transaction, until it returns true.
+             * The progress MUST be derivable from the data, e.g. by only touching rows that are not
+             * migrated yet. So the chunks can resume after restart.
+             */
+            std::function<bool(Sqlite::Transaction&)> backfillChunk{nullptr};
+            /**
+             * Run backfillChunk in RunBackgroundAsync instead of RunAsync.
+             * The readers and writers MUST work with the rows that are not backfilled yet.
+             */
+            bool background{false};
+        };
+
+        /**
+         * @brief Run the pending steps.
+         * Throws if the database has a newer version than the last step.
+         */
+        static JS::Promise<void> RunAsync(Sqlite& db, std::vector<Step> steps);
+        /**
+         * @brief Run the pending background backfills, in order of their versions.
+         * Call after RunAsync, without awaiting. Stops when the database is gone or a chunk fails,
+         * the rest is resumed by the next call.
+         */
+        static JS::Promise<void> RunBackgroundAsync(std::weak_ptr<Sqlite> weakDb, std::vector<Step> steps);
+
+        static JS::Promise<int64_t> GetVersionAsync(Sqlite& db);
+    private:
+        static void SetVersion(Sqlite::Transaction& transaction, int64_t version);
+    };
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
 #include "Sqlite.h"
 
 using namespace TUI::Database;
@@ -39,42 +43,205 @@ Sqlite::UniqueSqlite3::operator sqlite3*() const
 	return _db;
 }
 
-/** UniqueStmtInternal */
+/** ExecResult::Row */
 
-Sqlite::UniqueStmt::UniqueStmtInternal::UniqueStmtInternal(sqlite3_stmt* stmt)
-	: _stmt(stmt)
+Sqlite::ExecResult::Row::Row(Value* values, size_t columnCount)
+	: _values(values), _columnCount(columnCount)
 {
 }
 
-Sqlite::UniqueStmt::UniqueStmtInternal::~UniqueStmtInternal()
+size_t Sqlite::ExecResult::Row::ColumnCount() const
 {
-	if (_stmt) 
+	return _columnCount;
+}
+
+bool Sqlite::ExecResult::Row::IsNull(size_t column) const
+{
+	return std::holds_alternative<std::nullptr_t>(At(column));
+}
+
+const Sqlite::Value& Sqlite::ExecResult::Row::operator[](size_t column) const
+{
+	return At(column);
+}
+
+Sqlite::Value& Sqlite::ExecResult::Row::At(size_t column) const
+{
+	if (column >= _columnCount)
 	{
-		sqlite3_finalize(_stmt);
+		throw std::out_of_range("Column index out of range");
 	}
+	return _values[column];
+}
+
+/** ExecResult::Iterator */
+
+Sqlite::ExecResult::Iterator::Iterator(ExecResult* result, size_t row)
+	: _result(result), _row(row)
+{
+}
+
+Sqlite::ExecResult::Row Sqlite::ExecResult::Iterator::operator*() const
+{
+	return (*_result)[_row];
+}
+
+Sqlite::ExecResult::Iterator& Sqlite::ExecResult::Iterator::operator++()
+{
+	_row++;
+	return *this;
+}
+
+bool Sqlite::ExecResult::Iterator::operator==(const Iterator& other) const
+{
+	return _result == other._result && _row == other._row;
+}
+
+/** ExecResult */
+
+Sqlite::ExecResult::ExecResult(std::vector<std::string> columns)
+	: _columns(std::move(columns))
+{
+}
+
+const std::vector<std::string>& Sqlite::ExecResult::Columns() const
+{
+	return _columns;
+}
+
+size_t Sqlite::ExecResult::ColumnIndex(const std::string& name) const
+{
+	for (size_t i = 0; i < _columns.size(); i++)
+	{
+		if (_columns[i] == name)
+		{
+			return i;
+		}
+	}
+	throw std::runtime_error("Column not found: " + name);
+}
+
+size_t Sqlite::ExecResult::size() const
+{
+	if (_columns.empty())
+	{
+		return 0;
+	}
+	return _values.size() / _columns.size();
+}
+
+bool Sqlite::ExecResult::empty() const
+{
+	return size() == 0;
+}
+
+Sqlite::ExecResult::Row Sqlite::ExecResult::operator[](size_t row)
+{
+	if (row >= size())
+	{
+		throw std::out_of_range("Row index out of range");
+	}
+	return Row(_values.data() + row * _columns.size(), _columns.size());
+}
+
+Sqlite::ExecResult::Row Sqlite::ExecResult::front()
+{
+	return (*this)[0];
 }
 
-Sqlite::UniqueStmt::UniqueStmtInternal::UniqueStmtInternal(UniqueStmtInternal &&other) noexcept
-	: _stmt(other._stmt)
+Sqlite::ExecResult::Iterator Sqlite::ExecResult::begin()
+{
+	return Iterator(this, 0);
+}
+
+Sqlite::ExecResult::Iterator Sqlite::ExecResult::end()
+{
+	return Iterator(this, size());
+}
+
+/** StatementCache */
+
+Sqlite::StatementCache::StatementCache(size_t maxSize)
+	: _cache(maxSize)
+{
+}
+
+std::shared_ptr<sqlite3_stmt> Sqlite::StatementCache::Acquire(sqlite3* db, const std::string& query)
+{
+	auto cached = _cache.TryGet(query);
+	if (cached.has_value())
+	{
+		_hits.fetch_add(1, std::memory_order_relaxed);
+		return std::move(cached.value());
+	}
+	_misses.fetch_add(1, std::memory_order_relaxed);
+	/** Hint sqlite that the statement will be retained for a long time */
+	auto stmt = Prepare(db, query, SQLITE_PREPARE_PERSISTENT);
+	_cache.Update(query, stmt);
+	return stmt;
+}
+
+std::shared_ptr<sqlite3_stmt> Sqlite::StatementCache::Prepare(sqlite3* db, const std::string& query, unsigned int flags)
+{
+	sqlite3_stmt* rawStmt = nullptr;
+	if (sqlite3_prepare_v3(db, query.c_str(), -1, flags, &rawStmt, nullptr) != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to prepare statement: " + std::string(sqlite3_errmsg(db)));
+	}
+	return std::shared_ptr<sqlite3_stmt>(rawStmt, [](sqlite3_stmt* s) {
+		sqlite3_finalize(s);
+	});
+}
+
+Sqlite::StatementCacheStats Sqlite::StatementCache::GetStats() const
+{
+	return StatementCacheStats{
+		_hits.load(std::memory_order_relaxed),
+		_misses.load(std::memory_order_relaxed)};
+}
+
+/** StmtLease */
+
+Sqlite::UniqueStmt::StmtLease::StmtLease(std::shared_ptr<sqlite3_stmt> stmt)
+	: _stmt(std::move(stmt))
+{
+}
+
+Sqlite::UniqueStmt::StmtLease::~StmtLease()
+{
+	Release();
+}
+
+Sqlite::UniqueStmt::StmtLease::StmtLease(StmtLease &&other) noexcept
+	: _stmt(std::move(other._stmt))
 {
 	other._stmt = nullptr;
 }
 
-Sqlite::UniqueStmt::UniqueStmtInternal &Sqlite::UniqueStmt::UniqueStmtInternal::operator=(UniqueStmtInternal &&other) noexcept
+Sqlite::UniqueStmt::StmtLease &Sqlite::UniqueStmt::StmtLease::operator=(StmtLease &&other) noexcept
 {
 	if (this != &other) {
-		if (_stmt) {
-			sqlite3_finalize(_stmt);
-		}
-		_stmt = other._stmt;
+		Release();
+		_stmt = std::move(other._stmt);
 		other._stmt = nullptr;
 	}
 	return *this;
 }
 
-Sqlite::UniqueStmt::UniqueStmtInternal::operator sqlite3_stmt*() const
+Sqlite::UniqueStmt::StmtLease::operator sqlite3_stmt*() const
 {
-	return _stmt;
+	return _stmt.get();
+}
+
+void Sqlite::UniqueStmt::StmtLease::Release()
+{
+	if (_stmt)
+	{
+		/** The return values only repeat the errors of the last step. */
+		sqlite3_reset(_stmt.get());
+		sqlite3_clear_bindings(_stmt.get());
+		_stmt = nullptr;
+	}
 }
 
 /** UniqueStmt */
@@ -145,17 +312,399 @@ void Sqlite::UniqueStmt::BindValue(int i, std::nullptr_t)
 	}
 }
 
+void Sqlite::UniqueStmt::BindValue(int i, const Common::Uuid& value)
+{
+	auto bytes = value.Bytes();
+	/** Let sqlite copy the 16 bytes instead of allocating a list node to keep them */
+	int rc = sqlite3_bind_blob(_stmt, i, bytes.data(), static_cast<int>(bytes.size()), SQLITE_TRANSIENT);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to bind uuid value: " + SqliteErrorToMessage(rc));
+	}
+}
+
+/** StreamCursor */
+
+void Sqlite::StreamCursor::Open(const std::filesystem::path& dbPath, const SqliteOptions& options)
+{
+	sqlite3* rawDb = nullptr;
+	int rc = sqlite3_open_v2(dbPath.string().c_str(), &rawDb, SQLITE_OPEN_READONLY, nullptr);
+	db = UniqueSqlite3(rawDb);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to open stream connection: " + SqliteErrorToMessage(rc));
+	}
+	ApplyConnectionOptions(db, options, false);
+}
+
+void Sqlite::StreamCursor::Release()
+{
+	stmt.reset();
+	db = UniqueSqlite3(nullptr);
+}
+
+/** StreamCursorGuard */
+
+Sqlite::StreamCursorGuard::StreamCursorGuard(
+	Common::WorkerThread& workerThread, std::shared_ptr<StreamCursor> cursor, size_t& activeStreams)
+	: _workerThread(workerThread), _cursor(std::move(cursor)), _activeStreams(activeStreams)
+{
+	_activeStreams++;
+}
+
+Sqlite::StreamCursorGuard::~StreamCursorGuard()
+{
+	_activeStreams--;
+	if (_done)
+	{
+		return;
+	}
+	try
+	{
+		/** Queued after the batch that may still be stepping */
+		_workerThread.ExecTaskAsync([cursor = _cursor]() {
+			cursor->Release();
+		});
+	}
+	catch(...)
+	{
+		/** The worker thread is closed, nothing is stepping */
+		_cursor->Release();
+	}
+}
+
+void Sqlite::StreamCursorGuard::SetDone()
+{
+	_done = true;
+}
+
+/** WriteBarrier */
+
+void Sqlite::WriteBarrier::Hold()
+{
+	std::unique_lock lock{_mutex};
+	_holds++;
+	_condition.notify_all();
+	_condition.wait(lock, [this]() { return _released; });
+}
+
+bool Sqlite::WriteBarrier::WaitForHolds(size_t count, std::chrono::milliseconds timeout)
+{
+	std::unique_lock lock{_mutex};
+	return _condition.wait_for(lock, timeout, [this, count]() { return _holds >= count; });
+}
+
+void Sqlite::WriteBarrier::Release()
+{
+	std::lock_guard lock{_mutex};
+	_released = true;
+	_condition.notify_all();
+}
+
+/** BackupState */
+
+Sqlite::BackupState::~BackupState()
+{
+	if (backup)
+	{
+		sqlite3_backup_finish(backup);
+		backup = nullptr;
+	}
+	dest = UniqueSqlite3(nullptr);
+	source = UniqueSqlite3(nullptr);
+	if (!completed && !tempPath.empty())
+	{
+		std::error_code ec{};
+		std::filesystem::remove(tempPath, ec);
+	}
+}
+
+void Sqlite::BackupState::TakeSnapshot(const std::filesystem::path& dbPath)
+{
+	sqlite3* db = nullptr;
+	int rc = sqlite3_open_v2(dbPath.string().c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+	source = UniqueSqlite3(db);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to open backup source: " + SqliteErrorToMessage(rc));
+	}
+	/** Pin a read snapshot, so writes on the other connections do not restart the backup */
+	rc = sqlite3_exec(source, "BEGIN; SELECT COUNT(*) FROM sqlite_schema;", nullptr, nullptr, nullptr);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to begin backup snapshot: " + SqliteErrorToMessage(rc));
+	}
+}
+
+void Sqlite::BackupState::Begin()
+{
+	/** Left over by a failed backup */
+	std::error_code ec{};
+	std::filesystem::remove(tempPath, ec);
+	sqlite3* db = nullptr;
+	int rc = sqlite3_open_v2(tempPath.string().c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+	dest = UniqueSqlite3(db);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to open backup destination: " + SqliteErrorToMessage(rc));
+	}
+	backup = sqlite3_backup_init(dest, "main", source, "main");
+	if (!backup)
+	{
+		throw std::runtime_error("Failed to start backup: " + std::string(sqlite3_errmsg(dest)));
+	}
+}
+
+bool Sqlite::BackupState::Step(int pages, BackupProgress& progress)
+{
+	int rc = sqlite3_backup_step(backup, pages);
+	progress.remainingPages = sqlite3_backup_remaining(backup);
+	progress.pageCount = sqlite3_backup_pagecount(backup);
+	switch (rc)
+	{
+	case SQLITE_DONE:
+		return true;
+	case SQLITE_OK:
+	/** Retried in the next step */
+	case SQLITE_BUSY:
+	case SQLITE_LOCKED:
+		return false;
+	default:
+		throw std::runtime_error("Backup failed: " + SqliteErrorToMessage(rc));
+	}
+}
+
+void Sqlite::BackupState::Finish(const std::filesystem::path& destPath)
+{
+	int rc = sqlite3_backup_finish(backup);
+	backup = nullptr;
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to finish backup: " + SqliteErrorToMessage(rc));
+	}
+	dest = UniqueSqlite3(nullptr);
+	source = UniqueSqlite3(nullptr);
+	std::filesystem::rename(tempPath, destPath);
+	completed = true;
+}
+
 /** Sqlite */
 
 
-Sqlite::Sqlite(Tev &tev)
-	: _tev(tev), _workerThread(tev)
+Sqlite::Sqlite(Tev &tev, SqliteOptions options)
+	: _tev(tev), _options(options), _workerThread(tev)
+{
+	if (_options.maxWriteBatchSize == 0)
+	{
+		_options.maxWriteBatchSize = 1;
+	}
+}
+
+Sqlite::~Sqlite()
+{
+	_closed = true;
+	_writeBatchTimeout.Clear();
+	_checkpointTimeout.Clear();
+	/** Fails the running backup. Nothing of the backup touches this afterwards. */
+	_backupThread.reset();
+	/** This settles the running batch */
+	_workerThread.Close();
+	auto pendingWrites = std::move(_pendingWrites);
+	_pendingWrites.clear();
+	for (auto& task : pendingWrites)
+	{
+		task.settle(std::make_exception_ptr(std::runtime_error("Sqlite closed")));
+	}
+}
+
+Sqlite::StatementCacheStats Sqlite::GetStatementCacheStats() const
+{
+	return _stmtCache.GetStats();
+}
+
+Sqlite::StatementCacheStats Sqlite::GetAsyncStatementCacheStats() const
+{
+	return _stmtCacheAsync.GetStats();
+}
+
+Sqlite::StatementCacheStats Sqlite::GetReadStatementCacheStats() const
+{
+	StatementCacheStats stats{};
+	for (const auto& connection : _readConnections)
+	{
+		auto connectionStats = connection->stmtCache.GetStats();
+		stats.hits += connectionStats.hits;
+		stats.misses += connectionStats.misses;
+	}
+	return stats;
+}
+
+Sqlite::WriteBatchStats Sqlite::GetWriteBatchStats() const
+{
+	return _writeBatchStats;
+}
+
+Sqlite::CheckpointStats Sqlite::GetCheckpointStats() const
+{
+	auto stats = _checkpointStats;
+	stats.walFrames = _walFrames.load(std::memory_order_relaxed);
+	stats.checkpointedWalFrames = _checkpointedWalFrames.load(std::memory_order_relaxed);
+	stats.walSize = GetWalSize();
+	return stats;
+}
+
+std::optional<Sqlite::BackupProgress> Sqlite::GetBackupProgress() const
+{
+	return _backupProgress;
+}
+
+const std::filesystem::path& Sqlite::GetPath() const
+{
+	return _dbPath;
+}
+
+JS::Promise<void> Sqlite::BackupAsync(
+	std::filesystem::path destPath, SqliteBackupOptions options, std::function<void(BackupProgress)> onProgress)
+{
+	return BackupAllAsync({BackupTarget{this, std::move(destPath)}}, options, std::move(onProgress));
+}
+
+JS::Promise<void> Sqlite::BackupAllAsync(
+	std::vector<BackupTarget> targets, SqliteBackupOptions options, std::function<void(BackupProgress)> onProgress)
+{
+	if (targets.empty())
+	{
+		co_return;
+	}
+	for (const auto& target : targets)
+	{
+		if (target.sqlite->_backupProgress.has_value())
+		{
+			throw std::runtime_error("Backup already running");
+		}
+		if (target.sqlite->_closed)
+		{
+			throw std::runtime_error("Sqlite closed");
+		}
+	}
+	std::vector<std::shared_ptr<BackupState>> states{};
+	std::vector<std::filesystem::path> dbPaths{};
+	for (const auto& target : targets)
+	{
+		if (!target.sqlite->_backupThread)
+		{
+			target.sqlite->_backupThread = std::make_unique<Common::WorkerThread>(target.sqlite->_tev);
+		}
+		target.sqlite->_backupProgress = BackupProgress{};
+		auto state = std::make_shared<BackupState>();
+		state->tempPath = target.destPath;
+		state->tempPath += ".tmp";
+		states.push_back(std::move(state));
+		dbPaths.push_back(target.sqlite->_dbPath);
+	}
+	auto resetProgress = [&targets]() {
+		for (const auto& target : targets)
+		{
+			target.sqlite->_backupProgress.reset();
+		}
+	};
+	/** Hold every writer thread between its batches, so no write commits between the snapshots */
+	auto barrier = std::make_shared<WriteBarrier>();
+	std::vector<JS::Promise<void>> holds{};
+	auto timeout = std::chrono::milliseconds(targets.front().sqlite->_options.busyTimeoutMs);
+	try
+	{
+		for (const auto& target : targets)
+		{
+			holds.push_back(target.sqlite->_workerThread.ExecTaskAsync([barrier]() {
+				barrier->Hold();
+			}));
+		}
+		co_await targets.front().sqlite->_backupThread->ExecTaskAsync([states, dbPaths, barrier, timeout]() {
+			try
+			{
+				if (!barrier->WaitForHolds(dbPaths.size(), timeout))
+				{
+					throw std::runtime_error("Timed out waiting for the writers");
+				}
+				for (size_t i = 0; i < states.size(); i++)
+				{
+					states[i]->TakeSnapshot(dbPaths[i]);
+				}
+			}
+			catch(...)
+			{
+				barrier->Release();
+				throw;
+			}
+			barrier->Release();
+			for (const auto& state : states)
+			{
+				state->Begin();
+			}
+		});
+		for (auto& hold : holds)
+		{
+			co_await hold;
+		}
+		for (size_t i = 0; i < targets.size(); i++)
+		{
+			co_await targets[i].sqlite->CopyBackupAsync(states[i], targets[i].destPath, options, onProgress);
+			/** Release the snapshot of the copied file */
+			states[i].reset();
+		}
+	}
+	catch(...)
+	{
+		barrier->Release();
+		resetProgress();
+		throw;
+	}
+	resetProgress();
+}
+
+JS::Promise<void> Sqlite::CopyBackupAsync(
+	std::shared_ptr<BackupState> state,
+	std::filesystem::path destPath,
+	SqliteBackupOptions options,
+	std::function<void(BackupProgress)> onProgress)
 {
+	auto pagesPerStep = std::max(options.pagesPerStep, 1);
+	auto stepDelay = std::chrono::milliseconds(options.stepDelayMs);
+	bool done = false;
+	bool first = true;
+	while (!done)
+	{
+		/** The thread is dedicated to backups, so it can just sleep */
+		auto step = _backupThread->ExecTaskAsync([state, pagesPerStep, stepDelay, first]() {
+			if (!first)
+			{
+				std::this_thread::sleep_for(stepDelay);
+			}
+			BackupStep result{};
+			result.done = state->Step(pagesPerStep, result.progress);
+			return result;
+		});
+		auto result = co_await step;
+		first = false;
+		done = result.done;
+		_backupProgress = result.progress;
+		if (onProgress)
+		{
+			onProgress(result.progress);
+		}
+	}
+	co_await _backupThread->ExecTaskAsync([state, destPath]() {
+		state->Finish(destPath);
+	});
+	_backupProgress.reset();
 }
 
-JS::Promise<std::shared_ptr<Sqlite>> Sqlite::CreateAsync(Tev& tev, const std::filesystem::path& dbPath)
+JS::Promise<std::shared_ptr<Sqlite>> Sqlite::CreateAsync(
+	Tev& tev, const std::filesystem::path& dbPath, SqliteOptions options)
 {
-	auto sqlite = std::shared_ptr<Sqlite>(new Sqlite(tev));
+	auto sqlite = std::shared_ptr<Sqlite>(new Sqlite(tev, options));
+	sqlite->_dbPath = dbPath;
 	int rc = 0;
 	sqlite3* db = nullptr;
 	rc = sqlite3_open(dbPath.string().c_str(), &db);
@@ -166,33 +715,435 @@ JS::Promise<std::shared_ptr<Sqlite>> Sqlite::CreateAsync(Tev& tev, const std::fi
 	}
 	/** Set the database to WAL mode */
 	sqlite->Exec("PRAGMA journal_mode=WAL;");
-	/** @todo other settings? */
-	co_await sqlite->_workerThread.ExecTaskAsync([sqlite, dbPath](){
+	ApplyConnectionOptions(sqlite->_db, options, true);
+	if (options.checkpointIdleMs > 0)
+	{
+		/** Writes of this connection are checkpointed by the scheduler too */
+		sqlite3_wal_hook(sqlite->_db, &Sqlite::MainWalHook, sqlite.get());
+	}
+	/**
+	 * Do not capture the shared pointer. The task is released in the worker thread,
+	 * which must not be the last owner.
+	 */
+	auto sqlitePtr = sqlite.get();
+	co_await sqlite->_workerThread.ExecTaskAsync([sqlitePtr, dbPath, options](){
 		/** Open the async connection in the worker thread */
 		int rc = 0;
 		sqlite3* db = nullptr;
 		rc = sqlite3_open(dbPath.string().c_str(), &db);
-		sqlite->_dbAsync = UniqueSqlite3(db);
+		sqlitePtr->_dbAsync = UniqueSqlite3(db);
 		if (rc != SQLITE_OK)
 		{
 			throw std::runtime_error("Failed to open async connection: " + SqliteErrorToMessage(rc));
 		}
+		ApplyConnectionOptions(db, options, true);
+		if (options.checkpointIdleMs > 0)
+		{
+			sqlite3_wal_hook(db, &Sqlite::WalHook, sqlitePtr);
+		}
 	});
+	/** The read connections are opened after WAL is set up by the main connection */
+	for (size_t i = 0; i < options.readConnectionCount; i++)
+	{
+		auto connection = std::make_unique<ReadConnection>(tev);
+		auto connectionPtr = connection.get();
+		sqlite->_readConnections.push_back(std::move(connection));
+		co_await connectionPtr->workerThread.ExecTaskAsync([connectionPtr, dbPath, options](){
+			/** Open the read connection in its own thread */
+			int rc = 0;
+			sqlite3* db = nullptr;
+			rc = sqlite3_open_v2(dbPath.string().c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+			connectionPtr->db = UniqueSqlite3(db);
+			if (rc != SQLITE_OK)
+			{
+				throw std::runtime_error("Failed to open read connection: " + SqliteErrorToMessage(rc));
+			}
+			ApplyConnectionOptions(db, options, false);
+		});
+	}
 	co_return sqlite;
 }
 
+Sqlite::ReadConnection::ReadConnection(Tev& tev)
+	: workerThread(tev)
+{
+}
+
+Sqlite::ReadConnection& Sqlite::GetLeastBusyReadConnection()
+{
+	ReadConnection* leastBusy = _readConnections.front().get();
+	for (const auto& connection : _readConnections)
+	{
+		if (connection->workerThread.GetPendingTaskCount() < leastBusy->workerThread.GetPendingTaskCount())
+		{
+			leastBusy = connection.get();
+		}
+	}
+	return *leastBusy;
+}
+
+JS::AsyncGenerator<Sqlite::ExecResult> Sqlite::QueryStreamInternal(
+	Common::WorkerThread& workerThread, size_t batchSize, std::function<void(StreamCursor&)> open)
+{
+	auto cursor = std::make_shared<StreamCursor>();
+	StreamCursorGuard guard{workerThread, cursor, _activeStreams};
+	bool done = false;
+	while (!done)
+	{
+		auto step = workerThread.ExecTaskAsync([cursor, open, batchSize]() {
+			try
+			{
+				if (!cursor->stmt.has_value())
+				{
+					open(*cursor);
+				}
+				ExecResult rows{GetColumns(*cursor->stmt)};
+				bool finished = StepInternal(*cursor->stmt, rows, batchSize);
+				if (finished)
+				{
+					cursor->Release();
+				}
+				return StreamBatch{std::move(rows), finished};
+			}
+			catch(...)
+			{
+				cursor->Release();
+				throw;
+			}
+		});
+		auto batch = co_await step;
+		done = batch.done;
+		if (done)
+		{
+			guard.SetDone();
+		}
+		if (!batch.rows.empty())
+		{
+			co_yield std::move(batch.rows);
+		}
+	}
+}
+
+void Sqlite::QueueWrite(WriteTask&& task)
+{
+	/** The writer is not idle anymore */
+	_checkpointTimeout.Clear();
+	_pendingWrites.push_back(std::move(task));
+	ScheduleWriteBatch();
+}
+
+void Sqlite::ScheduleWriteBatch()
+{
+	if (_closed || _writeBatchRunning || _pendingWrites.empty())
+	{
+		return;
+	}
+	/** Writes queued while the last batch was running have waited long enough */
+	if (_options.maxWriteDelayMs == 0 || _pendingWrites.size() >= _options.maxWriteBatchSize)
+	{
+		FlushWriteBatchAsync();
+		return;
+	}
+	if (_writeBatchTimeout == nullptr)
+	{
+		_writeBatchTimeout = _tev.SetTimeout([this](){
+			FlushWriteBatchAsync();
+		}, _options.maxWriteDelayMs);
+	}
+}
+
+JS::Promise<void> Sqlite::FlushWriteBatchAsync()
+{
+	_writeBatchTimeout.Clear();
+	auto batchSize = std::min(_pendingWrites.size(), _options.maxWriteBatchSize);
+	auto batch = std::make_shared<std::vector<WriteTask>>(
+		std::make_move_iterator(_pendingWrites.begin()),
+		std::make_move_iterator(_pendingWrites.begin() + batchSize));
+	_pendingWrites.erase(_pendingWrites.begin(), _pendingWrites.begin() + batchSize);
+	_writeBatchRunning = true;
+	_writeBatchStats.batches++;
+	_writeBatchStats.writes += batchSize;
+
+	std::vector<std::exception_ptr> results{};
+	std::exception_ptr batchException{nullptr};
+	try
+	{
+		results = co_await _workerThread.ExecTaskAsync([this, batch](){
+			return RunWriteBatch(*batch);
+		});
+	}
+	catch(...)
+	{
+		batchException = std::current_exception();
+	}
+
+	/**
+	 * Start the next batch before settling this one.
+	 * The callers may release this object in settle. So do not touch this afterwards.
+	 */
+	_writeBatchRunning = false;
+	_walDirty = true;
+	if (IsCheckpointSchedulerEnabled() && !_pendingWrites.empty()
+		&& _walFrames.load(std::memory_order_relaxed) - _checkpointedWalFrames.load(std::memory_order_relaxed)
+			>= _options.maxWalFrames)
+	{
+		/** The writer is too busy to wait for idle. The next batch starts after the checkpoint. */
+		CheckpointAsync(SQLITE_CHECKPOINT_PASSIVE);
+	}
+	else
+	{
+		ScheduleWriteBatch();
+	}
+	ScheduleCheckpoint();
+	for (size_t i = 0; i < batch->size(); i++)
+	{
+		(*batch)[i].settle(batchException ? batchException : results[i]);
+	}
+}
+
+std::vector<std::exception_ptr> Sqlite::RunWriteBatch(std::vector<WriteTask>& batch)
+{
+	std::vector<std::exception_ptr> results(batch.size(), nullptr);
+	/** Always use a transaction even for a single write, as a write may have multiple statements */
+	auto execSimple = [this](const std::string& query) {
+		UniqueStmt stmt(_dbAsync, _stmtCacheAsync, query);
+		ExecInternal(stmt);
+	};
+	try
+	{
+		execSimple("BEGIN;");
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			/** A savepoint per write, so a failed write does not affect the others */
+			execSimple("SAVEPOINT write_task;");
+			try
+			{
+				batch[i].run();
+			}
+			catch(...)
+			{
+				results[i] = std::current_exception();
+				execSimple("ROLLBACK TO write_task;");
+			}
+			execSimple("RELEASE write_task;");
+		}
+		execSimple("COMMIT;");
+	}
+	catch(...)
+	{
+		if (!sqlite3_get_autocommit(_dbAsync))
+		{
+			sqlite3_exec(_dbAsync, "ROLLBACK;", nullptr, nullptr, nullptr);
+		}
+		throw;
+	}
+	return results;
+}
+
+bool Sqlite::IsCheckpointSchedulerEnabled() const
+{
+	return _options.checkpointIdleMs > 0;
+}
+
+void Sqlite::ScheduleCheckpoint()
+{
+	if (_closed || !IsCheckpointSchedulerEnabled() || !_walDirty
+		|| _writeBatchRunning || !_pendingWrites.empty() || _checkpointTimeout != nullptr)
+	{
+		return;
+	}
+	_checkpointTimeout = _tev.SetTimeout([this](){
+		_checkpointTimeout.Clear();
+		if (_writeBatchRunning || !_pendingWrites.empty())
+		{
+			return;
+		}
+		_walDirty = false;
+		/**
+		 * Truncating needs all readers off the WAL, so only do it when the file is worth shrinking.
+		 * A backup or a stream holds its snapshot for long, truncating would only fail meanwhile.
+		 */
+		bool truncate = GetWalSize() >= _options.walTruncateSize
+			&& !_backupProgress.has_value() && _activeStreams == 0;
+		auto mode = truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE;
+		CheckpointAsync(mode);
+	}, _options.checkpointIdleMs);
+}
+
+JS::Promise<void> Sqlite::CheckpointAsync(int mode)
+{
+	_writeBatchRunning = true;
+	std::optional<CheckpointResult> result{std::nullopt};
+	try
+	{
+		result = co_await _workerThread.ExecTaskAsync([this, mode](){
+			return RunCheckpoint(mode);
+		});
+	}
+	catch(...)
+	{
+		/** Retried by the next checkpoint */
+	}
+	_writeBatchRunning = false;
+	if (result.has_value())
+	{
+		_checkpointStats.checkpoints++;
+		if (mode == SQLITE_CHECKPOINT_TRUNCATE && !result->busy)
+		{
+			_checkpointStats.truncates++;
+		}
+		if (result->busy || result->checkpointedFrames < result->logFrames)
+		{
+			_checkpointStats.incomplete++;
+		}
+	}
+	ScheduleWriteBatch();
+}
+
+Sqlite::CheckpointResult Sqlite::RunCheckpoint(int mode)
+{
+	int logFrames = 0;
+	int checkpointedFrames = 0;
+	/** Do not block the writer waiting for the readers, a busy truncate is retried by the next idle checkpoint */
+	if (mode == SQLITE_CHECKPOINT_TRUNCATE)
+	{
+		sqlite3_busy_timeout(_dbAsync, 0);
+	}
+	int rc = sqlite3_wal_checkpoint_v2(_dbAsync, nullptr, mode, &logFrames, &checkpointedFrames);
+	if (mode == SQLITE_CHECKPOINT_TRUNCATE)
+	{
+		sqlite3_busy_timeout(_dbAsync, _options.busyTimeoutMs);
+	}
+	if (rc != SQLITE_OK && rc != SQLITE_BUSY)
+	{
+		throw std::runtime_error("Failed to checkpoint: " + SqliteErrorToMessage(rc));
+	}
+	/** -1 if the checkpoint could not start */
+	if (logFrames >= 0)
+	{
+		_walFrames.store(logFrames, std::memory_order_relaxed);
+		_checkpointedWalFrames.store(logFrames, std::memory_order_relaxed);
+	}
+	return CheckpointResult{rc == SQLITE_BUSY, logFrames, checkpointedFrames};
+}
+
+int64_t Sqlite::GetWalSize() const
+{
+	std::error_code ec{};
+	auto walPath = _dbPath;
+	walPath += "-wal";
+	auto size = std::filesystem::file_size(walPath, ec);
+	return ec ? 0 : static_cast<int64_t>(size);
+}
+
+int Sqlite::WalHook(void* context, sqlite3*, const char*, int frames)
+{
+	auto sqlite = static_cast<Sqlite*>(context);
+	sqlite->SetWalFrames(frames);
+	return SQLITE_OK;
+}
+
+int Sqlite::MainWalHook(void* context, sqlite3*, const char*, int frames)
+{
+	auto sqlite = static_cast<Sqlite*>(context);
+	sqlite->SetWalFrames(frames);
+	sqlite->_walDirty = true;
+	sqlite->ScheduleCheckpoint();
+	return SQLITE_OK;
+}
+
+void Sqlite::SetWalFrames(int frames)
+{
+	/** The WAL restarted from the beginning, all of it is new */
+	if (frames < _checkpointedWalFrames.load(std::memory_order_relaxed))
+	{
+		_checkpointedWalFrames.store(0, std::memory_order_relaxed);
+	}
+	_walFrames.store(frames, std::memory_order_relaxed);
+}
+
+void Sqlite::ApplyConnectionOptions(sqlite3* db, const SqliteOptions& options, bool writable)
+{
+	sqlite3_busy_timeout(db, options.busyTimeoutMs);
+	std::string pragmas =
+		"PRAGMA cache_size = " + std::to_string(-options.cacheSizeKiB) + ";"
+		"PRAGMA mmap_size = " + std::to_string(options.mmapSize) + ";"
+		"PRAGMA temp_store = " + std::string(options.tempStoreMemory ? "MEMORY" : "DEFAULT") + ";";
+	if (writable)
+	{
+		switch (options.synchronous)
+		{
+		case SqliteSynchronous::OFF:
+			pragmas += "PRAGMA synchronous = OFF;";
+			break;
+		case SqliteSynchronous::FULL:
+			pragmas += "PRAGMA synchronous = FULL;";
+			break;
+		case SqliteSynchronous::NORMAL:
+		default:
+			pragmas += "PRAGMA synchronous = NORMAL;";
+			break;
+		}
+		if (options.checkpointIdleMs > 0)
+		{
+			/** Checkpoints are scheduled on the writer thread instead */
+			pragmas += "PRAGMA wal_autocheckpoint = 0;";
+		}
+	}
+	int rc = sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, nullptr);
+	if (rc != SQLITE_OK)
+	{
+		throw std::runtime_error("Failed to apply connection options: " + SqliteErrorToMessage(rc));
+	}
+}
+
+std::string Sqlite::ExceptionToMessage(std::exception_ptr exception)
+{
+	try
+	{
+		std::rethrow_exception(exception);
+	}
+	catch(const std::exception& e)
+	{
+		return e.what();
+	}
+	catch(...)
+	{
+		return "Unknown exception";
+	}
+}
+
 Sqlite::ExecResult Sqlite::ExecInternal(const UniqueStmt& stmt)
 {
-	ExecResult result{};
-	bool finished = false;
-	while(!finished)
+	ExecResult result{GetColumns(stmt)};
+	StepInternal(stmt, result, std::numeric_limits<size_t>::max());
+	return result;
+}
+
+std::vector<std::string> Sqlite::GetColumns(sqlite3_stmt* stmt)
+{
+	int columnCount = sqlite3_column_count(stmt);
+	std::vector<std::string> columns{};
+	columns.reserve(static_cast<size_t>(columnCount));
+	for (int i = 0; i < columnCount; i++)
+	{
+		const char* columnName = sqlite3_column_name(stmt, i);
+		columns.emplace_back(columnName ? columnName : "");
+	}
+	return columns;
+}
+
+bool Sqlite::StepInternal(const UniqueStmt& stmt, ExecResult& result, size_t maxRows)
+{
+	int columnCount = sqlite3_column_count(stmt);
+	auto& values = result._values;
+	for (size_t row = 0; row < maxRows; row++)
 	{
 		int rc = sqlite3_step(stmt);
 		switch (rc)
 		{
 		case SQLITE_DONE:
-			finished = true;
-			break;
+			return true;
 		case SQLITE_BUSY:
 			throw std::runtime_error("Database busy");
 		    break;
@@ -200,65 +1151,53 @@ Sqlite::ExecResult Sqlite::ExecInternal(const UniqueStmt& stmt)
 			throw std::runtime_error("Database misuse");
 			break;
 		case SQLITE_ROW:{
-			int columnCount = sqlite3_column_count(stmt);
-			std::unordered_map<std::string, Value> row;
 			for (int i = 0; i < columnCount; i++)
 			{
-				std::string columnName{sqlite3_column_name(stmt, i)};
 				int columnType = sqlite3_column_type(stmt, i);
-				std::optional<Value> value{std::nullopt};
 				switch(columnType)
 				{
-				case SQLITE_NULL:
-					value = nullptr;
-					break;
 				case SQLITE_INTEGER:
-					value = static_cast<int64_t>(sqlite3_column_int64(stmt, i));
+					values.emplace_back(static_cast<int64_t>(sqlite3_column_int64(stmt, i)));
 					break;
 				case SQLITE_FLOAT:
-					value = sqlite3_column_double(stmt, i);
+					values.emplace_back(sqlite3_column_double(stmt, i));
 					break;
 				case SQLITE_TEXT:{
 					const unsigned char* text = sqlite3_column_text(stmt, i);
 					if (!text)
 					{
-						value = nullptr;
+						values.emplace_back(nullptr);
 						break;
 					}
 					/** This does not include the \0 */
 					int textSize = sqlite3_column_bytes(stmt, i);
-					value = std::string(reinterpret_cast<const char*>(text), textSize);			
+					values.emplace_back(std::in_place_type<std::string>, reinterpret_cast<const char*>(text), textSize);
 				} break;
 				case SQLITE_BLOB:{
 					const void* blob = sqlite3_column_blob(stmt, i);
 					if (!blob)
 					{
-						value = nullptr;
+						values.emplace_back(nullptr);
 						break;
 					}
 					int blobSize = sqlite3_column_bytes(stmt, i);
-					value = std::vector<uint8_t>(static_cast<const uint8_t*>(blob), static_cast<const uint8_t*>(blob) + blobSize);
+					values.emplace_back(
+						std::in_place_type<std::vector<uint8_t>>,
+						static_cast<const uint8_t*>(blob), static_cast<const uint8_t*>(blob) + blobSize);
 				} break;
+				case SQLITE_NULL:
 				default:
+					values.emplace_back(nullptr);
 					break;
 				}
-				if (!value.has_value())
-				{
-					row.emplace(columnName, std::move(Value(nullptr)));
-				}
-				else
-				{
-					row.emplace(columnName, std::move(value.value()));
-				}
 			}
-			result.push_back(std::move(row));
 		} break;
 		default:
 			throw std::runtime_error("Database error: " + SqliteErrorToMessage(rc));
 			break;
 		}
 	}
-	return result;
+	return false;
 }
 
 std::string Sqlite::SqliteErrorToMessage(int rc)
@@ -1,19 +1,88 @@
 #pragma once
 
+#include <algorithm>
 #include <filesystem>
 #include <string>
 #include <vector>
 #include <list>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <variant>
-#include <unordered_map>
+#include <optional>
+#include <iterator>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <type_traits>
 #include <js-style-co-routine/Promise.h>
+#include <js-style-co-routine/AsyncGenerator.h>
 #include <tev-cpp/Tev.h>
 #include <sqlite3.h>
 #include "common/UniqueTypes.h"
+#include "common/Uuid.h"
 #include "common/WorkerThread.h"
+#include "common/Cache.h"
 
 namespace TUI::Database
 {
+    enum class SqliteSynchronous
+    {
+        OFF,
+        /** Durable in WAL mode, except for the last commits on a power loss. */
+        NORMAL,
+        FULL
+    };
+
+    struct SqliteOptions
+    {
+        /**
+         * Size of the read connection pool used by ExecReadAsync.
+         * If this is 0, ExecReadAsync will fall back to the write connection.
+         */
+        size_t readConnectionCount{2};
+        /** Max number of queued writes committed in one transaction. */
+        size_t maxWriteBatchSize{64};
+        /**
+         * Max time in ms a write waits for more writes to join its transaction.
+         * With 0, writes are only grouped while the previous transaction is running.
+         */
+        uint64_t maxWriteDelayMs{0};
+
+        /** Performance profile, applied to every connection. */
+        SqliteSynchronous synchronous{SqliteSynchronous::NORMAL};
+        /** Page cache size per connection in KiB. */
+        int64_t cacheSizeKiB{16 * 1024};
+        /** Bytes of the database file memory mapped per connection. 0 disables mmap. */
+        int64_t mmapSize{256 * 1024 * 1024};
+        /** Keep temporary tables and indices in memory. */
+        bool tempStoreMemory{true};
+        /** Time a connection waits for a lock before failing with busy. */
+        int busyTimeoutMs{5000};
+
+        /**
+         * Time in ms the writer must be idle before the WAL is checkpointed.
+         * 0 disables the scheduler and leaves checkpoints to the sqlite autocheckpoint.
+         */
+        uint64_t checkpointIdleMs{100};
+        /**
+         * WAL pages written since the last checkpoint that force a PASSIVE checkpoint between write batches,
+         * even if the writer is busy.
+         */
+        int maxWalFrames{4000};
+        /** WAL file size in bytes above which an idle checkpoint also truncates the file. */
+        int64_t walTruncateSize{64 * 1024 * 1024};
+    };
+
+    struct SqliteBackupOptions
+    {
+        /** Pages copied per step. The source is only locked during a step. */
+        int pagesPerStep{256};
+        /** Pause between steps, so the backup does not starve the live traffic. */
+        uint64_t stepDelayMs{10};
+    };
+
     /**
      * Design decisions:
      * 
@@ -22,40 +91,395 @@ namespace TUI::Database
      * The async interface is intended for writes, while the sync interface is intended for reads.
      * This avoids writes from blocking reads in WAL mode.
      * 
+     * Heavy reads should use the async read interface instead. Which runs on a pool of read only
+     * connections, each in its own thread. So a slow read does not block the main loop or the writes.
+     * 
+     * Async writes are group committed. Writes queued while the writer thread is busy, or within
+     * maxWriteDelayMs, run in one transaction. Each write runs in its own savepoint, so it still
+     * succeeds or fails on its own. Do NOT issue BEGIN/COMMIT with ExecAsync, use TransactionAsync instead.
+     * 
+     * WAL checkpoints replace the sqlite autocheckpoint. They run on the writer thread once it has been idle
+     * for checkpointIdleMs, or between batches when the WAL grows by maxWalFrames since the last checkpoint. So they do not stall
+     * a commit halfway through a burst of writes. A TRUNCATE checkpoint never waits for the readers,
+     * and is skipped while a backup or a stream holds its snapshot.
+     * 
      * More function wrappings should happen in the upper layers.
+     * 
+     * Prepared statements are cached per connection and keyed by the query text.
+     * So queries should bind their parameters instead of formatting them into the query.
      */
     class Sqlite
     {
+    private:
+        class StatementCache;
     public:
         using Value = std::variant<std::nullptr_t, int64_t, double, std::string, std::vector<uint8_t>>;
 
-        static JS::Promise<std::shared_ptr<Sqlite>> CreateAsync(Tev& tev, const std::filesystem::path& dbPath);
-        ~Sqlite() = default;
+        static JS::Promise<std::shared_ptr<Sqlite>> CreateAsync(
+            Tev& tev, const std::filesystem::path& dbPath, SqliteOptions options = {});
+        ~Sqlite();
 
         Sqlite(const Sqlite&) = delete;
         Sqlite& operator=(const Sqlite&) = delete;
         Sqlite(Sqlite&&) noexcept = delete;
         Sqlite& operator=(Sqlite&&) noexcept = delete;
 
-        using ExecResult = std::list<std::unordered_map<std::string, Value>>;
+        /**
+         * @brief Result of a query.
+         * The column names are stored once. The values are stored row by row in one vector
+         * and addressed by column index, in the order of the select list.
+         */
+        class ExecResult
+        {
+        public:
+            class Row
+            {
+            public:
+                Row(Value* values, size_t columnCount);
+
+                size_t ColumnCount() const;
+                bool IsNull(size_t column) const;
+                const Value& operator[](size_t column) const;
+
+                /**
+                 * @brief Take the value of a column. Strings and blobs are moved out of the result.
+                 * So each column should only be taken once.
+                 * T can be std::optional<U>, which gives std::nullopt for NULL.
+                 * T can be Common::Uuid, which is read from a 16-byte blob.
+                 * 
+                 * @throws std::runtime_error if the value is of a different type.
+                 */
+                template<typename T>
+                T Get(size_t column)
+                {
+                    if constexpr (IsOptional<T>::value)
+                    {
+                        if (IsNull(column))
+                        {
+                            return std::nullopt;
+                        }
+                        return Get<typename T::value_type>(column);
+                    }
+                    else if constexpr (std::is_same_v<T, Common::Uuid>)
+                    {
+                        /** Uuids are stored as 16-byte blobs */
+                        return Common::Uuid{Get<std::vector<uint8_t>>(column)};
+                    }
+                    else
+                    {
+                        auto& value = At(column);
+                        if (!std::holds_alternative<T>(value))
+                        {
+                            throw std::runtime_error("Column type mismatch");
+                        }
+                        return std::move(std::get<T>(value));
+                    }
+                }
+            private:
+                template<typename T>
+                struct IsOptional : std::false_type {};
+                template<typename T>
+                struct IsOptional<std::optional<T>> : std::true_type {};
+
+                Value& At(size_t column) const;
+
+                Value* _values;
+                size_t _columnCount;
+            };
+
+            class Iterator
+            {
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = Row;
+                using difference_type = std::ptrdiff_t;
+
+                Iterator(ExecResult* result, size_t row);
+
+                Row operator*() const;
+                Iterator& operator++();
+                bool operator==(const Iterator& other) const;
+            private:
+                ExecResult* _result;
+                size_t _row;
+            };
+
+            ExecResult() = default;
+            explicit ExecResult(std::vector<std::string> columns);
+
+            const std::vector<std::string>& Columns() const;
+            /** @throws std::runtime_error if the column does not exist. */
+            size_t ColumnIndex(const std::string& name) const;
+
+            size_t size() const;
+            bool empty() const;
+            Row operator[](size_t row);
+            Row front();
+            Iterator begin();
+            Iterator end();
+        private:
+            friend class Sqlite;
+
+            std::vector<std::string> _columns{};
+            std::vector<Value> _values{};
+        };
+
+        /**
+         * @brief Statement executor of TransactionAsync and the read transactions.
+         * Only valid in the transaction callback.
+         */
+        class Transaction
+        {
+        public:
+            template<typename... Args>
+            ExecResult Exec(const std::string& query, Args&&... args)
+            {
+                UniqueStmt stmt(_db, _stmtCache, query, std::forward<Args>(args)...);
+                return _sqlite.ExecInternal(stmt);
+            }
+            /** Rows changed by the last INSERT, UPDATE or DELETE */
+            int64_t Changes() const
+            {
+                return sqlite3_changes64(_db);
+            }
+        private:
+            friend class Sqlite;
+
+            Transaction(Sqlite& sqlite, sqlite3* db, StatementCache& stmtCache)
+                : _sqlite(sqlite), _db(db), _stmtCache(stmtCache) {}
+
+            Sqlite& _sqlite;
+            sqlite3* _db;
+            StatementCache& _stmtCache;
+        };
+
         template<typename... Args>
         JS::Promise<ExecResult> ExecAsync(const std::string& query, Args&&... args)
         {
             /** Use tuple so values are moved/copied efficiently */
             auto tup = std::make_tuple(std::forward<Args>(args)...);
-            return _workerThread.ExecTaskAsync([this, query, tup = std::move(tup)]() -> ExecResult {
+            return TransactionAsync([query, tup = std::move(tup)](Transaction& transaction) mutable {
                 return std::apply([&](auto&&... unpackedArgs) {
-                    UniqueStmt stmt(_dbAsync, query, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
+                    return transaction.Exec(query, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
+                }, std::move(tup));
+            });
+        }
+        /**
+         * @brief Run the callback in the writer thread. All statements executed by the callback
+         * are committed together, or rolled back together if it throws.
+         * The callback may be grouped with other writes, but never sees their partial states.
+         * 
+         * The callback runs in another thread. Do not capture anything owned by the main loop.
+         * 
+         * @tparam Func (Transaction&) -> T
+         * @return JS::Promise<T> The return value of the callback.
+         */
+        template<typename Func>
+        auto TransactionAsync(Func&& callback) -> JS::Promise<std::invoke_result_t<Func&, Transaction&>>
+        {
+            using ReturnType = std::invoke_result_t<Func&, Transaction&>;
+            JS::Promise<ReturnType> promise;
+            if constexpr (std::is_void_v<ReturnType>)
+            {
+                QueueWrite(WriteTask{
+                    [this, callback = std::forward<Func>(callback)]() mutable {
+                        Transaction transaction{*this, _dbAsync, _stmtCacheAsync};
+                        callback(transaction);
+                    },
+                    [promise](std::exception_ptr exception) {
+                        if (exception)
+                        {
+                            promise.Reject(ExceptionToMessage(exception));
+                            return;
+                        }
+                        promise.Resolve();
+                    }
+                });
+            }
+            else
+            {
+                auto result = std::make_shared<std::optional<ReturnType>>(std::nullopt);
+                QueueWrite(WriteTask{
+                    [this, result, callback = std::forward<Func>(callback)]() mutable {
+                        Transaction transaction{*this, _dbAsync, _stmtCacheAsync};
+                        result->emplace(callback(transaction));
+                    },
+                    [result, promise](std::exception_ptr exception) {
+                        if (exception)
+                        {
+                            promise.Reject(ExceptionToMessage(exception));
+                            return;
+                        }
+                        promise.Resolve(std::move(result->value()));
+                    }
+                });
+            }
+            return promise;
+        }
+        /**
+         * @brief Execute a read only query on the least busy read connection.
+         * Writes will fail on the read connections.
+         */
+        template<typename... Args>
+        JS::Promise<ExecResult> ExecReadAsync(const std::string& query, Args&&... args)
+        {
+            if (_readConnections.empty())
+            {
+                return ExecAsync(query, std::forward<Args>(args)...);
+            }
+            auto& connection = GetLeastBusyReadConnection();
+            auto tup = std::make_tuple(std::forward<Args>(args)...);
+            return connection.workerThread.ExecTaskAsync([this, &connection, query, tup = std::move(tup)]() -> ExecResult {
+                return std::apply([&](auto&&... unpackedArgs) {
+                    UniqueStmt stmt(connection.db, connection.stmtCache, query, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
                     return ExecInternal(stmt);
                 }, std::move(tup));
             });
         }
+        /**
+         * @brief Run the callback in one read transaction on the least busy read connection.
+         * All statements executed by the callback see the same snapshot. Writes will fail.
+         * Without read connections, the callback runs as a write transaction instead.
+         *
+         * The callback runs in another thread. Do not capture anything owned by the main loop.
+         *
+         * @tparam Func (Transaction&) -> T
+         * @return JS::Promise<T> The return value of the callback.
+         */
+        template<typename Func>
+        auto ReadTransactionAsync(Func&& callback) -> JS::Promise<std::invoke_result_t<Func&, Transaction&>>
+        {
+            if (_readConnections.empty())
+            {
+                return TransactionAsync(std::forward<Func>(callback));
+            }
+            auto& connection = GetLeastBusyReadConnection();
+            return connection.workerThread.ExecTaskAsync([this, &connection, callback = std::forward<Func>(callback)]() mutable {
+                return RunReadTransaction(connection.db, connection.stmtCache, callback);
+            });
+        }
+        /**
+         * @brief Stream the rows of a read only query, in batches of at most batchSize rows.
+         * Each batch is stepped on a read worker thread when it is pulled, so only one batch is held in memory.
+         * 
+         * The stream has its own connection, so its read snapshot does not leak into other reads.
+         * The snapshot is held until the stream is drained or dropped, which holds back WAL checkpoints.
+         * Without read connections, the batches are stepped on the writer thread, between the write batches.
+         * 
+         * This object MUST outlive the generator.
+         */
+        template<typename... Args>
+        JS::AsyncGenerator<ExecResult> QueryStream(size_t batchSize, const std::string& query, Args&&... args)
+        {
+            auto tup = std::make_tuple(std::forward<Args>(args)...);
+            /** Called in the worker thread */
+            std::function<void(StreamCursor&)> open = [dbPath = _dbPath, options = _options, query, tup = std::move(tup)](StreamCursor& cursor) {
+                cursor.Open(dbPath, options);
+                std::apply([&](const auto&... unpackedArgs) {
+                    cursor.stmt.emplace(StatementCache::Prepare(cursor.db, query, 0), unpackedArgs...);
+                }, tup);
+            };
+            auto& workerThread = _readConnections.empty() ? _workerThread : GetLeastBusyReadConnection().workerThread;
+            return QueryStreamInternal(workerThread, std::max<size_t>(batchSize, 1), std::move(open));
+        }
         template<typename... Args>
         ExecResult Exec(const std::string& query, Args&&... args)
         {
-            UniqueStmt stmt(_db, query, std::forward<Args>(args)...);
+            UniqueStmt stmt(_db, _stmtCache, query, std::forward<Args>(args)...);
             return ExecInternal(stmt);
         }
+        /**
+         * @brief Run the callback in one read transaction on the sync connection.
+         * All statements executed by the callback see the same snapshot.
+         *
+         * @tparam Func (Transaction&) -> T
+         * @return T The return value of the callback.
+         */
+        template<typename Func>
+        auto ReadTransaction(Func&& callback) -> std::invoke_result_t<Func&, Transaction&>
+        {
+            return RunReadTransaction(_db, _stmtCache, callback);
+        }
+
+        struct StatementCacheStats
+        {
+            uint64_t hits{0};
+            uint64_t misses{0};
+        };
+        /** Statement cache stats of the sync connection. */
+        StatementCacheStats GetStatementCacheStats() const;
+        /** Statement cache stats of the async connection. */
+        StatementCacheStats GetAsyncStatementCacheStats() const;
+        /** Statement cache stats summed over all read connections. */
+        StatementCacheStats GetReadStatementCacheStats() const;
+
+        struct WriteBatchStats
+        {
+            /** Number of transactions committed by the writer thread */
+            uint64_t batches{0};
+            uint64_t writes{0};
+        };
+        WriteBatchStats GetWriteBatchStats() const;
+
+        struct CheckpointStats
+        {
+            uint64_t checkpoints{0};
+            uint64_t truncates{0};
+            /** Checkpoints that could not complete because of readers */
+            uint64_t incomplete{0};
+            /** Pages in the WAL after the last commit or checkpoint */
+            int walFrames{0};
+            /** Pages in the WAL when the last checkpoint ran, 0 after the WAL restarts */
+            int checkpointedWalFrames{0};
+            /** Current size of the WAL file in bytes */
+            int64_t walSize{0};
+        };
+        CheckpointStats GetCheckpointStats() const;
+
+        struct BackupProgress
+        {
+            int remainingPages{0};
+            int pageCount{0};
+        };
+        /**
+         * @brief Copy a consistent snapshot of the database to destPath, without blocking reads or writes.
+         * 
+         * The pages are copied in steps on a dedicated thread, from a read snapshot taken when the backup starts.
+         * So writes during the backup do not restart it, but WAL checkpoints are held back until it is done.
+         * The file is written to destPath with a ".tmp" suffix, and renamed when complete.
+         * Only one backup can run at a time.
+         * 
+         * @param onProgress Called in the main loop after each step. Can be nullptr.
+         */
+        JS::Promise<void> BackupAsync(
+            std::filesystem::path destPath,
+            SqliteBackupOptions options = {},
+            std::function<void(BackupProgress)> onProgress = nullptr);
+        struct BackupTarget
+        {
+            /** MUST outlive the backup */
+            Sqlite* sqlite;
+            std::filesystem::path destPath;
+        };
+        /**
+         * @brief Copy snapshots of several databases, all of the same instant.
+         * 
+         * The writer threads of all databases are held between their batches while the snapshots are taken,
+         * so no async write commits in between. Writes queue up meanwhile, which only takes as long as
+         * the running batches and opening the snapshots. Writes of the sync connections are not held.
+         * The files are then copied one by one as in BackupAsync. Each database holds its snapshot,
+         * and its WAL checkpoints, until it is copied.
+         * 
+         * @param onProgress Called in the main loop after each step of each file. Can be nullptr.
+         */
+        static JS::Promise<void> BackupAllAsync(
+            std::vector<BackupTarget> targets,
+            SqliteBackupOptions options = {},
+            std::function<void(BackupProgress)> onProgress = nullptr);
+        /** Progress of the running backup, if any. */
+        std::optional<BackupProgress> GetBackupProgress() const;
+
+        const std::filesystem::path& GetPath() const;
 
     private:
         class UniqueSqlite3
@@ -74,18 +498,51 @@ namespace TUI::Database
             sqlite3* _db{nullptr};
         };
 
+        /**
+         * @brief LRU cache of prepared statements for a single connection.
+         * Not thread-safe except for the stats. Each connection should have its own cache.
+         */
+        class StatementCache
+        {
+        public:
+            explicit StatementCache(size_t maxSize);
+            ~StatementCache() = default;
+
+            StatementCache(const StatementCache&) = delete;
+            StatementCache& operator=(const StatementCache&) = delete;
+            StatementCache(StatementCache&&) noexcept = delete;
+            StatementCache& operator=(StatementCache&&) noexcept = delete;
+
+            /**
+             * @brief Get the cached statement for the query or prepare a new one.
+             * An evicted statement stays valid until the last reference is released.
+             */
+            std::shared_ptr<sqlite3_stmt> Acquire(sqlite3* db, const std::string& query);
+            StatementCacheStats GetStats() const;
+
+            /** @param flags SQLITE_PREPARE_* flags */
+            static std::shared_ptr<sqlite3_stmt> Prepare(sqlite3* db, const std::string& query, unsigned int flags);
+        private:
+            Common::Cache<std::string, std::shared_ptr<sqlite3_stmt>> _cache;
+            std::atomic<uint64_t> _hits{0};
+            std::atomic<uint64_t> _misses{0};
+        };
+
         class UniqueStmt
         {
         public:
             template<typename... Args>
-            UniqueStmt(sqlite3* db, const std::string& query, Args&&... args)
+            UniqueStmt(sqlite3* db, StatementCache& cache, const std::string& query, Args&&... args)
+                : _stmt(cache.Acquire(db, query))
+            {
+                int i = 1;
+                (BindValue(i++, std::forward<Args>(args)), ...);
+            }
+            /** For a statement outside the cache */
+            template<typename... Args>
+            UniqueStmt(std::shared_ptr<sqlite3_stmt> stmt, Args&&... args)
+                : _stmt(std::move(stmt))
             {
-                sqlite3_stmt* stmt = nullptr;
-                if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-                {
-                    throw std::runtime_error("Failed to prepare statement: " + std::string(sqlite3_errmsg(db)));
-                }
-                _stmt = UniqueStmtInternal(stmt);
                 int i = 1;
                 (BindValue(i++, std::forward<Args>(args)), ...);
             }
@@ -98,19 +555,26 @@ namespace TUI::Database
 
             operator sqlite3_stmt*() const;
         private:
-            class UniqueStmtInternal
+            /**
+             * @brief Holds a cached statement for one execution.
+             * Resets the statement and clears the bindings on release, so it can be reused
+             * and never points to the released bound values.
+             */
+            class StmtLease
             {
             public:
-                explicit UniqueStmtInternal(sqlite3_stmt* stmt);
-                ~UniqueStmtInternal();
-                UniqueStmtInternal(const UniqueStmtInternal&) = delete;
-                UniqueStmtInternal& operator=(const UniqueStmtInternal&) = delete;
-                UniqueStmtInternal(UniqueStmtInternal&& other) noexcept;
-                UniqueStmtInternal& operator=(UniqueStmtInternal&& other) noexcept;
+                explicit StmtLease(std::shared_ptr<sqlite3_stmt> stmt);
+                ~StmtLease();
+                StmtLease(const StmtLease&) = delete;
+                StmtLease& operator=(const StmtLease&) = delete;
+                StmtLease(StmtLease&& other) noexcept;
+                StmtLease& operator=(StmtLease&& other) noexcept;
 
                 operator sqlite3_stmt*() const;
             private:
-                sqlite3_stmt* _stmt{nullptr};
+                void Release();
+
+                std::shared_ptr<sqlite3_stmt> _stmt{nullptr};
             };
 
             void BindValue(int i, std::string&& value);
@@ -120,22 +584,247 @@ namespace TUI::Database
             void BindValue(int i, int64_t value);
             void BindValue(int i, double value);
             void BindValue(int i, std::nullptr_t);
+            /** Bound as a 16-byte blob */
+            void BindValue(int i, const Common::Uuid& value);
 
             std::list<std::string> _bondStrings{};
             std::list<std::vector<uint8_t>> _bondBlobs{};
             /** Put this last so it is destructed first */
-            UniqueStmtInternal _stmt{nullptr};
+            StmtLease _stmt;
+        };
+
+        static constexpr size_t STATEMENT_CACHE_SIZE = 64;
+
+        struct ReadConnection
+        {
+            explicit ReadConnection(Tev& tev);
+
+            UniqueSqlite3 db{nullptr};
+            /** The cache MUST be destructed before the connection. */
+            StatementCache stmtCache{STATEMENT_CACHE_SIZE};
+            /** Only access the connection in this thread. */
+            Common::WorkerThread workerThread;
+        };
+
+        /**
+         * @brief A queued async write.
+         * run is called in the writer thread inside the batch transaction.
+         * settle is called in the main loop after the batch is done, with the exception of run if any.
+         */
+        struct WriteTask
+        {
+            std::function<void()> run;
+            std::function<void(std::exception_ptr)> settle;
+        };
+
+        /**
+         * @brief State of a QueryStream. Only touched in its worker thread,
+         * except for the release on close.
+         */
+        struct StreamCursor
+        {
+            void Open(const std::filesystem::path& dbPath, const SqliteOptions& options);
+            void Release();
+
+            UniqueSqlite3 db{nullptr};
+            /** Put this after db so it is destructed first */
+            std::optional<UniqueStmt> stmt{std::nullopt};
+        };
+        struct StreamBatch
+        {
+            ExecResult rows;
+            bool done;
+        };
+        /**
+         * @brief Releases the cursor of a dropped stream in its worker thread,
+         * after the batch that may still be stepping.
+         */
+        class StreamCursorGuard
+        {
+        public:
+            StreamCursorGuard(Common::WorkerThread& workerThread, std::shared_ptr<StreamCursor> cursor, size_t& activeStreams);
+            ~StreamCursorGuard();
+
+            StreamCursorGuard(const StreamCursorGuard&) = delete;
+            StreamCursorGuard& operator=(const StreamCursorGuard&) = delete;
+            StreamCursorGuard(StreamCursorGuard&&) noexcept = delete;
+            StreamCursorGuard& operator=(StreamCursorGuard&&) noexcept = delete;
+
+            void SetDone();
+        private:
+            Common::WorkerThread& _workerThread;
+            std::shared_ptr<StreamCursor> _cursor;
+            size_t& _activeStreams;
+            bool _done{false};
+        };
+
+        /**
+         * @brief Holds the writer threads of several databases between their batches.
+         * Hold is run as a task in each writer thread, the backup thread waits for all of them.
+         */
+        class WriteBarrier
+        {
+        public:
+            /** Called in a writer thread. Blocks until released, which the backup always does. */
+            void Hold();
+            /** @return false if not all writer threads are held in time */
+            bool WaitForHolds(size_t count, std::chrono::milliseconds timeout);
+            void Release();
+        private:
+            std::mutex _mutex{};
+            std::condition_variable _condition{};
+            size_t _holds{0};
+            bool _released{false};
+        };
+        /** State of a backup. Only touched in the backup thread. */
+        struct BackupState
+        {
+            BackupState() = default;
+            /** Removes the temporary file if the backup is not complete */
+            ~BackupState();
+
+            BackupState(const BackupState&) = delete;
+            BackupState& operator=(const BackupState&) = delete;
+            BackupState(BackupState&&) noexcept = delete;
+            BackupState& operator=(BackupState&&) noexcept = delete;
+
+            /** Open the source and pin its read snapshot */
+            void TakeSnapshot(const std::filesystem::path& dbPath);
+            /** Open the destination, after TakeSnapshot */
+            void Begin();
+            /** @return true if all pages are copied. */
+            bool Step(int pages, BackupProgress& progress);
+            void Finish(const std::filesystem::path& destPath);
+
+            std::filesystem::path tempPath{};
+            UniqueSqlite3 source{nullptr};
+            UniqueSqlite3 dest{nullptr};
+            sqlite3_backup* backup{nullptr};
+            bool completed{false};
+        };
+        struct BackupStep
+        {
+            BackupProgress progress;
+            bool done;
+        };
+        struct CheckpointResult
+        {
+            bool busy;
+            int logFrames;
+            int checkpointedFrames;
         };
 
         static std::string SqliteErrorToMessage(int rc);
+        static std::string ExceptionToMessage(std::exception_ptr exception);
+
+        Sqlite(Tev& tev, SqliteOptions options);
+
+        /** @param writable Also set the options for the connections that commit. */
+        static void ApplyConnectionOptions(sqlite3* db, const SqliteOptions& options, bool writable);
+        /** Called in the writer thread after each commit. Replaces the autocheckpoint. */
+        static int WalHook(void* context, sqlite3* db, const char* dbName, int frames);
+        /** Called in the main loop after each commit of the sync connection */
+        static int MainWalHook(void* context, sqlite3* db, const char* dbName, int frames);
+        /** Called by the WAL hooks */
+        void SetWalFrames(int frames);
 
-        Sqlite(Tev& tev);
+        void QueueWrite(WriteTask&& task);
+        void ScheduleWriteBatch();
+        JS::Promise<void> FlushWriteBatchAsync();
+        /** Called in the writer thread */
+        std::vector<std::exception_ptr> RunWriteBatch(std::vector<WriteTask>& batch);
+
+        bool IsCheckpointSchedulerEnabled() const;
+        /** Arm the idle checkpoint if the writer is idle and the WAL has new pages */
+        void ScheduleCheckpoint();
+        /** Runs in place of a write batch, so writes queue up meanwhile */
+        JS::Promise<void> CheckpointAsync(int mode);
+        /** Called in the writer thread */
+        CheckpointResult RunCheckpoint(int mode);
+        /** Copy the snapshot of a begun backup state */
+        JS::Promise<void> CopyBackupAsync(
+            std::shared_ptr<BackupState> state,
+            std::filesystem::path destPath,
+            SqliteBackupOptions options,
+            std::function<void(BackupProgress)> onProgress);
+        int64_t GetWalSize() const;
+
+        ReadConnection& GetLeastBusyReadConnection();
+
+        /** The cursor has its own connection, so it can be stepped on any worker thread */
+        JS::AsyncGenerator<ExecResult> QueryStreamInternal(
+            Common::WorkerThread& workerThread, size_t batchSize, std::function<void(StreamCursor&)> open);
 
         ExecResult ExecInternal(const UniqueStmt& stmt);
+        /** Called in the thread of the connection */
+        template<typename Func>
+        auto RunReadTransaction(sqlite3* db, StatementCache& stmtCache, Func& callback)
+            -> std::invoke_result_t<Func&, Transaction&>
+        {
+            Transaction transaction{*this, db, stmtCache};
+            /** Deferred, the snapshot starts with the first read */
+            transaction.Exec("BEGIN;");
+            try
+            {
+                if constexpr (std::is_void_v<std::invoke_result_t<Func&, Transaction&>>)
+                {
+                    callback(transaction);
+                    transaction.Exec("COMMIT;");
+                }
+                else
+                {
+                    auto result = callback(transaction);
+                    transaction.Exec("COMMIT;");
+                    return result;
+                }
+            }
+            catch(...)
+            {
+                if (!sqlite3_get_autocommit(db))
+                {
+                    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                }
+                throw;
+            }
+        }
+        static std::vector<std::string> GetColumns(sqlite3_stmt* stmt);
+        /**
+         * @brief Step the statement and append at most maxRows rows to the result.
+         * @return true if the statement is done.
+         */
+        static bool StepInternal(const UniqueStmt& stmt, ExecResult& result, size_t maxRows);
 
         Tev& _tev;
+        SqliteOptions _options;
+        std::filesystem::path _dbPath{};
         UniqueSqlite3 _db{nullptr};
         UniqueSqlite3 _dbAsync{nullptr};
+        /** The caches MUST be destructed before the connections. */
+        StatementCache _stmtCache{STATEMENT_CACHE_SIZE};
+        StatementCache _stmtCacheAsync{STATEMENT_CACHE_SIZE};
+        /** The write batch states MUST outlive the worker thread, which settles the running batch on close. */
+        std::vector<WriteTask> _pendingWrites{};
+        bool _writeBatchRunning{false};
+        bool _closed{false};
+        Tev::Timeout _writeBatchTimeout{};
+        WriteBatchStats _writeBatchStats{};
+        Tev::Timeout _checkpointTimeout{};
+        /** Whether the WAL got new pages since the last idle checkpoint */
+        bool _walDirty{false};
+        /** Written by the writer thread */
+        std::atomic<int> _walFrames{0};
+        /**
+         * _walFrames when the last checkpoint ran. Only the frames after it force a checkpoint,
+         * a reader may keep the older ones in the WAL through any number of checkpoints.
+         */
+        std::atomic<int> _checkpointedWalFrames{0};
+        CheckpointStats _checkpointStats{};
         Common::WorkerThread _workerThread;
+        std::vector<std::unique_ptr<ReadConnection>> _readConnections{};
+        /** Started by the first backup */
+        std::unique_ptr<Common::WorkerThread> _backupThread{nullptr};
+        std::optional<BackupProgress> _backupProgress{std::nullopt};
+        /** Open QueryStreams, each pins a read snapshot */
+        size_t _activeStreams{0};
     };
 }
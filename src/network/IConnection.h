@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <js-style-co-routine/Promise.h>
+#include "OutboundBuffer.h"
 
 namespace TUI::Network
 {
@@ -19,7 +20,7 @@ namespace TUI::Network
 
         virtual void Close() = 0;
         virtual bool IsClosed() const noexcept = 0;
-        virtual void Send(std::vector<std::uint8_t> message) = 0;
+        virtual void Send(OutboundBuffer message) = 0;
         virtual JS::Promise<std::optional<std::vector<std::uint8_t>>> ReceiveAsync() = 0;
         virtual Identity GetId() const = 0;
     };
@@ -37,7 +38,7 @@ namespace TUI::Network
         IConnection& operator=(IConnection&&) = delete;
 
         virtual void Close() = 0;
-        virtual void Send(std::vector<std::uint8_t> message) = 0;
+        virtual void Send(OutboundBuffer message) = 0;
         virtual JS::Promise<std::optional<std::vector<std::uint8_t>>> ReceiveAsync() = 0;
         virtual bool IsClosed() const noexcept = 0;
     };
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace TUI::Network
+{
+    /**
+     * @brief An outbound message with room before and after the payload.
+     * The layers below add their headers and trailers in place, instead of copying the payload.
+     * A buffer made from a vector has no room, and is copied once by the first layer that needs it.
+     */
+    class OutboundBuffer
+    {
+    public:
+        /** For the transport, LWS_PRE */
+        static constexpr size_t TRANSPORT_HEADROOM = 32;
+        /** For the session, the nonce */
+        static constexpr size_t SESSION_HEADROOM = 16;
+        static constexpr size_t HEADROOM = TRANSPORT_HEADROOM + SESSION_HEADROOM;
+        /** For the session, the AEAD tag */
+        static constexpr size_t TAILROOM = 16;
+
+        /** An empty payload, with all the room */
+        OutboundBuffer()
+            : _storage(HEADROOM, 0), _offset(HEADROOM)
+        {
+            _storage.reserve(HEADROOM + TAILROOM);
+        }
+
+        /** Takes the vector as the payload, without room */
+        OutboundBuffer(std::vector<std::uint8_t> payload)
+            : _storage(std::move(payload)), _offset(0)
+        {
+        }
+
+        OutboundBuffer(const OutboundBuffer&) = delete;
+        OutboundBuffer& operator=(const OutboundBuffer&) = delete;
+        OutboundBuffer(OutboundBuffer&& other) noexcept
+            : _storage(std::move(other._storage)), _offset(other._offset)
+        {
+            other._storage.clear();
+            other._offset = 0;
+        }
+
+        OutboundBuffer& operator=(OutboundBuffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                _storage = std::move(other._storage);
+                _offset = other._offset;
+                other._storage.clear();
+                other._offset = 0;
+            }
+            return *this;
+        }
+
+        std::uint8_t* Data()
+        {
+            return _storage.data() + _offset;
+        }
+
+        const std::uint8_t* Data() const
+        {
+            return _storage.data() + _offset;
+        }
+
+        size_t Size() const
+        {
+            return _storage.size() - _offset;
+        }
+
+        size_t Headroom() const
+        {
+            return _offset;
+        }
+
+        /**
+         * @brief Append to the payload.
+         * The capacity always keeps TAILROOM spare, so UseTailroom(TAILROOM) does not reallocate.
+         */
+        void Append(const std::uint8_t* data, size_t size)
+        {
+            auto* target = Extend(size);
+            if (size > 0)
+            {
+                std::memcpy(target, data, size);
+            }
+        }
+
+        /**
+         * @brief Grow the payload at the end, keeping TAILROOM spare after it.
+         *
+         * @return The first of the new bytes
+         */
+        std::uint8_t* Extend(size_t size)
+        {
+            return Grow(size, TAILROOM);
+        }
+
+        /**
+         * @brief Grow the payload at the end into the tailroom, for a trailer written last.
+         * Only reallocates if size is more than TAILROOM.
+         *
+         * @return The first of the new bytes
+         */
+        std::uint8_t* UseTailroom(size_t size)
+        {
+            return Grow(size, 0);
+        }
+
+        /**
+         * @brief Grow the payload at the front.
+         * Copies the payload once if there is not enough room, and leaves HEADROOM in front of it.
+         *
+         * @return Data()
+         */
+        std::uint8_t* Prepend(size_t size)
+        {
+            EnsureHeadroom(size);
+            _offset -= size;
+            return Data();
+        }
+
+        void EnsureHeadroom(size_t size)
+        {
+            if (_offset >= size)
+            {
+                return;
+            }
+            auto headroom = std::max(HEADROOM, size);
+            std::vector<std::uint8_t> storage{};
+            storage.reserve(headroom + Size() + TAILROOM);
+            storage.resize(headroom, 0);
+            storage.insert(storage.end(), _storage.begin() + _offset, _storage.end());
+            _storage = std::move(storage);
+            _offset = headroom;
+        }
+
+        /** A copy of the payload */
+        std::vector<std::uint8_t> ToVector() const
+        {
+            return std::vector<std::uint8_t>(_storage.begin() + _offset, _storage.end());
+        }
+
+    private:
+        std::uint8_t* Grow(size_t size, size_t spare)
+        {
+            auto oldSize = _storage.size();
+            auto required = oldSize + size;
+            if (required + spare > _storage.capacity())
+            {
+                _storage.reserve(std::max(_storage.capacity() * 2, required + TAILROOM));
+            }
+            _storage.resize(required);
+            return _storage.data() + oldSize;
+        }
+
+        std::vector<std::uint8_t> _storage;
+        size_t _offset;
+    };
+}
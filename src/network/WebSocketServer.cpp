@@ -1,10 +1,11 @@
 #include "WebSocketServer.h"
-#include <sys/eventfd.h>
 
 using namespace TUI::Common;
 using namespace TUI::Network;
 using namespace TUI::Network::WebSocket;
 
+static_assert(LWS_PRE <= OutboundBuffer::TRANSPORT_HEADROOM, "Not enough headroom for LWS_PRE");
+
 /**
  * Libwebsockets is a pain in the a*s to integrate with a custom event loop.
  * So we just start a new thread to let it do its thing.
@@ -14,8 +15,9 @@ using namespace TUI::Network::WebSocket;
  * Main thread -> lws thread
  * Use lws_cancel_service() to get a LWS_CALLBACK_EVENT_WAIT_CANCELLED callback 
  *     (Great naming. Not actually canceling anything)
+ * Only the first message of a batch cancels the service, the callback takes the whole batch.
  * lws thread -> main thread
- * Use eventfd to notify the event loop.
+ * Use a TevInjectionQueue, which wakes the event loop once per batch too.
  */
 
 /** Connection */
@@ -46,7 +48,7 @@ bool Server::Connection::IsClosed() const noexcept
     return _closed;
 }
 
-void Server::Connection::Send(std::vector<std::uint8_t> message)
+void Server::Connection::Send(OutboundBuffer message)
 {
     auto server = _server.lock();
     if (!server)
@@ -107,19 +109,14 @@ Server::Server(Tev& tev, const std::string& address, int port, bool addressIsUds
 
     _context = std::make_unique<LwsTypes::Context>(info);
 
-    _rxEventFd = Unique::Fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
-    if (_rxEventFd == -1)
-    {
-        throw std::runtime_error("Failed to create eventfd for tx");
-    }
+    _rxQueue = TevInjectionQueue<ITCRxMessage>::Create(
+        _tev, std::bind(&Server::ITCRxCallback, this, std::placeholders::_1));
 
     _lwsThread = std::thread(std::bind(&Server::LwsThreadFunc, this));
     if (!_lwsThread.joinable())
     {
         throw std::runtime_error("Failed to create LWS thread");
     }
-
-    _rxHandler = _tev.SetReadHandler(_rxEventFd, std::bind(&Server::ITCRxCallback, this));
 }
 
 Server::~Server()
@@ -144,20 +141,10 @@ void Server::CloseInternal(bool closedByLws)
         return;
     }
     _closed = true;
-    if (_rxHandler != nullptr)
-    {
-        _rxHandler.Clear();
-    }
-    if (_rxEventFd != -1)
-    {
-        _rxEventFd = Unique::Fd(-1);
-    }
+    _rxQueue->Close();
     if (!closedByLws)
     {
-        SendMessageToLwsThread(
-            ITCType::CLOSE_SERVER,
-            nullptr
-        );
+        SendMessageToLwsThread(ITCCloseServer{});
     }
     if (_lwsThread.joinable())
     {
@@ -184,88 +171,66 @@ void Server::CloseConnection(std::uint64_t id, bool closedByPeer)
     connection->_closed = true;
     if (!closedByPeer)
     {
-        SendMessageToLwsThread(
-            ITCType::DISCONNECT,
-            std::make_unique<ITCDataConnectionId>(id)
-        );
+        SendMessageToLwsThread(ITCDisconnect{id});
     }
     connection->_receiveGenerator.Finish();
 }
 
-void Server::SendMessage(std::uint64_t id, std::vector<std::uint8_t> message)
+void Server::SendMessage(std::uint64_t id, OutboundBuffer message)
 {
     auto item = _connections.find(id);
     if (item == _connections.end())
     {
         return;
     }
-    SendMessageToLwsThread(
-        ITCType::SEND_MESSAGE,
-        std::make_unique<ITCDataMessage>(id, std::move(message))
-    );
+    SendMessageToLwsThread(ITCSendMessage{id, std::move(message)});
 }
 
-void Server::ITCRxCallback()
+void Server::ITCRxCallback(ITCRxMessage&& message)
 {
-    auto self = shared_from_this();
-    /** Read from eventfd to clear the event */
-    eventfd_t value;
-    eventfd_read(_rxEventFd, &value);
-    while (true)
+    /**
+     * Not pinned with shared_from_this. Each branch hands off to the user's code last,
+     * and the queue stops calling this once the server is closed.
+     */
+    if (auto* accepted = std::get_if<ITCConnectionAccepted>(&message))
     {
-        struct ITCMessage msg;
-        {
-            std::lock_guard<std::mutex> lock(_rxMutex);
-            if (_rxQueue.empty())
-            {
-                break;
-            }
-            msg = std::move(_rxQueue.front());
-            _rxQueue.pop_front();
-        }
-        switch (msg.type)
+        auto connection = std::shared_ptr<Connection>(new Connection(accepted->id, shared_from_this()));
+        _connections[accepted->id] = connection;
+        _connectionGenerator.Feed(connection);
+    }
+    else if (auto* disconnected = std::get_if<ITCConnectionDisconnected>(&message))
+    {
+        CloseConnection(disconnected->id, true);
+    }
+    else if (auto* received = std::get_if<ITCMessageReceived>(&message))
+    {
+        auto it = _connections.find(received->id);
+        if (it == _connections.end())
         {
-        case ITCType::CONNECTION_ACCEPTED:{
-            auto data = std::unique_ptr<ITCDataConnectionId>(
-                static_cast<ITCDataConnectionId*>(msg.data.release())
-            );
-            auto connection = std::shared_ptr<Connection>(new Connection(data->id, shared_from_this()));
-            _connections[data->id] = connection;
-            _connectionGenerator.Feed(connection);
-        } break;
-        case ITCType::CONNECTION_DISCONNECTED:{
-            auto data = std::unique_ptr<ITCDataConnectionDisconnected>(
-                static_cast<ITCDataConnectionDisconnected*>(msg.data.release())
-            );
-            CloseConnection(data->id, true);
-        } break;
-        case ITCType::MESSAGE_RECEIVED:{
-            auto data = std::unique_ptr<ITCDataMessage>(
-                static_cast<ITCDataMessage*>(msg.data.release())
-            );
-            auto it = _connections.find(data->id);
-            if (it == _connections.end())
-            {
-                break;
-            }
-            it->second->_receiveGenerator.Feed(std::move(data->message));
-        } break;
-        case ITCType::SERVER_CLOSED: {
-            CloseInternal(true);
-            /** DO NOT handle any more messages */
             return;
-        } break;
-        default:
-            break;
         }
+        it->second->_receiveGenerator.Feed(std::move(received->message));
+    }
+    else if (std::holds_alternative<ITCServerClosed>(message))
+    {
+        /** This closes the queue, so no more messages are handled */
+        CloseInternal(true);
     }
 }
 
-void Server::SendMessageToLwsThread(ITCType type, std::unique_ptr<IITCData> data)
+void Server::SendMessageToLwsThread(ITCTxMessage message)
 {
-    std::lock_guard<std::mutex> lock(_txMutex);
-    _txQueue.push_back(ITCMessage{type, std::move(data)});
-    _context->CancelService();
+    bool signal = false;
+    {
+        std::lock_guard<std::mutex> lock(_txMutex);
+        _txQueue.push_back(std::move(message));
+        signal = !_txSignalPending;
+        _txSignalPending = true;
+    }
+    if (signal)
+    {
+        _context->CancelService();
+    }
 }
 
 /** Danger zone. Functions in another thread */
@@ -279,10 +244,7 @@ void Server::LwsThreadFunc()
     }
     if (rc < 0)
     {
-        SendMessageToMainThread(
-            ITCType::SERVER_CLOSED,
-            nullptr
-        );
+        SendMessageToMainThread(ITCServerClosed{});
     }
 }
 
@@ -311,55 +273,7 @@ extern "C" int Server::LwsCallback(
         {
         case LWS_CALLBACK_EVENT_WAIT_CANCELLED:{
             /** wsi and server exists for this callback. */
-            while (true)
-            {
-                ITCMessage msg;
-                {
-                    std::lock_guard<std::mutex> lock(server->_txMutex);
-                    if (server->_txQueue.empty())
-                    {
-                        break;
-                    }
-                    msg = std::move(server->_txQueue.front());
-                    server->_txQueue.pop_front();
-                }
-                switch (msg.type)
-                {
-                case ITCType::SEND_MESSAGE: {
-                    auto data = std::unique_ptr<ITCDataMessage>(
-                        static_cast<ITCDataMessage*>(msg.data.release())
-                    );
-                    auto it = server->_lwsConnections.find(data->id);
-                    if (it == server->_lwsConnections.end())
-                    {
-                        break;
-                    }
-                    auto& connection = it->second;
-                    connection->txQueue.push(std::move(data->message));
-                    lws_callback_on_writable(connection->wsi);
-                } break;
-                case ITCType::DISCONNECT: {
-                    auto data = std::unique_ptr<ITCDataConnectionId>(
-                        static_cast<ITCDataConnectionId*>(msg.data.release())
-                    );
-                    auto it = server->_lwsConnections.find(data->id);
-                    if (it == server->_lwsConnections.end())
-                    {
-                        /** This is normal if this is a redundant message */
-                        break;
-                    }
-                    auto connection = std::move(it->second);
-                    server->_lwsConnections.erase(it);
-                    lws_close_reason(connection->wsi, LWS_CLOSE_STATUS_NORMAL, nullptr, 0);
-                } break;
-                case ITCType::CLOSE_SERVER: {
-                    /** Signal the server thread to exit */
-                    server->_lwsThreadShouldExit = true;
-                } break;
-                default:
-                    break;
-                }
-            }
+            server->ITCTxCallback();
         } break;
         case LWS_CALLBACK_ESTABLISHED: {
             if (!pId)
@@ -369,10 +283,7 @@ extern "C" int Server::LwsCallback(
             auto connectionId = server->_connectionIdSeed++;
             *pId = connectionId;
             auto connection = std::make_unique<LwsConnection>(connectionId, wsi);
-            server->SendMessageToMainThread(
-                ITCType::CONNECTION_ACCEPTED,
-                std::make_unique<ITCDataConnectionId>(connectionId)
-            );
+            server->SendMessageToMainThread(ITCConnectionAccepted{connectionId});
             server->_lwsConnections[connectionId] = std::move(connection);
         } break;
         case LWS_CALLBACK_CLOSED: {
@@ -385,10 +296,7 @@ extern "C" int Server::LwsCallback(
             if (it != server->_lwsConnections.end())
             {
                 server->_lwsConnections.erase(it);
-                server->SendMessageToMainThread(
-                    ITCType::CONNECTION_DISCONNECTED,
-                    std::make_unique<ITCDataConnectionDisconnected>(connectionId, "Connection closed")
-                );
+                server->SendMessageToMainThread(ITCConnectionDisconnected{connectionId, "Connection closed"});
             }
         } break;
         case LWS_CALLBACK_RECEIVE: {
@@ -403,6 +311,11 @@ extern "C" int Server::LwsCallback(
                 lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL, nullptr, 0);
                 return -1;
             }
+            if (it->second->closing)
+            {
+                /** Closed by the main thread, nobody is listening */
+                break;
+            }
             if (!lws_frame_is_binary(wsi))
             {
                 /** We only support binary messages */
@@ -416,10 +329,7 @@ extern "C" int Server::LwsCallback(
             );
             if (lws_is_final_fragment(wsi))
             {
-                server->SendMessageToMainThread(
-                    ITCType::MESSAGE_RECEIVED,
-                    std::make_unique<ITCDataMessage>(id, std::move(connection->rxBuffer))
-                );
+                server->SendMessageToMainThread(ITCMessageReceived{id, std::move(connection->rxBuffer)});
                 connection->rxBuffer.clear();
             }
         } break;
@@ -438,19 +348,25 @@ extern "C" int Server::LwsCallback(
             {
                 auto message = std::move(it->second->txQueue.front());
                 it->second->txQueue.pop();
-                /** Prepend LWS_PRE bytes to the message */
-                message.insert(message.begin(), LWS_PRE, 0);
+                /** lws writes its header in the LWS_PRE bytes before the payload. Only copies without headroom. */
+                message.EnsureHeadroom(LWS_PRE);
                 /** We only transmit binary data */
                 int written = lws_write(
                     wsi,
-                    message.data() + LWS_PRE,
-                    message.size() - LWS_PRE,
+                    message.Data(),
+                    message.Size(),
                     LWS_WRITE_BINARY);
-                if (written < static_cast<int>(message.size()) - LWS_PRE)
+                if (written < static_cast<int>(message.Size()))
                 {
                     return -1;
                 }
             }
+            if (it->second->closing)
+            {
+                /** The queued messages are sent first. Returning -1 closes the connection. */
+                lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL, nullptr, 0);
+                return -1;
+            }
         } break;
         default:
             break;
@@ -464,12 +380,56 @@ extern "C" int Server::LwsCallback(
     return 0;
 }
 
-void Server::SendMessageToMainThread(ITCType type, std::unique_ptr<IITCData> data)
+void Server::ITCTxCallback()
+{
+    {
+        std::lock_guard<std::mutex> lock(_txMutex);
+        std::swap(_txQueue, _txBatch);
+        _txSignalPending = false;
+    }
+    for (auto& message : _txBatch)
+    {
+        if (auto* send = std::get_if<ITCSendMessage>(&message))
+        {
+            auto it = _lwsConnections.find(send->id);
+            if (it == _lwsConnections.end())
+            {
+                continue;
+            }
+            auto& connection = it->second;
+            connection->txQueue.push(std::move(send->message));
+            lws_callback_on_writable(connection->wsi);
+        }
+        else if (auto* disconnect = std::get_if<ITCDisconnect>(&message))
+        {
+            auto it = _lwsConnections.find(disconnect->id);
+            if (it == _lwsConnections.end())
+            {
+                /** This is normal if this is a redundant message */
+                continue;
+            }
+            /** Closed in the writeable callback, after the queued messages. LWS_CALLBACK_CLOSED removes it. */
+            it->second->closing = true;
+            lws_callback_on_writable(it->second->wsi);
+        }
+        else if (std::holds_alternative<ITCCloseServer>(message))
+        {
+            /** Signal the server thread to exit */
+            _lwsThreadShouldExit = true;
+        }
+    }
+    /** Keep the capacity for the next swap */
+    _txBatch.clear();
+}
+
+void Server::SendMessageToMainThread(ITCRxMessage message)
 {
-    std::lock_guard<std::mutex> lock(_rxMutex);
-    _rxQueue.push_back(ITCMessage{type, std::move(data)});
-    if (_rxEventFd != -1)
+    try
+    {
+        _rxQueue->Inject(std::move(message));
+    }
+    catch(...)
     {
-        eventfd_write(_rxEventFd, 1);
+        /** The main thread is closing the server, nobody is listening */
     }
 }
@@ -3,12 +3,15 @@
 #include <memory>
 #include <unordered_map>
 #include <thread>
-#include <deque>
+#include <mutex>
+#include <queue>
+#include <variant>
+#include <vector>
 #include <js-style-co-routine/Promise.h>
 #include <js-style-co-routine/AsyncGenerator.h>
 #include <tev-cpp/Tev.h>
 #include "LwsTypes.h"
-#include "common/UniqueTypes.h"
+#include "common/TevInjectionQueue.h"
 #include "IConnection.h"
 #include "IServer.h"
 
@@ -32,7 +35,7 @@ namespace TUI::Network::WebSocket
 
         /** DO NOT call these directly. You do not have the id do to so. */
         void CloseConnection(std::uint64_t id, bool closedByPeer = false);
-        void SendMessage(std::uint64_t id, std::vector<std::uint8_t> message);
+        void SendMessage(std::uint64_t id, OutboundBuffer message);
     private:
         /** 1MiB */
         static constexpr size_t LWS_BUFFER_SIZE = 1 * 1024 * 1024; 
@@ -49,7 +52,7 @@ namespace TUI::Network::WebSocket
 
             void Close() override;
             bool IsClosed() const noexcept override;
-            void Send(std::vector<std::uint8_t> message) override;
+            void Send(OutboundBuffer message) override;
             JS::Promise<std::optional<std::vector<std::uint8_t>>> ReceiveAsync() override;
         private:
             Connection(std::uint64_t id, std::shared_ptr<Server> server);
@@ -63,61 +66,55 @@ namespace TUI::Network::WebSocket
         {
             std::uint64_t id;
             struct lws* wsi;
-            std::queue<std::vector<std::uint8_t>> txQueue;
+            std::queue<OutboundBuffer> txQueue;
             std::vector<std::uint8_t> rxBuffer;
+            /** Disconnected by the main thread, closed once txQueue is sent */
+            bool closing{false};
         };
 
-        /** Inter-thread communication messages */
-        enum class ITCType
+        /** Inter-thread communication messages, main thread -> lws thread */
+        struct ITCSendMessage
         {
-            /** For tx */
-            SEND_MESSAGE,
-            DISCONNECT,
-            CLOSE_SERVER,
-            /** For rx */
-            CONNECTION_ACCEPTED,
-            CONNECTION_DISCONNECTED,
-            MESSAGE_RECEIVED,
-            SERVER_CLOSED,
+            std::uint64_t id;
+            OutboundBuffer message;
         };
 
-        struct IITCData
+        struct ITCDisconnect
         {
-            virtual ~IITCData() = default;
+            std::uint64_t id;
         };
 
-        struct ITCDataMessage : public IITCData
+        struct ITCCloseServer
         {
-            explicit ITCDataMessage(std::uint64_t id, std::vector<std::uint8_t> message)
-                : id(id), message(std::move(message))
-            {
-            }
-            uint64_t id;
-            std::vector<std::uint8_t> message;
         };
 
-        struct ITCDataConnectionId : public IITCData
+        using ITCTxMessage = std::variant<ITCSendMessage, ITCDisconnect, ITCCloseServer>;
+
+        /** Inter-thread communication messages, lws thread -> main thread */
+        struct ITCConnectionAccepted
         {
-            explicit ITCDataConnectionId(std::uint64_t id) : id(id) {}
-            uint64_t id;
+            std::uint64_t id;
         };
 
-        struct ITCDataConnectionDisconnected : public IITCData
+        struct ITCConnectionDisconnected
         {
-            explicit ITCDataConnectionDisconnected(std::uint64_t id, std::string reason) 
-                : id(id), reason(std::move(reason))
-            {
-            }
-            uint64_t id;
+            std::uint64_t id;
             std::string reason;
         };
 
-        struct ITCMessage
+        struct ITCMessageReceived
+        {
+            std::uint64_t id;
+            std::vector<std::uint8_t> message;
+        };
+
+        struct ITCServerClosed
         {
-            ITCType type;
-            std::unique_ptr<IITCData> data;
         };
 
+        using ITCRxMessage = std::variant<
+            ITCConnectionAccepted, ITCConnectionDisconnected, ITCMessageReceived, ITCServerClosed>;
+
         Tev& _tev;
         std::vector<struct lws_protocols> _protocols{};         /** lws thread only */
         std::unique_ptr<LwsTypes::Context> _context{nullptr};   /** lws thread only */
@@ -128,20 +125,24 @@ namespace TUI::Network::WebSocket
         std::thread _lwsThread{};
         bool _lwsThreadShouldExit{false};                       /** lws thread only */
         bool _closed{false};
+        /**
+         * Swapped with _txBatch by the lws thread, so the vectors keep their capacity.
+         * One lws_cancel_service per batch.
+         */
         std::mutex _txMutex{};                                  /** Both threads */
-        std::deque<ITCMessage> _txQueue{};                      /** Both threads */
-        Common::Unique::Fd _rxEventFd{-1};                      /** Both threads */
-        Tev::FdHandler _rxHandler{};
-        std::mutex _rxMutex{};                                  /** Both threads */
-        std::deque<ITCMessage> _rxQueue{};                      /** Both threads */
+        std::vector<ITCTxMessage> _txQueue{};                   /** Both threads */
+        bool _txSignalPending{false};                           /** Both threads */
+        std::vector<ITCTxMessage> _txBatch{};                   /** lws thread only */
+        std::shared_ptr<Common::TevInjectionQueue<ITCRxMessage>> _rxQueue{nullptr}; /** Both threads */
 
         /** Functions */
         static int LwsCallback(struct lws* wsi, enum lws_callback_reasons reason, void* user, void* in, size_t len) noexcept;
         Server(Tev& tev, const std::string& address, int port, bool addressIsUds = false);
         void LwsThreadFunc();
-        void ITCRxCallback();
-        void SendMessageToMainThread(ITCType type, std::unique_ptr<IITCData> data = nullptr);
-        void SendMessageToLwsThread(ITCType type, std::unique_ptr<IITCData> data = nullptr);
+        void ITCRxCallback(ITCRxMessage&& message);
+        void ITCTxCallback();
+        void SendMessageToMainThread(ITCRxMessage message);
+        void SendMessageToLwsThread(ITCTxMessage message);
         void CloseInternal(bool closedByLws = false);
     };
 }
@@ -336,6 +336,20 @@ namespace TUI::Rpc
             }
         }
 
+        /**
+         * @brief Same as json.dump(), copied once into the buffer that goes down to the socket.
+         * The session and the transport add their headers and trailers in its room.
+         * Streaming into the buffer through std::ostream is slower than this copy,
+         * nlohmann puts most characters one by one, see test/BenchDumpJson.cpp.
+         */
+        static Network::OutboundBuffer DumpJson(const nlohmann::json& json)
+        {
+            auto text = json.dump();
+            Network::OutboundBuffer buffer{};
+            buffer.Append(reinterpret_cast<const std::uint8_t*>(text.data()), text.size());
+            return buffer;
+        }
+
         void TrySendResponse(
             std::weak_ptr<Network::IConnection<Identity>> conenction, double id, const nlohmann::json& result) const noexcept
         {
@@ -346,8 +360,7 @@ namespace TUI::Rpc
                 response.set_result(result);
                 nlohmann::json responseJson{};
                 Schema::Rpc::to_json(responseJson, response);
-                auto responseStr = responseJson.dump();
-                std::vector<std::uint8_t> responseData(responseStr.begin(), responseStr.end());
+                auto responseData = DumpJson(responseJson);
                 auto conn = conenction.lock();
                 if (conn && !conn->IsClosed())
                 {
@@ -372,8 +385,7 @@ namespace TUI::Rpc
                 response.set_result(result);
                 nlohmann::json responseJson{};
                 Schema::Rpc::to_json(responseJson, response);
-                auto responseStr = responseJson.dump();
-                std::vector<std::uint8_t> responseData(responseStr.begin(), responseStr.end());
+                auto responseData = DumpJson(responseJson);
                 auto conn = connection.lock();
                 if (conn && !conn->IsClosed())
                 {
@@ -400,8 +412,7 @@ namespace TUI::Rpc
                 response.set_error(error);
                 nlohmann::json responseJson{};
                 Schema::Rpc::to_json(responseJson, response);
-                auto responseStr = responseJson.dump();
-                std::vector<std::uint8_t> responseData(responseStr.begin(), responseStr.end());
+                auto responseData = DumpJson(responseJson);
                 auto conn = connection.lock();
                 if (conn && !conn->IsClosed())
                 {
@@ -12,8 +12,12 @@
 //     MessageNode data = nlohmann::json::parse(jsonString);
 //     LinearHistory data = nlohmann::json::parse(jsonString);
 //     TreeHistory data = nlohmann::json::parse(jsonString);
+//     GetChatParams data = nlohmann::json::parse(jsonString);
+//     ChatHistoryDelta data = nlohmann::json::parse(jsonString);
 //     GetChatListParams data = nlohmann::json::parse(jsonString);
 //     GetChatListResult data = nlohmann::json::parse(jsonString);
+//     SearchChatsParams data = nlohmann::json::parse(jsonString);
+//     SearchChatsResult data = nlohmann::json::parse(jsonString);
 //     ChatCompletionParams data = nlohmann::json::parse(jsonString);
 //     ChatCompletionInfo data = nlohmann::json::parse(jsonString);
 //     ExecuteGenerationTaskParams data = nlohmann::json::parse(jsonString);
@@ -27,6 +31,7 @@
 //     GetUserListResult data = nlohmann::json::parse(jsonString);
 //     NewUserParams data = nlohmann::json::parse(jsonString);
 //     SetUserAdminSettingsParams data = nlohmann::json::parse(jsonString);
+//     BackupProgress data = nlohmann::json::parse(jsonString);
 //     ProtocolNegotiationRequest data = nlohmann::json::parse(jsonString);
 //     ProtocolNegotiationResponse data = nlohmann::json::parse(jsonString);
 
@@ -273,17 +278,102 @@ namespace IServer {
         void set_nodes(const std::map<std::string, MessageNode> & value) { this->nodes = value; }
     };
 
+    class GetChatParams {
+        public:
+        GetChatParams() = default;
+        virtual ~GetChatParams() = default;
+
+        private:
+        std::string id;
+        std::optional<double> since;
+
+        public:
+        const std::string & get_id() const { return id; }
+        std::string & get_mutable_id() { return id; }
+        void set_id(const std::string & value) { this->id = value; }
+
+        /**
+         * The version of a previous result. Only the changes after it are returned.
+         * If not set, the whole chat is returned.
+         */
+        std::optional<double> get_since() const { return since; }
+        void set_since(std::optional<double> value) { this->since = value; }
+    };
+
+    class ChatHistoryDelta {
+        public:
+        ChatHistoryDelta() = default;
+        virtual ~ChatHistoryDelta() = default;
+
+        private:
+        std::map<std::string, std::vector<std::string>> children;
+        std::map<std::string, MessageNode> nodes;
+        double version;
+
+        public:
+        /**
+         * The new children lists of the nodes from before since.
+         */
+        const std::map<std::string, std::vector<std::string>> & get_children() const { return children; }
+        std::map<std::string, std::vector<std::string>> & get_mutable_children() { return children; }
+        void set_children(const std::map<std::string, std::vector<std::string>> & value) { this->children = value; }
+
+        /**
+         * The nodes added after since.
+         */
+        const std::map<std::string, MessageNode> & get_nodes() const { return nodes; }
+        std::map<std::string, MessageNode> & get_mutable_nodes() { return nodes; }
+        void set_nodes(const std::map<std::string, MessageNode> & value) { this->nodes = value; }
+
+        /**
+         * Pass this as since to get the next changes.
+         */
+        const double & get_version() const { return version; }
+        double & get_mutable_version() { return version; }
+        void set_version(const double & value) { this->version = value; }
+    };
+
+    /**
+     * Position after the last chat of the previous page.
+     */
+    class ChatListCursor {
+        public:
+        ChatListCursor() = default;
+        virtual ~ChatListCursor() = default;
+
+        private:
+        std::string id;
+        double timestamp;
+
+        public:
+        const std::string & get_id() const { return id; }
+        std::string & get_mutable_id() { return id; }
+        void set_id(const std::string & value) { this->id = value; }
+
+        const double & get_timestamp() const { return timestamp; }
+        double & get_mutable_timestamp() { return timestamp; }
+        void set_timestamp(const double & value) { this->timestamp = value; }
+    };
+
     class GetChatListParams {
         public:
         GetChatListParams() = default;
         virtual ~GetChatListParams() = default;
 
         private:
+        std::optional<ChatListCursor> after;
         std::optional<std::vector<std::string>> meta_data_keys;
         double quantity;
         double start;
 
         public:
+        /**
+         * If set, list the chats after the cursor and ignore start.
+         * Preferred over start, as deep pages are as fast as the first one.
+         */
+        std::optional<ChatListCursor> get_after() const { return after; }
+        void set_after(std::optional<ChatListCursor> value) { this->after = value; }
+
         /**
          * If no key is specified, no metadata will be returned.
          */
@@ -307,6 +397,69 @@ namespace IServer {
         private:
         std::string id;
         std::optional<std::map<std::string, nlohmann::json>> metadata;
+        std::optional<double> timestamp;
+
+        public:
+        const std::string & get_id() const { return id; }
+        std::string & get_mutable_id() { return id; }
+        void set_id(const std::string & value) { this->id = value; }
+
+        std::optional<std::map<std::string, nlohmann::json>> get_metadata() const { return metadata; }
+        void set_metadata(std::optional<std::map<std::string, nlohmann::json>> value) { this->metadata = value; }
+
+        /**
+         * Pass this with the id as the cursor of the next page.
+         * Not set by servers older than the cursor.
+         */
+        std::optional<double> get_timestamp() const { return timestamp; }
+        void set_timestamp(std::optional<double> value) { this->timestamp = value; }
+    };
+
+    class SearchChatsParams {
+        public:
+        SearchChatsParams() = default;
+        virtual ~SearchChatsParams() = default;
+
+        private:
+        std::optional<std::vector<std::string>> meta_data_keys;
+        double quantity;
+        std::string query;
+        double start;
+
+        public:
+        /**
+         * If no key is specified, no metadata will be returned.
+         */
+        std::optional<std::vector<std::string>> get_meta_data_keys() const { return meta_data_keys; }
+        void set_meta_data_keys(std::optional<std::vector<std::string>> value) { this->meta_data_keys = value; }
+
+        const double & get_quantity() const { return quantity; }
+        double & get_mutable_quantity() { return quantity; }
+        void set_quantity(const double & value) { this->quantity = value; }
+
+        /**
+         * Words to match in the messages and the "title" metadata of the chats.
+         * Every word must match a whole word of the same message, or of the title.
+         */
+        const std::string & get_query() const { return query; }
+        std::string & get_mutable_query() { return query; }
+        void set_query(const std::string & value) { this->query = value; }
+
+        const double & get_start() const { return start; }
+        double & get_mutable_start() { return start; }
+        void set_start(const double & value) { this->start = value; }
+    };
+
+    class SearchChatsResultElement {
+        public:
+        SearchChatsResultElement() = default;
+        virtual ~SearchChatsResultElement() = default;
+
+        private:
+        std::string id;
+        std::optional<std::map<std::string, nlohmann::json>> metadata;
+        std::string snippet;
+        double timestamp;
 
         public:
         const std::string & get_id() const { return id; }
@@ -315,6 +468,17 @@ namespace IServer {
 
         std::optional<std::map<std::string, nlohmann::json>> get_metadata() const { return metadata; }
         void set_metadata(std::optional<std::map<std::string, nlohmann::json>> value) { this->metadata = value; }
+
+        /**
+         * Text around the best match of the chat.
+         */
+        const std::string & get_snippet() const { return snippet; }
+        std::string & get_mutable_snippet() { return snippet; }
+        void set_snippet(const std::string & value) { this->snippet = value; }
+
+        const double & get_timestamp() const { return timestamp; }
+        double & get_mutable_timestamp() { return timestamp; }
+        void set_timestamp(const double & value) { this->timestamp = value; }
     };
 
     class ChatCompletionParams {
@@ -603,6 +767,25 @@ namespace IServer {
         void set_id(const std::string & value) { this->id = value; }
     };
 
+    class BackupProgress {
+        public:
+        BackupProgress() = default;
+        virtual ~BackupProgress() = default;
+
+        private:
+        double page_count;
+        double remaining_pages;
+
+        public:
+        const double & get_page_count() const { return page_count; }
+        double & get_mutable_page_count() { return page_count; }
+        void set_page_count(const double & value) { this->page_count = value; }
+
+        const double & get_remaining_pages() const { return remaining_pages; }
+        double & get_mutable_remaining_pages() { return remaining_pages; }
+        void set_remaining_pages(const double & value) { this->remaining_pages = value; }
+    };
+
     class ProtocolNegotiationRequest {
         public:
         ProtocolNegotiationRequest() = default;
@@ -644,6 +827,7 @@ namespace IServer {
     using GetMetadataResult = std::map<std::string, nlohmann::json>;
     using LinearHistory = std::vector<Message>;
     using GetChatListResult = std::vector<GetChatListResultElement>;
+    using SearchChatsResult = std::vector<SearchChatsResultElement>;
     using GetModelListResult = std::vector<GetModelListResultElement>;
     using GetUserListResult = std::vector<GetUserListResultElement>;
 }
@@ -674,12 +858,27 @@ namespace IServer {
     void from_json(const json & j, TreeHistory & x);
     void to_json(json & j, const TreeHistory & x);
 
+    void from_json(const json & j, GetChatParams & x);
+    void to_json(json & j, const GetChatParams & x);
+
+    void from_json(const json & j, ChatHistoryDelta & x);
+    void to_json(json & j, const ChatHistoryDelta & x);
+
+    void from_json(const json & j, ChatListCursor & x);
+    void to_json(json & j, const ChatListCursor & x);
+
     void from_json(const json & j, GetChatListParams & x);
     void to_json(json & j, const GetChatListParams & x);
 
     void from_json(const json & j, GetChatListResultElement & x);
     void to_json(json & j, const GetChatListResultElement & x);
 
+    void from_json(const json & j, SearchChatsParams & x);
+    void to_json(json & j, const SearchChatsParams & x);
+
+    void from_json(const json & j, SearchChatsResultElement & x);
+    void to_json(json & j, const SearchChatsResultElement & x);
+
     void from_json(const json & j, ChatCompletionParams & x);
     void to_json(json & j, const ChatCompletionParams & x);
 
@@ -719,6 +918,9 @@ namespace IServer {
     void from_json(const json & j, SetUserAdminSettingsParams & x);
     void to_json(json & j, const SetUserAdminSettingsParams & x);
 
+    void from_json(const json & j, BackupProgress & x);
+    void to_json(json & j, const BackupProgress & x);
+
     void from_json(const json & j, ProtocolNegotiationRequest & x);
     void to_json(json & j, const ProtocolNegotiationRequest & x);
 
@@ -817,7 +1019,45 @@ namespace IServer {
         j["nodes"] = x.get_nodes();
     }
 
+    inline void from_json(const json & j, GetChatParams& x) {
+        x.set_id(j.at("id").get<std::string>());
+        x.set_since(get_stack_optional<double>(j, "since"));
+    }
+
+    inline void to_json(json & j, const GetChatParams & x) {
+        j = json::object();
+        j["id"] = x.get_id();
+        if (x.get_since()) {
+            j["since"] = x.get_since();
+        }
+    }
+
+    inline void from_json(const json & j, ChatHistoryDelta& x) {
+        x.set_children(j.at("children").get<std::map<std::string, std::vector<std::string>>>());
+        x.set_nodes(j.at("nodes").get<std::map<std::string, MessageNode>>());
+        x.set_version(j.at("version").get<double>());
+    }
+
+    inline void to_json(json & j, const ChatHistoryDelta & x) {
+        j = json::object();
+        j["children"] = x.get_children();
+        j["nodes"] = x.get_nodes();
+        j["version"] = x.get_version();
+    }
+
+    inline void from_json(const json & j, ChatListCursor& x) {
+        x.set_id(j.at("id").get<std::string>());
+        x.set_timestamp(j.at("timestamp").get<double>());
+    }
+
+    inline void to_json(json & j, const ChatListCursor & x) {
+        j = json::object();
+        j["id"] = x.get_id();
+        j["timestamp"] = x.get_timestamp();
+    }
+
     inline void from_json(const json & j, GetChatListParams& x) {
+        x.set_after(get_stack_optional<ChatListCursor>(j, "after"));
         x.set_meta_data_keys(get_stack_optional<std::vector<std::string>>(j, "metaDataKeys"));
         x.set_quantity(j.at("quantity").get<double>());
         x.set_start(j.at("start").get<double>());
@@ -825,6 +1065,9 @@ namespace IServer {
 
     inline void to_json(json & j, const GetChatListParams & x) {
         j = json::object();
+        if (x.get_after()) {
+            j["after"] = x.get_after();
+        }
         if (x.get_meta_data_keys()) {
             j["metaDataKeys"] = x.get_meta_data_keys();
         }
@@ -835,6 +1078,7 @@ namespace IServer {
     inline void from_json(const json & j, GetChatListResultElement& x) {
         x.set_id(j.at("id").get<std::string>());
         x.set_metadata(get_stack_optional<std::map<std::string, nlohmann::json>>(j, "metadata"));
+        x.set_timestamp(get_stack_optional<double>(j, "timestamp"));
     }
 
     inline void to_json(json & j, const GetChatListResultElement & x) {
@@ -843,6 +1087,43 @@ namespace IServer {
         if (x.get_metadata()) {
             j["metadata"] = x.get_metadata();
         }
+        if (x.get_timestamp()) {
+            j["timestamp"] = x.get_timestamp();
+        }
+    }
+
+    inline void from_json(const json & j, SearchChatsParams& x) {
+        x.set_meta_data_keys(get_stack_optional<std::vector<std::string>>(j, "metaDataKeys"));
+        x.set_quantity(j.at("quantity").get<double>());
+        x.set_query(j.at("query").get<std::string>());
+        x.set_start(j.at("start").get<double>());
+    }
+
+    inline void to_json(json & j, const SearchChatsParams & x) {
+        j = json::object();
+        if (x.get_meta_data_keys()) {
+            j["metaDataKeys"] = x.get_meta_data_keys();
+        }
+        j["quantity"] = x.get_quantity();
+        j["query"] = x.get_query();
+        j["start"] = x.get_start();
+    }
+
+    inline void from_json(const json & j, SearchChatsResultElement& x) {
+        x.set_id(j.at("id").get<std::string>());
+        x.set_metadata(get_stack_optional<std::map<std::string, nlohmann::json>>(j, "metadata"));
+        x.set_snippet(j.at("snippet").get<std::string>());
+        x.set_timestamp(j.at("timestamp").get<double>());
+    }
+
+    inline void to_json(json & j, const SearchChatsResultElement & x) {
+        j = json::object();
+        j["id"] = x.get_id();
+        if (x.get_metadata()) {
+            j["metadata"] = x.get_metadata();
+        }
+        j["snippet"] = x.get_snippet();
+        j["timestamp"] = x.get_timestamp();
     }
 
     inline void from_json(const json & j, ChatCompletionParams& x) {
@@ -1016,6 +1297,17 @@ namespace IServer {
         j["id"] = x.get_id();
     }
 
+    inline void from_json(const json & j, BackupProgress& x) {
+        x.set_page_count(j.at("pageCount").get<double>());
+        x.set_remaining_pages(j.at("remainingPages").get<double>());
+    }
+
+    inline void to_json(json & j, const BackupProgress & x) {
+        j = json::object();
+        j["pageCount"] = x.get_page_count();
+        j["remainingPages"] = x.get_remaining_pages();
+    }
+
     inline void from_json(const json & j, ProtocolNegotiationRequest& x) {
         x.set_turn_off_encryption(j.at("turnOffEncryption").get<bool>());
     }
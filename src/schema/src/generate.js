@@ -46,6 +46,12 @@ if (fileName === undefined) {
     console.error('Invalid file path provided.');
     process.exit(1);
 }
+const pendingFilePath = `${scriptRoot}pending/${fileName}`;
+if (fs.existsSync(pendingFilePath)) {
+    console.error(`${pendingFilePath} has types that are not upstream yet, regenerating would drop them from the header.`);
+    console.error('Merge them into the types submodule and delete the pending file first.');
+    process.exit(1);
+}
 console.log(`Generating C++ code for ${filePath}...`);
 const cppCode = await generateCppFromTypeScript(filePath);
 const outputFilePath = `${scriptRoot}../${fileName.replace(/\.ts$/, '.h')}`;
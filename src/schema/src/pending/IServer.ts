@@ -0,0 +1,87 @@
+/**
+ * Additions to types/IServer.ts that are not in the tiny-webui/types submodule yet.
+ * IServer.h carries them by hand until they are merged upstream and the submodule is bumped.
+ * generate.js refuses to regenerate IServer.h while this file exists, so they are not dropped silently.
+ * Delete this file in the change that bumps the submodule.
+ */
+
+import type { MessageNode } from '../types/IServer';
+
+export type GetChatParams = {
+    id: string;
+    /**
+     * The version of a previous result. Only the changes after it are returned.
+     * If not set, the whole chat is returned.
+     */
+    since?: number;
+};
+
+export type ChatHistoryDelta = {
+    /**
+     * The nodes added after since.
+     */
+    nodes: { [id: string]: MessageNode };
+    /**
+     * The new children lists of the nodes from before since.
+     */
+    children: { [id: string]: Array<string> };
+    /**
+     * Pass this as since to get the next changes.
+     */
+    version: number;
+};
+
+/**
+ * Position after the last chat of the previous page.
+ */
+export type ChatListCursor = {
+    id: string;
+    timestamp: number;
+};
+
+/** Fields added to the existing GetChatListParams */
+export type GetChatListParamsAdditions = {
+    /**
+     * If set, list the chats after the cursor and ignore start.
+     * Preferred over start, as deep pages are as fast as the first one.
+     */
+    after?: ChatListCursor;
+};
+
+/** Fields added to the existing elements of GetChatListResult */
+export type GetChatListResultElementAdditions = {
+    /**
+     * Pass this with the id as the cursor of the next page.
+     * Not set by servers older than the cursor.
+     */
+    timestamp?: number;
+};
+
+export type SearchChatsParams = {
+    start: number;
+    quantity: number;
+    /**
+     * Words to match in the messages and the "title" metadata of the chats.
+     * Every word must match a whole word of the same message, or of the title.
+     */
+    query: string;
+    /**
+     * If no key is specified, no metadata will be returned.
+     */
+    metaDataKeys?: Array<string>;
+};
+
+export type SearchChatsResult = Array<{
+    id: string;
+    metadata?: { [key: string]: any };
+    /**
+     * Text around the best match of the chat.
+     */
+    snippet: string;
+    timestamp: number;
+}>;
+
+export type BackupProgress = {
+    pageCount: number;
+    remainingPages: number;
+};
@@ -24,12 +24,15 @@ struct AppParams
     std::optional<std::string> unixSocketPath{std::nullopt};
     std::optional<std::string> address{std::nullopt};
     std::optional<uint16_t> port{std::nullopt};
+    Database::SqliteOptions sqliteOptions{};
+    size_t chatHistoryCacheSize{Database::Database::DEFAULT_CHAT_HISTORY_CACHE_SIZE};
+    std::optional<size_t> chatShardCount{std::nullopt};
 
     static AppParams Parse(int argc, char const *argv[])
     {
         int opt = -1;
         AppParams params{};
-        while ((opt = getopt(argc, const_cast<char**>(argv), "d:u:a:p:")) != -1)
+        while ((opt = getopt(argc, const_cast<char**>(argv), "d:u:a:p:r:b:w:c:n:S:P:m:t:i:F:W:")) != -1)
         {
             switch (opt)
             {
@@ -45,6 +48,42 @@ struct AppParams
             case 'p':
                 params.port = static_cast<uint16_t>(std::stoi(optarg));
                 break;
+            case 'r':
+                params.sqliteOptions.readConnectionCount = static_cast<size_t>(std::stoul(optarg));
+                break;
+            case 'b':
+                params.sqliteOptions.maxWriteBatchSize = static_cast<size_t>(std::stoul(optarg));
+                break;
+            case 'w':
+                params.sqliteOptions.maxWriteDelayMs = static_cast<uint64_t>(std::stoull(optarg));
+                break;
+            case 'c':
+                params.chatHistoryCacheSize = static_cast<size_t>(std::stoull(optarg)) * 1024 * 1024;
+                break;
+            case 'n':
+                params.chatShardCount = static_cast<size_t>(std::stoul(optarg));
+                break;
+            case 'S':
+                params.sqliteOptions.synchronous = ParseSynchronous(optarg);
+                break;
+            case 'P':
+                params.sqliteOptions.cacheSizeKiB = static_cast<int64_t>(std::stoll(optarg)) * 1024;
+                break;
+            case 'm':
+                params.sqliteOptions.mmapSize = static_cast<int64_t>(std::stoll(optarg)) * 1024 * 1024;
+                break;
+            case 't':
+                params.sqliteOptions.busyTimeoutMs = std::stoi(optarg);
+                break;
+            case 'i':
+                params.sqliteOptions.checkpointIdleMs = static_cast<uint64_t>(std::stoull(optarg));
+                break;
+            case 'F':
+                params.sqliteOptions.maxWalFrames = std::stoi(optarg);
+                break;
+            case 'W':
+                params.sqliteOptions.walTruncateSize = static_cast<int64_t>(std::stoll(optarg)) * 1024 * 1024;
+                break;
             default:
                 break;
             }
@@ -52,6 +91,23 @@ struct AppParams
         return params;
     }
 
+    static Database::SqliteSynchronous ParseSynchronous(const std::string& value)
+    {
+        if (value == "off")
+        {
+            return Database::SqliteSynchronous::OFF;
+        }
+        if (value == "normal")
+        {
+            return Database::SqliteSynchronous::NORMAL;
+        }
+        if (value == "full")
+        {
+            return Database::SqliteSynchronous::FULL;
+        }
+        throw std::invalid_argument("Invalid synchronous mode: " + value);
+    }
+
     void Check() const
     {
         if (!dbPath.has_value())
@@ -70,7 +126,31 @@ struct AppParams
         oss << "Usage: " << std::endl 
             << programName << std::endl
             << "    -d <database_path>" << std::endl
-            << "    -u <unix_socket_path> | -a <address> -p <port>" << std::endl;
+            << "    -u <unix_socket_path> | -a <address> -p <port>" << std::endl
+            << "    [-r <read_connection_count>] (default: "
+            << Database::SqliteOptions{}.readConnectionCount << ")" << std::endl
+            << "    [-b <max_write_batch_size>] (default: "
+            << Database::SqliteOptions{}.maxWriteBatchSize << ")" << std::endl
+            << "    [-w <max_write_delay_ms>] (default: "
+            << Database::SqliteOptions{}.maxWriteDelayMs << ")" << std::endl
+            << "    [-c <chat_history_cache_size_mb>] (default: "
+            << Database::Database::DEFAULT_CHAT_HISTORY_CACHE_SIZE / 1024 / 1024 << ")" << std::endl
+            << "    [-n <chat_shard_count>] (fixed when first set, 0 for none, default: as created)" << std::endl
+            << "    [-S off|normal|full] (sqlite synchronous, default: normal)" << std::endl
+            << "    [-P <page_cache_size_mb>] (per connection, default: "
+            << Database::SqliteOptions{}.cacheSizeKiB / 1024 << ")" << std::endl
+            << "    [-m <mmap_size_mb>] (default: "
+            << Database::SqliteOptions{}.mmapSize / 1024 / 1024 << ")" << std::endl
+            << "    [-t <busy_timeout_ms>] (default: "
+            << Database::SqliteOptions{}.busyTimeoutMs << ")" << std::endl
+            << "    [-i <checkpoint_idle_ms>] (0 for sqlite autocheckpoint, default: "
+            << Database::SqliteOptions{}.checkpointIdleMs << ")" << std::endl
+            << "    [-F <max_wal_frames>] (default: "
+            << Database::SqliteOptions{}.maxWalFrames << ")" << std::endl
+            << "    [-W <wal_truncate_size_mb>] (default: "
+            << Database::SqliteOptions{}.walTruncateSize / 1024 / 1024 << ")" << std::endl
+            << "Send SIGUSR1 to write a backup of the database and its chat shards next to them, "
+            << "all from the same instant." << std::endl;
         return oss.str();
     }
 };
@@ -84,6 +164,7 @@ struct App
 
 static JS::Promise<void> MainNoexceptAsync(AppParams params);
 static JS::Promise<void> MainAsync(AppParams params);
+static JS::Promise<void> BackupNoexceptAsync();
 static void SignalHandler(int sig);
 
 static App gApp{};
@@ -128,7 +209,8 @@ static JS::Promise<void> MainNoexceptAsync(AppParams params)
 
 static JS::Promise<void> MainAsync(AppParams params)
 {
-    auto database = co_await Database::Database::CreateAsync(gApp.tev, params.dbPath.value());
+    auto database = co_await Database::Database::CreateAsync(
+        gApp.tev, params.dbPath.value(), params.sqliteOptions, params.chatHistoryCacheSize, params.chatShardCount);
     std::shared_ptr<Network::IServer<void>> webSocketServer{nullptr};
     if (params.unixSocketPath.has_value())
     {
@@ -142,17 +224,14 @@ static JS::Promise<void> MainAsync(AppParams params)
     }
     auto secureSessionServer = Application::SecureSession::Server::Create(
         gApp.tev, std::move(webSocketServer), 
-        [=](const std::string& username) -> std::optional<std::pair<std::string, Common::Uuid>> {
-            try
-            {
-                auto userId = database->GetUserId(username);
-                auto credential = database->GetUserCredential(userId);
-                return std::make_pair(credential, userId);
-            }
-            catch(...)
+        [=](const std::string& username) -> std::optional<Application::SecureSession::Server::UserCredential> {
+            auto item = database->FindUserCredential(username);
+            if (!item.has_value())
             {
                 return std::nullopt;
             }
+            return Application::SecureSession::Server::UserCredential{
+                item.value().userId, {item.value().w0, item.value().L, item.value().salt}};
         });
     gApp.service = std::make_shared<Application::Service>(
         gApp.tev, std::move(secureSessionServer), std::move(database),
@@ -164,6 +243,11 @@ static JS::Promise<void> MainAsync(AppParams params)
         gApp.tev,
         [](int&& sig) {
             std::cout << "Signal received: " << sig << std::endl;
+            if (sig == SIGUSR1)
+            {
+                BackupNoexceptAsync();
+                return;
+            }
             gApp.service->Close();
             gApp.signalQueue->Close();
         },
@@ -173,6 +257,25 @@ static JS::Promise<void> MainAsync(AppParams params)
         });
     signal(SIGINT, SignalHandler);
     signal(SIGTERM, SignalHandler);
+    signal(SIGUSR1, SignalHandler);
+}
+
+static JS::Promise<void> BackupNoexceptAsync()
+{
+    try
+    {
+        auto onProgress = [](Database::Sqlite::BackupProgress progress) {
+            std::cout << "Backup progress: " << (progress.pageCount - progress.remainingPages)
+                << "/" << progress.pageCount << " pages" << std::endl;
+        };
+        /** The progress is of one file at a time, the shards are copied after the database */
+        auto path = co_await gApp.service->BackupDatabaseAsync(onProgress);
+        std::cout << "Backup written to " << path.string() << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Backup failed: " << e.what() << std::endl;
+    }
 }
 
 static void SignalHandler(int sig)
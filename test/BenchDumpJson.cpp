@@ -0,0 +1,173 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "network/OutboundBuffer.h"
+
+using namespace TUI::Network;
+
+/**
+ * The previous streambuf.
+ * No put area, every character goes through overflow.
+ */
+class UnbufferedStreamBuf : public std::streambuf
+{
+public:
+    explicit UnbufferedStreamBuf(OutboundBuffer& buffer) : _buffer(buffer) {}
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *_buffer.Extend(1) = static_cast<std::uint8_t>(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize count) override
+    {
+        _buffer.Append(reinterpret_cast<const std::uint8_t*>(s), static_cast<size_t>(count));
+        return count;
+    }
+
+private:
+    OutboundBuffer& _buffer;
+};
+
+/**
+ * With a put area, appended when full.
+ * Saves the virtual call per character, but not the ostream sentry around it.
+ */
+class PutAreaStreamBuf : public std::streambuf
+{
+public:
+    explicit PutAreaStreamBuf(OutboundBuffer& buffer) : _buffer(buffer)
+    {
+        setp(_window, _window + sizeof(_window));
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        sync();
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        _buffer.Append(reinterpret_cast<const std::uint8_t*>(pbase()), static_cast<size_t>(pptr() - pbase()));
+        setp(_window, _window + sizeof(_window));
+        return 0;
+    }
+
+private:
+    OutboundBuffer& _buffer;
+    char _window[4096];
+};
+
+/** What RpcServer does, a string copied once into the buffer */
+OutboundBuffer DumpAndCopy(const nlohmann::json& json)
+{
+    auto text = json.dump();
+    OutboundBuffer buffer{};
+    buffer.Append(reinterpret_cast<const std::uint8_t*>(text.data()), text.size());
+    return buffer;
+}
+
+template<typename StreamBuf>
+OutboundBuffer DumpToStream(const nlohmann::json& json)
+{
+    OutboundBuffer buffer{};
+    StreamBuf streamBuf{buffer};
+    std::ostream stream{&streamBuf};
+    stream << json;
+    stream.flush();
+    return buffer;
+}
+
+/** A chat history of short messages, mostly structure */
+nlohmann::json MakeChatHistory(size_t nodeCount)
+{
+    auto nodes = nlohmann::json::object();
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        auto id = std::to_string(i);
+        nodes[id] = {
+            {"id", id},
+            {"message", {
+                {"role", i % 2 == 0 ? "user" : "assistant"},
+                {"content", {{{"type", "text"}, {"data", "Message number " + id}}}}
+            }},
+            {"parent", i == 0 ? "" : std::to_string(i - 1)},
+            {"children", nlohmann::json::array({std::to_string(i + 1)})},
+            {"timestamp", 1700000000000.0 + static_cast<double>(i)}
+        };
+    }
+    return {{"id", 1}, {"result", {{"nodes", nodes}}}};
+}
+
+/** One long message, mostly string */
+nlohmann::json MakeLongMessage(size_t size)
+{
+    return {{"id", 1}, {"result", {{"role", "assistant"}, {"content", std::string(size, 'x')}}}};
+}
+
+/**
+ * @return Nanoseconds per call
+ */
+template<typename Func>
+double Run(const nlohmann::json& json, int iterations, Func&& dump)
+{
+    size_t totalSize = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        auto buffer = dump(json);
+        totalSize += buffer.Size();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    /** Keep the results alive */
+    if (totalSize == 0)
+    {
+        std::cerr << "Empty output" << std::endl;
+    }
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+}
+
+void Compare(const std::string& name, const nlohmann::json& json, int iterations)
+{
+    auto expected = json.dump();
+    auto check = [&](const OutboundBuffer& buffer) {
+        if (std::string(reinterpret_cast<const char*>(buffer.Data()), buffer.Size()) != expected)
+        {
+            std::cerr << name << ": output differs from dump()" << std::endl;
+        }
+    };
+    check(DumpToStream<UnbufferedStreamBuf>(json));
+    check(DumpToStream<PutAreaStreamBuf>(json));
+    auto copyNs = Run(json, iterations, DumpAndCopy);
+    auto unbufferedNs = Run(json, iterations, DumpToStream<UnbufferedStreamBuf>);
+    auto putAreaNs = Run(json, iterations, DumpToStream<PutAreaStreamBuf>);
+    std::cout << name << " (" << expected.size() << " bytes): "
+        << "dump+copy " << copyNs / 1000 << " us, "
+        << "unbuffered stream " << unbufferedNs / 1000 << " us, "
+        << "put area stream " << putAreaNs / 1000 << " us" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 200;
+    Compare("Small response", MakeChatHistory(1), iterations * 100);
+    Compare("Chat history", MakeChatHistory(2000), iterations);
+    Compare("Long message", MakeLongMessage(4 * 1024 * 1024), iterations / 10 + 1);
+    return 0;
+}
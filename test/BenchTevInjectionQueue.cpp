@@ -0,0 +1,136 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <tev-cpp/Tev.h>
+#include "common/TevInjectionQueue.h"
+#include "common/UniqueTypes.h"
+
+using namespace TUI::Common;
+
+/**
+ * The previous TevInjectionQueue, as the baseline.
+ * A mutex per item on both sides, and an eventfd write per item.
+ */
+template<typename T>
+class MutexInjectionQueue : public std::enable_shared_from_this<MutexInjectionQueue<T>>
+{
+public:
+    static std::shared_ptr<MutexInjectionQueue<T>> Create(Tev& tev, std::function<void(T&&)> onData)
+    {
+        return std::shared_ptr<MutexInjectionQueue<T>>(new MutexInjectionQueue<T>(tev, std::move(onData)));
+    }
+
+    void Inject(T&& data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push(std::move(data));
+        }
+        if (eventfd_write(_eventFd, 1) != 0)
+        {
+            throw std::runtime_error("Failed to write to eventfd: " + std::string(strerror(errno)));
+        }
+    }
+
+    void Close()
+    {
+        _closed = true;
+        _readHandler.Clear();
+    }
+
+private:
+    MutexInjectionQueue(Tev& tev, std::function<void(T&&)> onData)
+        : _onData(std::move(onData))
+    {
+        _eventFd = Unique::Fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        _readHandler = tev.SetReadHandler(_eventFd, std::bind(&MutexInjectionQueue<T>::ReadHandler, this));
+    }
+
+    void ReadHandler()
+    {
+        auto self = this->shared_from_this();
+        eventfd_t v;
+        if (eventfd_read(_eventFd, &v) != 0)
+        {
+            return;
+        }
+        while (!_closed)
+        {
+            std::optional<T> data;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_queue.empty())
+                {
+                    break;
+                }
+                data = std::move(_queue.front());
+                _queue.pop();
+            }
+            _onData(std::move(data.value()));
+        }
+    }
+
+    std::function<void(T&&)> _onData;
+    std::queue<T> _queue{};
+    std::mutex _mutex{};
+    bool _closed{false};
+    Unique::Fd _eventFd{-1};
+    Tev::FdHandler _readHandler{};
+};
+
+/**
+ * @return Nanoseconds per message, from the first inject to the last delivery
+ */
+template<template<typename> typename Queue>
+double Run(int producerCount, int messageCount)
+{
+    Tev tev{};
+    std::shared_ptr<Queue<int>> queue{nullptr};
+    int64_t total = static_cast<int64_t>(producerCount) * messageCount;
+    int64_t received = 0;
+    queue = Queue<int>::Create(tev, [&](int&&) {
+        if (++received == total)
+        {
+            queue->Close();
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; p++)
+    {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < messageCount; i++)
+            {
+                queue->Inject(int(i));
+            }
+        });
+    }
+    tev.MainLoop();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / total;
+}
+
+int main(int argc, char const *argv[])
+{
+    int messageCount = argc > 1 ? std::stoi(argv[1]) : 200000;
+    for (int producerCount : {1, 2, 4, 8})
+    {
+        auto mutexNs = Run<MutexInjectionQueue>(producerCount, messageCount);
+        auto ringNs = Run<TevInjectionQueue>(producerCount, messageCount);
+        std::cout << producerCount << " producer(s) x " << messageCount << " messages: "
+            << "mutex " << mutexNs << " ns/msg, "
+            << "ring " << ringNs << " ns/msg" << std::endl;
+    }
+    return 0;
+}
@@ -24,6 +24,16 @@ int main(int argc, char const *argv[])
     cache.Update(4, 4);
     auto value4 = cache.TryGet(4);
     AssertWithMessage(value4.has_value() && value4.value() == 4, "Cache should contain key 4 with updated value 4");
+    cache.Erase(4);
+    AssertWithMessage(cache.TryGet(4).has_value() == false, "Cache should not contain key 4 after erase");
+    cache.Update(6, 60);
+    cache.Update(7, 70);
+    AssertWithMessage(cache.TryGet(5).has_value(), "Erase should free a slot");
+    cache.Clear();
+    AssertWithMessage(cache.TryGet(5).has_value() == false && cache.TryGet(7).has_value() == false,
+        "Cache should be empty after clear");
+    cache.Update(8, 80);
+    AssertWithMessage(cache.TryGet(8).has_value(), "Cache should be usable after clear");
 
     return 0;
 }
@@ -37,6 +37,20 @@ int main(int argc, char const *argv[])
             "Decrypted message does not match original message");
     }
 
+    /** In place, the same output as Encrypt for the same counter */
+    Encryptor inPlaceEncryptor(key);
+    Encryptor referenceEncryptor(key);
+    for (const auto& message: messages)
+    {
+        std::vector<uint8_t> buffer(NONCE_SIZE + message.size() + TAG_SIZE, 0);
+        std::copy(message.begin(), message.end(), buffer.begin() + NONCE_SIZE);
+        inPlaceEncryptor.EncryptInPlace(buffer.data(), message.size());
+        std::vector<uint8_t> plainText(message.begin(), message.end());
+        AssertWithMessage(
+            buffer == referenceEncryptor.Encrypt(plainText),
+            "In place encryption does not match Encrypt");
+    }
+
     return 0;
 }
 
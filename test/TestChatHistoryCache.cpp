@@ -0,0 +1,184 @@
+#include <iostream>
+#include "database/ChatHistoryCache.h"
+#include "Utility.h"
+
+using namespace TUI::Common;
+using namespace TUI::Database;
+using namespace TUI::Schema;
+
+IServer::MessageNode MakeNode(const std::string& id, const std::optional<std::string>& parent, size_t dataSize = 10)
+{
+    IServer::MessageNode node{};
+    node.set_id(id);
+    node.set_parent(parent);
+    IServer::MessageContent content{};
+    content.set_type(IServer::Type::TEXT);
+    content.set_data(std::string(dataSize, 'a'));
+    IServer::Message message{};
+    message.set_role(IServer::MessageRole::USER);
+    message.set_content({content});
+    node.set_message(std::move(message));
+    node.set_timestamp(0);
+    return node;
+}
+
+IServer::TreeHistory MakeHistory(size_t dataSize = 10)
+{
+    IServer::TreeHistory history{};
+    auto root = MakeNode("root", std::nullopt, dataSize);
+    root.get_mutable_children().push_back("child");
+    history.get_mutable_nodes().emplace("root", std::move(root));
+    history.get_mutable_nodes().emplace("child", MakeNode("child", "root", dataSize));
+    return history;
+}
+
+void Load(ChatHistoryCache& cache, const Uuid& userId, const Uuid& chatId, const IServer::TreeHistory& history)
+{
+    cache.BeginLoad(userId, chatId);
+    cache.EndLoad(userId, chatId, &history);
+}
+
+void TestFind()
+{
+    ChatHistoryCache cache{1024 * 1024};
+    Uuid userId{};
+    Uuid chatId{};
+    AssertWithMessage(cache.Find(userId, chatId) == nullptr, "Empty cache should miss");
+    Load(cache, userId, chatId, MakeHistory());
+    auto cached = cache.Find(userId, chatId);
+    AssertWithMessage(cached != nullptr && cached->get_nodes().size() == 2, "Loaded history should be cached");
+    AssertWithMessage(cache.Find(userId, Uuid{}) == nullptr, "Other chats should miss");
+    auto stats = cache.GetStats();
+    AssertWithMessage(stats.hits == 1 && stats.misses == 2, "Hits and misses should be counted");
+    AssertWithMessage(stats.entries == 1 && stats.size > 0, "Size should be tracked");
+}
+
+void TestAppend()
+{
+    ChatHistoryCache cache{1024 * 1024};
+    Uuid userId{};
+    Uuid chatId{};
+    Load(cache, userId, chatId, MakeHistory());
+    auto sizeBefore = cache.GetStats().size;
+    cache.Append(userId, chatId, MakeNode("child2", "root"));
+    auto cached = cache.Find(userId, chatId);
+    AssertWithMessage(cached != nullptr && cached->get_nodes().size() == 3, "Appended node should be cached");
+    const auto& children = cached->get_nodes().at("root").get_children();
+    AssertWithMessage(children.size() == 2 && children[1] == "child2", "Appended node should be a child of its parent");
+    AssertWithMessage(cache.GetStats().size > sizeBefore, "Size should grow");
+    /** Not cached, ignored */
+    cache.Append(userId, Uuid{}, MakeNode("node", std::nullopt));
+    AssertWithMessage(cache.GetStats().entries == 1, "Append should not add chats");
+}
+
+void TestErase()
+{
+    ChatHistoryCache cache{1024 * 1024};
+    Uuid userId{};
+    Uuid otherUserId{};
+    Uuid chatId1{};
+    Uuid chatId2{};
+    Load(cache, userId, chatId1, MakeHistory());
+    Load(cache, userId, chatId2, MakeHistory());
+    Load(cache, otherUserId, chatId1, MakeHistory());
+    cache.Erase(userId, chatId1);
+    AssertWithMessage(cache.Find(userId, chatId1) == nullptr, "Erased chat should miss");
+    AssertWithMessage(cache.Find(userId, chatId2) != nullptr, "Other chats should stay");
+    Load(cache, userId, chatId1, MakeHistory());
+    cache.EraseUser(userId);
+    AssertWithMessage(cache.Find(userId, chatId1) == nullptr && cache.Find(userId, chatId2) == nullptr,
+        "Chats of the erased user should miss");
+    AssertWithMessage(cache.Find(otherUserId, chatId1) != nullptr, "Chats of other users should stay");
+    auto stats = cache.GetStats();
+    AssertWithMessage(stats.entries == 1, "Only one chat should be left");
+}
+
+void TestEviction()
+{
+    auto history = MakeHistory(1000);
+    ChatHistoryCache probe{1024 * 1024};
+    Load(probe, Uuid{}, Uuid{}, history);
+    auto entrySize = probe.GetStats().size;
+    /** Room for two */
+    ChatHistoryCache cache{entrySize * 2 + entrySize / 2};
+    Uuid userId{};
+    Uuid chatId1{};
+    Uuid chatId2{};
+    Uuid chatId3{};
+    Load(cache, userId, chatId1, history);
+    Load(cache, userId, chatId2, history);
+    /** chatId1 becomes the most recently used */
+    cache.Find(userId, chatId1);
+    Load(cache, userId, chatId3, history);
+    AssertWithMessage(cache.Find(userId, chatId2) == nullptr, "Least recently used chat should be evicted");
+    AssertWithMessage(cache.Find(userId, chatId1) != nullptr, "Recently used chat should stay");
+    auto stats = cache.GetStats();
+    AssertWithMessage(stats.evictions == 1 && stats.size <= stats.maxSize, "Size should be bounded");
+    /** Too large to cache */
+    Load(cache, userId, Uuid{}, MakeHistory(entrySize * 3));
+    AssertWithMessage(cache.GetStats().entries == 2, "Oversized history should not be cached");
+    /** Disabled */
+    ChatHistoryCache disabled{0};
+    Load(disabled, userId, chatId1, history);
+    AssertWithMessage(disabled.Find(userId, chatId1) == nullptr, "Disabled cache should miss");
+}
+
+void TestConcurrentLoad()
+{
+    ChatHistoryCache cache{1024 * 1024};
+    Uuid userId{};
+    Uuid chatId{};
+    /** A write during the load makes the loaded history stale */
+    cache.BeginLoad(userId, chatId);
+    cache.Append(userId, chatId, MakeNode("node", std::nullopt));
+    auto stale = MakeHistory();
+    cache.EndLoad(userId, chatId, &stale);
+    AssertWithMessage(cache.Find(userId, chatId) == nullptr, "Stale history should not be cached");
+    /** A failed load */
+    cache.BeginLoad(userId, chatId);
+    cache.EndLoad(userId, chatId, nullptr);
+    AssertWithMessage(cache.Find(userId, chatId) == nullptr, "Failed load should not be cached");
+    /** The next load is clean */
+    Load(cache, userId, chatId, MakeHistory());
+    AssertWithMessage(cache.Find(userId, chatId) != nullptr, "Clean load should be cached");
+    /** Deleting the user during a load */
+    Uuid chatId2{};
+    cache.BeginLoad(userId, chatId2);
+    cache.EraseUser(userId);
+    auto deleted = MakeHistory();
+    cache.EndLoad(userId, chatId2, &deleted);
+    AssertWithMessage(cache.Find(userId, chatId2) == nullptr, "History of a deleted user should not be cached");
+}
+
+void TestAppendLoadedNode()
+{
+    ChatHistoryCache cache{1024 * 1024};
+    Uuid userId{};
+    Uuid chatId{};
+    /** The write is committed before the load reads it, and reported after the load */
+    cache.BeginLoad(userId, chatId);
+    auto loaded = MakeHistory();
+    cache.EndLoad(userId, chatId, &loaded);
+    auto sizeBefore = cache.GetStats().size;
+    cache.Append(userId, chatId, MakeNode("child", "root"));
+    auto cached = cache.Find(userId, chatId);
+    AssertWithMessage(cached != nullptr && cached->get_nodes().size() == 2, "Loaded node should not be added again");
+    AssertWithMessage(cached->get_nodes().at("root").get_children().size() == 1,
+        "Loaded node should not be a child twice");
+    AssertWithMessage(cache.GetStats().size == sizeBefore, "Size should not change");
+}
+
+int main(int argc, char const *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    RunTest(TestFind());
+    RunTest(TestAppend());
+    RunTest(TestErase());
+    RunTest(TestEviction());
+    RunTest(TestConcurrentLoad());
+    RunTest(TestAppendLoadedNode());
+
+    return 0;
+}
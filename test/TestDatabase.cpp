@@ -2,6 +2,7 @@
 #include <filesystem>
 #include <tev-cpp/Tev.h>
 #include <js-style-co-routine/Promise.h>
+#include "common/Base64.h"
 #include "database/Database.h"
 #include "schema/IServer.h"
 #include "Utility.h"
@@ -220,6 +221,22 @@ JS::Promise<void> TestChatAsync()
         AssertWithMessage(retrievedNode1.get_parent().has_value() == true, "Node1 parent should not be null");
         AssertWithMessage(retrievedNode1.get_parent().value() == "node0", "Node1 parent ID should match");
         AssertWithMessage(retrievedNode1.get_children().empty(), "Node1 should have no children");
+
+        /** A sibling branch should not be in the branch of node1 */
+        IServer::MessageNode node2{};
+        node2.set_id("node2");
+        node2.set_parent("node0");
+        node2.set_timestamp(3.0);
+        co_await db->AppendChatHistoryAsync(userId, chatId, node2);
+        auto branch = co_await db->GetChatBranchAsync(userId, chatId, "node1");
+        AssertWithMessage(branch.has_value(), "Branch should be found");
+        AssertWithMessage(branch->size() == 2, "Branch should have 2 messages");
+        AssertWithMessage(branch->front().get_role() == MessageRoleType::USER, "Branch should start from the root");
+        AssertWithMessage(branch->back().get_role() == MessageRoleType::ASSISTANT, "Branch should end at the leaf");
+        branch = db->GetChatBranch(userId, chatId, "node0");
+        AssertWithMessage(branch.has_value() && branch->size() == 1, "Branch of the root should only have the root");
+        branch = db->GetChatBranch(userId, chatId, "missing");
+        AssertWithMessage(!branch.has_value(), "Branch of a missing message should not be found");
     }
     size_t count = db->GetChatCount(userId);
     AssertWithMessage(count == 1, "Chat count should be 1");
@@ -262,6 +279,754 @@ JS::Promise<void> TestChatAsync()
     AssertWithMessage(!chatFound, "Deleted chat found");
 }
 
+JS::Promise<void> TestReadAsync()
+{
+    auto modelId = co_await db->CreateModelAsync("test-settings");
+    co_await db->SetModelMetadataAsync(modelId, "test-metadata");
+    auto models = co_await db->ListModelAsync();
+    AssertWithMessage(models.size() == db->ListModel().size(), "Model list should match");
+    AssertWithMessage(co_await db->GetModelMetadataAsync(modelId) == "test-metadata", "Model metadata should match");
+    AssertWithMessage(co_await db->GetModelSettingsAsync(modelId) == "test-settings", "Model settings should match");
+
+    auto userId = co_await db->CreateUserAsync("test-user3", "test-admin-settings", "");
+    co_await db->SetUserPublicMetadataAsync(userId, "test-public-metadata");
+    auto users = co_await db->ListUserAsync();
+    AssertWithMessage(users.size() == db->ListUser().size(), "User list should match");
+    auto userStream = db->ListUserStream(1);
+    size_t streamedUsers = 0;
+    while (auto batch = co_await userStream.NextAsync())
+    {
+        AssertWithMessage(batch->size() == 1, "Streamed users should be batched");
+        streamedUsers += batch->size();
+    }
+    AssertWithMessage(streamedUsers == users.size(), "Streamed user list should match");
+    AssertWithMessage(co_await db->GetUserAdminSettingsAsync(userId) == "test-admin-settings", "User admin settings should match");
+    AssertWithMessage(co_await db->GetUserPublicMetadataAsync(userId) == "test-public-metadata", "User public metadata should match");
+    AssertWithMessage((co_await db->GetUserMetadataAsync(userId)).empty(), "User metadata should be empty");
+
+    auto chatId = co_await db->CreateChatAsync(userId);
+    co_await db->SetChatMetadataAsync(userId, chatId, "test-chat-metadata");
+    auto chats = co_await db->ListChatAsync(userId);
+    AssertWithMessage(chats.size() == 1 && chats.front().id == chatId, "Chat should be listed");
+    AssertWithMessage(co_await db->GetChatMetadataAsync(userId, chatId) == "test-chat-metadata", "Chat metadata should match");
+    IServer::MessageNode node{};
+    node.set_id("node0");
+    node.set_timestamp(1.0);
+    co_await db->AppendChatHistoryAsync(userId, chatId, node);
+    auto history = co_await db->GetChatHistoryAsync(userId, chatId);
+    AssertWithMessage(history.get_nodes().size() == 1, "Chat history should have 1 message");
+    try
+    {
+        co_await db->GetChatMetadataAsync(userId, Uuid{});
+        AssertWithMessage(false, "Getting a missing chat should throw");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+
+    co_await db->DeleteUserAsync(userId);
+    co_await db->DeleteModelAsync(modelId);
+}
+
+JS::Promise<void> TestChatListPagingAsync()
+{
+    auto userId = co_await db->CreateUserAsync("test-user4", "", "");
+    for (int i = 0; i < 5; i++)
+    {
+        co_await db->CreateChatAsync(userId);
+    }
+    auto allChats = db->ListChat(userId, 0, 10);
+    AssertWithMessage(allChats.size() == 5, "All chats should be listed");
+    /** Pages by cursor should match the full list, including chats with the same timestamp */
+    std::list<Database::ChatListItem> pagedChats{};
+    auto page = co_await db->ListChatAsync(userId, 0, 2);
+    while (!page.empty())
+    {
+        auto last = page.back();
+        pagedChats.splice(pagedChats.end(), page);
+        page = co_await db->ListChatAfterAsync(userId, last.timestamp, last.id, 2);
+    }
+    AssertWithMessage(pagedChats.size() == allChats.size(), "Paged chats should match the full list");
+    auto pagedIt = pagedChats.begin();
+    for (const auto& chat : allChats)
+    {
+        AssertWithMessage(pagedIt->id == chat.id, "Paged chats should be in the same order");
+        pagedIt++;
+    }
+    auto offsetPage = db->ListChat(userId, 2, 2);
+    auto cursorPage = db->ListChatAfter(userId, std::next(allChats.begin())->timestamp, std::next(allChats.begin())->id, 2);
+    AssertWithMessage(offsetPage.size() == 2 && cursorPage.size() == 2, "Pages should be full");
+    AssertWithMessage(offsetPage.front().id == cursorPage.front().id, "Offset and cursor pages should match");
+    co_await db->DeleteUserAsync(userId);
+}
+
+JS::Promise<void> TestChatHistoryCacheAsync()
+{
+    auto userId = co_await db->CreateUserAsync("test-user5", "test-admin-settings", "");
+    auto chatId = co_await db->CreateChatAsync(userId);
+    IServer::MessageNode node0{};
+    node0.set_id("node0");
+    node0.set_timestamp(1.5);
+    co_await db->AppendChatHistoryAsync(userId, chatId, node0);
+
+    auto statsBefore = db->GetChatHistoryCacheStats();
+    co_await db->GetChatHistoryAsync(userId, chatId);
+    co_await db->GetChatHistoryAsync(userId, chatId);
+    auto stats = db->GetChatHistoryCacheStats();
+    AssertWithMessage(stats.misses == statsBefore.misses + 1, "The first read should miss");
+    AssertWithMessage(stats.hits == statsBefore.hits + 1, "The second read should hit");
+
+    /** Updated in place */
+    IServer::MessageNode node1{};
+    node1.set_id("node1");
+    node1.set_parent("node0");
+    node1.set_timestamp(2.0);
+    co_await db->AppendChatHistoryAsync(userId, chatId, node1);
+    auto cached = co_await db->GetChatHistoryAsync(userId, chatId);
+    AssertWithMessage(db->GetChatHistoryCacheStats().hits == stats.hits + 1, "The read after append should hit");
+    auto uncachedDb = co_await Database::CreateAsync(tev, dbPath, {}, 0);
+    auto uncached = co_await uncachedDb->GetChatHistoryAsync(userId, chatId);
+    AssertWithMessage(static_cast<nlohmann::json>(cached) == static_cast<nlohmann::json>(uncached),
+        "The cached history should match the database");
+    auto branch = co_await db->GetChatBranchAsync(userId, chatId, "node1");
+    AssertWithMessage(branch.has_value() && branch->size() == 2, "The branch should be read from the cache");
+
+    /** Invalidated */
+    co_await db->DeleteChatAsync(userId, chatId);
+    AssertWithMessage((co_await db->GetChatHistoryAsync(userId, chatId)).get_nodes().empty(),
+        "The deleted chat should be empty");
+    auto chatId2 = co_await db->CreateChatAsync(userId);
+    co_await db->AppendChatHistoryAsync(userId, chatId2, node0);
+    co_await db->GetChatHistoryAsync(userId, chatId2);
+    co_await db->DeleteUserAsync(userId);
+    AssertWithMessage(db->GetChatHistory(userId, chatId2).get_nodes().empty(),
+        "The chats of the deleted user should be empty");
+}
+
+JS::Promise<void> TestChatHistorySinceAsync()
+{
+    auto userId = co_await db->CreateUserAsync("test-user6", "test-admin-settings", "");
+    auto chatId = co_await db->CreateChatAsync(userId);
+    auto append = [&](const std::string& id, std::optional<std::string> parent) {
+        IServer::MessageNode node{};
+        node.set_id(id);
+        node.set_parent(std::move(parent));
+        node.set_timestamp(1.0);
+        return db->AppendChatHistoryAsync(userId, chatId, std::move(node));
+    };
+    co_await append("node0", std::nullopt);
+    co_await append("node1", "node0");
+
+    auto full = co_await db->GetChatHistorySinceAsync(userId, chatId, 0);
+    AssertWithMessage(full.get_nodes().size() == 2 && full.get_children().empty(), "Since 0 should get the whole chat");
+    AssertWithMessage(full.get_nodes().at("node0").get_children().size() == 1, "Children of new nodes should be set");
+    auto version = static_cast<int64_t>(full.get_version());
+
+    auto empty = db->GetChatHistorySince(userId, chatId, version);
+    AssertWithMessage(empty.get_nodes().empty() && empty.get_children().empty(), "Nothing should be new");
+    AssertWithMessage(static_cast<int64_t>(empty.get_version()) == version, "The version should not change");
+
+    co_await append("node2", "node0");
+    co_await append("node3", "node2");
+    auto delta = co_await db->GetChatHistorySinceAsync(userId, chatId, version);
+    AssertWithMessage(delta.get_nodes().size() == 2, "Only the new nodes should be returned");
+    AssertWithMessage(delta.get_nodes().count("node2") && delta.get_nodes().count("node3"), "The new nodes should match");
+    AssertWithMessage(delta.get_nodes().at("node2").get_children() == std::vector<std::string>{"node3"},
+        "Children of new nodes should be set");
+    AssertWithMessage(delta.get_children().size() == 1, "Only the changed old node should have children listed");
+    AssertWithMessage((delta.get_children().at("node0") == std::vector<std::string>{"node1", "node2"}),
+        "The children list should be complete and in order");
+    AssertWithMessage(static_cast<int64_t>(delta.get_version()) > version, "The version should increase");
+
+    /** The sequence is per chat */
+    auto otherChatId = co_await db->CreateChatAsync(userId);
+    IServer::MessageNode node{};
+    node.set_id("node0");
+    node.set_timestamp(1.0);
+    co_await db->AppendChatHistoryAsync(userId, otherChatId, std::move(node));
+    auto other = db->GetChatHistorySince(userId, otherChatId, 0);
+    AssertWithMessage(other.get_nodes().size() == 1, "Other chats should not be mixed in");
+
+    /** The parent or the chat may be deleted while a node is generated */
+    try
+    {
+        co_await append("node4", "missing");
+        AssertWithMessage(false, "Appending to a missing parent should throw");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    co_await db->DeleteChatAsync(userId, chatId);
+    try
+    {
+        co_await append("node5", std::nullopt);
+        AssertWithMessage(false, "Appending to a deleted chat should throw");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    AssertWithMessage(db->GetChatHistorySince(userId, chatId, 0).get_nodes().empty(),
+        "Nothing should be stored for a deleted chat");
+}
+
+JS::Promise<void> TestMetadataKeysAsync()
+{
+    using Target = Database::MetadataTarget;
+    auto userId = co_await db->CreateUserAsync("test-user7", "", "");
+    auto chatId = co_await db->CreateChatAsync(userId);
+    Database::MetadataPath chatPath{Target::CHAT, chatId, userId};
+    std::vector<std::string> keys{"a"};
+
+    /** Unset metadata is empty */
+    auto metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(metadata.empty(), "Unset metadata should be empty");
+
+    std::map<std::string, nlohmann::json> entries{
+        {"a", 1}, {"b", "text"}, {"c", {{"x", true}, {"y", 2}}}, {"d", false}};
+    co_await db->SetMetadataKeysAsync(chatPath, entries);
+    keys = {"a", "b", "c", "d", "missing"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(
+        metadata == nlohmann::json({{"a", 1}, {"b", "text"}, {"c", {{"x", true}, {"y", 2}}}, {"d", false}}),
+        "The requested keys should keep their types");
+    keys = {"b", "with\"quote"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(metadata == nlohmann::json({{"b", "text"}}), "Only the requested keys should be returned");
+
+    /** Values are replaced, not merged */
+    entries = {{"c", {{"z", 3}}}};
+    co_await db->SetMetadataKeysAsync(chatPath, entries);
+    keys = {"a", "c"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(metadata == nlohmann::json({{"a", 1}, {"c", {{"z", 3}}}}), "Set should replace the value");
+
+    /** Nulls are values, not deletions */
+    entries = {{"n", nullptr}, {"o", {{"n", nullptr}}}};
+    co_await db->SetMetadataKeysAsync(chatPath, entries);
+    keys = {"n", "o"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(metadata == nlohmann::json({{"n", nullptr}, {"o", {{"n", nullptr}}}}), "Nulls should be stored");
+
+    /** Any key works, it is never put in a JSON path */
+    entries = {{"with\"quote", 1}, {"$.a", 2}};
+    co_await db->SetMetadataKeysAsync(chatPath, entries);
+    keys = {"with\"quote", "$.a", "a"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(chatPath, keys));
+    AssertWithMessage(metadata == nlohmann::json({{"with\"quote", 1}, {"$.a", 2}, {"a", 1}}),
+        "Keys with a double quote should be set");
+
+    keys = {"a", "c", "n", "o", "missing", "with\"quote", "$.a"};
+    co_await db->DeleteMetadataKeysAsync(chatPath, keys);
+    metadata = nlohmann::json::parse(db->GetChatMetadata(userId, chatId));
+    AssertWithMessage(metadata == nlohmann::json({{"b", "text"}, {"d", false}}), "Deleted keys should be removed");
+
+    /** Projected chat list */
+    keys = {"b"};
+    auto chats = co_await db->ListChatAsync(userId, 0, 10, keys);
+    AssertWithMessage(chats.size() == 1, "Chat should be listed");
+    AssertWithMessage(nlohmann::json::parse(chats.front().metadata) == nlohmann::json({{"b", "text"}}),
+        "Listed metadata should only have the requested keys");
+    chats = db->ListChatAfter(userId, chats.front().timestamp + 1, chatId, 10, std::vector<std::string>{});
+    AssertWithMessage(chats.size() == 1 && chats.front().metadata == "{}", "No keys should give an empty object");
+
+    /** Invalid metadata is treated as empty */
+    co_await db->SetUserPublicMetadataAsync(userId, "invalid");
+    Database::MetadataPath publicPath{Target::USER_PUBLIC, userId};
+    keys = {"a"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(publicPath, keys));
+    AssertWithMessage(metadata.empty(), "Invalid metadata should be empty");
+    entries = {{"a", 1}};
+    co_await db->SetMetadataKeysAsync(publicPath, entries);
+    AssertWithMessage(nlohmann::json::parse(db->GetUserPublicMetadata(userId)) == nlohmann::json({{"a", 1}}),
+        "Invalid metadata should be replaced");
+
+    /** Global metadata is created on the first write */
+    Database::MetadataPath globalPath{Target::GLOBAL};
+    co_await db->DeleteGlobalValueAsync("metadata");
+    entries = {{"g", "v"}};
+    co_await db->SetMetadataKeysAsync(globalPath, entries);
+    keys = {"g"};
+    metadata = nlohmann::json::parse(co_await db->GetMetadataKeysAsync(globalPath, keys));
+    AssertWithMessage(metadata == nlohmann::json({{"g", "v"}}), "Global metadata should be created");
+    co_await db->DeleteGlobalValueAsync("metadata");
+
+    /** Missing items */
+    bool thrown = false;
+    try
+    {
+        co_await db->SetMetadataKeysAsync(Database::MetadataPath{Target::MODEL, Uuid{}}, entries);
+    }
+    catch(const std::exception&)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "Setting the metadata of a missing model should throw");
+    thrown = false;
+    try
+    {
+        co_await db->GetMetadataKeysAsync(Database::MetadataPath{Target::CHAT, Uuid{}, userId}, keys);
+    }
+    catch(const std::exception&)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "Getting the metadata of a missing chat should throw");
+
+    co_await db->DeleteUserAsync(userId);
+}
+
+IServer::MessageNode MakeTextNode(const std::string& id, const std::string& text)
+{
+    IServer::MessageContent content{};
+    content.set_type(IServer::Type::TEXT);
+    content.set_data(text);
+    IServer::Message message{};
+    message.set_role(IServer::MessageRole::USER);
+    message.set_content({content});
+    IServer::MessageNode node{};
+    node.set_id(id);
+    node.set_message(std::move(message));
+    node.set_timestamp(1.0);
+    return node;
+}
+
+JS::Promise<void> TestChatSearchAsync()
+{
+    auto userId = co_await db->CreateUserAsync("test-user8", "", "");
+    auto otherUserId = co_await db->CreateUserAsync("test-user9", "", "");
+    auto chatId1 = co_await db->CreateChatAsync(userId);
+    auto chatId2 = co_await db->CreateChatAsync(userId);
+    auto otherChatId = co_await db->CreateChatAsync(otherUserId);
+    co_await db->AppendChatHistoryAsync(userId, chatId1, MakeTextNode("node0", "hello world"));
+    co_await db->AppendChatHistoryAsync(userId, chatId1, MakeTextNode("node1", "the quick brown fox"));
+    co_await db->SetChatMetadataAsync(userId, chatId2, R"({"title":"Fox facts","other":1})");
+    co_await db->AppendChatHistoryAsync(otherUserId, otherChatId, MakeTextNode("node0", "fox"));
+
+    auto results = co_await db->SearchChatAsync(userId, "fox");
+    AssertWithMessage(results.size() == 2, "Messages and titles should match");
+    for (const auto& item : results)
+    {
+        AssertWithMessage(item.id == chatId1 || item.id == chatId2, "Only the chats of the user should match");
+        AssertWithMessage(item.snippet.find("fox") != std::string::npos || item.snippet.find("Fox") != std::string::npos,
+            "The snippet should have the match");
+    }
+    results = co_await db->SearchChatAsync(userId, "  QUICK   fox ");
+    AssertWithMessage(results.size() == 1 && results.front().id == chatId1, "All words should match, ignoring case");
+    results = co_await db->SearchChatAsync(userId, "fox", 1, 10);
+    AssertWithMessage(results.size() == 1, "Results should be paged");
+    std::vector<std::string> keys{"title"};
+    results = co_await db->SearchChatAsync(userId, "facts", 0, 10, keys);
+    AssertWithMessage(results.size() == 1 && results.front().id == chatId2, "Titles should match");
+    AssertWithMessage(nlohmann::json::parse(results.front().metadata) == nlohmann::json({{"title", "Fox facts"}}),
+        "The metadata should only have the requested keys");
+    results = co_await db->SearchChatAsync(otherUserId, "fox");
+    AssertWithMessage(results.size() == 1 && results.front().id == otherChatId, "Other users should be scoped");
+
+    /** The query syntax is not exposed */
+    results = co_await db->SearchChatAsync(userId, "fox\" OR NEAR(");
+    AssertWithMessage(results.empty(), "Operators should be plain words");
+    results = co_await db->SearchChatAsync(userId, " \t ");
+    AssertWithMessage(results.empty(), "An empty query should match nothing");
+
+    /** The index follows the writes */
+    co_await db->SetChatMetadataAsync(userId, chatId2, R"({"title":"Cat facts"})");
+    results = co_await db->SearchChatAsync(userId, "fox");
+    AssertWithMessage(results.size() == 1 && results.front().id == chatId1, "Old titles should not match");
+    keys = {"title"};
+    co_await db->DeleteMetadataKeysAsync({Database::MetadataTarget::CHAT, chatId2, userId}, keys);
+    results = co_await db->SearchChatAsync(userId, "cat");
+    AssertWithMessage(results.empty(), "Deleted titles should not match");
+    co_await db->DeleteChatAsync(userId, chatId1);
+    results = co_await db->SearchChatAsync(userId, "quick");
+    AssertWithMessage(results.empty(), "Deleted chats should not match");
+
+    co_await db->DeleteUserAsync(userId);
+    co_await db->DeleteUserAsync(otherUserId);
+    auto rows = db->GetChatCount(otherUserId);
+    AssertWithMessage(rows == 0, "Chats of deleted users should be deleted");
+}
+
+/** The background backfills are done when none is pending */
+JS::Promise<void> WaitForBackfillAsync(const std::string& path)
+{
+    auto sqlite = co_await Sqlite::CreateAsync(tev, path);
+    while (sqlite->Exec("SELECT COUNT(*) FROM migration_backfill;").front().Get<int64_t>(0) > 0)
+    {
+        co_await sqlite->ExecAsync("SELECT 1;");
+    }
+}
+
+JS::Promise<void> TestLegacyChatContentAsync()
+{
+    /** Databases created by older versions store the children as JSON */
+    std::string legacyPath = dbPath + ".legacy";
+    Uuid userId{};
+    Uuid chatId{};
+    std::string userIdStr = static_cast<std::string>(userId);
+    std::string chatIdStr = static_cast<std::string>(chatId);
+    for (const auto& suffix : {"", "-wal", "-shm"})
+    {
+        std::filesystem::remove(legacyPath + suffix);
+    }
+    {
+        auto sqlite = co_await Sqlite::CreateAsync(tev, legacyPath);
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat_content ("
+            "user_id TEXT, chat_id TEXT, id TEXT, parent TEXT, children TEXT, message TEXT, timestamp INTEGER, "
+            "PRIMARY KEY (user_id, chat_id, id));");
+        std::string message = R"({"role":"user","content":[{"type":"text","data":"hi"}]})";
+        std::string insert = "INSERT INTO chat_content VALUES (?, ?, ?, ?, ?, ?, ?);";
+        co_await sqlite->ExecAsync(insert, userIdStr, chatIdStr, std::string("root"), std::string(""), std::string(R"(["a","b"])"), message, static_cast<int64_t>(1));
+        co_await sqlite->ExecAsync(insert, userIdStr, chatIdStr, std::string("a"), std::string("root"), std::string("[]"), message, static_cast<int64_t>(2));
+        co_await sqlite->ExecAsync(insert, userIdStr, chatIdStr, std::string("b"), std::string("root"), std::string("[]"), message, static_cast<int64_t>(3));
+        /** Older versions also store the UUIDs as text */
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat (timestamp INTEGER, user_id TEXT, id TEXT, metadata TEXT, PRIMARY KEY (user_id, id));");
+        co_await sqlite->ExecAsync(
+            "INSERT INTO chat VALUES (?, ?, ?, ?);", static_cast<int64_t>(1), userIdStr, chatIdStr, std::string("metadata"));
+    }
+    auto legacyDb = co_await Database::CreateAsync(tev, legacyPath);
+    auto columns = (co_await Sqlite::CreateAsync(tev, legacyPath))->Exec("SELECT name FROM pragma_table_info('chat_content');");
+    for (auto row : columns)
+    {
+        AssertWithMessage(row.Get<std::string>(0) != "children", "The children column should be dropped");
+    }
+    auto types = (co_await Sqlite::CreateAsync(tev, legacyPath))->Exec(
+        "SELECT typeof(user_id), typeof(chat_id), typeof(id) FROM chat_content;");
+    for (auto row : types)
+    {
+        AssertWithMessage(row.Get<std::string>(0) == "blob" && row.Get<std::string>(1) == "blob",
+            "The UUIDs should be converted to blobs");
+        AssertWithMessage(row.Get<std::string>(2) == "text", "The message ids should stay text");
+    }
+    auto chats = legacyDb->ListChat(userId, 0, 10);
+    AssertWithMessage(chats.size() == 1 && chats.front().id == chatId, "The chat should be listed after the migration");
+    AssertWithMessage(legacyDb->GetChatMetadata(userId, chatId) == "metadata", "The chat should be found by its id");
+    auto history = legacyDb->GetChatHistory(userId, chatId);
+    /** The re-encoder runs in the background. Text rows are readable before it finishes. */
+    auto branch = co_await legacyDb->GetChatBranchAsync(userId, chatId, "a");
+    AssertWithMessage(branch.has_value() && branch->size() == 2, "Text messages should be readable");
+    auto& nodes = history.get_nodes();
+    AssertWithMessage(nodes.size() == 3, "Chat history should have 3 messages");
+    auto& rootChildren = nodes.at("root").get_children();
+    AssertWithMessage(rootChildren.size() == 2, "Root should have 2 children");
+    AssertWithMessage(rootChildren[0] == "a" && rootChildren[1] == "b", "Children should be in insertion order");
+
+    auto textMessage = static_cast<nlohmann::json>(nodes.at("a").get_message());
+    /** The writes are in order, so the first re-encode chunk is done after this */
+    co_await legacyDb->SetGlobalValueAsync("key", "value");
+    auto messageTypes = (co_await Sqlite::CreateAsync(tev, legacyPath))->Exec(
+        "SELECT COUNT(*) FROM chat_content WHERE typeof(message) != 'blob';");
+    AssertWithMessage(messageTypes.front().Get<int64_t>(0) == 0, "The messages should be re-encoded");
+    history = legacyDb->GetChatHistory(userId, chatId);
+    AssertWithMessage(history.get_nodes().size() == 3, "Re-encoded messages should be readable");
+    AssertWithMessage(static_cast<nlohmann::json>(history.get_nodes().at("a").get_message()) == textMessage,
+        "Re-encoded messages should be the same");
+    co_await WaitForBackfillAsync(legacyPath);
+    auto results = co_await legacyDb->SearchChatAsync(userId, "hi");
+    AssertWithMessage(results.size() == 1 && results.front().id == chatId, "Existing messages should be indexed");
+}
+
+JS::Promise<void> TestLegacyBackfillChunksAsync()
+{
+    /** More rows than a chunk, with a gap in the rowids */
+    std::string legacyPath = dbPath + ".chunks";
+    for (const auto& suffix : {"", "-wal", "-shm"})
+    {
+        std::filesystem::remove(legacyPath + suffix);
+    }
+    Uuid userId{};
+    std::string userIdStr = static_cast<std::string>(userId);
+    {
+        auto sqlite = co_await Sqlite::CreateAsync(tev, legacyPath);
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat_content ("
+            "user_id TEXT, chat_id TEXT, id TEXT, parent TEXT, message TEXT, timestamp INTEGER, "
+            "PRIMARY KEY (user_id, chat_id, id));");
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat (timestamp INTEGER, user_id TEXT, id TEXT, metadata TEXT, PRIMARY KEY (user_id, id));");
+        std::string message = R"({"role":"user","content":[{"type":"text","data":"hi"}]})";
+        co_await sqlite->ExecAsync(
+            "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 2500) "
+            "INSERT INTO chat_content (rowid, user_id, chat_id, id, parent, message, timestamp) "
+            "SELECT CASE WHEN i > 1200 THEN i + 5000 ELSE i END, ?1, ?1, 'node' || i, '', ?2, i FROM n;",
+            userIdStr, message);
+        co_await sqlite->ExecAsync(
+            "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1200) "
+            "INSERT INTO chat (rowid, timestamp, user_id, id, metadata) "
+            "SELECT CASE WHEN i > 700 THEN i + 5000 ELSE i END, i, ?1, "
+            "printf('%08x-0000-4000-8000-%012x', i, i), json_object('title', 'fox ' || i) FROM n;",
+            userIdStr);
+        co_await sqlite->ExecAsync("CREATE TABLE model (id TEXT PRIMARY KEY, metadata TEXT, settings TEXT);");
+        co_await sqlite->ExecAsync(
+            "INSERT INTO model (id) VALUES "
+            "('0123ABCD-4567-89EF-0123-456789ABCDEF'), ('not a uuid'), ('0123abcd4-567-89ef-0123-456789abcdef');");
+    }
+    auto legacyDb = co_await Database::CreateAsync(tev, legacyPath);
+    co_await WaitForBackfillAsync(legacyPath);
+    auto sqlite = co_await Sqlite::CreateAsync(tev, legacyPath);
+    auto unfilled = sqlite->Exec("SELECT COUNT(*) FROM chat_content WHERE seq IS NOT rowid;");
+    AssertWithMessage(unfilled.front().Get<int64_t>(0) == 0, "Every row should get a sequence");
+    auto titles = sqlite->Exec("SELECT COUNT(*) FROM chat_search WHERE title IS NOT NULL;");
+    AssertWithMessage(titles.front().Get<int64_t>(0) == 1200, "Every title should be indexed once");
+    auto progress = sqlite->Exec("SELECT COUNT(*) FROM global WHERE key LIKE '%BackfillRowid';");
+    AssertWithMessage(progress.front().Get<int64_t>(0) == 0, "The progress should be removed when done");
+    auto indexes = sqlite->Exec("SELECT COUNT(*) FROM pragma_index_list('chat_content') WHERE name = 'chat_content_seq';");
+    AssertWithMessage(indexes.front().Get<int64_t>(0) == 1, "The sequence index should be created");
+    auto chatIds = sqlite->Exec(
+        "SELECT COUNT(*) FROM chat WHERE typeof(id) != 'blob' OR hex(id) != printf('%08X000040008000%012X', timestamp, timestamp);");
+    AssertWithMessage(chatIds.front().Get<int64_t>(0) == 0, "Every chat id should be converted");
+    auto modelIds = sqlite->Exec("SELECT hex(id) FROM model ORDER BY rowid;");
+    AssertWithMessage(modelIds.size() == 3 && modelIds[0].Get<std::string>(0) == "0123ABCD456789EF0123456789ABCDEF",
+        "Upper case UUIDs should be converted");
+    AssertWithMessage(modelIds[1].Get<std::string>(0).empty() && modelIds[2].Get<std::string>(0).empty(),
+        "Invalid UUIDs should become NULL");
+}
+
+std::string MakeCredential(uint8_t seed)
+{
+    IServer::UserCredential credential{};
+    credential.set_w0(Base64::Encode(std::array<uint8_t, 32>{seed}));
+    credential.set_l(Base64::Encode(std::array<uint8_t, 32>{static_cast<uint8_t>(seed + 1)}));
+    credential.set_salt(Base64::Encode(std::array<uint8_t, 16>{static_cast<uint8_t>(seed + 2)}));
+    return static_cast<nlohmann::json>(credential).dump();
+}
+
+JS::Promise<void> TestBackgroundBackfillAsync()
+{
+    /** A database from before the sequence and the search index, with many messages */
+    constexpr int64_t nodeCount = 20000;
+    std::string legacyPath = dbPath + ".background";
+    for (const auto& suffix : {"", "-wal", "-shm"})
+    {
+        std::filesystem::remove(legacyPath + suffix);
+    }
+    Uuid userId{};
+    Uuid chatId{};
+    {
+        auto sqlite = co_await Sqlite::CreateAsync(tev, legacyPath);
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat_content ("
+            "user_id TEXT, chat_id TEXT, id TEXT, parent TEXT, message TEXT, timestamp INTEGER, "
+            "PRIMARY KEY (user_id, chat_id, id));");
+        co_await sqlite->ExecAsync(
+            "CREATE TABLE chat (timestamp INTEGER, user_id TEXT, id TEXT, metadata TEXT, PRIMARY KEY (user_id, id));");
+        co_await sqlite->ExecAsync(
+            "INSERT INTO chat VALUES (1, ?, ?, '{\"title\":\"fox\"}');",
+            static_cast<std::string>(userId), static_cast<std::string>(chatId));
+        std::string message = R"({"role":"user","content":[{"type":"text","data":"hi"}]})";
+        co_await sqlite->ExecAsync(
+            "WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i < ?4 - 1) "
+            "INSERT INTO chat_content (user_id, chat_id, id, parent, message, timestamp) "
+            "SELECT ?1, ?2, 'node' || i, CASE WHEN i = 0 THEN '' ELSE 'node' || (i - 1) END, ?3, i FROM n;",
+            static_cast<std::string>(userId), static_cast<std::string>(chatId), message, nodeCount);
+    }
+    auto legacyDb = co_await Database::CreateAsync(tev, legacyPath);
+    auto sqlite = co_await Sqlite::CreateAsync(tev, legacyPath);
+    auto pending = sqlite->Exec("SELECT COUNT(*) FROM migration_backfill;");
+    AssertWithMessage(pending.front().Get<int64_t>(0) > 0, "The database should be usable before the backfills are done");
+    auto unfilled = sqlite->Exec("SELECT COUNT(*) FROM chat_content WHERE seq IS NULL;");
+    AssertWithMessage(unfilled.front().Get<int64_t>(0) > 0, "The sequence should not be filled yet");
+
+    /** Rows without a sequence are read in insertion order, and new rows come after them */
+    auto full = co_await legacyDb->GetChatHistorySinceAsync(userId, chatId, 0);
+    AssertWithMessage(full.get_nodes().size() == static_cast<size_t>(nodeCount), "Every node should be read");
+    auto version = static_cast<int64_t>(full.get_version());
+    IServer::MessageNode node{};
+    node.set_id("new");
+    node.set_parent("node" + std::to_string(nodeCount - 1));
+    node.set_timestamp(1.0);
+    co_await legacyDb->AppendChatHistoryAsync(userId, chatId, std::move(node));
+    auto delta = co_await legacyDb->GetChatHistorySinceAsync(userId, chatId, version);
+    AssertWithMessage(delta.get_nodes().size() == 1 && delta.get_nodes().count("new"),
+        "Only the new node should be newer than the old ones");
+
+    co_await WaitForBackfillAsync(legacyPath);
+    unfilled = sqlite->Exec("SELECT COUNT(*) FROM chat_content WHERE seq IS NULL;");
+    AssertWithMessage(unfilled.front().Get<int64_t>(0) == 0, "Every row should get a sequence");
+    delta = co_await legacyDb->GetChatHistorySinceAsync(userId, chatId, version);
+    AssertWithMessage(delta.get_nodes().size() == 1, "The backfill should not make old nodes new");
+    auto results = co_await legacyDb->SearchChatAsync(userId, "hi");
+    AssertWithMessage(results.size() == 1 && results.front().id == chatId, "Existing messages should be indexed");
+    auto indexed = sqlite->Exec("SELECT COUNT(*) FROM chat_search WHERE content IS NOT NULL;");
+    AssertWithMessage(indexed.front().Get<int64_t>(0) == nodeCount + 1, "Every message should be indexed once");
+    auto titles = sqlite->Exec("SELECT COUNT(*) FROM chat_search WHERE title IS NOT NULL;");
+    AssertWithMessage(titles.front().Get<int64_t>(0) == 1, "The title should be indexed once");
+}
+
+JS::Promise<void> TestUserCredentialCacheAsync()
+{
+    auto userId = co_await db->CreateUserAsync("credential-user", "", MakeCredential(1));
+    auto item = db->FindUserCredential("credential-user");
+    AssertWithMessage(item.has_value() && item->userId == userId, "The credential should be found by name");
+    AssertWithMessage(item->w0[0] == 1 && item->L[0] == 2 && item->salt[0] == 3, "The credential should be decoded");
+    AssertWithMessage(!db->FindUserCredential("no-such-user").has_value(), "Unknown users should not be found");
+
+    co_await db->SetUserCredentialAsync(userId, MakeCredential(10));
+    item = db->FindUserCredential("credential-user");
+    AssertWithMessage(item.has_value() && item->w0[0] == 10, "The cache should follow the credential");
+    co_await db->SetUserCredentialAsync(userId, "not a credential");
+    AssertWithMessage(!db->FindUserCredential("credential-user").has_value(), "Invalid credentials should not be found");
+
+    /** Loaded on creation */
+    co_await db->SetUserCredentialAsync(userId, MakeCredential(20));
+    auto reopenedDb = co_await Database::CreateAsync(tev, dbPath);
+    item = reopenedDb->FindUserCredential("credential-user");
+    AssertWithMessage(item.has_value() && item->w0[0] == 20, "The credential should be loaded");
+
+    co_await db->DeleteUserAsync(userId);
+    AssertWithMessage(!db->FindUserCredential("credential-user").has_value(), "Deleted users should not be found");
+
+    /** Misses are cached, until a user is written by this class */
+    AssertWithMessage(!db->FindUserCredential("late-user").has_value(), "Unknown users should not be found");
+    auto sqlite = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await sqlite->ExecAsync(
+        "INSERT INTO user (id, username, credential) VALUES (?, ?, ?);", Uuid{}, std::string("late-user"), MakeCredential(30));
+    AssertWithMessage(!db->FindUserCredential("late-user").has_value(), "Misses should be cached");
+    auto otherUserId = co_await db->CreateUserAsync("other-user", "", MakeCredential(40));
+    item = db->FindUserCredential("late-user");
+    AssertWithMessage(item.has_value() && item->w0[0] == 30, "Creating a user should drop the cached misses");
+    co_await db->DeleteUserAsync(item->userId);
+    co_await db->DeleteUserAsync(otherUserId);
+}
+
+JS::Promise<void> CreateUserWithChatAsync(std::shared_ptr<Database> database, std::string username)
+{
+    auto userId = co_await database->CreateUserAsync(std::move(username), "", "");
+    co_await database->CreateChatAsync(userId);
+}
+
+JS::Promise<void> TestChatShardingAsync()
+{
+    std::string shardedPath = dbPath + ".sharded";
+    std::vector<std::string> paths{shardedPath};
+    for (size_t i = 0; i < 2; i++)
+    {
+        paths.push_back(Database::GetChatShardPath(shardedPath, i).string());
+    }
+    for (const auto& path : paths)
+    {
+        for (const auto& suffix : {"", "-wal", "-shm"})
+        {
+            std::filesystem::remove(path + suffix);
+        }
+    }
+    auto shardedDb = co_await Database::CreateAsync(tev, shardedPath, {}, Database::DEFAULT_CHAT_HISTORY_CACHE_SIZE, 2);
+    /** Enough users for both shards to be used */
+    std::vector<std::pair<Uuid, Uuid>> chats{};
+    for (size_t i = 0; i < 32; i++)
+    {
+        auto userId = co_await shardedDb->CreateUserAsync("sharded-user" + std::to_string(i), "", "");
+        auto chatId = co_await shardedDb->CreateChatAsync(userId);
+        co_await shardedDb->AppendChatHistoryAsync(userId, chatId, MakeTextNode("node0", "sharded hello"));
+        co_await shardedDb->SetChatMetadataAsync(userId, chatId, R"({"title":"Sharded"})");
+        chats.emplace_back(userId, chatId);
+    }
+    std::vector<std::string> keys{"title"};
+    for (const auto& [userId, chatId] : chats)
+    {
+        auto list = co_await shardedDb->ListChatAsync(userId);
+        AssertWithMessage(list.size() == 1 && list.front().id == chatId, "Chats should be listed from the shard");
+        auto history = co_await shardedDb->GetChatHistoryAsync(userId, chatId);
+        AssertWithMessage(history.get_nodes().size() == 1, "History should be read from the shard");
+        auto results = co_await shardedDb->SearchChatAsync(userId, "hello");
+        AssertWithMessage(results.size() == 1 && results.front().id == chatId, "Search should run on the shard");
+        auto title = co_await shardedDb->GetMetadataKeysAsync(
+            {Database::MetadataTarget::CHAT, chatId, userId}, keys);
+        AssertWithMessage(nlohmann::json::parse(title) == nlohmann::json({{"title", "Sharded"}}),
+            "Metadata should be read from the shard");
+    }
+    auto countChats = [](std::shared_ptr<Sqlite> sqlite) {
+        return sqlite->Exec("SELECT COUNT(*) FROM chat;").front().Get<int64_t>(0);
+    };
+    AssertWithMessage(countChats(co_await Sqlite::CreateAsync(tev, shardedPath)) == 0,
+        "The database file should have no chats");
+    int64_t total = 0;
+    for (size_t i = 0; i < 2; i++)
+    {
+        auto count = countChats(co_await Sqlite::CreateAsync(tev, paths[i + 1]));
+        AssertWithMessage(count > 0, "Every shard should have chats");
+        total += count;
+    }
+    AssertWithMessage(total == 32, "Every chat should be in one shard");
+
+    co_await shardedDb->DeleteUserAsync(chats.front().first);
+    AssertWithMessage(shardedDb->GetChatCount(chats.front().first) == 0, "Chats of deleted users should be deleted");
+    auto users = shardedDb->ListUser();
+    AssertWithMessage(users.size() == 31, "The user should be deleted");
+
+    int64_t chatTotal = 0;
+    for (size_t i = 0; i < 2; i++)
+    {
+        chatTotal += countChats(co_await Sqlite::CreateAsync(tev, paths[i + 1]));
+    }
+    /** Writes during the backup are in none of the files, even the shards copied later */
+    SqliteBackupOptions slowOptions{};
+    slowOptions.pagesPerStep = 1;
+    slowOptions.stepDelayMs = 1;
+    std::optional<JS::Promise<void>> write{std::nullopt};
+    auto backupPath = co_await shardedDb->BackupAsync(slowOptions, [&](Sqlite::BackupProgress) {
+        if (!write.has_value())
+        {
+            write = CreateUserWithChatAsync(shardedDb, "backup-user");
+        }
+    });
+    co_await write.value();
+    AssertWithMessage(std::filesystem::exists(backupPath), "The database should be backed up");
+    {
+        auto mainBackup = co_await Sqlite::CreateAsync(tev, backupPath);
+        auto backupUsers = mainBackup->Exec("SELECT COUNT(*) FROM user;").front().Get<int64_t>(0);
+        AssertWithMessage(backupUsers == 31, "The backup should not have the user created during it");
+    }
+    int64_t backupChatTotal = 0;
+    for (size_t i = 0; i < 2; i++)
+    {
+        auto shardBackupPath = paths[i + 1] + backupPath.string().substr(shardedPath.size());
+        AssertWithMessage(std::filesystem::exists(shardBackupPath), "The shards should be backed up");
+        backupChatTotal += countChats(co_await Sqlite::CreateAsync(tev, shardBackupPath));
+        for (const auto& suffix : {"", "-wal", "-shm"})
+        {
+            std::filesystem::remove(shardBackupPath + suffix);
+        }
+    }
+    AssertWithMessage(backupChatTotal == chatTotal, "The shard backups should be of the same instant");
+    for (const auto& suffix : {"", "-wal", "-shm"})
+    {
+        std::filesystem::remove(backupPath.string() + suffix);
+    }
+
+    /** The count is kept */
+    shardedDb = nullptr;
+    shardedDb = co_await Database::CreateAsync(tev, shardedPath);
+    auto [userId, chatId] = chats.back();
+    AssertWithMessage(shardedDb->GetChatMetadata(userId, chatId) == R"({"title":"Sharded"})",
+        "Chats should be found after reopening");
+    shardedDb = nullptr;
+    bool thrown = false;
+    try
+    {
+        co_await Database::CreateAsync(tev, shardedPath, {}, Database::DEFAULT_CHAT_HISTORY_CACHE_SIZE, 3);
+    }
+    catch(...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "The shard count should not be changed");
+    thrown = false;
+    try
+    {
+        co_await Database::CreateAsync(tev, dbPath, {}, Database::DEFAULT_CHAT_HISTORY_CACHE_SIZE, 2);
+    }
+    catch(...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "A database with chats should not be sharded");
+}
+
 JS::Promise<void> TestAsync()
 {
     /** Always run this first */
@@ -270,6 +1035,17 @@ JS::Promise<void> TestAsync()
     RunAsyncTest(TestModelAsync());
     RunAsyncTest(TestUserAsync());
     RunAsyncTest(TestChatAsync());
+    RunAsyncTest(TestReadAsync());
+    RunAsyncTest(TestChatListPagingAsync());
+    RunAsyncTest(TestChatHistoryCacheAsync());
+    RunAsyncTest(TestChatHistorySinceAsync());
+    RunAsyncTest(TestMetadataKeysAsync());
+    RunAsyncTest(TestChatSearchAsync());
+    RunAsyncTest(TestLegacyChatContentAsync());
+    RunAsyncTest(TestLegacyBackfillChunksAsync());
+    RunAsyncTest(TestBackgroundBackfillAsync());
+    RunAsyncTest(TestUserCredentialCacheAsync());
+    RunAsyncTest(TestChatShardingAsync());
     RunTest(TestClose());
 }
 
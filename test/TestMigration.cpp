@@ -0,0 +1,228 @@
+#include <iostream>
+#include <filesystem>
+#include <tev-cpp/Tev.h>
+#include <js-style-co-routine/Promise.h>
+#include "database/Sqlite.h"
+#include "database/Migration.h"
+#include "Utility.h"
+
+using namespace TUI::Database;
+
+Tev tev{};
+std::string dbPath{};
+
+void RemoveDatabase()
+{
+    for (const auto& suffix : {"", "-wal", "-shm"})
+    {
+        if (std::filesystem::exists(dbPath + suffix))
+        {
+            std::filesystem::remove(dbPath + suffix);
+        }
+    }
+}
+
+std::vector<Migration::Step> GetSteps(std::vector<int64_t>& applied)
+{
+    return {
+        {1, "Create table", [&applied](Sqlite::Transaction& transaction) {
+            applied.push_back(1);
+            transaction.Exec("CREATE TABLE test (id INTEGER PRIMARY KEY, value TEXT);");
+        }},
+        {2, "Insert rows", [&applied](Sqlite::Transaction& transaction) {
+            applied.push_back(2);
+            for (int64_t i = 0; i < 10; i++)
+            {
+                transaction.Exec("INSERT INTO test (id, value) VALUES (?, ?);", i, std::string("old"));
+            }
+        }},
+    };
+}
+
+JS::Promise<void> TestRunAsync()
+{
+    RemoveDatabase();
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 0, "A new database should have version 0");
+
+    std::vector<int64_t> applied{};
+    co_await Migration::RunAsync(*db, GetSteps(applied));
+    AssertWithMessage((applied == std::vector<int64_t>{1, 2}), "Steps should run in order");
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 2, "The version should be bumped to the last step");
+
+    /** Applied steps are skipped */
+    applied.clear();
+    co_await Migration::RunAsync(*db, GetSteps(applied));
+    AssertWithMessage(applied.empty(), "Applied steps should not run again");
+    auto result = co_await db->ExecAsync("SELECT COUNT(*) FROM test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 10, "Rows should be inserted once");
+}
+
+JS::Promise<void> TestFailedStepAsync()
+{
+    RemoveDatabase();
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    std::vector<int64_t> applied{};
+    auto steps = GetSteps(applied);
+    steps.push_back({3, "Fail", [](Sqlite::Transaction& transaction) {
+        transaction.Exec("UPDATE test SET value = 'new';");
+        throw std::runtime_error("Step failed");
+    }});
+    bool thrown = false;
+    try
+    {
+        co_await Migration::RunAsync(*db, std::move(steps));
+    }
+    catch (...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "A failed step should throw");
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 2, "The version should stay at the last successful step");
+    auto result = co_await db->ExecAsync("SELECT COUNT(*) FROM test WHERE value = 'new';");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 0, "A failed step should be rolled back");
+}
+
+JS::Promise<void> TestBackfillAsync()
+{
+    RemoveDatabase();
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    std::vector<int64_t> applied{};
+    co_await Migration::RunAsync(*db, GetSteps(applied));
+
+    /** Interrupt the backfill after the first chunk */
+    int chunkCount = 0;
+    auto makeBackfill = [&chunkCount](int maxChunks) {
+        return [&chunkCount, maxChunks](Sqlite::Transaction& transaction) -> bool {
+            if (chunkCount >= maxChunks)
+            {
+                throw std::runtime_error("Interrupted");
+            }
+            chunkCount++;
+            transaction.Exec(
+                "UPDATE test SET value = 'new' WHERE id IN "
+                "(SELECT id FROM test WHERE value = 'old' LIMIT 3);");
+            auto result = transaction.Exec("SELECT COUNT(*) FROM test WHERE value = 'old';");
+            return result.front().Get<int64_t>(0) == 0;
+        };
+    };
+    auto steps = GetSteps(applied);
+    steps.push_back({3, "Backfill", nullptr, makeBackfill(1)});
+    try
+    {
+        co_await Migration::RunAsync(*db, std::move(steps));
+    }
+    catch (...)
+    {
+    }
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 2, "An unfinished backfill should not bump the version");
+    auto result = co_await db->ExecAsync("SELECT COUNT(*) FROM test WHERE value = 'new';");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 3, "The finished chunk should be committed");
+
+    /** Resume */
+    chunkCount = 0;
+    steps = GetSteps(applied);
+    steps.push_back({3, "Backfill", nullptr, makeBackfill(100)});
+    co_await Migration::RunAsync(*db, std::move(steps));
+    AssertWithMessage(chunkCount == 3, "The backfill should resume from the unfinished rows");
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 3, "The version should be bumped after the backfill");
+    result = co_await db->ExecAsync("SELECT COUNT(*) FROM test WHERE value = 'old';");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 0, "All rows should be backfilled");
+}
+
+JS::Promise<void> TestBackgroundBackfillAsync()
+{
+    RemoveDatabase();
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    std::vector<int64_t> applied{};
+    int chunkCount = 0;
+    auto steps = GetSteps(applied);
+    steps.push_back({3, "Background backfill", [](Sqlite::Transaction& transaction) {
+        transaction.Exec("ALTER TABLE test ADD COLUMN extra TEXT;");
+    }, [&chunkCount](Sqlite::Transaction& transaction) -> bool {
+        chunkCount++;
+        transaction.Exec(
+            "UPDATE test SET extra = 'filled' WHERE id IN "
+            "(SELECT id FROM test WHERE extra IS NULL LIMIT 3);");
+        auto result = transaction.Exec("SELECT COUNT(*) FROM test WHERE extra IS NULL;");
+        return result.front().Get<int64_t>(0) == 0;
+    }, true});
+    co_await Migration::RunAsync(*db, steps);
+    AssertWithMessage(chunkCount == 0, "A background backfill should not be awaited");
+    AssertWithMessage(co_await Migration::GetVersionAsync(*db) == 3, "The version should be bumped after the apply part");
+
+    co_await Migration::RunBackgroundAsync(db, steps);
+    AssertWithMessage(chunkCount == 4, "The background backfill should run until done");
+    auto result = co_await db->ExecAsync("SELECT COUNT(*) FROM test WHERE extra IS NULL;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 0, "All rows should be backfilled");
+
+    /** Done backfills do not run again */
+    chunkCount = 0;
+    co_await Migration::RunBackgroundAsync(db, steps);
+    AssertWithMessage(chunkCount == 0, "A finished backfill should not run again");
+}
+
+JS::Promise<void> TestInvalidVersionAsync()
+{
+    RemoveDatabase();
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    std::vector<int64_t> applied{};
+    co_await Migration::RunAsync(*db, GetSteps(applied));
+
+    /** The database is newer than the steps */
+    bool thrown = false;
+    try
+    {
+        auto steps = GetSteps(applied);
+        steps.pop_back();
+        co_await Migration::RunAsync(*db, std::move(steps));
+    }
+    catch (...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "A newer database should be rejected");
+
+    /** Steps out of order */
+    thrown = false;
+    applied.clear();
+    try
+    {
+        auto steps = GetSteps(applied);
+        std::swap(steps[0], steps[1]);
+        co_await Migration::RunAsync(*db, std::move(steps));
+    }
+    catch (...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "Steps out of order should be rejected");
+    AssertWithMessage(applied.empty(), "No step should run if the steps are invalid");
+}
+
+JS::Promise<void> TestAsync()
+{
+    RunAsyncTest(TestRunAsync());
+    RunAsyncTest(TestFailedStepAsync());
+    RunAsyncTest(TestBackfillAsync());
+    RunAsyncTest(TestBackgroundBackfillAsync());
+    RunAsyncTest(TestInvalidVersionAsync());
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <db_path>" << std::endl;
+        return 1;
+    }
+    dbPath = argv[1];
+
+    TestAsync();
+
+    tev.MainLoop();
+
+    RemoveDatabase();
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include "network/OutboundBuffer.h"
+#include "Utility.h"
+
+using namespace TUI::Network;
+
+static std::vector<std::uint8_t> StringToBytes(const std::string& str)
+{
+    return std::vector<std::uint8_t>(str.begin(), str.end());
+}
+
+void TestRoom()
+{
+    OutboundBuffer buffer{};
+    AssertWithMessage(buffer.Size() == 0, "A new buffer should be empty");
+    AssertWithMessage(buffer.Headroom() == OutboundBuffer::HEADROOM, "A new buffer should have all the headroom");
+    auto payload = StringToBytes("Hello, World!");
+    buffer.Append(payload.data(), payload.size());
+    buffer.Append(payload.data(), payload.size());
+    AssertWithMessage(buffer.Size() == 2 * payload.size(), "Append should grow the payload");
+
+    auto* data = buffer.Data();
+    auto* header = buffer.Prepend(4);
+    AssertWithMessage(header == data - 4, "Prepend should use the headroom");
+    auto* trailer = buffer.UseTailroom(OutboundBuffer::TAILROOM);
+    AssertWithMessage(buffer.Data() == header, "UseTailroom should not copy");
+    AssertWithMessage(trailer == header + 4 + 2 * payload.size(), "UseTailroom should return the new bytes");
+    buffer.EnsureHeadroom(OutboundBuffer::HEADROOM - 4);
+    AssertWithMessage(buffer.Data() == header, "EnsureHeadroom should not copy when there is room");
+    auto vector = buffer.ToVector();
+    AssertWithMessage(vector.size() == 4 + 2 * payload.size() + OutboundBuffer::TAILROOM, "Wrong size");
+    AssertWithMessage(std::equal(payload.begin(), payload.end(), vector.begin() + 4), "Wrong payload");
+}
+
+void TestFromVector()
+{
+    auto payload = StringToBytes("Hello, World!");
+    OutboundBuffer buffer = payload;
+    AssertWithMessage(buffer.Headroom() == 0, "A buffer from a vector has no room");
+    AssertWithMessage(buffer.ToVector() == payload, "The vector should be the payload");
+    buffer.Prepend(4);
+    AssertWithMessage(buffer.Headroom() == OutboundBuffer::HEADROOM - 4, "Prepend should add the headroom");
+    AssertWithMessage(buffer.Size() == payload.size() + 4, "Prepend should grow the payload");
+    auto vector = buffer.ToVector();
+    AssertWithMessage(std::equal(payload.begin(), payload.end(), vector.begin() + 4), "The payload should be kept");
+}
+
+void TestMove()
+{
+    OutboundBuffer buffer{};
+    auto payload = StringToBytes("Hello, World!");
+    buffer.Append(payload.data(), payload.size());
+    auto* data = buffer.Data();
+    OutboundBuffer moved{std::move(buffer)};
+    AssertWithMessage(moved.Data() == data, "Moving should not copy the payload");
+    AssertWithMessage(moved.ToVector() == payload, "Wrong payload after move");
+    AssertWithMessage(buffer.Size() == 0, "A moved from buffer should be empty");
+}
+
+void TestTailroomStable()
+{
+    auto check = [](OutboundBuffer& buffer) {
+        auto* data = buffer.Data();
+        auto size = buffer.Size();
+        /** What the session layer does: nonce in front, tag at the end */
+        auto* header = buffer.Prepend(OutboundBuffer::SESSION_HEADROOM);
+        buffer.UseTailroom(OutboundBuffer::TAILROOM);
+        AssertWithMessage(header == data - OutboundBuffer::SESSION_HEADROOM, "Prepend should not copy");
+        AssertWithMessage(buffer.Data() == header, "UseTailroom should not copy");
+        AssertWithMessage(buffer.Size() == size + OutboundBuffer::SESSION_HEADROOM + OutboundBuffer::TAILROOM, "Wrong size");
+    };
+    /** Around the initial capacity, 10 and 13 bytes used to leave less than TAILROOM */
+    for (size_t size = 0; size <= 2 * OutboundBuffer::TAILROOM + 1; size++)
+    {
+        OutboundBuffer buffer{};
+        std::vector<std::uint8_t> payload(size, 'x');
+        buffer.Append(payload.data(), payload.size());
+        check(buffer);
+    }
+    /** Char by char with Extend, like the RPC writer, so every capacity is hit exactly */
+    for (size_t size = 1; size <= 100; size++)
+    {
+        OutboundBuffer buffer{};
+        for (size_t i = 0; i < size; i++)
+        {
+            *buffer.Extend(1) = 'x';
+        }
+        check(buffer);
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    RunTest(TestRoom());
+    RunTest(TestFromVector());
+    RunTest(TestMove());
+    RunTest(TestTailroomStable());
+
+    return 0;
+}
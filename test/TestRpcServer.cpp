@@ -33,8 +33,9 @@ public:
      * 
      * @param message 
      */
-    void Send(std::vector<std::uint8_t> message) override
+    void Send(Network::OutboundBuffer buffer) override
     {
+        auto message = buffer.ToVector();
         if (_closed)
         {
             throw std::runtime_error("Connection is closed");
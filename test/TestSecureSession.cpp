@@ -74,8 +74,9 @@ public:
         return _closed;
     }
 
-    void Send(std::vector<std::uint8_t> message) override
+    void Send(Network::OutboundBuffer buffer) override
     {
+        auto message = buffer.ToVector();
         /** Send: rx */
         if (_closed)
         {
@@ -367,21 +368,16 @@ JS::Promise<void> TestFlowAsync(Tev& tev)
     std::string password = "password";
     Common::Uuid userId{};
     auto registration = Cipher::Spake2p::Register(username, password);
-    Schema::IServer::UserCredential userCredential;
-    userCredential.set_w0(Common::Base64::Encode(registration.w0));
-    userCredential.set_l(Common::Base64::Encode(registration.L));
-    userCredential.set_salt(Common::Base64::Encode(registration.salt));
-    auto userCredentialStr = static_cast<nlohmann::json>(userCredential).dump();
     auto testServer = std::make_shared<TestServer>(tev, username, password);
     auto secureSessionServer = SecureSession::Server::Create(
         tev,
         testServer,
-        [=](const std::string& usernameIn) -> std::pair<std::string, Common::Uuid> {
+        [=](const std::string& usernameIn) -> std::optional<SecureSession::Server::UserCredential> {
             if (usernameIn != username)
             {
                 throw std::runtime_error("Invalid username");
             }
-            return {userCredentialStr, userId};
+            return SecureSession::Server::UserCredential{userId, registration};
         });
     while(true)
     {
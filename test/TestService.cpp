@@ -38,7 +38,7 @@ public:
         return _connection->IsClosed();
     }
 
-    void Send(std::vector<std::uint8_t> message) override
+    void Send(Network::OutboundBuffer message) override
     {
         _connection->Send(std::move(message));
     }
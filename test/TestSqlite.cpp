@@ -1,4 +1,5 @@
 #include <iostream>
+#include <filesystem>
 #include <tev-cpp/Tev.h>
 #include <js-style-co-routine/Promise.h>
 #include "database/Sqlite.h"
@@ -9,6 +10,15 @@ using namespace TUI::Database;
 Tev tev{};
 std::string dbPath{};
 
+JS::Promise<void> DelayAsync(int ms)
+{
+    JS::Promise<void> promise;
+    auto timeout = tev.SetTimeout([=]() mutable {
+        promise.Resolve();
+    }, ms);
+    co_await promise;
+}
+
 JS::Promise<void> TestCreateAsync()
 {
     auto db = co_await Sqlite::CreateAsync(tev, dbPath);
@@ -28,12 +38,14 @@ JS::Promise<void> TestOperationsAsync()
                            "test2", nullptr, nullptr, nullptr);
     /** Select data */
     auto result = co_await db->ExecAsync("SELECT * FROM test;");
-    for (const auto& row : result)
+    AssertWithMessage(result.Columns().size() == 4, "Result should have 4 columns");
+    for (auto row : result)
     {
         std::cout << "Row:" << std::endl;
-        for (const auto& [columnName, value] : row)
+        for (size_t i = 0; i < row.ColumnCount(); i++)
         {
-            std::cout << "    " << columnName << ": ";
+            const auto& value = row[i];
+            std::cout << "    " << result.Columns()[i] << ": ";
             if (std::holds_alternative<std::nullptr_t>(value))
             {
                 std::cout << "NULL";
@@ -62,6 +74,25 @@ JS::Promise<void> TestOperationsAsync()
             std::cout << std::endl;
         }
     }
+    {
+        /** Typed access */
+        auto row = result.front();
+        AssertWithMessage(row.Get<std::string>(result.ColumnIndex("text")) == "test1", "Text should match");
+        AssertWithMessage(row.Get<double>(result.ColumnIndex("double")) == 3.14, "Double should match");
+        AssertWithMessage(row.Get<int64_t>(result.ColumnIndex("int64")) == 42, "Int64 should match");
+        AssertWithMessage(row.Get<std::vector<uint8_t>>(result.ColumnIndex("blob")).size() == 3, "Blob should match");
+        auto nullRow = result[1];
+        AssertWithMessage(!nullRow.Get<std::optional<int64_t>>(result.ColumnIndex("int64")).has_value(), "NULL should be nullopt");
+        try
+        {
+            nullRow.Get<int64_t>(result.ColumnIndex("int64"));
+            AssertWithMessage(false, "Getting NULL as int64 should throw");
+        }
+        catch(const std::runtime_error&)
+        {
+            /** Expected */
+        }
+    }
     /** Concurrent operation */
     auto writePromise = db->ExecAsync("INSERT INTO test (text, double, int64, blob) VALUES (?, ?, ?, ?);",
                                    "test3", 2.71, static_cast<int64_t>(84), std::vector<uint8_t>{0x04, 0x05, 0x06});
@@ -69,10 +100,470 @@ JS::Promise<void> TestOperationsAsync()
     co_await writePromise;
 }
 
+JS::Promise<void> TestStatementCacheAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS cache_test (id INTEGER PRIMARY KEY, value TEXT);");
+    auto asyncStatsBefore = db->GetAsyncStatementCacheStats();
+    for (int64_t i = 0; i < 10; i++)
+    {
+        co_await db->ExecAsync("INSERT INTO cache_test (id, value) VALUES (?, ?);", i, std::to_string(i));
+    }
+    auto asyncStatsAfter = db->GetAsyncStatementCacheStats();
+    AssertWithMessage(asyncStatsAfter.misses - asyncStatsBefore.misses == 1, "Async statement should only be prepared once");
+    /** The transaction control statements are cached as well */
+    AssertWithMessage(asyncStatsAfter.hits - asyncStatsBefore.hits >= 9, "Async statement should be reused");
+
+    auto statsBefore = db->GetStatementCacheStats();
+    for (int64_t i = 0; i < 10; i++)
+    {
+        /** The cached statement must be rebound each time */
+        auto result = db->Exec("SELECT value FROM cache_test WHERE id = ?;", i);
+        AssertWithMessage(result.size() == 1, "Row should be found");
+        AssertWithMessage(result.front().Get<std::string>(0) == std::to_string(i), "Value should match the bound id");
+    }
+    auto statsAfter = db->GetStatementCacheStats();
+    AssertWithMessage(statsAfter.misses - statsBefore.misses == 1, "Statement should only be prepared once");
+    AssertWithMessage(statsAfter.hits - statsBefore.hits == 9, "Statement should be reused");
+
+    /** A failed statement should not break the cached one */
+    try
+    {
+        co_await db->ExecAsync("INSERT INTO cache_test (id, value) VALUES (?, ?);", static_cast<int64_t>(0), std::string("duplicate"));
+        AssertWithMessage(false, "Inserting a duplicate key should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    co_await db->ExecAsync("INSERT INTO cache_test (id, value) VALUES (?, ?);", static_cast<int64_t>(10), std::string("10"));
+    auto result = db->Exec("SELECT COUNT(*) AS count FROM cache_test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 11, "Row count should match");
+}
+
+JS::Promise<void> TestReadAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    /** Committed writes should be visible to the read connections */
+    co_await db->ExecAsync("INSERT INTO cache_test (id, value) VALUES (?, ?);", static_cast<int64_t>(11), std::string("11"));
+    auto result = co_await db->ExecReadAsync("SELECT value FROM cache_test WHERE id = ?;", static_cast<int64_t>(11));
+    AssertWithMessage(result.size() == 1, "Row should be found");
+    AssertWithMessage(result.front().Get<std::string>(0) == "11", "Value should match");
+    /** Concurrent reads are spread over the pool */
+    std::vector<JS::Promise<Sqlite::ExecResult>> reads{};
+    for (int64_t i = 0; i < 8; i++)
+    {
+        reads.push_back(db->ExecReadAsync("SELECT value FROM cache_test WHERE id = ?;", i));
+    }
+    for (int64_t i = 0; i < 8; i++)
+    {
+        auto readResult = co_await reads[i];
+        AssertWithMessage(readResult.front().Get<std::string>(0) == std::to_string(i), "Value should match the bound id");
+    }
+    auto stats = db->GetReadStatementCacheStats();
+    AssertWithMessage(stats.misses <= SqliteOptions{}.readConnectionCount, "Statement should be prepared once per read connection");
+    /** The read connections are read only */
+    try
+    {
+        co_await db->ExecReadAsync("DELETE FROM cache_test;");
+        AssertWithMessage(false, "Writing on a read connection should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    /** Without read connections, reads fall back to the write connection */
+    SqliteOptions noReaderOptions{};
+    noReaderOptions.readConnectionCount = 0;
+    auto dbNoReader = co_await Sqlite::CreateAsync(tev, dbPath, noReaderOptions);
+    result = co_await dbNoReader->ExecReadAsync("SELECT COUNT(*) AS count FROM cache_test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 12, "Row count should match");
+}
+
+JS::Promise<void> TestGroupCommitAsync()
+{
+    SqliteOptions options{};
+    options.maxWriteBatchSize = 8;
+    options.maxWriteDelayMs = 5;
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath, options);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS batch_test (id INTEGER PRIMARY KEY, value TEXT);");
+    auto statsBefore = db->GetWriteBatchStats();
+    std::vector<JS::Promise<Sqlite::ExecResult>> writes{};
+    for (int64_t i = 0; i < 20; i++)
+    {
+        writes.push_back(db->ExecAsync("INSERT INTO batch_test (id, value) VALUES (?, ?);", i, std::to_string(i)));
+    }
+    /** A failed write should only fail itself */
+    auto duplicateWrite = db->ExecAsync("INSERT INTO batch_test (id, value) VALUES (?, ?);", static_cast<int64_t>(0), std::string("duplicate"));
+    for (auto& write : writes)
+    {
+        co_await write;
+    }
+    try
+    {
+        co_await duplicateWrite;
+        AssertWithMessage(false, "Inserting a duplicate key should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    auto statsAfter = db->GetWriteBatchStats();
+    AssertWithMessage(statsAfter.writes - statsBefore.writes == 21, "All writes should be counted");
+    AssertWithMessage(statsAfter.batches - statsBefore.batches == 3, "Writes should be grouped by the max batch size");
+    auto result = db->Exec("SELECT COUNT(*) AS count FROM batch_test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 20, "Row count should match");
+    result = db->Exec("SELECT value FROM batch_test WHERE id = 0;");
+    AssertWithMessage(result.front().Get<std::string>(0) == "0", "The failed write should be rolled back");
+}
+
+JS::Promise<void> TestTransactionAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS transaction_test (id INTEGER PRIMARY KEY, value TEXT);");
+    auto count = co_await db->TransactionAsync([](Sqlite::Transaction& transaction) {
+        transaction.Exec("INSERT INTO transaction_test (id, value) VALUES (?, ?);", static_cast<int64_t>(0), std::string("0"));
+        transaction.Exec("INSERT INTO transaction_test (id, value) VALUES (?, ?);", static_cast<int64_t>(1), std::string("1"));
+        auto result = transaction.Exec("SELECT COUNT(*) AS count FROM transaction_test;");
+        return result.front().Get<int64_t>(0);
+    });
+    AssertWithMessage(count == 2, "The transaction should see its own writes");
+    /** A failed transaction should be rolled back as a whole, without affecting the concurrent writes */
+    auto concurrentWrite = db->ExecAsync("INSERT INTO transaction_test (id, value) VALUES (?, ?);", static_cast<int64_t>(2), std::string("2"));
+    try
+    {
+        co_await db->TransactionAsync([](Sqlite::Transaction& transaction) {
+            transaction.Exec("UPDATE transaction_test SET value = ? WHERE id = ?;", std::string("updated"), static_cast<int64_t>(0));
+            transaction.Exec("INSERT INTO transaction_test (id, value) VALUES (?, ?);", static_cast<int64_t>(1), std::string("duplicate"));
+        });
+        AssertWithMessage(false, "The transaction should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    co_await concurrentWrite;
+    auto result = db->Exec("SELECT value FROM transaction_test WHERE id = ?;", static_cast<int64_t>(0));
+    AssertWithMessage(result.front().Get<std::string>(0) == "0", "The failed transaction should be rolled back");
+    result = db->Exec("SELECT COUNT(*) AS count FROM transaction_test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 3, "The concurrent write should be committed");
+}
+
+JS::Promise<void> TestReadTransactionAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    auto otherDb = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS read_transaction_test (id INTEGER PRIMARY KEY);");
+    co_await db->ExecAsync("DELETE FROM read_transaction_test;");
+    co_await db->ExecAsync("INSERT INTO read_transaction_test (id) VALUES (?);", static_cast<int64_t>(0));
+    /** Writes committed during the transaction are not visible to it */
+    auto counts = db->ReadTransaction([&](Sqlite::Transaction& transaction) {
+        auto before = transaction.Exec("SELECT COUNT(*) FROM read_transaction_test;").front().Get<int64_t>(0);
+        otherDb->Exec("INSERT INTO read_transaction_test (id) VALUES (?);", static_cast<int64_t>(1));
+        auto after = transaction.Exec("SELECT COUNT(*) FROM read_transaction_test;").front().Get<int64_t>(0);
+        return std::make_pair(before, after);
+    });
+    AssertWithMessage(counts.first == 1 && counts.second == 1, "The transaction should read one snapshot");
+    auto result = db->Exec("SELECT COUNT(*) FROM read_transaction_test;");
+    AssertWithMessage(result.front().Get<int64_t>(0) == 2, "The write should be visible after the transaction");
+
+    auto count = co_await db->ReadTransactionAsync([](Sqlite::Transaction& transaction) {
+        return transaction.Exec("SELECT COUNT(*) FROM read_transaction_test;").front().Get<int64_t>(0);
+    });
+    AssertWithMessage(count == 2, "The async transaction should see the committed writes");
+    /** Read only, and ended on failure so the connection is reusable */
+    try
+    {
+        co_await db->ReadTransactionAsync([](Sqlite::Transaction& transaction) {
+            transaction.Exec("SELECT COUNT(*) FROM read_transaction_test;");
+            transaction.Exec("DELETE FROM read_transaction_test;");
+        });
+        AssertWithMessage(false, "Writing in a read transaction should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    co_await db->ExecAsync("INSERT INTO read_transaction_test (id) VALUES (?);", static_cast<int64_t>(2));
+    count = co_await db->ReadTransactionAsync([](Sqlite::Transaction& transaction) {
+        return transaction.Exec("SELECT COUNT(*) FROM read_transaction_test;").front().Get<int64_t>(0);
+    });
+    AssertWithMessage(count == 3, "A failed transaction should not hold its snapshot");
+}
+
+JS::Promise<void> TestUuidAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS uuid_test (id BLOB PRIMARY KEY);");
+    TUI::Common::Uuid id{};
+    co_await db->ExecAsync("INSERT INTO uuid_test (id) VALUES (?);", id);
+    auto result = co_await db->ExecReadAsync("SELECT id, length(id) FROM uuid_test WHERE id = ?;", id);
+    AssertWithMessage(result.size() == 1, "The uuid should be found by itself");
+    auto row = result.front();
+    AssertWithMessage(row.Get<TUI::Common::Uuid>(0) == id, "The uuid should be read back");
+    AssertWithMessage(row.Get<int64_t>(1) == 16, "The uuid should be stored as 16 bytes");
+}
+
+JS::Promise<void> TestQueryStreamAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS stream_test (id INTEGER PRIMARY KEY, value TEXT);");
+    co_await db->ExecAsync("DELETE FROM stream_test;");
+    for (int64_t i = 0; i < 10; i++)
+    {
+        co_await db->ExecAsync("INSERT INTO stream_test (id, value) VALUES (?, ?);", i, std::to_string(i));
+    }
+    /** Rows come in bounded batches, in order */
+    auto stream = db->QueryStream(4, "SELECT id, value FROM stream_test WHERE id >= ? ORDER BY id;", static_cast<int64_t>(0));
+    std::vector<size_t> batchSizes{};
+    int64_t expected = 0;
+    auto batch = co_await stream.NextAsync();
+    /** Writes after the stream started are not visible to it, but are to other reads */
+    co_await db->ExecAsync("INSERT INTO stream_test (id, value) VALUES (?, ?);", static_cast<int64_t>(10), std::string("10"));
+    auto count = co_await db->ExecReadAsync("SELECT COUNT(*) FROM stream_test;");
+    AssertWithMessage(count.front().Get<int64_t>(0) == 11, "Other reads should not share the stream snapshot");
+    while (batch.has_value())
+    {
+        batchSizes.push_back(batch->size());
+        AssertWithMessage(batch->ColumnIndex("value") == 1, "Columns should be kept per batch");
+        for (auto row : batch.value())
+        {
+            AssertWithMessage(row.Get<int64_t>(0) == expected, "Rows should be in order");
+            AssertWithMessage(row.Get<std::string>(1) == std::to_string(expected), "Value should match");
+            expected++;
+        }
+        batch = co_await stream.NextAsync();
+    }
+    AssertWithMessage(expected == 10, "Stream should read its own snapshot");
+    AssertWithMessage((batchSizes == std::vector<size_t>{4, 4, 2}), "Batches should be bounded");
+    /** Empty result */
+    auto emptyStream = db->QueryStream(4, "SELECT id FROM stream_test WHERE id < ?;", static_cast<int64_t>(0));
+    AssertWithMessage(!(co_await emptyStream.NextAsync()).has_value(), "Empty result should end the stream");
+    /** Errors reject the pull */
+    auto badStream = db->QueryStream(4, "SELECT * FROM missing_table;");
+    try
+    {
+        co_await badStream.NextAsync();
+        AssertWithMessage(false, "Bad query should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    /** A dropped stream is released in its worker thread */
+    {
+        auto droppedStream = db->QueryStream(1, "SELECT id FROM stream_test;");
+        co_await droppedStream.NextAsync();
+    }
+    /** Without read connections, the batches are stepped on the writer thread */
+    SqliteOptions noReaderOptions{};
+    noReaderOptions.readConnectionCount = 0;
+    auto dbNoReader = co_await Sqlite::CreateAsync(tev, dbPath, noReaderOptions);
+    auto fallbackStream = dbNoReader->QueryStream(4, "SELECT id FROM stream_test;");
+    auto fallbackBatch = co_await fallbackStream.NextAsync();
+    AssertWithMessage(fallbackBatch.has_value() && fallbackBatch->size() == 4, "Fallback should still be batched");
+    /** Writes interleave with the batches, and are not in the snapshot */
+    co_await dbNoReader->ExecAsync("INSERT INTO stream_test (id) VALUES (?);", static_cast<int64_t>(1000));
+    size_t fallbackRows = fallbackBatch->size();
+    while (auto batch = co_await fallbackStream.NextAsync())
+    {
+        fallbackRows += batch->size();
+    }
+    AssertWithMessage(fallbackRows == 11, "Fallback should return all rows of its snapshot");
+    co_await dbNoReader->ExecAsync("DELETE FROM stream_test WHERE id = ?;", static_cast<int64_t>(1000));
+}
+
+JS::Promise<void> TestBackupAsync()
+{
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS backup_test (id INTEGER PRIMARY KEY, value TEXT);");
+    co_await db->ExecAsync("DELETE FROM backup_test;");
+    for (int64_t i = 0; i < 100; i++)
+    {
+        co_await db->ExecAsync("INSERT INTO backup_test (id, value) VALUES (?, ?);", i, std::string(1000, 'a'));
+    }
+    std::filesystem::path backupPath{dbPath + ".test.backup"};
+    std::filesystem::remove(backupPath);
+    SqliteBackupOptions options{};
+    options.pagesPerStep = 10;
+    options.stepDelayMs = 1;
+    size_t steps = 0;
+    Sqlite::BackupProgress lastProgress{};
+    std::optional<JS::Promise<Sqlite::ExecResult>> write{std::nullopt};
+    auto backup = db->BackupAsync(backupPath, options, [&](Sqlite::BackupProgress progress) {
+        steps++;
+        lastProgress = progress;
+        /** Writes go on during the backup, and are not in the snapshot */
+        if (!write.has_value())
+        {
+            write = db->ExecAsync("INSERT INTO backup_test (id, value) VALUES (?, ?);", static_cast<int64_t>(100), std::string("new"));
+        }
+    });
+    AssertWithMessage(db->GetBackupProgress().has_value(), "Backup should be running");
+    /** Only one backup at a time */
+    try
+    {
+        co_await db->BackupAsync(backupPath);
+        AssertWithMessage(false, "Concurrent backup should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    co_await backup;
+    AssertWithMessage(write.has_value(), "Write should be started");
+    co_await write.value();
+    AssertWithMessage(!db->GetBackupProgress().has_value(), "Backup should be done");
+    AssertWithMessage(steps > 1, "Backup should run in steps");
+    AssertWithMessage(lastProgress.remainingPages == 0 && lastProgress.pageCount > 0, "Progress should be reported");
+    AssertWithMessage(std::filesystem::exists(backupPath), "Backup file should exist");
+    AssertWithMessage(!std::filesystem::exists(backupPath.string() + ".tmp"), "Temporary file should be renamed");
+    {
+        SqliteOptions backupOptions{};
+        backupOptions.readConnectionCount = 0;
+        auto backupDb = co_await Sqlite::CreateAsync(tev, backupPath, backupOptions);
+        auto count = backupDb->Exec("SELECT COUNT(*) FROM backup_test;");
+        AssertWithMessage(count.front().Get<int64_t>(0) == 100, "Backup should be the snapshot at its start");
+    }
+    std::filesystem::remove(backupPath);
+    std::filesystem::remove(backupPath.string() + "-wal");
+    std::filesystem::remove(backupPath.string() + "-shm");
+    /** A failed backup leaves nothing behind */
+    std::filesystem::path badPath{dbPath + ".missing/test.backup"};
+    try
+    {
+        co_await db->BackupAsync(badPath);
+        AssertWithMessage(false, "Backup to a missing directory should fail");
+    }
+    catch(const std::exception&)
+    {
+        /** Expected */
+    }
+    AssertWithMessage(!db->GetBackupProgress().has_value(), "Failed backup should be done");
+}
+
+JS::Promise<void> TestConnectionOptionsAsync()
+{
+    SqliteOptions options{};
+    options.synchronous = SqliteSynchronous::FULL;
+    options.cacheSizeKiB = 1024;
+    options.busyTimeoutMs = 1234;
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath, options);
+    AssertWithMessage(db->Exec("PRAGMA synchronous;").front().Get<int64_t>(0) == 2, "Synchronous should be set");
+    AssertWithMessage(db->Exec("PRAGMA cache_size;").front().Get<int64_t>(0) == -1024, "Cache size should be set");
+    AssertWithMessage(db->Exec("PRAGMA busy_timeout;").front().Get<int64_t>(0) == 1234, "Busy timeout should be set");
+    AssertWithMessage(db->Exec("PRAGMA temp_store;").front().Get<int64_t>(0) == 2, "Temp store should be memory");
+    auto readResult = co_await db->ExecReadAsync("PRAGMA cache_size;");
+    AssertWithMessage(readResult.front().Get<int64_t>(0) == -1024, "Read connections should be set");
+    auto writeResult = co_await db->ExecAsync("PRAGMA wal_autocheckpoint;");
+    AssertWithMessage(writeResult.front().Get<int64_t>(0) == 0, "Autocheckpoint should be replaced by the scheduler");
+}
+
+JS::Promise<void> TestCheckpointAsync()
+{
+    SqliteOptions options{};
+    options.checkpointIdleMs = 20;
+    options.maxWalFrames = 1000000;
+    options.walTruncateSize = 1;
+    auto db = co_await Sqlite::CreateAsync(tev, dbPath, options);
+    co_await db->ExecAsync("CREATE TABLE IF NOT EXISTS checkpoint_test (id INTEGER PRIMARY KEY, value TEXT);");
+    for (int64_t i = 0; i < 20; i++)
+    {
+        co_await db->ExecAsync("INSERT OR REPLACE INTO checkpoint_test (id, value) VALUES (?, ?);", i, std::string(1000, 'a'));
+    }
+    AssertWithMessage(db->GetCheckpointStats().walFrames > 0, "WAL size should be reported");
+    /** Checkpointed and truncated once the writer is idle */
+    co_await DelayAsync(200);
+    auto stats = db->GetCheckpointStats();
+    AssertWithMessage(stats.checkpoints > 0 && stats.truncates > 0, "Idle writer should checkpoint");
+    AssertWithMessage(stats.walSize == 0 && stats.walFrames == 0, "WAL should be truncated");
+    /** No new pages, no checkpoint */
+    co_await DelayAsync(100);
+    AssertWithMessage(db->GetCheckpointStats().checkpoints == stats.checkpoints, "Clean WAL should not be checkpointed");
+    /** Writes of the sync connection are checkpointed too */
+    db->Exec("INSERT OR REPLACE INTO checkpoint_test (id, value) VALUES (?, ?);", static_cast<int64_t>(0), std::string(1000, 'c'));
+    co_await DelayAsync(200);
+    stats = db->GetCheckpointStats();
+    AssertWithMessage(stats.walSize == 0 && stats.walFrames == 0, "Sync writes should be checkpointed");
+    /** An open stream pins its snapshot, so the idle checkpoint does not truncate meanwhile */
+    {
+        auto stream = db->QueryStream(1, "SELECT id FROM checkpoint_test ORDER BY id;");
+        auto batch = co_await stream.NextAsync();
+        AssertWithMessage(batch.has_value(), "Stream should have rows");
+        co_await db->ExecAsync("INSERT OR REPLACE INTO checkpoint_test (id, value) VALUES (?, ?);", static_cast<int64_t>(1), std::string(1000, 'd'));
+        co_await DelayAsync(200);
+        auto streamStats = db->GetCheckpointStats();
+        AssertWithMessage(streamStats.checkpoints > stats.checkpoints, "Idle writer should still checkpoint");
+        AssertWithMessage(streamStats.truncates == stats.truncates, "Should not truncate while a stream is open");
+        stats = streamStats;
+    }
+    /** A large WAL is checkpointed between batches when the writer is busy */
+    SqliteOptions busyOptions{};
+    busyOptions.checkpointIdleMs = 60000;
+    busyOptions.maxWalFrames = 10;
+    auto busyDb = co_await Sqlite::CreateAsync(tev, dbPath, busyOptions);
+    std::vector<JS::Promise<Sqlite::ExecResult>> writes{};
+    for (int64_t round = 0; round < 5; round++)
+    {
+        for (int64_t i = 0; i < 20; i++)
+        {
+            writes.push_back(busyDb->ExecAsync(
+                "INSERT OR REPLACE INTO checkpoint_test (id, value) VALUES (?, ?);", i, std::string(1000, 'b')));
+        }
+        /** Let the batches run */
+        co_await writes.back();
+        writes.push_back(busyDb->ExecAsync("SELECT 1;"));
+        writes.push_back(busyDb->ExecAsync("SELECT 1;"));
+    }
+    for (auto& write : writes)
+    {
+        co_await write;
+    }
+    AssertWithMessage(busyDb->GetCheckpointStats().checkpoints > 0, "Busy writer should checkpoint a large WAL");
+    /**
+     * A stream keeps the WAL from restarting, so it stays large after the checkpoints.
+     * Only the growth since the last checkpoint forces the next one.
+     */
+    SqliteOptions pinnedOptions{busyOptions};
+    pinnedOptions.maxWriteBatchSize = 1;
+    auto pinnedDb = co_await Sqlite::CreateAsync(tev, dbPath, pinnedOptions);
+    auto pinningStream = pinnedDb->QueryStream(1, "SELECT id FROM checkpoint_test ORDER BY id;");
+    co_await pinningStream.NextAsync();
+    for (int64_t i = 0; i < 20; i++)
+    {
+        co_await pinnedDb->ExecAsync(
+            "INSERT OR REPLACE INTO checkpoint_test (id, value) VALUES (?, ?);", i, std::string(1000, 'e'));
+    }
+    auto pinnedStats = pinnedDb->GetCheckpointStats();
+    AssertWithMessage(pinnedStats.walFrames >= pinnedOptions.maxWalFrames, "The pinned WAL should stay large");
+    writes.clear();
+    for (int64_t i = 0; i < 20; i++)
+    {
+        writes.push_back(pinnedDb->ExecAsync(
+            "UPDATE checkpoint_test SET value = ? WHERE id = 0;", std::to_string(i)));
+    }
+    for (auto& write : writes)
+    {
+        co_await write;
+    }
+    AssertWithMessage(pinnedDb->GetCheckpointStats().checkpoints - pinnedStats.checkpoints < 10,
+        "Checkpointed frames should not force a checkpoint per batch");
+}
+
 JS::Promise<void> TestAsync()
 {
     RunAsyncTest(TestCreateAsync());
     RunAsyncTest(TestOperationsAsync());
+    RunAsyncTest(TestStatementCacheAsync());
+    RunAsyncTest(TestReadAsync());
+    RunAsyncTest(TestGroupCommitAsync());
+    RunAsyncTest(TestTransactionAsync());
+    RunAsyncTest(TestReadTransactionAsync());
+    RunAsyncTest(TestUuidAsync());
+    RunAsyncTest(TestQueryStreamAsync());
+    RunAsyncTest(TestBackupAsync());
+    RunAsyncTest(TestConnectionOptionsAsync());
+    RunAsyncTest(TestCheckpointAsync());
 }
 
 int main(int argc, char const *argv[])
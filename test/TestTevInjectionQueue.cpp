@@ -1,18 +1,17 @@
+#include <atomic>
 #include <iostream>
 #include <thread>
+#include <vector>
 #include <tev-cpp/Tev.h>
 #include "common/TevInjectionQueue.h"
+#include "Utility.h"
 
 using namespace TUI::Common;
 
-Tev tev{};
-std::shared_ptr<TevInjectionQueue<std::string>> queue{nullptr};
-
-int main(int argc, char const *argv[])
+void TestCloseInCallback()
 {
-    (void)argc;
-    (void)argv;
-
+    Tev tev{};
+    std::shared_ptr<TevInjectionQueue<std::string>> queue{nullptr};
     int messageReceived = 0;
     queue = TevInjectionQueue<std::string>::Create(tev, [&](std::string&& data){
         std::cout << "Received data: " << data << std::endl;
@@ -24,24 +23,167 @@ int main(int argc, char const *argv[])
         }
     });
 
-    std::thread producer([=]() {
+    bool closedSeen = false;
+    std::thread producer([&]() {
         try
         {
             for (int i = 0; i < 100; ++i) {
                 queue->Inject("Message " + std::to_string(i));
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
             }
         }
         catch(const std::exception& e)
         {
             std::cerr << "Sender error: " << e.what() << std::endl;
+            closedSeen = true;
         }
     });
 
     tev.MainLoop();
 
     producer.join();
+    AssertWithMessage(messageReceived == 10, "No message should be delivered after close");
+    AssertWithMessage(closedSeen, "Inject should throw after close");
+}
 
-    return 0;
+void TestManyProducers()
+{
+    constexpr int producerCount = 4;
+    constexpr int messageCount = 20000;
+    Tev tev{};
+    std::shared_ptr<TevInjectionQueue<std::pair<int, int>>> queue{nullptr};
+    std::vector<int> nextMessage(producerCount, 0);
+    int messageReceived = 0;
+    /** A small ring, so the overflow is used too */
+    queue = TevInjectionQueue<std::pair<int, int>>::Create(tev, [&](std::pair<int, int>&& data){
+        AssertWithMessage(data.second == nextMessage[data.first],
+            "Messages from one producer should be in order");
+        nextMessage[data.first]++;
+        if (++messageReceived == producerCount * messageCount)
+        {
+            queue->Close();
+        }
+    }, nullptr, 16);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < messageCount; ++i)
+            {
+                queue->Inject(std::make_pair(p, i));
+            }
+        });
+    }
+
+    tev.MainLoop();
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    AssertWithMessage(messageReceived == producerCount * messageCount, "All messages should be delivered");
 }
 
+/** Blocks in the move into the ring slot, after the slot is reserved and before it is published */
+struct GatedItem
+{
+    GatedItem(std::string name, std::atomic<bool>* entered = nullptr, std::atomic<bool>* gate = nullptr)
+        : name(std::move(name)), entered(entered), gate(gate)
+    {
+    }
+    GatedItem(GatedItem&& other)
+        : name(std::move(other.name))
+    {
+        if (other.gate != nullptr)
+        {
+            other.entered->store(true);
+            while (!other.gate->load())
+            {
+                std::this_thread::yield();
+            }
+            other.gate = nullptr;
+        }
+    }
+
+    std::string name;
+    std::atomic<bool>* entered{nullptr};
+    std::atomic<bool>* gate{nullptr};
+};
+
+void TestUnpublishedSlotBeforeOverflow()
+{
+    Tev tev{};
+    std::shared_ptr<TevInjectionQueue<GatedItem>> queue{nullptr};
+    std::vector<std::string> received{};
+    queue = TevInjectionQueue<GatedItem>::Create(tev, [&](GatedItem&& data){
+        received.push_back(data.name);
+        if (received.size() == 3)
+        {
+            queue->Close();
+        }
+    }, nullptr, 2);
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> gate{false};
+    /** Producer B reserves the head slot and stays inside TryPush */
+    std::thread producer([&]() {
+        queue->Inject(GatedItem("b", &entered, &gate));
+    });
+    while (!entered.load())
+    {
+        std::this_thread::yield();
+    }
+    /** a1 fills the ring, a2 overflows */
+    queue->Inject(GatedItem("a1"));
+    queue->Inject(GatedItem("a2"));
+
+    auto releaseTimeout = tev.SetTimeout([&](){
+        gate.store(true);
+    }, 100);
+
+    tev.MainLoop();
+
+    producer.join();
+    AssertWithMessage(received.size() == 3, "All messages should be delivered");
+    AssertWithMessage(received[0] == "b" && received[1] == "a1" && received[2] == "a2",
+        "The overflow should wait for the unpublished slot");
+}
+
+void TestMoveOnly()
+{
+    Tev tev{};
+    std::shared_ptr<TevInjectionQueue<std::unique_ptr<int>>> queue{nullptr};
+    int sum = 0;
+    queue = TevInjectionQueue<std::unique_ptr<int>>::Create(tev, [&](std::unique_ptr<int>&& data){
+        sum += *data;
+        if (*data == 0)
+        {
+            queue->Close();
+        }
+    }, nullptr, 4);
+    std::thread producer([&]() {
+        for (int i = 10; i >= 0; --i)
+        {
+            queue->Inject(std::make_unique<int>(i));
+        }
+    });
+
+    tev.MainLoop();
+
+    producer.join();
+    AssertWithMessage(sum == 55, "Move-only items should be delivered");
+}
+
+int main(int argc, char const *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    RunTest(TestCloseInCallback());
+    RunTest(TestManyProducers());
+    RunTest(TestUnpublishedSlotBeforeOverflow());
+    RunTest(TestMoveOnly());
+
+    return 0;
+}
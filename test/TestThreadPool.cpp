@@ -0,0 +1,168 @@
+#include <iostream>
+#include <chrono>
+#include <tev-cpp/Tev.h>
+#include <js-style-co-routine/Promise.h>
+#include <common/ThreadPool.h>
+#include "Utility.h"
+
+using namespace TUI::Common;
+
+Tev tev{};
+
+JS::Promise<void> DelayAsync(int ms)
+{
+    JS::Promise<void> promise;
+    auto timeout = tev.SetTimeout([=]() mutable {
+        promise.Resolve();
+    }, ms);
+    co_await promise;
+}
+
+JS::Promise<void> TestSuccessAsync()
+{
+    ThreadPool threadPool{tev, 2};
+    co_await threadPool.ExecTaskAsync([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    });
+    std::string result = co_await threadPool.ExecTaskAsync([]() -> std::string {
+        return "Hello from thread pool!";
+    });
+    AssertWithMessage(result == "Hello from thread pool!", "Wrong result");
+    auto input = std::make_unique<int>(41);
+    auto moved = co_await threadPool.ExecTaskAsync([input = std::move(input)]() mutable -> std::unique_ptr<int> {
+        (*input)++;
+        return std::move(input);
+    });
+    AssertWithMessage(moved != nullptr && *moved == 42, "Move-only results should be moved");
+    auto stats = threadPool.GetStats();
+    AssertWithMessage(stats.threadCount == 2, "Wrong thread count");
+    AssertWithMessage(stats.completedTasks == 3 && stats.pendingTasks == 0 && stats.queuedTasks == 0,
+        "Completed tasks should be counted");
+}
+
+JS::Promise<void> TestExceptionAsync()
+{
+    ThreadPool threadPool{tev, 2};
+    try
+    {
+        co_await threadPool.ExecTaskAsync([]() -> std::string {
+            throw std::runtime_error("Test exception");
+        });
+        AssertWithMessage(false, "Expected exception not thrown");
+    }
+    catch (const std::exception& e)
+    {
+        AssertWithMessage(std::string(e.what()) == "Test exception", "Wrong exception message");
+    }
+}
+
+JS::Promise<void> TestParallelAsync()
+{
+    ThreadPool threadPool{tev, 4};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<JS::Promise<int>> promises;
+    for (int i = 0; i < 8; ++i)
+    {
+        promises.push_back(threadPool.ExecTaskAsync([=]() -> int {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return i;
+        }));
+    }
+    auto results = co_await JS::Promise<int>::All(promises);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    for (int i = 0; i < 8; ++i)
+    {
+        AssertWithMessage(results[i] == i, "Result mismatch for task " + std::to_string(i));
+    }
+    /** 800ms if serialized */
+    AssertWithMessage(elapsed < std::chrono::milliseconds(600), "Tasks should run in parallel");
+    auto stats = threadPool.GetStats();
+    AssertWithMessage(stats.maxQueuedTasks >= 4, "Queue depth should be tracked");
+    AssertWithMessage(stats.maxRunTimeUs >= 100 * 1000 && stats.totalRunTimeUs >= 8 * 100 * 1000,
+        "Run time should be tracked");
+    AssertWithMessage(stats.maxQueueTimeUs >= 100 * 1000, "Queue time should be tracked");
+}
+
+JS::Promise<void> TestStealingAsync()
+{
+    /** Submitted round robin, so the second short task is queued behind the long one */
+    ThreadPool threadPool{tev, 2};
+    bool longDone = false;
+    auto longTask = threadPool.ExecTaskAsync([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    });
+    longTask.Then([&longDone]() {
+        longDone = true;
+    });
+    auto shortTask1 = threadPool.ExecTaskAsync([]() {});
+    auto shortTask2 = threadPool.ExecTaskAsync([]() {});
+    co_await shortTask1;
+    co_await shortTask2;
+    AssertWithMessage(!longDone, "Short tasks should not wait for the long one");
+    AssertWithMessage(threadPool.GetStats().stolenTasks > 0, "Idle threads should steal");
+    co_await longTask;
+}
+
+JS::Promise<void> TestCloseAsync()
+{
+    ThreadPool threadPool{tev, 1};
+    auto running = threadPool.ExecTaskAsync([]() -> std::string {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return "Task completed";
+    });
+    bool queuedRan = false;
+    auto queued = threadPool.ExecTaskAsync([&queuedRan]() {
+        queuedRan = true;
+    });
+    co_await DelayAsync(50);
+    threadPool.Close();
+    AssertWithMessage(!queuedRan, "Queued tasks should not run after close");
+    try
+    {
+        co_await running;
+        AssertWithMessage(false, "Expected exception not thrown after the pool closed");
+    }
+    catch (const std::exception& e)
+    {
+        AssertWithMessage(std::string(e.what()) == "ThreadPool closed", "Wrong exception message");
+    }
+    try
+    {
+        co_await queued;
+        AssertWithMessage(false, "Expected exception not thrown after the pool closed");
+    }
+    catch (const std::exception& e)
+    {
+        AssertWithMessage(std::string(e.what()) == "ThreadPool closed", "Wrong exception message");
+    }
+    try
+    {
+        threadPool.ExecTaskAsync([]() {});
+        AssertWithMessage(false, "Expected exception not thrown after the pool closed");
+    }
+    catch (const std::exception& e)
+    {
+        AssertWithMessage(std::string(e.what()) == "ThreadPool closed", "Wrong exception message");
+    }
+}
+
+JS::Promise<void> TestAsync()
+{
+    RunAsyncTest(TestSuccessAsync());
+    RunAsyncTest(TestExceptionAsync());
+    RunAsyncTest(TestParallelAsync());
+    RunAsyncTest(TestStealingAsync());
+    RunAsyncTest(TestCloseAsync());
+}
+
+int main(int argc, char const *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    TestAsync();
+
+    tev.MainLoop();
+
+    return 0;
+}
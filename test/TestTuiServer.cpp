@@ -179,17 +179,14 @@ static JS::Promise<void> MainAsync(AppParams params)
         gApp.tev, std::string(serverAddress), serverPort);
     auto secureSessionServer = Application::SecureSession::Server::Create(
         gApp.tev, std::move(webSocketServer), 
-        [=](const std::string& username) -> std::optional<std::pair<std::string, Common::Uuid>> {
-            try
-            {
-                auto userId = database->GetUserId(username);
-                auto credential = database->GetUserCredential(userId);
-                return std::make_pair(credential, userId);
-            }
-            catch(...)
+        [=](const std::string& username) -> std::optional<Application::SecureSession::Server::UserCredential> {
+            auto item = database->FindUserCredential(username);
+            if (!item.has_value())
             {
                 return std::nullopt;
             }
+            return Application::SecureSession::Server::UserCredential{
+                item.value().userId, {item.value().w0, item.value().L, item.value().salt}};
         });
     gApp.service = std::make_shared<Application::Service>(
         gApp.tev, std::move(secureSessionServer), std::move(database),
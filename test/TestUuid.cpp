@@ -38,6 +38,19 @@ void TestConversion()
     std::string uuidStr = static_cast<std::string>(uuid);
     Uuid uuid2{uuidStr};
     AssertWithMessage(uuid == uuid2, "UUID should be equal after conversion to string and back");
+    auto bytes = uuid.Bytes();
+    Uuid uuid3{std::vector<uint8_t>(bytes.begin(), bytes.end())};
+    AssertWithMessage(uuid == uuid3, "UUID should be equal after conversion to bytes and back");
+    bool thrown = false;
+    try
+    {
+        Uuid uuid4{std::vector<uint8_t>(15, 0)};
+    }
+    catch(...)
+    {
+        thrown = true;
+    }
+    AssertWithMessage(thrown, "UUID from bytes of a wrong size should throw");
 }
 
 int main(int argc, char const *argv[])
@@ -1,8 +1,18 @@
+#include <atomic>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 #include <tev-cpp/Tev.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <signal.h>
+#include <unistd.h>
 #include "network/WebSocketServer.h"
+#include "Utility.h"
 
 using namespace TUI::Network;
 
@@ -10,11 +20,308 @@ static Tev tev{};
 static std::shared_ptr<IServer<void>> server{nullptr};
 static int exitFd = -1;
 
+/** The interactive server uses 12345 */
+static constexpr int TEST_PORT = 12346;
+
 std::vector<std::uint8_t> StringToBytes(const std::string_view& str)
 {
     return std::vector<std::uint8_t>(str.begin(), str.end());
 }
 
+JS::Promise<void> DelayAsync(int ms)
+{
+    JS::Promise<void> promise;
+    auto timeout = tev.SetTimeout([=]() mutable {
+        promise.Resolve();
+    }, ms);
+    co_await promise;
+}
+
+/**
+ * A minimal blocking WebSocket client. Run it in its own thread, the server needs the event loop.
+ */
+class TestClient
+{
+public:
+    explicit TestClient(int port)
+    {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (_fd < 0)
+        {
+            throw std::runtime_error("Failed to create socket");
+        }
+        /** A missing frame fails the test instead of hanging it */
+        timeval timeout{5, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            close(_fd);
+            throw std::runtime_error("Failed to connect");
+        }
+        std::string request =
+            "GET / HTTP/1.1\r\n"
+            "Host: 127.0.0.1\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n"
+            "\r\n";
+        WriteAll(reinterpret_cast<const std::uint8_t*>(request.data()), request.size());
+        std::string response{};
+        while (response.size() < 4 || response.compare(response.size() - 4, 4, "\r\n\r\n") != 0)
+        {
+            std::uint8_t c = 0;
+            if (!ReadAll(&c, 1))
+            {
+                close(_fd);
+                throw std::runtime_error("Handshake failed");
+            }
+            response.push_back(static_cast<char>(c));
+        }
+        if (response.rfind("HTTP/1.1 101", 0) != 0)
+        {
+            close(_fd);
+            throw std::runtime_error("Handshake rejected: " + response);
+        }
+    }
+
+    ~TestClient()
+    {
+        close(_fd);
+    }
+
+    TestClient(const TestClient&) = delete;
+    TestClient& operator=(const TestClient&) = delete;
+    TestClient(TestClient&&) = delete;
+    TestClient& operator=(TestClient&&) = delete;
+
+    /** One masked binary frame */
+    void Send(const std::string& payload)
+    {
+        std::vector<std::uint8_t> frame{0x82};
+        if (payload.size() < 126)
+        {
+            frame.push_back(static_cast<std::uint8_t>(0x80 | payload.size()));
+        }
+        else
+        {
+            frame.push_back(0x80 | 126);
+            frame.push_back(static_cast<std::uint8_t>(payload.size() >> 8));
+            frame.push_back(static_cast<std::uint8_t>(payload.size()));
+        }
+        std::uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+        frame.insert(frame.end(), mask, mask + 4);
+        for (size_t i = 0; i < payload.size(); i++)
+        {
+            frame.push_back(static_cast<std::uint8_t>(payload[i]) ^ mask[i % 4]);
+        }
+        WriteAll(frame.data(), frame.size());
+    }
+
+    /**
+     * @return The payload of the next data frame.
+     * std::nullopt on a close frame, when the server closes the socket, or on timeout.
+     */
+    std::optional<std::string> Receive()
+    {
+        while (true)
+        {
+            std::uint8_t header[2]{};
+            if (!ReadAll(header, 2))
+            {
+                return std::nullopt;
+            }
+            auto opcode = header[0] & 0x0F;
+            std::uint64_t size = header[1] & 0x7F;
+            if (size >= 126)
+            {
+                std::uint8_t extended[8]{};
+                size_t extendedSize = size == 126 ? 2 : 8;
+                if (!ReadAll(extended, extendedSize))
+                {
+                    return std::nullopt;
+                }
+                size = 0;
+                for (size_t i = 0; i < extendedSize; i++)
+                {
+                    size = (size << 8) | extended[i];
+                }
+            }
+            std::uint8_t mask[4]{};
+            bool masked = header[1] & 0x80;
+            if (masked && !ReadAll(mask, 4))
+            {
+                return std::nullopt;
+            }
+            std::string payload(size, '\0');
+            if (size > 0 && !ReadAll(reinterpret_cast<std::uint8_t*>(payload.data()), size))
+            {
+                return std::nullopt;
+            }
+            if (masked)
+            {
+                for (size_t i = 0; i < payload.size(); i++)
+                {
+                    payload[i] = static_cast<char>(payload[i] ^ mask[i % 4]);
+                }
+            }
+            if (opcode == 0x8)
+            {
+                _closed = true;
+                return std::nullopt;
+            }
+            if (opcode == 0x1 || opcode == 0x2)
+            {
+                return payload;
+            }
+            /** Ping and pong */
+        }
+    }
+
+    /** Closed by the server, as opposed to timed out */
+    bool IsClosed() const
+    {
+        return _closed;
+    }
+private:
+    bool ReadAll(std::uint8_t* data, size_t size)
+    {
+        while (size > 0)
+        {
+            auto received = recv(_fd, data, size, 0);
+            if (received <= 0)
+            {
+                /** 0 is a close without a close frame, -1 is a timeout or an error */
+                _closed = received == 0;
+                return false;
+            }
+            data += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    void WriteAll(const std::uint8_t* data, size_t size)
+    {
+        while (size > 0)
+        {
+            auto sent = send(_fd, data, size, MSG_NOSIGNAL);
+            if (sent <= 0)
+            {
+                throw std::runtime_error("Failed to send");
+            }
+            data += sent;
+            size -= static_cast<size_t>(sent);
+        }
+    }
+
+    int _fd{-1};
+    bool _closed{false};
+};
+
+JS::Promise<void> TestFramesInOrderAsync()
+{
+    constexpr int frameCount = 1000;
+    auto testServer = WebSocket::Server::Create(tev, "127.0.0.1", TEST_PORT);
+    std::vector<std::string> received{};
+    std::thread clientThread([&]() {
+        TestClient client{TEST_PORT};
+        client.Send("ready");
+        while (received.size() < frameCount)
+        {
+            auto frame = client.Receive();
+            if (!frame.has_value())
+            {
+                break;
+            }
+            received.push_back(std::move(frame.value()));
+        }
+        /** The server sees the connection closed */
+    });
+    auto connection = co_await testServer->AcceptAsync();
+    AssertWithMessage(connection.has_value(), "The connection should be accepted");
+    auto message = co_await connection.value()->ReceiveAsync();
+    AssertWithMessage(message.has_value() && *message == StringToBytes("ready"), "The client message should arrive");
+    /** All in one loop tick, so they go to the lws thread as one batch */
+    for (int i = 0; i < frameCount; i++)
+    {
+        connection.value()->Send(StringToBytes("m" + std::to_string(i)));
+    }
+    message = co_await connection.value()->ReceiveAsync();
+    AssertWithMessage(!message.has_value(), "The connection should end when the client leaves");
+    clientThread.join();
+    AssertWithMessage(received.size() == frameCount, "Every frame should arrive");
+    for (int i = 0; i < frameCount; i++)
+    {
+        AssertWithMessage(received[i] == "m" + std::to_string(i), "The frames should arrive in order");
+    }
+    testServer->Close();
+}
+
+JS::Promise<void> TestCloseWithQueuedFramesAsync()
+{
+    constexpr int frameCount = 100;
+    auto testServer = WebSocket::Server::Create(tev, "127.0.0.1", TEST_PORT);
+    std::vector<std::string> received{};
+    bool closed = false;
+    std::atomic<bool> done{false};
+    std::thread clientThread([&]() {
+        TestClient client{TEST_PORT};
+        client.Send("ready");
+        while (auto frame = client.Receive())
+        {
+            received.push_back(std::move(frame.value()));
+        }
+        closed = client.IsClosed();
+        done = true;
+    });
+    auto connection = co_await testServer->AcceptAsync();
+    AssertWithMessage(connection.has_value(), "The connection should be accepted");
+    auto message = co_await connection.value()->ReceiveAsync();
+    AssertWithMessage(message.has_value(), "The client message should arrive");
+    for (int i = 0; i < frameCount; i++)
+    {
+        connection.value()->Send(StringToBytes("m" + std::to_string(i)));
+    }
+    /** In the same tick, the frames are still queued */
+    connection.value()->Close();
+    AssertWithMessage(connection.value()->IsClosed(), "The connection should be closed at once");
+    message = co_await connection.value()->ReceiveAsync();
+    AssertWithMessage(!message.has_value(), "A closed connection should not receive");
+    while (!done)
+    {
+        co_await DelayAsync(10);
+    }
+    clientThread.join();
+    AssertWithMessage(closed, "The server should close the socket");
+    AssertWithMessage(received.size() == frameCount, "The queued frames should be sent before closing");
+    for (int i = 0; i < frameCount; i++)
+    {
+        AssertWithMessage(received[i] == "m" + std::to_string(i), "The frames should arrive in order");
+    }
+    /** The server still works */
+    std::thread nextClientThread([&]() {
+        TestClient client{TEST_PORT};
+        client.Send("next");
+    });
+    connection = co_await testServer->AcceptAsync();
+    AssertWithMessage(connection.has_value(), "The next connection should be accepted");
+    message = co_await connection.value()->ReceiveAsync();
+    AssertWithMessage(message.has_value() && *message == StringToBytes("next"), "The next client should be served");
+    nextClientThread.join();
+    testServer->Close();
+}
+
+JS::Promise<void> TestAsync()
+{
+    RunAsyncTest(TestFramesInOrderAsync());
+    RunAsyncTest(TestCloseWithQueuedFramesAsync());
+}
+
 JS::Promise<void> ReceiveMessageAsync(std::shared_ptr<IConnection<void>> connection)
 {
     while (true)
@@ -29,7 +336,7 @@ JS::Promise<void> ReceiveMessageAsync(std::shared_ptr<IConnection<void>> connect
     }
 }
 
-JS::Promise<void> TestAsync()
+JS::Promise<void> ServeAsync()
 {
     server = WebSocket::Server::Create(tev, "127.0.0.1", 12345);
     while (true)
@@ -46,11 +353,8 @@ JS::Promise<void> TestAsync()
     }
 }
 
-int main(int argc, char const *argv[])
+int Serve()
 {
-    (void)argc;
-    (void)argv;
-
     exitFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     if (exitFd == -1)
     {
@@ -81,7 +385,7 @@ int main(int argc, char const *argv[])
         eventfd_write(exitFd, value);
     });
 
-    TestAsync().Catch([](const std::exception& e) {
+    ServeAsync().Catch([](const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     });
 
@@ -90,3 +394,17 @@ int main(int argc, char const *argv[])
     return 0;
 }
 
+int main(int argc, char const *argv[])
+{
+    /** Serve on 12345 until interrupted, to try with a browser */
+    if (argc > 1 && std::string(argv[1]) == "--interactive")
+    {
+        return Serve();
+    }
+
+    TestAsync();
+
+    tev.MainLoop();
+
+    return 0;
+}
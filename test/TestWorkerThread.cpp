@@ -74,6 +74,20 @@ JS::Promise<void> TestQueueAsync()
     }
 }
 
+JS::Promise<void> TestMoveOnlyAsync()
+{
+    WorkerThread workerThread{tev};
+    auto input = std::make_unique<std::string>("Moved");
+    auto promise = workerThread.ExecTaskAsync([input = std::move(input)]() mutable -> std::unique_ptr<std::string> {
+        *input += " through worker thread";
+        return std::move(input);
+    });
+    AssertWithMessage(workerThread.GetPendingTaskCount() == 1, "Task should be pending");
+    auto result = co_await promise;
+    AssertWithMessage(result != nullptr && *result == "Moved through worker thread", "Wrong result");
+    AssertWithMessage(workerThread.GetPendingTaskCount() == 0, "No task should be pending");
+}
+
 JS::Promise<void> TestCloseAsync()
 {
     WorkerThread workerThread{tev};
@@ -104,6 +118,7 @@ JS::Promise<void> TestAsync()
     RunAsyncTest(TestSuccessAsync());
     RunAsyncTest(TestExceptionAsync());
     RunAsyncTest(TestQueueAsync());
+    RunAsyncTest(TestMoveOnlyAsync());
     RunAsyncTest(TestCloseAsync());
 }
 